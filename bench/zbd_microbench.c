@@ -0,0 +1,471 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+/*
+ * Minimum number of iterations and default run time of a benchmark.
+ */
+#define ZBD_MB_MIN_ITER		3
+#define ZBD_MB_RUNTIME_MS	500
+
+/*
+ * Number of zones of the synthetic zone report used for the zone
+ * parsing and filtering benchmarks.
+ */
+#define ZBD_MB_PARSE_NR_ZONES	65536
+
+struct zbd_mb {
+	char			*path;
+	int			fd;
+	bool			rdonly;
+	unsigned long long	runtime_ns;
+	struct zbd_info		info;
+
+	/* Zone report, parse and list benchmarks */
+	struct zbd_zone		*zones;
+	unsigned int		nr_zones;
+	unsigned int		batch;
+	enum zbd_report_option	ro;
+
+	/* Synthetic zone report */
+	struct blk_zone_report	*rep;
+
+	/* Zone operation benchmarks */
+	off_t			zone_ofst;
+	off_t			zone_len;
+};
+
+typedef int (*zbd_mb_fn)(struct zbd_mb *mb);
+
+/*
+ * Run a benchmark function until the run time expires, with at least
+ * ZBD_MB_MIN_ITER iterations, and print the average time per iteration
+ * and the throughput of the items processed by each iteration.
+ */
+static int zbd_mb_run(struct zbd_mb *mb, const char *name,
+		      unsigned long long nr_items, zbd_mb_fn fn)
+{
+	unsigned long long start, elapsed, n = 0;
+	double ns;
+
+	start = zbd_now_ns();
+	do {
+		if (fn(mb) < 0) {
+			fprintf(stderr, "%s: benchmark failed\n", name);
+			return -1;
+		}
+		n++;
+		elapsed = zbd_now_ns() - start;
+	} while (n < ZBD_MB_MIN_ITER || elapsed < mb->runtime_ns);
+
+	ns = (double)elapsed / n;
+	printf("%-36s %10llu %14.1f %16.0f\n",
+	       name, n, ns, (double)nr_items * 1000000000.0 / ns);
+
+	return 0;
+}
+
+static void zbd_mb_print_header(const char *title)
+{
+	printf("\n%s\n", title);
+	printf("%-36s %10s %14s %16s\n",
+	       "benchmark", "iterations", "ns/iter", "items/s");
+}
+
+/*
+ * Zone parsing and filtering.
+ */
+static void zbd_mb_init_rep(struct zbd_mb *mb)
+{
+	struct blk_zone *blkz = (struct blk_zone *)(mb->rep + 1);
+	unsigned long long zlen = 524288;
+	unsigned int i;
+
+	mb->rep->nr_zones = ZBD_MB_PARSE_NR_ZONES;
+	mb->rep->flags = BLK_ZONE_REP_CAPACITY;
+
+	for (i = 0; i < ZBD_MB_PARSE_NR_ZONES; i++) {
+		blkz[i].start = i * zlen;
+		blkz[i].len = zlen;
+		blkz[i].capacity = zlen;
+		if (i < ZBD_MB_PARSE_NR_ZONES / 64) {
+			blkz[i].type = ZBD_ZONE_TYPE_CNV;
+			blkz[i].cond = ZBD_ZONE_COND_NOT_WP;
+			blkz[i].wp = blkz[i].start + zlen;
+			continue;
+		}
+
+		/* Mix of empty, full, closed and open zones */
+		blkz[i].type = ZBD_ZONE_TYPE_SWR;
+		switch (i & 3) {
+		case 0:
+			blkz[i].cond = ZBD_ZONE_COND_EMPTY;
+			blkz[i].wp = blkz[i].start;
+			break;
+		case 1:
+			blkz[i].cond = ZBD_ZONE_COND_FULL;
+			blkz[i].wp = blkz[i].start + zlen;
+			break;
+		case 2:
+			blkz[i].cond = ZBD_ZONE_COND_CLOSED;
+			blkz[i].wp = blkz[i].start + zlen / 2;
+			break;
+		default:
+			blkz[i].cond = ZBD_ZONE_COND_IMP_OPEN;
+			blkz[i].wp = blkz[i].start + zlen / 4;
+			break;
+		}
+	}
+}
+
+static int zbd_mb_parse(struct zbd_mb *mb)
+{
+	struct blk_zone *blkz = (struct blk_zone *)(mb->rep + 1);
+	struct zbd_zone z;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < mb->rep->nr_zones; i++) {
+		zbd_parse_zone(&z, &blkz[i], mb->rep);
+		if (zbd_should_report_zone(&z, mb->ro))
+			memcpy(&mb->zones[n++], &z, sizeof(z));
+	}
+
+	mb->nr_zones = n;
+
+	return 0;
+}
+
+static int zbd_mb_parse_all(struct zbd_mb *mb)
+{
+	static const struct {
+		enum zbd_report_option	ro;
+		const char		*name;
+	} ros[] = {
+		{ ZBD_RO_ALL,		"parse ro=all" },
+		{ ZBD_RO_NOT_WP,	"parse ro=not_wp" },
+		{ ZBD_RO_EMPTY,		"parse ro=empty" },
+		{ ZBD_RO_CLOSED,	"parse ro=closed" },
+		{ ZBD_RO_FULL,		"parse ro=full" },
+	};
+	unsigned int i;
+	int ret = 0;
+
+	mb->rep = calloc(1, sizeof(struct blk_zone_report) +
+			 sizeof(struct blk_zone) * ZBD_MB_PARSE_NR_ZONES);
+	mb->zones = calloc(ZBD_MB_PARSE_NR_ZONES, sizeof(struct zbd_zone));
+	if (!mb->rep || !mb->zones) {
+		fprintf(stderr, "No memory for synthetic zone report\n");
+		ret = -1;
+		goto out;
+	}
+
+	zbd_mb_init_rep(mb);
+
+	zbd_mb_print_header("Zone parsing and filtering (items: zones)");
+	for (i = 0; i < sizeof(ros) / sizeof(ros[0]); i++) {
+		mb->ro = ros[i].ro;
+		ret = zbd_mb_run(mb, ros[i].name, ZBD_MB_PARSE_NR_ZONES,
+				 zbd_mb_parse);
+		if (ret)
+			break;
+	}
+
+out:
+	free(mb->rep);
+	mb->rep = NULL;
+	free(mb->zones);
+	mb->zones = NULL;
+
+	return ret;
+}
+
+/*
+ * Device open and close.
+ */
+static int zbd_mb_open_close(struct zbd_mb *mb)
+{
+	struct zbd_info info;
+	int fd;
+
+	fd = zbd_open(mb->path, O_RDONLY, &info);
+	if (fd < 0)
+		return -1;
+	zbd_close(fd);
+
+	return 0;
+}
+
+/*
+ * Zone reports.
+ */
+static int zbd_mb_report_nr_zones(struct zbd_mb *mb)
+{
+	unsigned int nrz;
+
+	return zbd_report_nr_zones(mb->fd, 0, 0, mb->ro, &nrz);
+}
+
+static int zbd_mb_report(struct zbd_mb *mb)
+{
+	unsigned int nrz = mb->nr_zones;
+
+	return zbd_report_zones(mb->fd, 0, 0, mb->ro, mb->zones, &nrz);
+}
+
+static int zbd_mb_report_batch(struct zbd_mb *mb)
+{
+	off_t ofst = 0, end = mb->info.nr_zones * mb->info.zone_size;
+	unsigned int nrz;
+	int ret;
+
+	while (ofst < end) {
+		nrz = mb->batch;
+		ret = zbd_report_zones(mb->fd, ofst, end - ofst, ZBD_RO_ALL,
+				       mb->zones, &nrz);
+		if (ret || !nrz)
+			return -1;
+		ofst = mb->zones[nrz - 1].start + mb->zones[nrz - 1].len;
+	}
+
+	return 0;
+}
+
+static int zbd_mb_list(struct zbd_mb *mb)
+{
+	struct zbd_zone *zones;
+	unsigned int nrz;
+	int ret;
+
+	ret = zbd_list_zones(mb->fd, 0, 0, mb->ro, &zones, &nrz);
+	if (ret)
+		return ret;
+	free(zones);
+
+	return 0;
+}
+
+static int zbd_mb_report_all(struct zbd_mb *mb)
+{
+	static const unsigned int counts[] = { 1, 16, 256, 4096, 65536 };
+	static const unsigned int batches[] = { 16, 128, 1024, 8192 };
+	unsigned int i, nr_zones = mb->info.nr_zones;
+	char name[64];
+	int ret = 0;
+
+	mb->zones = calloc(nr_zones, sizeof(struct zbd_zone));
+	if (!mb->zones) {
+		fprintf(stderr, "No memory for %u zones\n", nr_zones);
+		return -1;
+	}
+
+	zbd_mb_print_header("Device open (items: open+close)");
+	ret = zbd_mb_run(mb, "open+close", 1, zbd_mb_open_close);
+	if (ret)
+		goto out;
+
+	zbd_mb_print_header("Zone reports (items: zones)");
+
+	mb->ro = ZBD_RO_ALL;
+	ret = zbd_mb_run(mb, "report_nr_zones", nr_zones,
+			 zbd_mb_report_nr_zones);
+	if (ret)
+		goto out;
+
+	/* Reports of an increasing number of zones, in a single call */
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		mb->nr_zones = counts[i];
+		if (mb->nr_zones > nr_zones)
+			mb->nr_zones = nr_zones;
+		sprintf(name, "report_zones nr=%u", mb->nr_zones);
+		ret = zbd_mb_run(mb, name, mb->nr_zones, zbd_mb_report);
+		if (ret || mb->nr_zones == nr_zones)
+			break;
+	}
+	if (ret)
+		goto out;
+
+	/* Report of all zones in batches of an increasing number of zones */
+	for (i = 0; i < sizeof(batches) / sizeof(batches[0]); i++) {
+		mb->batch = batches[i];
+		if (mb->batch > nr_zones)
+			mb->batch = nr_zones;
+		sprintf(name, "report_zones all batch=%u", mb->batch);
+		ret = zbd_mb_run(mb, name, nr_zones, zbd_mb_report_batch);
+		if (ret || mb->batch == nr_zones)
+			break;
+	}
+	if (ret)
+		goto out;
+
+	/* Filtered report of all zones */
+	mb->nr_zones = nr_zones;
+	mb->ro = ZBD_RO_EMPTY;
+	ret = zbd_mb_run(mb, "report_zones ro=empty", nr_zones,
+			 zbd_mb_report);
+	if (ret)
+		goto out;
+
+	mb->ro = ZBD_RO_ALL;
+	ret = zbd_mb_run(mb, "list_zones", nr_zones, zbd_mb_list);
+
+out:
+	free(mb->zones);
+	mb->zones = NULL;
+
+	return ret;
+}
+
+/*
+ * Zone management operations. These operate on a single empty sequential
+ * zone and leave that zone empty.
+ */
+static int zbd_mb_zone_open_close(struct zbd_mb *mb)
+{
+	if (zbd_open_zones(mb->fd, mb->zone_ofst, mb->zone_len))
+		return -1;
+
+	return zbd_close_zones(mb->fd, mb->zone_ofst, mb->zone_len);
+}
+
+static int zbd_mb_zone_finish_reset(struct zbd_mb *mb)
+{
+	if (zbd_finish_zones(mb->fd, mb->zone_ofst, mb->zone_len))
+		return -1;
+
+	return zbd_reset_zones(mb->fd, mb->zone_ofst, mb->zone_len);
+}
+
+static int zbd_mb_zone_reset(struct zbd_mb *mb)
+{
+	return zbd_reset_zones(mb->fd, mb->zone_ofst, mb->zone_len);
+}
+
+static int zbd_mb_zone_ops(struct zbd_mb *mb)
+{
+	struct zbd_zone zone;
+	unsigned int nrz = 1;
+	int ret;
+
+	ret = zbd_report_zones(mb->fd, 0, 0, ZBD_RO_EMPTY, &zone, &nrz);
+	if (ret)
+		return ret;
+	if (!nrz) {
+		printf("\nNo empty zone: skipping zone operations\n");
+		return 0;
+	}
+
+	mb->zone_ofst = zbd_zone_start(&zone);
+	mb->zone_len = zbd_zone_len(&zone);
+
+	zbd_mb_print_header("Zone operations (items: operations)");
+
+	ret = zbd_mb_run(mb, "zones_operation reset (empty)", 1,
+			 zbd_mb_zone_reset);
+	if (ret)
+		return ret;
+
+	ret = zbd_mb_run(mb, "zones_operation open+close", 2,
+			 zbd_mb_zone_open_close);
+	if (ret)
+		return ret;
+
+	return zbd_mb_run(mb, "zones_operation finish+reset", 2,
+			  zbd_mb_zone_finish_reset);
+}
+
+static void zbd_mb_usage(const char *name)
+{
+	printf("Usage: %s [options] [<dev path>]\n"
+	       "Run libzbd microbenchmarks. Zone parsing and filtering\n"
+	       "benchmarks use a synthetic zone report. Zone report, list,\n"
+	       "operation and device open benchmarks are run only if a zoned\n"
+	       "block device is specified (e.g. a null_blk device in zoned\n"
+	       "mode). Zone operations are executed on the first empty zone\n"
+	       "of the device, which is left empty.\n"
+	       "Options:\n"
+	       "  -h | --help : Display this help\n"
+	       "  -r          : Read only, do not run zone operations\n"
+	       "  -t <ms>     : Run each benchmark for <ms> milli-seconds\n"
+	       "                (default: %d ms)\n",
+	       name, ZBD_MB_RUNTIME_MS);
+}
+
+int main(int argc, char **argv)
+{
+	struct zbd_mb mb;
+	int i, ret;
+
+	memset(&mb, 0, sizeof(mb));
+	mb.fd = -1;
+	mb.runtime_ns = ZBD_MB_RUNTIME_MS * 1000000ULL;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-h") == 0 ||
+		    strcmp(argv[i], "--help") == 0) {
+			zbd_mb_usage(argv[0]);
+			return 0;
+		}
+
+		if (strcmp(argv[i], "-r") == 0) {
+			mb.rdonly = true;
+		} else if (strcmp(argv[i], "-t") == 0) {
+			if (i >= argc - 1)
+				goto err;
+			i++;
+			mb.runtime_ns = strtoull(argv[i], NULL, 10) * 1000000ULL;
+			if (!mb.runtime_ns)
+				goto err;
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
+			goto err;
+		} else {
+			break;
+		}
+	}
+
+	if (i < argc - 1)
+		goto err;
+	if (i == argc - 1)
+		mb.path = argv[i];
+
+	ret = zbd_mb_parse_all(&mb);
+	if (ret)
+		return 1;
+
+	if (!mb.path) {
+		printf("\nNo device specified: skipping device benchmarks\n");
+		return 0;
+	}
+
+	mb.fd = zbd_open(mb.path, mb.rdonly ? O_RDONLY : O_RDWR, &mb.info);
+	if (mb.fd < 0) {
+		fprintf(stderr, "Open %s failed (%s)\n",
+			mb.path, strerror(errno));
+		return 1;
+	}
+
+	printf("\nDevice %s: %u zones of %llu B\n",
+	       mb.path, mb.info.nr_zones,
+	       (unsigned long long)mb.info.zone_size);
+
+	ret = zbd_mb_report_all(&mb);
+	if (!ret && !mb.rdonly)
+		ret = zbd_mb_zone_ops(&mb);
+
+	zbd_close(mb.fd);
+
+	return ret ? 1 : 0;
+
+err:
+	zbd_mb_usage(argv[0]);
+	return 1;
+}
@@ -18,6 +18,7 @@ extern "C" {
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <linux/blkzoned.h>
 
@@ -112,6 +113,106 @@ enum zbd_log_level {
  */
 extern void zbd_set_log_level(enum zbd_log_level);
 
+/**
+ * @brief Library log message record
+ */
+struct zbd_log_record {
+
+	/**
+	 * Message log level.
+	 */
+	enum zbd_log_level	level;
+
+	/**
+	 * File descriptor of the device concerned by the message, or -1
+	 * if the message is not related to a particular device.
+	 */
+	int			fd;
+
+	/**
+	 * errno value of the error reported, or 0.
+	 */
+	int			err;
+
+	/**
+	 * Thread ID of the thread that generated the message.
+	 */
+	pid_t			tid;
+
+	/**
+	 * Time (CLOCK_REALTIME) in nanoseconds when the message was generated.
+	 * Messages are not timestamped (0) when using the default handler.
+	 */
+	unsigned long long	time_ns;
+
+	/**
+	 * Library function that generated the message.
+	 */
+	const char		*func;
+
+	/**
+	 * Message text, without a trailing new line.
+	 */
+	const char		*msg;
+};
+
+/**
+ * @brief Library log message handler
+ * @param[in] rec	Message record
+ * @param[in] data	Handler private data given with \a zbd_set_log_handler
+ *
+ * The record and its strings are valid only for the duration of the call.
+ */
+typedef void (*zbd_log_handler_t)(const struct zbd_log_record *rec,
+				  void *data);
+
+/**
+ * @brief Log handler flags
+ *
+ * @ZBD_LOG_ASYNC: Queue messages in lock-free per-thread ring buffers
+ *		   drained by a background thread calling the handler.
+ */
+enum zbd_log_flags {
+	ZBD_LOG_ASYNC	= (1 << 0),
+};
+
+/**
+ * @brief Set the library log message handler
+ * @param[in] handler	Message handler, or NULL to use the default handler
+ * @param[in] data	Handler private data
+ * @param[in] flags	Handler flags (enum zbd_log_flags)
+ *
+ * Set the function called for each message generated by the library
+ * according to the log level of the calling thread. The default handler
+ * prints messages to stderr (errors) and stdout (debug messages).
+ * Without ZBD_LOG_ASYNC, the handler is called synchronously in the
+ * context of the thread generating the message. With ZBD_LOG_ASYNC,
+ * messages are formatted into a ring buffer of the thread generating the
+ * message without any system call, and the handler is called from a
+ * background thread. Messages are truncated to 255 characters in ring
+ * buffers and dropped if a thread ring buffer is full, and the number of
+ * messages dropped is reported with an error message. Messages pending
+ * when the handler is changed or when the library is unloaded are
+ * delivered to the previous handler. A synchronous handler may still be
+ * called for messages generated concurrently with a handler change.
+ * A synchronous handler may call this function, but an asynchronous
+ * handler may not.
+ *
+ * @return Returns 0 on success and -1 otherwise, with errno set to EDEADLK
+ * if called from an asynchronous handler.
+ */
+extern int zbd_set_log_handler(zbd_log_handler_t handler, void *data,
+			       unsigned int flags);
+
+/**
+ * @brief Deliver pending log messages
+ *
+ * With ZBD_LOG_ASYNC, wait for all messages queued when this function is
+ * called to be delivered to the log handler. Without ZBD_LOG_ASYNC, this
+ * function does nothing.
+ */
+extern void zbd_log_flush(void);
+
 /**
  * @brief Block device zone models.
  */
@@ -549,6 +650,1148 @@ extern const char *zbd_zone_type_str(struct zbd_zone *z, bool s);
  */
 extern const char *zbd_zone_cond_str(struct zbd_zone *z, bool s);
 
+/**
+ * @brief GC victim selection index (opaque)
+ */
+struct zbd_gc_index;
+
+/**
+ * @brief GC victim selection policies
+ *
+ * @ZBD_GC_GREEDY: Select zones with the least amount of valid data first.
+ * @ZBD_GC_COST_BENEFIT: Select zones with the best (1 - u) * age / (1 + u)
+ *			 score first, with u the ratio of valid data in the
+ *			 zone and age the time since the zone data was last
+ *			 modified.
+ */
+enum zbd_gc_policy {
+	ZBD_GC_GREEDY		= 0x00,
+	ZBD_GC_COST_BENEFIT	= 0x01,
+};
+
+/**
+ * @brief Allocate a GC victim selection index
+ * @param[in] zones	Array of zone information of all zones of a device
+ * @param[in] nr_zones	Number of zones in the array \a zones
+ *
+ * Allocate an index tracking the amount of valid data and the age of the
+ * sequential zones of a device. \a zones must be the zone information of all
+ * zones of the device, as returned by \a zbd_list_zones with ZBD_RO_ALL for
+ * the entire device capacity, so that a zone number is equal to the index of
+ * the zone in the array. All written data of a zone is initially considered
+ * valid and full zones are GC victim candidates. The index can be freed using
+ * \a zbd_gc_index_free. An index is not thread safe: calls operating on the
+ * same index must be serialized by the caller.
+ *
+ * @return The address of the index on success and NULL otherwise.
+ */
+extern struct zbd_gc_index *zbd_gc_index_alloc(struct zbd_zone *zones,
+					       unsigned int nr_zones);
+
+/**
+ * @brief Free a GC victim selection index
+ * @param[in] idx	Index obtained with \a zbd_gc_index_alloc
+ */
+extern void zbd_gc_index_free(struct zbd_gc_index *idx);
+
+/**
+ * @brief Account for data written to a zone
+ * @param[in] idx	Index obtained with \a zbd_gc_index_alloc
+ * @param[in] zno	Zone number
+ * @param[in] len	Number of bytes written
+ *
+ * Increase the amount of written and valid data of the zone \a zno by \a len
+ * bytes. A zone becomes a GC victim candidate once it is fully written.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_gc_index_write(struct zbd_gc_index *idx, unsigned int zno,
+			      unsigned long long len);
+
+/**
+ * @brief Account for data of a zone becoming invalid
+ * @param[in] idx	Index obtained with \a zbd_gc_index_alloc
+ * @param[in] zno	Zone number
+ * @param[in] len	Number of bytes invalidated
+ *
+ * Decrease the amount of valid data of the zone \a zno by \a len bytes.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_gc_index_invalidate(struct zbd_gc_index *idx, unsigned int zno,
+				   unsigned long long len);
+
+/**
+ * @brief Make a zone a GC victim candidate
+ * @param[in] idx	Index obtained with \a zbd_gc_index_alloc
+ * @param[in] zno	Zone number
+ *
+ * Indicate that the zone \a zno will not be written anymore, e.g. after
+ * the zone was finished using \a zbd_finish_zones, and that it can be
+ * selected as a GC victim.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_gc_index_finish(struct zbd_gc_index *idx, unsigned int zno);
+
+/**
+ * @brief Account for a zone reset
+ * @param[in] idx	Index obtained with \a zbd_gc_index_alloc
+ * @param[in] zno	Zone number
+ *
+ * Clear the amount of written and valid data of the zone \a zno and remove
+ * the zone from the set of GC victim candidates.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_gc_index_reset(struct zbd_gc_index *idx, unsigned int zno);
+
+/**
+ * @brief Get the amount of valid data and the age of a zone
+ * @param[in] idx	Index obtained with \a zbd_gc_index_alloc
+ * @param[in] zno	Zone number
+ * @param[out] valid	Amount of valid data of the zone in bytes
+ * @param[out] age_ms	Time in milliseconds since the zone was last modified
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_gc_index_get_zone(struct zbd_gc_index *idx, unsigned int zno,
+				 unsigned long long *valid,
+				 unsigned long long *age_ms);
+
+/**
+ * @brief Get the best GC victim zones
+ * @param[in] idx	Index obtained with \a zbd_gc_index_alloc
+ * @param[in] policy	Victim selection policy
+ * @param[out] znos	Array of zone numbers to fill
+ * @param[in,out] nr_zones	Size of the array \a znos on entry, number of
+ *				victim zones returned on exit
+ *
+ * Get the zone numbers of at most \a nr_zones GC victim candidate zones, best
+ * victim first, according to \a policy. Zones are ordered by buckets of
+ * valid data ratio, each bucket covering 1/256th of the zone capacity, and by
+ * age within a bucket. Getting k victims costs O(k log(256)) operations,
+ * independently of the number of zones of the device.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_gc_index_get_victims(struct zbd_gc_index *idx,
+				    enum zbd_gc_policy policy,
+				    unsigned int *znos, unsigned int *nr_zones);
+
+/**
+ * @brief Write lifetime hints
+ *
+ * Expected lifetime classes of written data, with the same meaning as the
+ * RWH_WRITE_LIFE_* values used with fcntl(F_SET_RW_HINT).
+ */
+enum zbd_write_hint {
+	ZBD_WRITE_HINT_NOT_SET	= 0,
+	ZBD_WRITE_HINT_NONE	= 1,
+	ZBD_WRITE_HINT_SHORT	= 2,
+	ZBD_WRITE_HINT_MEDIUM	= 3,
+	ZBD_WRITE_HINT_LONG	= 4,
+	ZBD_WRITE_HINT_EXTREME	= 5,
+};
+
+/**
+ * @brief Number of write lifetime hint classes
+ */
+#define ZBD_NR_WRITE_HINTS	6
+
+/**
+ * @brief Write stream (opaque)
+ */
+struct zbd_wstream;
+
+/**
+ * @brief Allocate a write stream
+ * @param[in] fd	File descriptor obtained with \a zbd_open
+ * @param[in] ofst	Byte offset of the first zone the stream can use
+ * @param[in] len	Length in bytes of the range of zones the stream
+ *			can use
+ * @param[in] max_zones	Maximum number of zones written simultaneously
+ *
+ * Allocate a write stream that separates written data in different zones
+ * according to the data expected lifetime. The stream writes each write hint
+ * class to its own zone, allocating empty sequential zones in the range
+ * [ofst..ofst+len] (all zones from \a ofst if \a len is 0).
+ * The number of zones simultaneously written is limited to \a max_zones
+ * (at most ZBD_NR_WRITE_HINTS if \a max_zones is 0) and to the open and
+ * active zones resources of the device not in use when the stream is
+ * allocated. When this limit is reached, a class without a zone shares the
+ * zone of the class with the nearest lifetime, the shorter lifetime class
+ * being used on ties, until that zone is full.
+ * A write stream can be used by multiple threads. The stream can be freed
+ * using \a zbd_wstream_free.
+ *
+ * @return The address of the stream on success and NULL otherwise.
+ */
+extern struct zbd_wstream *zbd_wstream_alloc(int fd, off_t ofst, off_t len,
+					     unsigned int max_zones);
+
+/**
+ * @brief Free a write stream
+ * @param[in] ws	Stream obtained with \a zbd_wstream_alloc
+ *
+ * Free a write stream. The zones partially written by the stream are
+ * not finished.
+ */
+extern void zbd_wstream_free(struct zbd_wstream *ws);
+
+/**
+ * @brief Write data to the zone of a write hint class
+ * @param[in] ws	Stream obtained with \a zbd_wstream_alloc
+ * @param[in] hint	Lifetime hint of the data written
+ * @param[in] buf	Data to write
+ * @param[in] count	Number of bytes to write
+ * @param[out] ofst	Device offset where the data was written
+ *
+ * Write data at the write pointer of the zone used for \a hint. \a count
+ * must be a multiple of the device logical block size. As with write(2),
+ * fewer than \a count bytes may be written, when the end of the zone
+ * capacity is reached. After a failed or short write, the zone write
+ * pointer is obtained from the device. Writes using the same zone are
+ * serialized. Writes to sequential zones must be direct I/Os, so \a fd
+ * must be open with O_DIRECT for zoned devices with sequential zones.
+ *
+ * @return The number of bytes written on success and -1 otherwise, with
+ * errno set to ENOSPC if no zone is available to write, or to EINVAL if
+ * \a count is not a multiple of the device logical block size.
+ */
+extern ssize_t zbd_wstream_write(struct zbd_wstream *ws,
+				 enum zbd_write_hint hint,
+				 const void *buf, size_t count, off_t *ofst);
+
+/**
+ * @brief Zone finish policy (opaque)
+ */
+struct zbd_fpolicy;
+
+/**
+ * @brief Zone finish policy parameters
+ */
+struct zbd_fpolicy_params {
+
+	/**
+	 * Finish zones written to at least this percentage of their capacity.
+	 * A value of 0 disables finishing zones based on their fill level.
+	 */
+	unsigned int		fill_pct;
+
+	/**
+	 * Number of zones reaching the fill threshold that triggers the
+	 * execution of finish operations from \a zbd_fpolicy_update.
+	 * A value of 0 or 1 finishes zones as soon as they reach the fill
+	 * threshold.
+	 */
+	unsigned int		batch_size;
+
+	/**
+	 * Finish zones that were not written for at least this number of
+	 * milliseconds when \a zbd_fpolicy_run is called. A value of 0
+	 * disables finishing idle zones.
+	 */
+	unsigned long long	idle_ms;
+
+	/**
+	 * Function called, if not NULL, for each zone finished by the
+	 * policy with the device file descriptor, the zone start offset
+	 * in bytes and \a cb_data. Writes to a zone finished fail, so an
+	 * application must stop writing to a zone reported with this
+	 * function. The function is called without the policy lock held.
+	 */
+	void			(*finish_cb)(int fd, off_t ofst, void *data);
+	void			*cb_data;
+};
+
+/**
+ * @brief Zone finish policy counters
+ */
+struct zbd_fpolicy_stats {
+
+	/**
+	 * Number of zones finished because of their fill level.
+	 */
+	unsigned long long	nr_finished_fill;
+
+	/**
+	 * Number of zones finished because they were idle.
+	 */
+	unsigned long long	nr_finished_idle;
+
+	/**
+	 * Number of finish zone operations executed. A single operation
+	 * finishes a range of contiguous zones.
+	 */
+	unsigned long long	nr_finish_ops;
+
+	/**
+	 * Number of failed finish zone operations.
+	 */
+	unsigned long long	nr_errors;
+
+	/**
+	 * Total unwritten capacity in bytes of the zones finished.
+	 */
+	unsigned long long	finished_unwritten_bytes;
+
+	/**
+	 * Number of zones currently active.
+	 */
+	unsigned int		nr_active_zones;
+};
+
+/**
+ * @brief Allocate a zone finish policy
+ * @param[in] fd	File descriptor obtained with \a zbd_open
+ * @param[in] params	Policy parameters
+ *
+ * Allocate a zone finish policy engine for the device open with \a fd.
+ * The policy tracks the fill level and the time of the last write of active
+ * zones, using the information given with \a zbd_fpolicy_update, and
+ * finishes zones according to \a params to release the device active zone
+ * resources. The zones that are active when the policy is allocated are
+ * tracked as if they were just written. A policy can be used by multiple
+ * threads and can be freed using \a zbd_fpolicy_free.
+ *
+ * @return The address of the policy on success and NULL otherwise.
+ */
+extern struct zbd_fpolicy *zbd_fpolicy_alloc(int fd,
+					     struct zbd_fpolicy_params *params);
+
+/**
+ * @brief Free a zone finish policy
+ * @param[in] fp	Policy obtained with \a zbd_fpolicy_alloc
+ */
+extern void zbd_fpolicy_free(struct zbd_fpolicy *fp);
+
+/**
+ * @brief Account for data written to a zone
+ * @param[in] fp	Policy obtained with \a zbd_fpolicy_alloc
+ * @param[in] ofst	Device byte offset of the data written
+ * @param[in] len	Number of bytes written
+ *
+ * Update the write pointer position and last write time of the zone
+ * containing \a ofst. If the number of zones reaching the fill threshold
+ * of the policy reaches the policy batch size, these zones are finished,
+ * using a single zone operation for each range of contiguous zones. Zones
+ * may thus be finished while the application is writing to them: the
+ * application must check the zones reported with the \a finish_cb function
+ * of the policy parameters before writing again to a zone. The zones that
+ * failed to be finished remain active and are finished again later.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_fpolicy_update(struct zbd_fpolicy *fp, off_t ofst, size_t len);
+
+/**
+ * @brief Account for a zone reset
+ * @param[in] fp	Policy obtained with \a zbd_fpolicy_alloc
+ * @param[in] ofst	Device byte offset of the zone reset
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_fpolicy_reset(struct zbd_fpolicy *fp, off_t ofst);
+
+/**
+ * @brief Finish zones according to a finish policy
+ * @param[in] fp	Policy obtained with \a zbd_fpolicy_alloc
+ *
+ * Finish all zones that reached the policy fill threshold and all zones
+ * that were idle for longer than the policy idle timeout. This function
+ * should be called periodically for idle zones to be finished. Each zone
+ * finished is reported with the \a finish_cb function of the policy
+ * parameters, and the application must not write again to these zones.
+ *
+ * @return The number of zones finished on success and -1 if any zone
+ * finish operation failed.
+ */
+extern int zbd_fpolicy_run(struct zbd_fpolicy *fp);
+
+/**
+ * @brief Get a zone finish policy counters
+ * @param[in] fp	Policy obtained with \a zbd_fpolicy_alloc
+ * @param[out] stats	Address where to return the policy counters
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_fpolicy_get_stats(struct zbd_fpolicy *fp,
+				 struct zbd_fpolicy_stats *stats);
+
+/**
+ * @brief Zone read stream (opaque)
+ */
+struct zbd_rstream;
+
+/**
+ * @brief Zone read stream flags
+ *
+ * @ZBD_RSTREAM_DIRECT: Read the device using direct I/Os (O_DIRECT).
+ */
+enum zbd_rstream_flags {
+	ZBD_RSTREAM_DIRECT	= (1U << 0),
+};
+
+/**
+ * @brief Allocate a zone read stream
+ * @param[in] fd	File descriptor obtained with \a zbd_open
+ * @param[in] ra_size	Readahead buffer size in bytes
+ * @param[in] flags	Stream flags (enum zbd_rstream_flags)
+ *
+ * Allocate a stream for reading zone data with \a zbd_zone_read. The stream
+ * caches the information of the zone last read and reads ahead zone data into
+ * a buffer of \a ra_size bytes (1 MiB if \a ra_size is 0) aligned to the
+ * device physical block size. A stream must be used by a single thread at a
+ * time and can be freed using \a zbd_rstream_free.
+ *
+ * @return The address of the stream on success and NULL otherwise.
+ */
+extern struct zbd_rstream *zbd_rstream_alloc(int fd, size_t ra_size,
+					     unsigned int flags);
+
+/**
+ * @brief Free a zone read stream
+ * @param[in] rs	Stream obtained with \a zbd_rstream_alloc
+ */
+extern void zbd_rstream_free(struct zbd_rstream *rs);
+
+/**
+ * @brief Read zone data
+ * @param[in] rs	Stream obtained with \a zbd_rstream_alloc
+ * @param[in] buf	Buffer where to store the data read
+ * @param[in] count	Number of bytes to read
+ * @param[in] ofst	Device byte offset to read from
+ *
+ * Read at most \a count bytes of data of the zone containing \a ofst. Reads
+ * are clamped to the readable data of the zone: up to the write pointer
+ * position for sequential zones that are not full and up to the zone
+ * capacity otherwise. The cached zone write pointer position is refreshed
+ * only when a read goes beyond it. Reads continuing the previous read are
+ * read ahead within the zone, up to the zone write pointer, so that small
+ * sequential reads are served from the stream buffer. Other reads only read
+ * the requested range, aligned to the device logical block size. Data read
+ * ahead is dropped when a read targets another zone, or when the zone
+ * condition changes or its write pointer goes below the data read ahead.
+ *
+ * @return The number of bytes read, 0 if \a ofst is at or after the end
+ * of the zone readable data, or -1 if an error occurred.
+ */
+extern ssize_t zbd_zone_read(struct zbd_rstream *rs, void *buf, size_t count,
+			     off_t ofst);
+
+/**
+ * @brief I/O buffer pool (opaque)
+ */
+struct zbd_buf_pool;
+
+/**
+ * @brief I/O buffer pool flags
+ *
+ * @ZBD_BUF_POOL_HUGEPAGE: Back the pool buffers with huge pages if possible.
+ */
+enum zbd_buf_pool_flags {
+	ZBD_BUF_POOL_HUGEPAGE	= (1U << 0),
+};
+
+/**
+ * @brief Allocate a pool of aligned I/O buffers
+ * @param[in] fd	File descriptor obtained with \a zbd_open, or -1
+ * @param[in] buf_size	Size in bytes of the buffers
+ * @param[in] nr_bufs	Number of buffers of the pool
+ * @param[in] flags	Pool flags (enum zbd_buf_pool_flags)
+ *
+ * Allocate a pool of \a nr_bufs buffers usable for direct I/Os to the device
+ * open with \a fd. Buffers are aligned to the larger of the system page size
+ * and of the device physical block size (the page size if \a fd is -1), and
+ * \a buf_size is rounded up to a multiple of this alignment. All buffers are
+ * allocated upfront from a single memory region, using huge pages if
+ * ZBD_BUF_POOL_HUGEPAGE is specified in \a flags, with a fallback to
+ * transparent huge pages. Free buffers are cached per thread, so that getting
+ * and returning buffers does not contend with other threads in most cases.
+ * Buffers cached by a thread are given to other threads when all other
+ * buffers are in use. The pool can be freed using \a zbd_buf_pool_free.
+ *
+ * @return The address of the pool on success and NULL otherwise, with
+ * errno set to EINVAL if the total size of the buffers is too large.
+ */
+extern struct zbd_buf_pool *zbd_buf_pool_alloc(int fd, size_t buf_size,
+					       unsigned int nr_bufs,
+					       unsigned int flags);
+
+/**
+ * @brief Free a buffer pool
+ * @param[in] pool	Pool obtained with \a zbd_buf_pool_alloc
+ *
+ * Free a buffer pool and all its buffers. The pool must not be used by any
+ * thread once this function is called.
+ */
+extern void zbd_buf_pool_free(struct zbd_buf_pool *pool);
+
+/**
+ * @brief Get a free buffer from a pool
+ * @param[in] pool	Pool obtained with \a zbd_buf_pool_alloc
+ *
+ * @return The address of a buffer on success and NULL otherwise, with errno
+ * set to ENOBUFS if all buffers of the pool are in use.
+ */
+extern void *zbd_buf_get(struct zbd_buf_pool *pool);
+
+/**
+ * @brief Return a buffer to a pool
+ * @param[in] pool	Pool obtained with \a zbd_buf_pool_alloc
+ * @param[in] buf	Buffer obtained with \a zbd_buf_get
+ */
+extern void zbd_buf_put(struct zbd_buf_pool *pool, void *buf);
+
+/**
+ * @brief Get the size of the buffers of a pool
+ * @param[in] pool	Pool obtained with \a zbd_buf_pool_alloc
+ *
+ * @return The size in bytes of the pool buffers, or 0 with errno set to
+ * EINVAL if \a pool is NULL.
+ */
+extern size_t zbd_buf_pool_buf_size(struct zbd_buf_pool *pool);
+
+/**
+ * @brief Get the index of a buffer in its pool
+ * @param[in] pool	Pool obtained with \a zbd_buf_pool_alloc
+ * @param[in] buf	Buffer obtained with \a zbd_buf_get
+ *
+ * The index of a buffer is the index of its I/O vector in the array returned
+ * by \a zbd_buf_pool_iovecs, that is, the buffer index to use for io_uring
+ * fixed buffer operations if the pool buffers were registered.
+ *
+ * @return The index of the buffer on success and -1 otherwise.
+ */
+extern int zbd_buf_index(struct zbd_buf_pool *pool, void *buf);
+
+/**
+ * @brief Get the I/O vectors describing a pool buffers
+ * @param[in] pool	Pool obtained with \a zbd_buf_pool_alloc
+ * @param[out] nr_iovecs	Number of I/O vectors returned
+ *
+ * Get an array of I/O vectors with one vector per buffer of the pool. This
+ * array can be used directly to register the pool buffers as io_uring fixed
+ * buffers, e.g. with io_uring_register_buffers(). The array belongs to the
+ * pool and must not be modified or freed.
+ *
+ * @return The address of the I/O vector array on success and NULL otherwise.
+ */
+extern const struct iovec *zbd_buf_pool_iovecs(struct zbd_buf_pool *pool,
+					       unsigned int *nr_iovecs);
+
+/**
+ * @brief Number of per errno error counters of struct zbd_stats
+ */
+#define ZBD_STATS_MAX_ERRNO	134
+
+/**
+ * @brief Device statistics counters
+ *
+ * Counters accumulated for a device file descriptor since the device was
+ * open with \a zbd_open or since the last call to \a zbd_reset_stats.
+ */
+struct zbd_stats {
+
+	/**
+	 * Number of calls to zbd_report_zones(), including the calls
+	 * resulting from zbd_list_zones() and zbd_report_nr_zones().
+	 */
+	unsigned long long	nr_report_calls;
+
+	/**
+	 * Total number of zones reported.
+	 */
+	unsigned long long	nr_zones_reported;
+
+	/**
+	 * Number of zone report and zone management ioctls executed and
+	 * total execution time in nanoseconds of these ioctls.
+	 */
+	unsigned long long	nr_ioctls;
+	unsigned long long	ioctl_time_ns;
+
+	/**
+	 * Number of zone management operations executed, per operation type.
+	 */
+	unsigned long long	nr_reset_ops;
+	unsigned long long	nr_open_ops;
+	unsigned long long	nr_close_ops;
+	unsigned long long	nr_finish_ops;
+
+	/**
+	 * Number of bytes read with zone read streams and written with
+	 * zone write streams.
+	 */
+	unsigned long long	bytes_read;
+	unsigned long long	bytes_written;
+
+	/**
+	 * Total number of errors and number of errors per errno value.
+	 * Errors with an errno value larger than or equal to
+	 * ZBD_STATS_MAX_ERRNO are counted in errors[0].
+	 */
+	unsigned long long	nr_errors;
+	unsigned long long	errors[ZBD_STATS_MAX_ERRNO];
+};
+
+/**
+ * @brief Get a device statistics counters
+ * @param[in] fd	File descriptor obtained with \a zbd_open
+ * @param[out] stats	Address where to return the counters
+ *
+ * Counters are updated without locking and are not a snapshot: counters
+ * updated by other threads while this function executes may or may not be
+ * included in the values returned.
+ *
+ * @return Returns 0 on success and -1 otherwise. If the library was
+ * compiled without statistics support, -1 is returned and errno is set
+ * to ENOTSUP.
+ */
+extern int zbd_get_stats(int fd, struct zbd_stats *stats);
+
+/**
+ * @brief Reset a device statistics counters
+ * @param[in] fd	File descriptor obtained with \a zbd_open
+ *
+ * Reset the statistics counters and the latency histograms of a device.
+ *
+ * @return Returns 0 on success and -1 otherwise. If the library was
+ * compiled without statistics support, -1 is returned and errno is set
+ * to ENOTSUP.
+ */
+extern int zbd_reset_stats(int fd);
+
+/**
+ * @brief Latency histogram operation types
+ */
+enum zbd_lat_op {
+	ZBD_LAT_REPORT	= 0x00,
+	ZBD_LAT_RESET	= 0x01,
+	ZBD_LAT_OPEN	= 0x02,
+	ZBD_LAT_CLOSE	= 0x03,
+	ZBD_LAT_FINISH	= 0x04,
+	ZBD_LAT_NR_OPS,
+};
+
+/**
+ * @brief Latency histogram buckets
+ *
+ * Latencies below 2^ZBD_LAT_HIST_SUB_BITS nanoseconds are counted exactly.
+ * Larger latencies are counted using 2^ZBD_LAT_HIST_SUB_BITS buckets per
+ * power of 2, that is, with a relative error below 3%.
+ */
+#define ZBD_LAT_HIST_SUB_BITS	5
+#define ZBD_LAT_HIST_NR_BUCKETS	\
+	((64 - ZBD_LAT_HIST_SUB_BITS + 1) << ZBD_LAT_HIST_SUB_BITS)
+
+/**
+ * @brief Latency histogram
+ */
+struct zbd_lat_hist {
+
+	/**
+	 * Number of latencies recorded, total, minimum and maximum latency
+	 * in nanoseconds.
+	 */
+	unsigned long long	count;
+	unsigned long long	sum_ns;
+	unsigned long long	min_ns;
+	unsigned long long	max_ns;
+
+	/**
+	 * Number of latencies recorded per bucket.
+	 */
+	unsigned long long	buckets[ZBD_LAT_HIST_NR_BUCKETS];
+};
+
+/**
+ * @brief Get a device latency histogram for an operation type
+ * @param[in] fd	File descriptor obtained with \a zbd_open
+ * @param[in] op	Operation type
+ * @param[out] hist	Address where to return the histogram
+ *
+ * Get the histogram of the latencies of the zone report ioctls or of the
+ * zone management ioctls of type \a op executed for a device. Latencies are
+ * measured with a monotonic clock around each ioctl. As for statistics
+ * counters, the histogram returned is not a snapshot.
+ *
+ * @return Returns 0 on success and -1 otherwise. If the library was
+ * compiled without statistics support, -1 is returned and errno is set
+ * to ENOTSUP.
+ */
+extern int zbd_get_lat_hist(int fd, enum zbd_lat_op op,
+			    struct zbd_lat_hist *hist);
+
+/**
+ * @brief Record a latency in a latency histogram
+ * @param[in,out] hist	Histogram
+ * @param[in] ns	Latency in nanoseconds
+ *
+ * Add the latency \a ns to \a hist, e.g. to build the histogram of the
+ * latencies of operations measured by an application. An histogram
+ * initialized with zeros is an empty histogram. This function is not
+ * thread-safe: concurrent callers must use different histograms, which can
+ * then be aggregated using \a zbd_lat_hist_merge.
+ */
+extern void zbd_lat_hist_add(struct zbd_lat_hist *hist, unsigned long long ns);
+
+/**
+ * @brief Merge latency histograms
+ * @param[in,out] hist	Histogram to merge into
+ * @param[in] from	Histogram to merge
+ *
+ * Add the latencies recorded in \a from to \a hist, e.g. to aggregate the
+ * histograms of several devices or of histograms obtained at different
+ * times. An histogram initialized with zeros is an empty histogram.
+ */
+extern void zbd_lat_hist_merge(struct zbd_lat_hist *hist,
+			       const struct zbd_lat_hist *from);
+
+/**
+ * @brief Get a latency histogram percentile
+ * @param[in] hist	Histogram
+ * @param[in] pct	Percentile (0 to 100)
+ *
+ * @return The latency in nanoseconds below which \a pct percent of the
+ * latencies of \a hist are, or 0 if the histogram is empty.
+ */
+extern unsigned long long
+zbd_lat_hist_percentile(const struct zbd_lat_hist *hist, double pct);
+
+/**
+ * @brief Returns a string describing a latency histogram operation type
+ * @param[in] op	Operation type
+ *
+ * @return A string describing the operation type ("report", "reset", ...).
+ */
+extern const char *zbd_lat_op_str(enum zbd_lat_op op);
+
+/**
+ * @brief Injected fault types
+ *
+ * @ZBD_FAULT_ERROR: Fail the zone reports or zone operations with an error.
+ * @ZBD_FAULT_DELAY: Add latency to the zone reports or zone operations.
+ * @ZBD_FAULT_OFFLINE: Report zones as offline and fail zone operations on
+ *		       these zones with EIO.
+ * @ZBD_FAULT_READONLY: Report zones as read-only and fail zone operations on
+ *			these zones with EIO.
+ * @ZBD_FAULT_WP: Report the write pointer of sequential zones shifted.
+ */
+enum zbd_fault_type {
+	ZBD_FAULT_ERROR		= 0x00,
+	ZBD_FAULT_DELAY		= 0x01,
+	ZBD_FAULT_OFFLINE	= 0x02,
+	ZBD_FAULT_READONLY	= 0x03,
+	ZBD_FAULT_WP		= 0x04,
+};
+
+/**
+ * @brief Injected latency distributions
+ *
+ * @ZBD_FAULT_DIST_FIXED: Constant latency.
+ * @ZBD_FAULT_DIST_UNIFORM: Latency uniformly distributed between the
+ *			    minimum and maximum latency.
+ * @ZBD_FAULT_DIST_EXP: Latency exponentially distributed with the given
+ *			mean, up to the maximum latency if not 0.
+ */
+enum zbd_fault_dist {
+	ZBD_FAULT_DIST_FIXED	= 0x00,
+	ZBD_FAULT_DIST_UNIFORM	= 0x01,
+	ZBD_FAULT_DIST_EXP	= 0x02,
+};
+
+/**
+ * @brief Operation mask of a fault, from an operation type.
+ */
+#define ZBD_FAULT_OP(op)	(1U << (op))
+
+/**
+ * @brief Fault injection rule
+ */
+struct zbd_fault {
+
+	/**
+	 * Fault type.
+	 */
+	enum zbd_fault_type	type;
+
+	/**
+	 * Mask of the operations affected (ZBD_FAULT_OP() of enum zbd_lat_op
+	 * values), or 0 for all operations. Only used for ZBD_FAULT_ERROR and
+	 * ZBD_FAULT_DELAY faults.
+	 */
+	unsigned int		ops;
+
+	/**
+	 * Range in bytes of the zones affected. A length of 0 means all zones
+	 * from ofst.
+	 */
+	long long		ofst;
+	long long		len;
+
+	/**
+	 * Probability (0 to 1) of injecting the fault for each operation or
+	 * zone reported, or 0 to always inject the fault. Offline and
+	 * read-only faults are permanent once injected and apply to all the
+	 * zones of the range.
+	 */
+	double			rate;
+
+	/**
+	 * Maximum number of times the fault is injected, or 0 for no limit.
+	 */
+	unsigned long long	count;
+
+	/**
+	 * errno value of ZBD_FAULT_ERROR faults (default: EIO).
+	 */
+	int			err;
+
+	/**
+	 * Latency distribution, mean or minimum latency and maximum latency
+	 * in nanoseconds of ZBD_FAULT_DELAY faults.
+	 */
+	enum zbd_fault_dist	dist;
+	unsigned long long	delay_ns;
+	unsigned long long	delay_max_ns;
+
+	/**
+	 * Number of bytes added to the write pointer of the zones reported
+	 * with ZBD_FAULT_WP faults (may be negative).
+	 */
+	long long		wp_shift;
+
+	/**
+	 * Random number generator seed, for reproducible fault sequences.
+	 */
+	unsigned int		seed;
+};
+
+/**
+ * @brief Add a fault injection rule
+ * @param[in] fault	Fault injection rule
+ *
+ * Add a rule injecting faults in the zone reports and zone operations
+ * executed for all devices. Faults are injected in place of or before the
+ * execution of the zone report and zone management ioctls, and in the zone
+ * information reported, and are accounted for in the device statistics
+ * and latency histograms. Data reads and writes are not affected. Rules
+ * can also be added with the LIBZBD_FAULTS environment variable, using the
+ * syntax of \a zbd_fault_parse.
+ *
+ * @return Returns the identifier of the rule (0 or more) on success and
+ * -1 otherwise.
+ */
+extern int zbd_fault_add(const struct zbd_fault *fault);
+
+/**
+ * @brief Add fault injection rules from a string
+ * @param[in] spec	Rules description
+ *
+ * Add the rules described by \a spec, in the form
+ * "type[:key=value[,key=value...]][;type...]". type can be "error",
+ * "delay", "offline", "readonly" or "wp", and keys can be "op" (report,
+ * reset, open, close or finish, separated with '+'), "ofst", "len" (bytes),
+ * "rate", "count", "err" (EIO, ENOTSUP, EBUSY or a number), "dist" (fixed,
+ * uniform or exp), "us", "max_us", "shift" (bytes) and "seed". For example:
+ * "error:op=reset,err=EBUSY,rate=0.01;delay:op=report,dist=exp,us=2000".
+ *
+ * @return Returns 0 on success and -1 otherwise, with errno set to EINVAL
+ * if \a spec is invalid. Rules of \a spec preceding an invalid rule are
+ * added.
+ */
+extern int zbd_fault_parse(const char *spec);
+
+/**
+ * @brief Get the number of faults injected by a rule
+ * @param[in] id	Rule identifier returned by \a zbd_fault_add
+ * @param[out] count	Address where to return the number of faults injected
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_fault_get_count(int id, unsigned long long *count);
+
+/**
+ * @brief Remove all fault injection rules
+ */
+extern void zbd_fault_clear(void);
+
+/**
+ * @brief Call trace file magic and version.
+ */
+#define ZBD_REC_MAGIC		"ZBDTRACE"
+#define ZBD_REC_VERSION		1
+
+/**
+ * @brief Call trace file header
+ *
+ * A call trace file is a header followed by one record (struct zbd_rec) per
+ * library call, in the order in which the calls completed.
+ */
+struct zbd_rec_hdr {
+	char			magic[8];	/* 8 */
+	uint32_t		version;	/* 12 */
+	uint32_t		rec_size;	/* 16 */
+
+	/* Time (CLOCK_REALTIME) in nanoseconds of the start of the trace */
+	uint64_t		start_time_ns;	/* 24 */
+
+	uint8_t			reserved[40];	/* 64 */
+} __attribute__((packed));
+
+/**
+ * @brief Call trace record types
+ *
+ * @ZBD_REC_OPEN: zbd_open(). The offset, length and number of zones fields
+ *		  are the device zone size, capacity and number of zones.
+ * @ZBD_REC_CLOSE: zbd_close().
+ * @ZBD_REC_REPORT: zbd_report_zones(). The op field is the report option
+ *		    and the number of zones field is the number of zones
+ *		    requested (0 for a zone count only).
+ * @ZBD_REC_LIST: zbd_list_zones(). The op field is the report option.
+ * @ZBD_REC_ZONE_OP: zbd_zones_operation(). The op field is the operation.
+ */
+enum zbd_rec_type {
+	ZBD_REC_OPEN		= 0x01,
+	ZBD_REC_CLOSE		= 0x02,
+	ZBD_REC_REPORT		= 0x03,
+	ZBD_REC_LIST		= 0x04,
+	ZBD_REC_ZONE_OP		= 0x05,
+};
+
+/**
+ * @brief Call trace record
+ */
+struct zbd_rec {
+	/* Start time of the call from the start of the trace (ns) */
+	uint64_t		time_ns;	/* 8 */
+
+	/* Duration of the call (ns) */
+	uint64_t		lat_ns;		/* 16 */
+
+	/* Call arguments */
+	uint64_t		ofst;		/* 24 */
+	uint64_t		len;		/* 32 */
+	uint32_t		nr_zones;	/* 36 */
+
+	/*
+	 * Call return value. For successful zone reports and zone lists,
+	 * the number of zones reported or listed.
+	 */
+	int32_t			ret;		/* 40 */
+
+	int16_t			fd;		/* 42 */
+	uint8_t			type;		/* 43 */
+	uint8_t			op;		/* 44 */
+
+	/* errno value of failed calls */
+	uint16_t		err;		/* 46 */
+
+	/* Low 16 bits of the thread ID of the caller */
+	uint16_t		tid;		/* 48 */
+} __attribute__((packed));
+
+/**
+ * @brief Start recording library calls
+ * @param[in] path	Path of the call trace file to create
+ *
+ * Record the calls to zbd_open(), zbd_close(), zbd_report_zones(),
+ * zbd_list_zones() and zbd_zones_operation() (including the calls of
+ * library functions using them) from all threads, with their arguments,
+ * results, start time and duration, into the call trace file \a path.
+ * Recording can also be started when the library is loaded by setting the
+ * LIBZBD_RECORD environment variable to the path of the trace file.
+ * Recorded calls can be replayed with the "zbd replay" command.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_record_start(const char *path);
+
+/**
+ * @brief Stop recording library calls
+ *
+ * Stop recording and close the call trace file. Recording is also stopped
+ * when the library is unloaded.
+ *
+ * @return Returns 0 on success and -1 if writing the trace file failed.
+ */
+extern int zbd_record_stop(void);
+
+/**
+ * @brief Zone activity sampler (opaque data structure)
+ */
+struct zbd_sampler;
+
+/**
+ * @brief Zone activity derived from zone report samples
+ */
+struct zbd_zone_activity {
+
+	/**
+	 * Number of bytes written to the zone since the first sample.
+	 */
+	unsigned long long	bytes_written;
+
+	/**
+	 * Write rate of the zone in bytes per second during the interval
+	 * between the last two samples.
+	 */
+	unsigned long long	write_rate;
+
+	/**
+	 * Number of zone resets, zone open and zone close transitions and
+	 * transitions to the full condition detected since the first sample.
+	 */
+	unsigned long long	nr_resets;
+	unsigned long long	nr_opens;
+	unsigned long long	nr_closes;
+	unsigned long long	nr_fulls;
+};
+
+/**
+ * @brief Zone timeline file magic and version.
+ */
+#define ZBD_TL_MAGIC		"ZBDTLINE"
+#define ZBD_TL_VERSION		1
+
+/**
+ * @brief Zone timeline file header
+ *
+ * A zone timeline file is a header followed by the capacity of each zone
+ * (uint32_t number of 512B sectors) and by the samples. Each sample is a
+ * struct zbd_tl_sample followed by a zone state column and by a zone write
+ * pointer column, each with one value per zone. The state of a zone is its
+ * condition (bits 0 to 3), its reset write pointer recommended flag (bit 4),
+ * its non_seq write resources flag (bit 5) and its type (bits 6 and 7).
+ * The write pointer of a zone is its offset in 512B sectors from the zone
+ * start, which is the zone capacity for full zones and 0 for zones without
+ * a valid write pointer.
+ * Columns are encoded as sequences of LEB128 variable length integers,
+ * a value 0 followed by n encoding n + 1 zero values. The state column
+ * values are the XOR of the zone state with its state in the previous
+ * sample and the write pointer column values are the zigzag encoded
+ * differences of the zone write pointer with the previous sample (the
+ * previous values are 0 for the first sample).
+ */
+struct zbd_tl_hdr {
+	char			magic[8];	/* 8 */
+	uint32_t		version;	/* 12 */
+	uint32_t		nr_zones;	/* 16 */
+
+	/* Zone size and start offset of the first zone in bytes */
+	uint64_t		zone_size;	/* 24 */
+	uint64_t		start;		/* 32 */
+
+	/* Time (CLOCK_REALTIME) in nanoseconds of the first sample */
+	uint64_t		start_time_ns;	/* 40 */
+
+	uint8_t			reserved[24];	/* 64 */
+} __attribute__((packed));
+
+/**
+ * @brief Zone timeline sample header
+ */
+struct zbd_tl_sample {
+	/* Time of the sample from the first sample (ns) */
+	uint64_t		time_ns;	/* 8 */
+
+	/* Size in bytes of the state and write pointer columns */
+	uint32_t		state_len;	/* 12 */
+	uint32_t		wp_len;		/* 16 */
+} __attribute__((packed));
+
+/**
+ * @brief Allocate a zone activity sampler
+ * @param[in] fd	File descriptor obtained with \a zbd_open
+ * @param[in] ofst	Byte offset of the first zone to sample
+ * @param[in] len	Length in bytes of the range of zones to sample
+ *			(0 for all zones from \a ofst)
+ * @param[in] path	Path of the zone timeline file to create, or NULL
+ *
+ * Allocate a sampler deriving the activity of the zones of a range from
+ * successive zone reports, the first one taken on allocation and the
+ * following ones with \a zbd_sampler_sample. If \a path
+ * is not NULL, each sample is also appended to a zone timeline file
+ * created at \a path, which can be read with \a zbd_timeline_open. A
+ * sampler must not be used by multiple threads at the same time and can
+ * be freed using \a zbd_sampler_free.
+ *
+ * @return The address of the sampler on success and NULL otherwise.
+ */
+extern struct zbd_sampler *zbd_sampler_alloc(int fd, off_t ofst, off_t len,
+					     const char *path);
+
+/**
+ * @brief Free a zone activity sampler
+ * @param[in] s		Sampler obtained with \a zbd_sampler_alloc
+ */
+extern void zbd_sampler_free(struct zbd_sampler *s);
+
+/**
+ * @brief Take a zone activity sample
+ * @param[in] s		Sampler obtained with \a zbd_sampler_alloc
+ *
+ * Get the zone information of the sampler zone range and update the
+ * activity of the zones from the differences with the previous sample.
+ * A write pointer moving back is counted as a zone reset, and a zone
+ * finished is counted as written up to its capacity. Events happening
+ * between two samples and cancelling each other (e.g. a zone reset and
+ * rewritten up to the same write pointer) cannot be detected, so the
+ * sampling interval should be shorter than the time needed to fill a zone.
+ *
+ * @return Returns 0 on success and -1 otherwise.
+ */
+extern int zbd_sampler_sample(struct zbd_sampler *s);
+
+/**
+ * @brief Get the activity of the zones of a sampler
+ * @param[in] s		Sampler obtained with \a zbd_sampler_alloc
+ * @param[out] nr_zones	Address where to return the number of zones
+ *
+ * @return The array of the activity of the zones of the sampler range,
+ * valid until the next call to \a zbd_sampler_sample or
+ * \a zbd_sampler_free.
+ */
+extern const struct zbd_zone_activity *
+zbd_sampler_activity(struct zbd_sampler *s, unsigned int *nr_zones);
+
+/**
+ * @brief Zone timeline file reader (opaque data structure)
+ */
+struct zbd_timeline;
+
+/**
+ * @brief Open a zone timeline file
+ * @param[in] path	Path of the zone timeline file
+ * @param[out] hdr	Address where to return the file header, or NULL
+ *
+ * @return The address of the reader on success and NULL otherwise.
+ */
+extern struct zbd_timeline *zbd_timeline_open(const char *path,
+					      struct zbd_tl_hdr *hdr);
+
+/**
+ * @brief Close a zone timeline file
+ * @param[in] tl	Reader obtained with \a zbd_timeline_open
+ */
+extern void zbd_timeline_close(struct zbd_timeline *tl);
+
+/**
+ * @brief Read the next sample of a zone timeline file
+ * @param[in] tl	Reader obtained with \a zbd_timeline_open
+ * @param[out] time_ns	Address where to return the sample time
+ * @param[out] zones	Array of the header nr_zones zones where to return
+ *			the zone information of the sample
+ *
+ * @return Returns 1 if a sample was read, 0 at the end of the file and
+ * -1 if the file is invalid.
+ */
+extern int zbd_timeline_next(struct zbd_timeline *tl,
+			     unsigned long long *time_ns,
+			     struct zbd_zone *zones);
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,8 +20,6 @@
 /*
  * Per fd device information.
  */
-#define ZBD_FD_MAX	1024
-
 static struct zbd_info *zbd_fdi[ZBD_FD_MAX];
 
 static inline struct zbd_info *zbd_get_fd(int fd)
@@ -368,10 +366,7 @@ int zbd_device_is_zoned(const char *filename)
 		model == ZBD_DM_HOST_MANAGED;
 }
 
-/**
- * zbd_open - open a ZBD device
- */
-int zbd_open(const char *filename, int flags, struct zbd_info *info)
+static int zbd_do_open(const char *filename, int flags, struct zbd_info *info)
 {
 	char *path = NULL, *devname = NULL;
 	struct zbd_info *zbdi;
@@ -400,6 +395,11 @@ int zbd_open(const char *filename, int flags, struct zbd_info *info)
 	if (!zbdi)
 		goto err;
 
+	if (zbd_stats_alloc(fd)) {
+		free(zbdi);
+		goto err;
+	}
+
 	zbd_fdi[fd] = zbdi;
 	if (info)
 		memcpy(info, zbdi, sizeof(struct zbd_info));
@@ -419,20 +419,60 @@ err:
 	return fd;
 }
 
+/**
+ * zbd_open - open a ZBD device
+ */
+int zbd_open(const char *filename, int flags, struct zbd_info *info)
+{
+	unsigned long long start = zbd_rec_begin();
+	struct zbd_info *zbdi;
+	int fd;
+
+	zbd_trace2(open_entry, filename, flags);
+	fd = zbd_do_open(filename, flags, info);
+	zbd_trace2(open_return, filename, fd);
+
+	if (start) {
+		zbdi = zbd_get_fd(fd);
+		if (zbdi)
+			zbd_rec(ZBD_REC_OPEN, fd, 0, zbdi->zone_size,
+				zbdi->nr_sectors << SECTOR_SHIFT,
+				zbdi->nr_zones, fd, start);
+		else
+			zbd_rec(ZBD_REC_OPEN, fd, 0, 0, 0, 0, fd, start);
+	}
+
+	return fd;
+}
+
 /**
  * zbd_close - close a ZBD Device
  */
 void zbd_close(int fd)
 {
+	unsigned long long start = zbd_rec_begin();
 	struct zbd_info *zbdi = zbd_get_fd(fd);
+	int ret;
+
+	zbd_trace1(close_entry, fd);
 
 	if (!zbdi) {
 		zbd_error("Invalid file descriptor %d\n\n", fd);
+		zbd_trace2(close_return, fd, -1);
 		return;
 	}
 
-	close(fd);
+	zbd_stats_free(fd);
+	ret = close(fd);
+	if (ret)
+		zbd_error_fd(fd, errno, "%d: close failed %d (%s)\n",
+			     fd, errno, strerror(errno));
 	zbd_put_fd(fd);
+
+	zbd_trace2(close_return, fd, ret);
+
+	if (start)
+		zbd_rec(ZBD_REC_CLOSE, fd, 0, 0, 0, 0, 0, start);
 }
 
 /**
@@ -456,69 +496,67 @@ int zbd_get_info(int fd, struct zbd_info *info)
 }
 
 /*
- * zbd_should_report_zone - Test if a zone must be reported.
+ * Check the fault injection rules for a zone report or zone management ioctl.
  */
-static bool zbd_should_report_zone(struct zbd_zone *zone,
-				   enum zbd_report_option ro)
+static int zbd_ioctl_fault(int fd, enum zbd_lat_op lat_op, void *arg)
 {
-	switch (ro) {
-	case ZBD_RO_ALL:
-		return true;
-	case ZBD_RO_NOT_WP:
-		return zbd_zone_not_wp(zone);
-	case ZBD_RO_EMPTY:
-		return zbd_zone_empty(zone);
-	case ZBD_RO_IMP_OPEN:
-		return zbd_zone_imp_open(zone);
-	case ZBD_RO_EXP_OPEN:
-		return zbd_zone_exp_open(zone);
-	case ZBD_RO_CLOSED:
-		return zbd_zone_closed(zone);
-	case ZBD_RO_FULL:
-		return zbd_zone_full(zone);
-	case ZBD_RO_RDONLY:
-		return zbd_zone_rdonly(zone);
-	case ZBD_RO_OFFLINE:
-		return zbd_zone_offline(zone);
-	case ZBD_RO_RWP_RECOMMENDED:
-		return zbd_zone_rwp_recommended(zone);
-	case ZBD_RO_NON_SEQ:
-		return zbd_zone_non_seq_resources(zone);
-	default:
-		return false;
+	struct zbd_info *zbdi = zbd_get_fd(fd);
+	unsigned long long start, end;
+
+	if (lat_op == ZBD_LAT_REPORT) {
+		struct blk_zone_report *rep = arg;
+
+		start = rep->sector << SECTOR_SHIFT;
+		end = start + rep->nr_zones * zbdi->zone_size;
+	} else {
+		struct blk_zone_range *range = arg;
+
+		start = range->sector << SECTOR_SHIFT;
+		end = start + (range->nr_sectors << SECTOR_SHIFT);
 	}
+
+	return zbd_fault_ioctl(fd, lat_op, start, end);
 }
 
 /*
- * zbd_parse_zone - Fill a zone descriptor
+ * Execute a zone report or zone management ioctl, accounting for it in the
+ * device statistics and latency histograms.
  */
-static inline void zbd_parse_zone(struct zbd_zone *zone, struct blk_zone *blkz,
-				  struct blk_zone_report *rep)
+static int zbd_ioctl(int fd, enum zbd_lat_op lat_op, unsigned long op,
+		     void *arg)
 {
-	zone->start = blkz->start << SECTOR_SHIFT;
-	zone->len = blkz->len << SECTOR_SHIFT;
-	if (rep->flags & BLK_ZONE_REP_CAPACITY)
-		zone->capacity = blkz->capacity << SECTOR_SHIFT;
+#ifdef HAVE_ZBD_STATS
+	unsigned long long start = zbd_now_ns(), ns;
+#endif
+	int ret = 0;
+
+	if (zbd_faults())
+		ret = zbd_ioctl_fault(fd, lat_op, arg);
+	if (ret) {
+		errno = ret;
+		ret = -1;
+	} else {
+		ret = ioctl(fd, op, arg);
+	}
+
+#ifdef HAVE_ZBD_STATS
+	ns = zbd_now_ns() - start;
+	zbd_stats_add(fd, ZBD_STAT_IOCTLS, 1);
+	zbd_stats_add(fd, ZBD_STAT_IOCTL_NS, ns);
+	if (ret)
+		zbd_stats_error(fd, errno);
 	else
-		zone->capacity = zone->len;
-	zone->wp = blkz->wp << SECTOR_SHIFT;
-
-	zone->type = blkz->type;
-	zone->cond = blkz->cond;
-	zone->flags = 0;
-	if (blkz->reset)
-		zone->flags |= ZBD_ZONE_RWP_RECOMMENDED;
-	if (blkz->non_seq)
-		zone->flags |= ZBD_ZONE_NON_SEQ_RESOURCES;
+		zbd_stats_lat(fd, lat_op, ns);
+#endif
+
+	return ret;
 }
 
 #define ZBD_REPORT_MAX_NR_ZONE	8192
 
-/**
- * zbd_report_zones - Get zone information
- */
-int zbd_report_zones(int fd, off_t ofst, off_t len, enum zbd_report_option ro,
-		     struct zbd_zone *zones, unsigned int *nr_zones)
+static int zbd_do_report_zones(int fd, off_t ofst, off_t len,
+			       enum zbd_report_option ro,
+			       struct zbd_zone *zones, unsigned int *nr_zones)
 {
 	struct zbd_info *zbdi = zbd_get_fd(fd);
 	unsigned long long zone_size_mask, end;
@@ -535,6 +573,8 @@ int zbd_report_zones(int fd, off_t ofst, off_t len, enum zbd_report_option ro,
 		return -1;
 	}
 
+	zbd_stats_add(fd, ZBD_STAT_REPORT_CALLS, 1);
+
 	/*
 	 * To get zone reports, we need zones and nr_zones.
 	 * To get only the number of zones, we need only nr_zones.
@@ -588,12 +628,13 @@ int zbd_report_zones(int fd, off_t ofst, off_t len, enum zbd_report_option ro,
 		rep->sector = ofst;
 		rep->nr_zones = rep_nr_zones;
 
-		ret = ioctl(fd, BLKREPORTZONE, rep);
+		ret = zbd_ioctl(fd, ZBD_LAT_REPORT, BLKREPORTZONE, rep);
 		if (ret != 0) {
 			ret = -errno;
-			zbd_error("%d: ioctl BLKREPORTZONE at %llu failed %d (%s)\n",
-				  fd, (unsigned long long)ofst,
-				  errno, strerror(errno));
+			zbd_error_fd(fd, errno,
+				     "%d: ioctl BLKREPORTZONE at %llu failed %d (%s)\n",
+				     fd, (unsigned long long)ofst,
+				     errno, strerror(errno));
 			goto out;
 		}
 
@@ -606,6 +647,8 @@ int zbd_report_zones(int fd, off_t ofst, off_t len, enum zbd_report_option ro,
 				break;
 
 			zbd_parse_zone(&z, &blkz[i], rep);
+			if (zbd_faults())
+				zbd_fault_zone(&z);
 			if (zbd_should_report_zone(&z, ro)) {
 				if (zones)
 					memcpy(&zones[n], &z, sizeof(z));
@@ -618,6 +661,7 @@ int zbd_report_zones(int fd, off_t ofst, off_t len, enum zbd_report_option ro,
 
 	/* Return number of zones */
 	*nr_zones = n;
+	zbd_stats_add(fd, ZBD_STAT_ZONES_REPORTED, n);
 
 out:
 	free(rep);
@@ -626,11 +670,30 @@ out:
 }
 
 /**
- * zbd_list_zones - Get zone information
+ * zbd_report_zones - Get zone information
  */
-int zbd_list_zones(int fd, off_t ofst, off_t len,
-		   enum zbd_report_option ro,
-		   struct zbd_zone **pzones, unsigned int *pnr_zones)
+int zbd_report_zones(int fd, off_t ofst, off_t len, enum zbd_report_option ro,
+		     struct zbd_zone *zones, unsigned int *nr_zones)
+{
+	unsigned long long start = zbd_rec_begin();
+	unsigned int nrz = zones && nr_zones ? *nr_zones : 0;
+	int ret;
+
+	zbd_trace5(report_zones_entry, fd, ofst, len, ro, nrz);
+	ret = zbd_do_report_zones(fd, ofst, len, ro, zones, nr_zones);
+	zbd_trace3(report_zones_return, fd, ret,
+		   !ret && nr_zones ? *nr_zones : 0);
+
+	if (start)
+		zbd_rec(ZBD_REC_REPORT, fd, ro, ofst, len, nrz,
+			!ret && nr_zones ? (int)*nr_zones : ret, start);
+
+	return ret;
+}
+
+static int zbd_do_list_zones(int fd, off_t ofst, off_t len,
+			     enum zbd_report_option ro,
+			     struct zbd_zone **pzones, unsigned int *pnr_zones)
 {
 	struct zbd_info *zbdi = zbd_get_fd(fd);
 	struct zbd_zone *zones = NULL;
@@ -643,7 +706,7 @@ int zbd_list_zones(int fd, off_t ofst, off_t len,
 	}
 
 	/* Get number of zones */
-	ret = zbd_report_nr_zones(fd, ofst, len, ro, &nr_zones);
+	ret = zbd_do_report_zones(fd, ofst, len, ro, NULL, &nr_zones);
 	if (ret < 0)
 		return ret;
 
@@ -656,10 +719,10 @@ int zbd_list_zones(int fd, off_t ofst, off_t len,
 		return -ENOMEM;
 
 	/* Get zones information */
-	ret = zbd_report_zones(fd, ofst, len, ro, zones, &nr_zones);
+	ret = zbd_do_report_zones(fd, ofst, len, ro, zones, &nr_zones);
 	if (ret != 0) {
-		zbd_error("%d: zbd_report_zones failed %d\n",
-			  fd, ret);
+		zbd_error_fd(fd, -ret, "%d: zbd_report_zones failed %d\n",
+			     fd, ret);
 		free(zones);
 		return ret;
 	}
@@ -670,6 +733,27 @@ out:
 	return 0;
 }
 
+/**
+ * zbd_list_zones - Get zone information
+ */
+int zbd_list_zones(int fd, off_t ofst, off_t len,
+		   enum zbd_report_option ro,
+		   struct zbd_zone **pzones, unsigned int *pnr_zones)
+{
+	unsigned long long start = zbd_rec_begin();
+	int ret;
+
+	zbd_trace4(list_zones_entry, fd, ofst, len, ro);
+	ret = zbd_do_list_zones(fd, ofst, len, ro, pzones, pnr_zones);
+	zbd_trace3(list_zones_return, fd, ret, !ret ? *pnr_zones : 0);
+
+	if (start)
+		zbd_rec(ZBD_REC_LIST, fd, ro, ofst, len, 0,
+			!ret ? (int)*pnr_zones : ret, start);
+
+	return ret;
+}
+
 /*
  * BLKOPENZONE, BLKCLOSEZONE and BLKFINISHZONE ioctl commands
  * were introduced with kernel 5.5. If they are not defined on the
@@ -690,14 +774,13 @@ out:
 #define ENOIOCTLCMD	515
 #endif
 
-/**
- * zbd_zone_operation - Execute an operation on a zone
- */
-int zbd_zones_operation(int fd, enum zbd_zone_op op, off_t ofst, off_t len)
+static int zbd_do_zones_operation(int fd, enum zbd_zone_op op,
+				  off_t ofst, off_t len)
 {
 	struct zbd_info *zbdi = zbd_get_fd(fd);
 	unsigned long long zone_size_mask, end;
 	struct blk_zone_range range;
+	enum zbd_lat_op lat_op;
 	const char *ioctl_name;
 	unsigned long ioctl_op;
 	int ret;
@@ -721,18 +804,22 @@ int zbd_zones_operation(int fd, enum zbd_zone_op op, off_t ofst, off_t len)
 	case ZBD_OP_RESET:
 		ioctl_name = "BLKRESETZONE";
 		ioctl_op = BLKRESETZONE;
+		lat_op = ZBD_LAT_RESET;
 		break;
 	case ZBD_OP_OPEN:
 		ioctl_name = "BLKOPENZONE";
 		ioctl_op = BLKOPENZONE;
+		lat_op = ZBD_LAT_OPEN;
 		break;
 	case ZBD_OP_CLOSE:
 		ioctl_name = "BLKCLOSEZONE";
 		ioctl_op = BLKCLOSEZONE;
+		lat_op = ZBD_LAT_CLOSE;
 		break;
 	case ZBD_OP_FINISH:
 		ioctl_name = "BLKFINISHZONE";
 		ioctl_op = BLKFINISHZONE;
+		lat_op = ZBD_LAT_FINISH;
 		break;
 	default:
 		zbd_error("Invalid zone operation 0x%x\n", op);
@@ -748,18 +835,38 @@ int zbd_zones_operation(int fd, enum zbd_zone_op op, off_t ofst, off_t len)
 	/* Execute the operation */
 	range.sector = ofst;
 	range.nr_sectors = end - ofst;
-	ret = ioctl(fd, ioctl_op, &range);
+	zbd_stats_add(fd, ZBD_STAT_RESET_OPS + op - ZBD_OP_RESET, 1);
+	ret = zbd_ioctl(fd, lat_op, ioctl_op, &range);
 	if (ret != 0) {
 		if (errno == ENOIOCTLCMD || errno == ENOTTY) {
-			zbd_error("ioctl %s is not supported\n",
-				  ioctl_name);
+			zbd_error_fd(fd, ENOTSUP,
+				     "ioctl %s is not supported\n",
+				     ioctl_name);
 			errno = ENOTSUP;
 		} else {
-			zbd_error("ioctl %s failed %d (%s)\n",
-				  ioctl_name, errno, strerror(errno));
+			zbd_error_fd(fd, errno, "ioctl %s failed %d (%s)\n",
+				     ioctl_name, errno, strerror(errno));
 		}
 		return -1;
 	}
 
 	return 0;
 }
+
+/**
+ * zbd_zone_operation - Execute an operation on a zone
+ */
+int zbd_zones_operation(int fd, enum zbd_zone_op op, off_t ofst, off_t len)
+{
+	unsigned long long start = zbd_rec_begin();
+	int ret;
+
+	zbd_trace4(zones_operation_entry, fd, op, ofst, len);
+	ret = zbd_do_zones_operation(fd, op, ofst, len);
+	zbd_trace4(zones_operation_return, fd, op, ret, ret ? errno : 0);
+
+	if (start)
+		zbd_rec(ZBD_REC_ZONE_OP, fd, op, ofst, len, 0, ret, start);
+
+	return ret;
+}
@@ -15,12 +15,26 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sched.h>
 
 /*
  * 512B sector size shift.
  */
 #define SECTOR_SHIFT	9
 
+/*
+ * Monotonic clock time in nanoseconds.
+ */
+static inline unsigned long long zbd_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /*
  * Handle kernel zone capacity support
  */
@@ -50,11 +64,225 @@ struct blk_zone zones[0];
 #define blk_zone_report blk_zone_report_v2
 #endif /* HAVE_BLK_ZONE_REP_V2 */
 
+/*
+ * zbd_should_report_zone - Test if a zone must be reported.
+ */
+static inline bool zbd_should_report_zone(struct zbd_zone *zone,
+					  enum zbd_report_option ro)
+{
+	switch (ro) {
+	case ZBD_RO_ALL:
+		return true;
+	case ZBD_RO_NOT_WP:
+		return zbd_zone_not_wp(zone);
+	case ZBD_RO_EMPTY:
+		return zbd_zone_empty(zone);
+	case ZBD_RO_IMP_OPEN:
+		return zbd_zone_imp_open(zone);
+	case ZBD_RO_EXP_OPEN:
+		return zbd_zone_exp_open(zone);
+	case ZBD_RO_CLOSED:
+		return zbd_zone_closed(zone);
+	case ZBD_RO_FULL:
+		return zbd_zone_full(zone);
+	case ZBD_RO_RDONLY:
+		return zbd_zone_rdonly(zone);
+	case ZBD_RO_OFFLINE:
+		return zbd_zone_offline(zone);
+	case ZBD_RO_RWP_RECOMMENDED:
+		return zbd_zone_rwp_recommended(zone);
+	case ZBD_RO_NON_SEQ:
+		return zbd_zone_non_seq_resources(zone);
+	default:
+		return false;
+	}
+}
+
+/*
+ * zbd_parse_zone - Fill a zone descriptor
+ */
+static inline void zbd_parse_zone(struct zbd_zone *zone, struct blk_zone *blkz,
+				  struct blk_zone_report *rep)
+{
+	zone->start = blkz->start << SECTOR_SHIFT;
+	zone->len = blkz->len << SECTOR_SHIFT;
+	if (rep->flags & BLK_ZONE_REP_CAPACITY)
+		zone->capacity = blkz->capacity << SECTOR_SHIFT;
+	else
+		zone->capacity = zone->len;
+	zone->wp = blkz->wp << SECTOR_SHIFT;
+
+	zone->type = blkz->type;
+	zone->cond = blkz->cond;
+	zone->flags = 0;
+	if (blkz->reset)
+		zone->flags |= ZBD_ZONE_RWP_RECOMMENDED;
+	if (blkz->non_seq)
+		zone->flags |= ZBD_ZONE_NON_SEQ_RESOURCES;
+}
+
+/*
+ * Maximum number of open devices.
+ */
+#define ZBD_FD_MAX	1024
+
+/*
+ * Device statistics counters.
+ */
+enum zbd_stat {
+	ZBD_STAT_REPORT_CALLS,
+	ZBD_STAT_ZONES_REPORTED,
+	ZBD_STAT_IOCTLS,
+	ZBD_STAT_IOCTL_NS,
+	ZBD_STAT_RESET_OPS,
+	ZBD_STAT_OPEN_OPS,
+	ZBD_STAT_CLOSE_OPS,
+	ZBD_STAT_FINISH_OPS,
+	ZBD_STAT_BYTES_READ,
+	ZBD_STAT_BYTES_WRITTEN,
+	ZBD_STAT_ERRORS,
+
+	/* Per errno error counters */
+	ZBD_STAT_ERRNO,
+
+	ZBD_STAT_NR = ZBD_STAT_ERRNO + ZBD_STATS_MAX_ERRNO,
+};
+
+#ifdef HAVE_ZBD_STATS
+
+/*
+ * Counters are sharded per CPU to avoid contention between threads
+ * using the same device. Each shard uses separate cache lines.
+ */
+#define ZBD_STATS_NR_SHARDS	16
+
+struct zbd_stats_shard {
+	unsigned long long	cnt[ZBD_STAT_NR];
+} __attribute__((aligned(64)));
+
+struct zbd_dev_stats {
+	struct zbd_stats_shard	shards[ZBD_STATS_NR_SHARDS];
+	struct zbd_lat_hist	lat[ZBD_LAT_NR_OPS];
+};
+
+extern struct zbd_dev_stats *zbd_stats_fd[ZBD_FD_MAX];
+
+extern int zbd_stats_alloc(int fd);
+extern void zbd_stats_free(int fd);
+extern void zbd_stats_lat(int fd, enum zbd_lat_op op, unsigned long long ns);
+
+static inline void zbd_stats_add(int fd, enum zbd_stat stat,
+				 unsigned long long val)
+{
+	struct zbd_dev_stats *st;
+	int cpu;
+
+	if (fd < 0 || fd >= ZBD_FD_MAX)
+		return;
+
+	st = zbd_stats_fd[fd];
+	if (!st)
+		return;
+
+	cpu = sched_getcpu();
+	if (cpu < 0)
+		cpu = 0;
+	cpu &= ZBD_STATS_NR_SHARDS - 1;
+
+	__atomic_fetch_add(&st->shards[cpu].cnt[stat], val, __ATOMIC_RELAXED);
+}
+
+#else
+
+static inline int zbd_stats_alloc(int fd)
+{
+	return 0;
+}
+
+static inline void zbd_stats_free(int fd)
+{
+}
+
+static inline void zbd_stats_add(int fd, enum zbd_stat stat,
+				 unsigned long long val)
+{
+}
+
+static inline void zbd_stats_lat(int fd, enum zbd_lat_op op,
+				 unsigned long long ns)
+{
+}
+
+#endif /* HAVE_ZBD_STATS */
+
+static inline void zbd_stats_error(int fd, int err)
+{
+	zbd_stats_add(fd, ZBD_STAT_ERRORS, 1);
+	if (err <= 0 || err >= ZBD_STATS_MAX_ERRNO)
+		err = 0;
+	zbd_stats_add(fd, ZBD_STAT_ERRNO + err, 1);
+}
+
 extern int zbd_get_sysfs_attr_int64(char *devname, const char *attr,
 				    long long *val);
 extern int zbd_get_sysfs_attr_str(char *devname, const char *attr,
 				  char *val, int val_len);
 
+/*
+ * Fault injection (see zbd_fault_add()).
+ */
+extern int zbd_fault_active;
+extern int zbd_fault_ioctl(int fd, enum zbd_lat_op op,
+			   unsigned long long start, unsigned long long end);
+extern void zbd_fault_zone(struct zbd_zone *z);
+
+static inline bool zbd_faults(void)
+{
+	return __atomic_load_n(&zbd_fault_active, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Library calls recording (see zbd_record_start()): zbd_rec_begin() returns
+ * the start time of a call if calls are recorded, and 0 otherwise.
+ */
+extern int zbd_rec_active;
+extern void zbd_rec(enum zbd_rec_type type, int fd, unsigned int op,
+		    unsigned long long ofst, unsigned long long len,
+		    unsigned int nr_zones, int ret, unsigned long long start);
+
+static inline unsigned long long zbd_rec_begin(void)
+{
+	if (!__atomic_load_n(&zbd_rec_active, __ATOMIC_ACQUIRE))
+		return 0;
+
+	return zbd_now_ns();
+}
+
+/*
+ * USDT probes of the "libzbd" provider. A probe is a NOP instruction
+ * unless it is enabled by a tracer (bpftrace, perf, SystemTap, ...).
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define zbd_trace1(name,a1)					\
+	DTRACE_PROBE1(libzbd, name, a1)
+#define zbd_trace2(name,a1,a2)					\
+	DTRACE_PROBE2(libzbd, name, a1, a2)
+#define zbd_trace3(name,a1,a2,a3)				\
+	DTRACE_PROBE3(libzbd, name, a1, a2, a3)
+#define zbd_trace4(name,a1,a2,a3,a4)				\
+	DTRACE_PROBE4(libzbd, name, a1, a2, a3, a4)
+#define zbd_trace5(name,a1,a2,a3,a4,a5)				\
+	DTRACE_PROBE5(libzbd, name, a1, a2, a3, a4, a5)
+#else
+#define zbd_trace1(name,a1)			do { } while (0)
+#define zbd_trace2(name,a1,a2)			do { } while (0)
+#define zbd_trace3(name,a1,a2,a3)		do { } while (0)
+#define zbd_trace4(name,a1,a2,a3,a4)		do { } while (0)
+#define zbd_trace5(name,a1,a2,a3,a4,a5)		do { } while (0)
+#endif /* HAVE_SYS_SDT_H */
+
 /*
  * Library log level (per thread).
  */
@@ -66,25 +294,38 @@ extern __thread int zbd_log_level;
 		fflush(stream);				\
 	} while (0)
 
-#define zbd_print_level(l,stream,format,args...)		\
-	do {							\
-		if ((l) <= zbd_log_level)			\
-			zbd_print((stream), "(libzbd) " format,	\
-				  ## args);			\
+extern void zbd_log(enum zbd_log_level level, int fd, int err,
+		    const char *func, const char *format, ...)
+	__attribute__((format(printf, 5, 6)));
+
+#define zbd_print_level(l,fd,err,format,args...)			\
+	do {								\
+		if ((l) <= zbd_log_level)				\
+			zbd_log((l), (fd), (err), __func__,		\
+				format, ## args);			\
 	} while (0)
 
 #define zbd_error(format,args...)	\
-	zbd_print_level(ZBD_LOG_ERROR, stderr, "[ERROR] " format, ##args)
+	zbd_print_level(ZBD_LOG_ERROR, -1, 0, format, ##args)
 
 #define zbd_debug(format,args...)	\
-	zbd_print_level(ZBD_LOG_DEBUG, stdout, format, ##args)
+	zbd_print_level(ZBD_LOG_DEBUG, -1, 0, format, ##args)
+
+/*
+ * Messages with the structured fd and errno fields of log records set.
+ */
+#define zbd_error_fd(fd,err,format,args...)	\
+	zbd_print_level(ZBD_LOG_ERROR, fd, err, format, ##args)
+
+#define zbd_debug_fd(fd,format,args...)	\
+	zbd_print_level(ZBD_LOG_DEBUG, fd, 0, format, ##args)
 
-#define zbd_panic(format,args...)	\
+#define zbd_panic(format,args...)			\
 	do {						\
-		zbd_print_level(ZBD_LOG_ERROR,		\
-				stderr,			\
+		zbd_print_level(ZBD_LOG_ERROR, -1, 0,	\
 				"[PANIC] " format,	\
 				##args);		\
+		zbd_log_flush();			\
 		assert(0);				\
 	} while (0)
 
@@ -0,0 +1,422 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define ZBD_HUGEPAGE_SIZE	(2UL * 1024 * 1024)
+
+/*
+ * Maximum number of free buffers cached per thread.
+ */
+#define ZBD_BUF_CACHE_SIZE	8
+
+struct zbd_buf_cache {
+	struct zbd_buf_pool	*pool;
+	struct zbd_buf_cache	*next;
+	pthread_mutex_t		lock;
+	unsigned int		nr_bufs;
+	unsigned int		bufs[ZBD_BUF_CACHE_SIZE];
+};
+
+struct zbd_buf_pool {
+	size_t			buf_size;
+	unsigned int		nr_bufs;
+	void			*mem;
+	size_t			mem_size;
+	void			*base;
+	bool			hugepage;
+	struct iovec		*iovs;
+
+	/* Free buffers not cached by a thread */
+	pthread_mutex_t		lock;
+	unsigned int		*free;
+	unsigned int		nr_free;
+
+	/* Per thread caches of free buffers */
+	pthread_key_t		key;
+	struct zbd_buf_cache	*caches;
+};
+
+/*
+ * Move at most nr buffers from a thread cache to the pool free list.
+ * The cache lock is only contended when another thread steals buffers
+ * from the cache, so the pool lock is never taken with a cache lock held.
+ */
+static void zbd_buf_cache_flush(struct zbd_buf_cache *cache,
+				unsigned int nr)
+{
+	struct zbd_buf_pool *pool = cache->pool;
+	unsigned int bufs[ZBD_BUF_CACHE_SIZE];
+	unsigned int n = 0;
+
+	pthread_mutex_lock(&cache->lock);
+	while (n < nr && cache->nr_bufs)
+		bufs[n++] = cache->bufs[--cache->nr_bufs];
+	pthread_mutex_unlock(&cache->lock);
+
+	pthread_mutex_lock(&pool->lock);
+	while (n)
+		pool->free[pool->nr_free++] = bufs[--n];
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Return the buffers of a thread cache to the pool and free the cache when
+ * the thread exits.
+ */
+static void zbd_buf_cache_release(void *data)
+{
+	struct zbd_buf_cache *cache = data;
+	struct zbd_buf_pool *pool = cache->pool;
+	struct zbd_buf_cache **prev;
+
+	zbd_buf_cache_flush(cache, ZBD_BUF_CACHE_SIZE);
+
+	pthread_mutex_lock(&pool->lock);
+	for (prev = &pool->caches; *prev; prev = &(*prev)->next) {
+		if (*prev == cache) {
+			*prev = cache->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+static struct zbd_buf_cache *zbd_buf_get_cache(struct zbd_buf_pool *pool)
+{
+	struct zbd_buf_cache *cache = pthread_getspecific(pool->key);
+
+	if (cache)
+		return cache;
+
+	cache = calloc(1, sizeof(struct zbd_buf_cache));
+	if (!cache)
+		return NULL;
+	cache->pool = pool;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	if (pthread_setspecific(pool->key, cache)) {
+		pthread_mutex_destroy(&cache->lock);
+		free(cache);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	cache->next = pool->caches;
+	pool->caches = cache;
+	pthread_mutex_unlock(&pool->lock);
+
+	return cache;
+}
+
+/*
+ * Get at most nr free buffers from the pool free list, or if the free list
+ * is empty, from the caches of other threads.
+ */
+static unsigned int zbd_buf_pool_refill(struct zbd_buf_pool *pool,
+					struct zbd_buf_cache *cache,
+					unsigned int *bufs, unsigned int nr)
+{
+	struct zbd_buf_cache *c;
+	unsigned int n = 0;
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (n < nr && pool->nr_free)
+		bufs[n++] = pool->free[--pool->nr_free];
+
+	for (c = pool->caches; c && !n; c = c->next) {
+		if (c == cache)
+			continue;
+		pthread_mutex_lock(&c->lock);
+		while (n < nr && c->nr_bufs)
+			bufs[n++] = c->bufs[--c->nr_bufs];
+		pthread_mutex_unlock(&c->lock);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return n;
+}
+
+/*
+ * Allocate the pool memory, using huge pages if requested and possible.
+ */
+static int zbd_buf_pool_alloc_mem(struct zbd_buf_pool *pool, size_t align,
+				  unsigned int flags)
+{
+	size_t size = pool->buf_size * pool->nr_bufs;
+	uintptr_t base;
+
+	if (flags & ZBD_BUF_POOL_HUGEPAGE) {
+		pool->mem_size = (size + ZBD_HUGEPAGE_SIZE - 1) &
+			~(ZBD_HUGEPAGE_SIZE - 1);
+		pool->mem = mmap(NULL, pool->mem_size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+				 -1, 0);
+		if (pool->mem != MAP_FAILED) {
+			pool->hugepage = true;
+			pool->base = pool->mem;
+			return 0;
+		}
+		zbd_debug("Huge page allocation of %zu B failed, "
+			  "using transparent huge pages\n", pool->mem_size);
+	}
+
+	pool->mem_size = size + align;
+	pool->mem = mmap(NULL, pool->mem_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pool->mem == MAP_FAILED) {
+		pool->mem = NULL;
+		return -1;
+	}
+
+	if (flags & ZBD_BUF_POOL_HUGEPAGE)
+		madvise(pool->mem, pool->mem_size, MADV_HUGEPAGE);
+
+	base = ((uintptr_t)pool->mem + align - 1) & ~((uintptr_t)align - 1);
+	pool->base = (void *)base;
+
+	return 0;
+}
+
+/**
+ * zbd_buf_pool_alloc - Allocate a pool of aligned I/O buffers
+ */
+struct zbd_buf_pool *zbd_buf_pool_alloc(int fd, size_t buf_size,
+					unsigned int nr_bufs,
+					unsigned int flags)
+{
+	struct zbd_buf_pool *pool;
+	struct zbd_info info;
+	size_t align;
+	unsigned int i;
+
+	if (!buf_size || !nr_bufs) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	align = sysconf(_SC_PAGESIZE);
+	if (fd >= 0) {
+		if (zbd_get_info(fd, &info)) {
+			errno = EINVAL;
+			return NULL;
+		}
+		if (info.pblock_size > align)
+			align = info.pblock_size;
+	}
+
+	/* The pool memory size must not overflow, including alignment */
+	if (buf_size > SIZE_MAX - align ||
+	    nr_bufs > (SIZE_MAX - ZBD_HUGEPAGE_SIZE - align) /
+	    ((buf_size + align - 1) & ~(align - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(struct zbd_buf_pool));
+	if (!pool)
+		return NULL;
+
+	pool->buf_size = (buf_size + align - 1) & ~(align - 1);
+	pool->nr_bufs = nr_bufs;
+
+	pool->free = calloc(nr_bufs, sizeof(unsigned int));
+	pool->iovs = calloc(nr_bufs, sizeof(struct iovec));
+	if (!pool->free || !pool->iovs)
+		goto err;
+
+	if (zbd_buf_pool_alloc_mem(pool, align, flags)) {
+		zbd_error("Allocate %u buffers of %zu B failed\n",
+			  nr_bufs, pool->buf_size);
+		goto err;
+	}
+
+	for (i = 0; i < nr_bufs; i++) {
+		pool->iovs[i].iov_base = pool->base + i * pool->buf_size;
+		pool->iovs[i].iov_len = pool->buf_size;
+		pool->free[i] = nr_bufs - 1 - i;
+	}
+	pool->nr_free = nr_bufs;
+
+	if (pthread_key_create(&pool->key, zbd_buf_cache_release))
+		goto err;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	return pool;
+
+err:
+	if (pool->mem)
+		munmap(pool->mem, pool->mem_size);
+	free(pool->free);
+	free(pool->iovs);
+	free(pool);
+	errno = ENOMEM;
+	return NULL;
+}
+
+/**
+ * zbd_buf_pool_free - Free a buffer pool
+ */
+void zbd_buf_pool_free(struct zbd_buf_pool *pool)
+{
+	struct zbd_buf_cache *cache;
+
+	if (!pool)
+		return;
+
+	pthread_key_delete(pool->key);
+	while (pool->caches) {
+		cache = pool->caches;
+		pool->caches = cache->next;
+		pthread_mutex_destroy(&cache->lock);
+		free(cache);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	munmap(pool->mem, pool->mem_size);
+	free(pool->free);
+	free(pool->iovs);
+	free(pool);
+}
+
+/**
+ * zbd_buf_get - Get a free buffer from a pool
+ */
+void *zbd_buf_get(struct zbd_buf_pool *pool)
+{
+	unsigned int bufs[ZBD_BUF_CACHE_SIZE / 2], n;
+	struct zbd_buf_cache *cache;
+	int idx = -1;
+
+	if (!pool) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cache = zbd_buf_get_cache(pool);
+	if (!cache)
+		return NULL;
+
+	pthread_mutex_lock(&cache->lock);
+	if (cache->nr_bufs)
+		idx = cache->bufs[--cache->nr_bufs];
+	pthread_mutex_unlock(&cache->lock);
+	if (idx >= 0)
+		return pool->iovs[idx].iov_base;
+
+	/* Refill half of the thread cache */
+	n = zbd_buf_pool_refill(pool, cache, bufs, ZBD_BUF_CACHE_SIZE / 2);
+	if (!n) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	idx = bufs[--n];
+	if (n) {
+		pthread_mutex_lock(&cache->lock);
+		while (n && cache->nr_bufs < ZBD_BUF_CACHE_SIZE)
+			cache->bufs[cache->nr_bufs++] = bufs[--n];
+		pthread_mutex_unlock(&cache->lock);
+	}
+
+	return pool->iovs[idx].iov_base;
+}
+
+/**
+ * zbd_buf_put - Return a buffer to a pool
+ */
+void zbd_buf_put(struct zbd_buf_pool *pool, void *buf)
+{
+	struct zbd_buf_cache *cache;
+	int idx;
+
+	idx = zbd_buf_index(pool, buf);
+	if (idx < 0) {
+		zbd_error("Invalid buffer %p\n", buf);
+		return;
+	}
+
+	cache = zbd_buf_get_cache(pool);
+	if (!cache) {
+		pthread_mutex_lock(&pool->lock);
+		pool->free[pool->nr_free++] = idx;
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&cache->lock);
+		if (cache->nr_bufs < ZBD_BUF_CACHE_SIZE) {
+			cache->bufs[cache->nr_bufs++] = idx;
+			pthread_mutex_unlock(&cache->lock);
+			return;
+		}
+		pthread_mutex_unlock(&cache->lock);
+
+		zbd_buf_cache_flush(cache, ZBD_BUF_CACHE_SIZE / 2);
+	}
+}
+
+/**
+ * zbd_buf_index - Get the index of a buffer in its pool
+ */
+int zbd_buf_index(struct zbd_buf_pool *pool, void *buf)
+{
+	size_t ofst;
+
+	if (!pool || buf < pool->base ||
+	    buf >= pool->base + pool->buf_size * pool->nr_bufs)
+		goto err;
+
+	ofst = buf - pool->base;
+	if (ofst % pool->buf_size)
+		goto err;
+
+	return ofst / pool->buf_size;
+
+err:
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * zbd_buf_pool_buf_size - Get the size of the buffers of a pool
+ */
+size_t zbd_buf_pool_buf_size(struct zbd_buf_pool *pool)
+{
+	if (!pool) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	return pool->buf_size;
+}
+
+/**
+ * zbd_buf_pool_iovecs - Get the I/O vectors describing a pool buffers
+ */
+const struct iovec *zbd_buf_pool_iovecs(struct zbd_buf_pool *pool,
+					unsigned int *nr_iovecs)
+{
+	if (!pool || !nr_iovecs) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	*nr_iovecs = pool->nr_bufs;
+
+	return pool->iovs;
+}
@@ -0,0 +1,543 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+
+struct zbd_fault_rule {
+	struct zbd_fault	f;
+	unsigned long long	start;
+	unsigned long long	end;
+	unsigned long long	count;
+	unsigned int		rnd;
+	bool			armed;
+};
+
+/*
+ * Fault injection rules. Rules are checked with the lock held, but only
+ * when zbd_fault_active is set, so that zone reports and zone operations
+ * are not slowed down when no fault is injected.
+ */
+static pthread_mutex_t zbd_fault_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zbd_fault_rule *zbd_fault_rules;
+static unsigned int zbd_fault_nr_rules;
+static unsigned int zbd_fault_max_rules;
+int zbd_fault_active;
+
+/*
+ * xorshift32 pseudo random number in [0, 1).
+ */
+static double zbd_fault_rand(struct zbd_fault_rule *r)
+{
+	unsigned int x = r->rnd;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	r->rnd = x;
+
+	return (double)x / 4294967296.0;
+}
+
+/*
+ * Decide if a rule injects a fault, accounting for the injection.
+ */
+static bool zbd_fault_hit(struct zbd_fault_rule *r)
+{
+	if (r->f.count && r->count >= r->f.count)
+		return false;
+
+	if (r->f.rate > 0 && zbd_fault_rand(r) >= r->f.rate)
+		return false;
+
+	r->count++;
+
+	return true;
+}
+
+static inline bool zbd_fault_overlap(struct zbd_fault_rule *r,
+				     unsigned long long start,
+				     unsigned long long end)
+{
+	return start < r->end && end > r->start;
+}
+
+/*
+ * Offline and read-only faults are permanent once injected.
+ */
+static bool zbd_fault_armed(struct zbd_fault_rule *r)
+{
+	if (!r->armed && zbd_fault_hit(r))
+		r->armed = true;
+
+	return r->armed;
+}
+
+static unsigned long long zbd_fault_delay(struct zbd_fault_rule *r)
+{
+	unsigned long long ns = r->f.delay_ns, max_ns = r->f.delay_max_ns;
+
+	switch (r->f.dist) {
+	case ZBD_FAULT_DIST_UNIFORM:
+		if (max_ns > ns)
+			ns += (max_ns - ns) * zbd_fault_rand(r);
+		break;
+	case ZBD_FAULT_DIST_EXP:
+		ns = -log(1.0 - zbd_fault_rand(r)) * ns;
+		if (max_ns && ns > max_ns)
+			ns = max_ns;
+		break;
+	case ZBD_FAULT_DIST_FIXED:
+	default:
+		break;
+	}
+
+	return ns;
+}
+
+/*
+ * Check the rules for a zone report or zone management ioctl on the byte
+ * range [start, end). Injected latency is added before returning.
+ * Returns 0 if the ioctl must be executed, or the errno value to fail it
+ * with otherwise.
+ */
+int zbd_fault_ioctl(int fd, enum zbd_lat_op op,
+		    unsigned long long start, unsigned long long end)
+{
+	unsigned long long ns = 0;
+	struct zbd_fault_rule *r;
+	struct timespec ts;
+	unsigned int i;
+	int err = 0;
+
+	pthread_mutex_lock(&zbd_fault_lock);
+
+	for (i = 0; i < zbd_fault_nr_rules; i++) {
+		r = &zbd_fault_rules[i];
+		if (!zbd_fault_overlap(r, start, end))
+			continue;
+
+		switch (r->f.type) {
+		case ZBD_FAULT_ERROR:
+			if ((!r->f.ops || r->f.ops & ZBD_FAULT_OP(op)) &&
+			    !err && zbd_fault_hit(r))
+				err = r->f.err;
+			break;
+		case ZBD_FAULT_DELAY:
+			if ((!r->f.ops || r->f.ops & ZBD_FAULT_OP(op)) &&
+			    zbd_fault_hit(r))
+				ns += zbd_fault_delay(r);
+			break;
+		case ZBD_FAULT_OFFLINE:
+		case ZBD_FAULT_READONLY:
+			if (op != ZBD_LAT_REPORT && !err &&
+			    zbd_fault_armed(r))
+				err = EIO;
+			break;
+		default:
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&zbd_fault_lock);
+
+	if (ns) {
+		ts.tv_sec = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		while (nanosleep(&ts, &ts) && errno == EINTR)
+			;
+	}
+
+	if (err)
+		zbd_debug_fd(fd, "%d: Injected %s error %d\n",
+			     fd, zbd_lat_op_str(op), err);
+
+	return err;
+}
+
+/*
+ * Apply the rules to a reported zone.
+ */
+void zbd_fault_zone(struct zbd_zone *z)
+{
+	unsigned long long start = z->start, end = z->start + z->len;
+	unsigned long long wp, zcap_end;
+	struct zbd_fault_rule *r;
+	unsigned int i;
+
+	pthread_mutex_lock(&zbd_fault_lock);
+
+	for (i = 0; i < zbd_fault_nr_rules; i++) {
+		r = &zbd_fault_rules[i];
+		if (!zbd_fault_overlap(r, start, end))
+			continue;
+
+		switch (r->f.type) {
+		case ZBD_FAULT_OFFLINE:
+			if (zbd_fault_armed(r)) {
+				z->cond = ZBD_ZONE_COND_OFFLINE;
+				z->wp = z->start;
+			}
+			break;
+		case ZBD_FAULT_READONLY:
+			if (zbd_fault_armed(r) &&
+			    z->cond != ZBD_ZONE_COND_OFFLINE)
+				z->cond = ZBD_ZONE_COND_READONLY;
+			break;
+		case ZBD_FAULT_WP:
+			if (zbd_zone_cnv(z) ||
+			    (z->cond != ZBD_ZONE_COND_EMPTY &&
+			     z->cond != ZBD_ZONE_COND_IMP_OPEN &&
+			     z->cond != ZBD_ZONE_COND_EXP_OPEN &&
+			     z->cond != ZBD_ZONE_COND_CLOSED) ||
+			    !zbd_fault_hit(r))
+				break;
+			zcap_end = z->start + z->capacity;
+			if (r->f.wp_shift < 0 &&
+			    (unsigned long long)-r->f.wp_shift > z->wp - z->start)
+				wp = z->start;
+			else
+				wp = z->wp + r->f.wp_shift;
+			if (wp > zcap_end)
+				wp = zcap_end;
+			z->wp = wp;
+			if (wp == z->start)
+				z->cond = ZBD_ZONE_COND_EMPTY;
+			else if (wp == zcap_end)
+				z->cond = ZBD_ZONE_COND_FULL;
+			else if (z->cond == ZBD_ZONE_COND_EMPTY)
+				z->cond = ZBD_ZONE_COND_CLOSED;
+			break;
+		default:
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&zbd_fault_lock);
+}
+
+/**
+ * zbd_fault_add - Add a fault injection rule
+ */
+int zbd_fault_add(const struct zbd_fault *fault)
+{
+	struct zbd_fault_rule *r;
+	int id;
+
+	if (!fault || fault->type > ZBD_FAULT_WP ||
+	    fault->dist > ZBD_FAULT_DIST_EXP ||
+	    fault->ofst < 0 || fault->len < 0 ||
+	    fault->rate < 0 || fault->rate > 1 ||
+	    fault->err < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&zbd_fault_lock);
+
+	if (zbd_fault_nr_rules == zbd_fault_max_rules) {
+		unsigned int max = zbd_fault_max_rules ?
+			zbd_fault_max_rules * 2 : 8;
+
+		r = realloc(zbd_fault_rules,
+			    max * sizeof(struct zbd_fault_rule));
+		if (!r) {
+			pthread_mutex_unlock(&zbd_fault_lock);
+			zbd_error("No memory for fault injection rule\n");
+			errno = ENOMEM;
+			return -1;
+		}
+		zbd_fault_rules = r;
+		zbd_fault_max_rules = max;
+	}
+
+	id = zbd_fault_nr_rules;
+	r = &zbd_fault_rules[id];
+	memset(r, 0, sizeof(struct zbd_fault_rule));
+	r->f = *fault;
+	if (!r->f.err)
+		r->f.err = EIO;
+	r->start = fault->ofst;
+	if (fault->len)
+		r->end = fault->ofst + fault->len;
+	else
+		r->end = ULLONG_MAX;
+	r->rnd = fault->seed ? fault->seed : (unsigned int)id + 1;
+
+	zbd_fault_nr_rules++;
+	__atomic_store_n(&zbd_fault_active, 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&zbd_fault_lock);
+
+	return id;
+}
+
+/**
+ * zbd_fault_get_count - Get the number of faults injected by a rule
+ */
+int zbd_fault_get_count(int id, unsigned long long *count)
+{
+	int ret = 0;
+
+	if (!count) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&zbd_fault_lock);
+	if (id < 0 || (unsigned int)id >= zbd_fault_nr_rules) {
+		errno = EINVAL;
+		ret = -1;
+	} else {
+		*count = zbd_fault_rules[id].count;
+	}
+	pthread_mutex_unlock(&zbd_fault_lock);
+
+	return ret;
+}
+
+/**
+ * zbd_fault_clear - Remove all fault injection rules
+ */
+void zbd_fault_clear(void)
+{
+	pthread_mutex_lock(&zbd_fault_lock);
+	__atomic_store_n(&zbd_fault_active, 0, __ATOMIC_RELEASE);
+	zbd_fault_nr_rules = 0;
+	pthread_mutex_unlock(&zbd_fault_lock);
+}
+
+static const char *zbd_fault_type_names[] = {
+	[ZBD_FAULT_ERROR]	= "error",
+	[ZBD_FAULT_DELAY]	= "delay",
+	[ZBD_FAULT_OFFLINE]	= "offline",
+	[ZBD_FAULT_READONLY]	= "readonly",
+	[ZBD_FAULT_WP]		= "wp",
+};
+
+static const char *zbd_fault_dist_names[] = {
+	[ZBD_FAULT_DIST_FIXED]		= "fixed",
+	[ZBD_FAULT_DIST_UNIFORM]	= "uniform",
+	[ZBD_FAULT_DIST_EXP]		= "exp",
+};
+
+static int zbd_fault_parse_name(const char *val, const char **names,
+				unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		if (strcmp(val, names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+static int zbd_fault_parse_num(const char *val, long long *num)
+{
+	char *end;
+
+	errno = 0;
+	*num = strtoll(val, &end, 0);
+	if (errno || end == val || *end)
+		return -1;
+
+	return 0;
+}
+
+static int zbd_fault_parse_rate(const char *val, double *rate)
+{
+	char *end;
+
+	errno = 0;
+	*rate = strtod(val, &end);
+	if (errno || end == val || *end)
+		return -1;
+
+	return 0;
+}
+
+static int zbd_fault_parse_ops(char *val, unsigned int *ops)
+{
+	char *op, *save = NULL;
+	unsigned int i;
+
+	*ops = 0;
+	for (op = strtok_r(val, "+", &save); op;
+	     op = strtok_r(NULL, "+", &save)) {
+		if (strcmp(op, "all") == 0) {
+			*ops = 0;
+			return 0;
+		}
+		for (i = 0; i < ZBD_LAT_NR_OPS; i++) {
+			if (strcmp(op, zbd_lat_op_str(i)) == 0)
+				break;
+		}
+		if (i == ZBD_LAT_NR_OPS)
+			return -1;
+		*ops |= ZBD_FAULT_OP(i);
+	}
+
+	return 0;
+}
+
+static int zbd_fault_parse_err(const char *val, int *err)
+{
+	long long num;
+
+	if (strcmp(val, "EIO") == 0)
+		*err = EIO;
+	else if (strcmp(val, "ENOTSUP") == 0)
+		*err = ENOTSUP;
+	else if (strcmp(val, "EBUSY") == 0)
+		*err = EBUSY;
+	else if (zbd_fault_parse_num(val, &num) == 0 && num > 0 &&
+		 num <= INT_MAX)
+		*err = num;
+	else
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Parse a rule "type[:key=value[,key=value...]]".
+ */
+static int zbd_fault_parse_rule(char *str, struct zbd_fault *f)
+{
+	char *key, *val, *save = NULL;
+	long long num;
+	int ret;
+
+	memset(f, 0, sizeof(struct zbd_fault));
+
+	val = strchr(str, ':');
+	if (val)
+		*val++ = '\0';
+
+	ret = zbd_fault_parse_name(str, zbd_fault_type_names,
+				   ZBD_FAULT_WP + 1);
+	if (ret < 0)
+		return -1;
+	f->type = ret;
+
+	if (!val)
+		return 0;
+
+	for (key = strtok_r(val, ",", &save); key;
+	     key = strtok_r(NULL, ",", &save)) {
+		val = strchr(key, '=');
+		if (!val)
+			return -1;
+		*val++ = '\0';
+
+		if (strcmp(key, "op") == 0) {
+			ret = zbd_fault_parse_ops(val, &f->ops);
+		} else if (strcmp(key, "err") == 0) {
+			ret = zbd_fault_parse_err(val, &f->err);
+		} else if (strcmp(key, "dist") == 0) {
+			ret = zbd_fault_parse_name(val, zbd_fault_dist_names,
+						   ZBD_FAULT_DIST_EXP + 1);
+			if (ret >= 0)
+				f->dist = ret;
+		} else if (strcmp(key, "rate") == 0) {
+			ret = zbd_fault_parse_rate(val, &f->rate);
+		} else {
+			ret = zbd_fault_parse_num(val, &num);
+			if (ret)
+				return -1;
+			if (strcmp(key, "ofst") == 0)
+				f->ofst = num;
+			else if (strcmp(key, "len") == 0)
+				f->len = num;
+			else if (strcmp(key, "count") == 0 && num >= 0)
+				f->count = num;
+			else if (strcmp(key, "us") == 0 && num >= 0)
+				f->delay_ns = num * 1000ULL;
+			else if (strcmp(key, "max_us") == 0 && num >= 0)
+				f->delay_max_ns = num * 1000ULL;
+			else if (strcmp(key, "shift") == 0)
+				f->wp_shift = num;
+			else if (strcmp(key, "seed") == 0)
+				f->seed = num;
+			else
+				return -1;
+		}
+		if (ret < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * zbd_fault_parse - Add fault injection rules from a string
+ */
+int zbd_fault_parse(const char *spec)
+{
+	char *str, *rule, *copy, *save = NULL;
+	struct zbd_fault f;
+	int ret = 0;
+
+	if (!spec) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	str = strdup(spec);
+	if (!str) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	for (rule = strtok_r(str, ";", &save); rule;
+	     rule = strtok_r(NULL, ";", &save)) {
+		/* Parsing a rule modifies it: keep a copy for errors */
+		copy = strdup(rule);
+		if (!copy) {
+			errno = ENOMEM;
+			ret = -1;
+			break;
+		}
+		if (zbd_fault_parse_rule(rule, &f)) {
+			zbd_error("Invalid fault injection rule \"%s\"\n",
+				  copy);
+			free(copy);
+			errno = EINVAL;
+			ret = -1;
+			break;
+		}
+		if (zbd_fault_add(&f) < 0) {
+			zbd_error("Invalid fault injection rule \"%s\"\n",
+				  copy);
+			free(copy);
+			ret = -1;
+			break;
+		}
+		free(copy);
+	}
+
+	free(str);
+
+	return ret;
+}
+
+/*
+ * Add the rules of the LIBZBD_FAULTS environment variable.
+ */
+static void __attribute__((constructor)) zbd_fault_init(void)
+{
+	const char *spec = getenv("LIBZBD_FAULTS");
+
+	if (spec && *spec)
+		zbd_fault_parse(spec);
+}
@@ -0,0 +1,407 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define ZBD_FP_NOT_ACTIVE	UINT_MAX
+
+/*
+ * Per zone write state.
+ */
+struct zbd_fp_zone {
+	unsigned long long	start;
+	unsigned long long	capacity;
+	unsigned long long	wp;
+	unsigned long long	atime;
+	unsigned int		active_idx;
+	bool			seq;
+	bool			pending;
+	bool			finishing;
+};
+
+struct zbd_fpolicy {
+	int			fd;
+	struct zbd_info		info;
+	struct zbd_fpolicy_params params;
+
+	pthread_mutex_t		lock;
+
+	struct zbd_fp_zone	*zones;
+
+	/* Numbers of the zones being written, i.e. active zones */
+	unsigned int		*active;
+	unsigned int		nr_active;
+	unsigned int		nr_pending;
+
+	struct zbd_fpolicy_stats stats;
+};
+
+static void zbd_fp_activate(struct zbd_fpolicy *fp, unsigned int zno)
+{
+	struct zbd_fp_zone *fpz = &fp->zones[zno];
+
+	if (fpz->active_idx != ZBD_FP_NOT_ACTIVE)
+		return;
+
+	fpz->active_idx = fp->nr_active;
+	fp->active[fp->nr_active++] = zno;
+}
+
+static void zbd_fp_deactivate(struct zbd_fpolicy *fp, unsigned int zno)
+{
+	struct zbd_fp_zone *fpz = &fp->zones[zno];
+	unsigned int last;
+
+	if (fpz->active_idx == ZBD_FP_NOT_ACTIVE)
+		return;
+
+	last = fp->active[--fp->nr_active];
+	fp->active[fpz->active_idx] = last;
+	fp->zones[last].active_idx = fpz->active_idx;
+	fpz->active_idx = ZBD_FP_NOT_ACTIVE;
+
+	if (fpz->pending) {
+		fpz->pending = false;
+		fp->nr_pending--;
+	}
+}
+
+static bool zbd_fp_fill_reached(struct zbd_fpolicy *fp,
+				struct zbd_fp_zone *fpz)
+{
+	unsigned long long written = fpz->wp - fpz->start;
+
+	return fp->params.fill_pct &&
+		written * 100 >= fpz->capacity * fp->params.fill_pct;
+}
+
+/**
+ * zbd_fpolicy_alloc - Allocate a zone finish policy
+ */
+struct zbd_fpolicy *zbd_fpolicy_alloc(int fd,
+				      struct zbd_fpolicy_params *params)
+{
+	struct zbd_zone *zones = NULL;
+	struct zbd_fp_zone *fpz;
+	struct zbd_fpolicy *fp;
+	unsigned long long now;
+	unsigned int i, nz;
+	int ret;
+
+	if (!params || params->fill_pct > 100) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fp = calloc(1, sizeof(struct zbd_fpolicy));
+	if (!fp)
+		return NULL;
+
+	fp->fd = fd;
+	memcpy(&fp->params, params, sizeof(struct zbd_fpolicy_params));
+	ret = zbd_get_info(fd, &fp->info);
+	if (ret) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &zones, &nz);
+	if (ret)
+		goto err;
+	if (nz != fp->info.nr_zones) {
+		errno = EIO;
+		goto err;
+	}
+
+	fp->zones = calloc(nz, sizeof(struct zbd_fp_zone));
+	fp->active = calloc(nz, sizeof(unsigned int));
+	if (!fp->zones || !fp->active)
+		goto err;
+
+	/* Track all zones that are already active */
+	now = zbd_now_ns();
+	for (i = 0; i < nz; i++) {
+		fpz = &fp->zones[i];
+		fpz->start = zbd_zone_start(&zones[i]);
+		fpz->capacity = zbd_zone_capacity(&zones[i]);
+		fpz->wp = zbd_zone_wp(&zones[i]);
+		fpz->atime = now;
+		fpz->seq = zbd_zone_seq(&zones[i]);
+		fpz->active_idx = ZBD_FP_NOT_ACTIVE;
+		if (fpz->seq && zbd_zone_is_active(&zones[i]))
+			zbd_fp_activate(fp, i);
+	}
+
+	free(zones);
+
+	pthread_mutex_init(&fp->lock, NULL);
+
+	return fp;
+
+err:
+	free(zones);
+	free(fp->zones);
+	free(fp->active);
+	free(fp);
+	return NULL;
+}
+
+/**
+ * zbd_fpolicy_free - Free a zone finish policy
+ */
+void zbd_fpolicy_free(struct zbd_fpolicy *fp)
+{
+	if (!fp)
+		return;
+
+	pthread_mutex_destroy(&fp->lock);
+	free(fp->zones);
+	free(fp->active);
+	free(fp);
+}
+
+static int zbd_fp_cmp_zno(const void *a, const void *b)
+{
+	unsigned int za = *(const unsigned int *)a;
+	unsigned int zb = *(const unsigned int *)b;
+
+	return (za > zb) - (za < zb);
+}
+
+/*
+ * Account for the zones of a range that were finished.
+ */
+static void zbd_fp_finished(struct zbd_fpolicy *fp, unsigned int *zno,
+			    unsigned int nr)
+{
+	struct zbd_fp_zone *fpz;
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		fpz = &fp->zones[zno[i]];
+		if (fpz->pending)
+			fp->stats.nr_finished_fill++;
+		else
+			fp->stats.nr_finished_idle++;
+		fp->stats.finished_unwritten_bytes +=
+			fpz->start + fpz->capacity - fpz->wp;
+		fpz->wp = fpz->start + fpz->capacity;
+		fpz->finishing = false;
+		zbd_fp_deactivate(fp, zno[i]);
+	}
+}
+
+/*
+ * Finish zones, issuing a single zone operation for each range of
+ * contiguous zones. zno must be sorted. The zones of a range that failed
+ * to be finished remain active. Returns the number of zones finished.
+ */
+static int zbd_fp_finish(struct zbd_fpolicy *fp, unsigned int *zno,
+			 unsigned int nr)
+{
+	unsigned int i, j, k, nr_finished = 0;
+	int ret, err = 0;
+
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr; j++) {
+			if (zno[j] != zno[j - 1] + 1)
+				break;
+		}
+
+		ret = zbd_finish_zones(fp->fd,
+				       (off_t)zno[i] * fp->info.zone_size,
+				       (off_t)(j - i) * fp->info.zone_size);
+
+		pthread_mutex_lock(&fp->lock);
+		fp->stats.nr_finish_ops++;
+		if (ret) {
+			err = errno;
+			fp->stats.nr_errors++;
+			for (k = i; k < j; k++)
+				fp->zones[zno[k]].finishing = false;
+		} else {
+			zbd_fp_finished(fp, &zno[i], j - i);
+		}
+		pthread_mutex_unlock(&fp->lock);
+
+		if (ret) {
+			zbd_error_fd(fp->fd, err,
+				     "%d: Finish zones %u..%u failed %d (%s)\n",
+				     fp->fd, zno[i], zno[j - 1],
+				     err, strerror(err));
+			continue;
+		}
+
+		nr_finished += j - i;
+		if (fp->params.finish_cb) {
+			for (k = i; k < j; k++)
+				fp->params.finish_cb(fp->fd,
+					(off_t)zno[k] * fp->info.zone_size,
+					fp->params.cb_data);
+		}
+	}
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return nr_finished;
+}
+
+/*
+ * Collect the zones that must be finished and finish them.
+ */
+static int zbd_fp_run(struct zbd_fpolicy *fp, bool idle)
+{
+	unsigned long long now, idle_ns;
+	unsigned int i, nr = 0, *zno;
+	struct zbd_fp_zone *fpz;
+	int ret;
+
+	pthread_mutex_lock(&fp->lock);
+
+	zno = malloc(sizeof(unsigned int) * (fp->nr_active + 1));
+	if (!zno) {
+		pthread_mutex_unlock(&fp->lock);
+		return -1;
+	}
+
+	now = zbd_now_ns();
+	idle_ns = fp->params.idle_ms * 1000000ULL;
+	for (i = 0; i < fp->nr_active; i++) {
+		fpz = &fp->zones[fp->active[i]];
+		if (fpz->finishing)
+			continue;
+		if (fpz->pending ||
+		    (idle && idle_ns && now - fpz->atime >= idle_ns)) {
+			/* The zone is deactivated once finished */
+			fpz->finishing = true;
+			zno[nr++] = fp->active[i];
+		}
+	}
+
+	pthread_mutex_unlock(&fp->lock);
+
+	qsort(zno, nr, sizeof(unsigned int), zbd_fp_cmp_zno);
+	ret = zbd_fp_finish(fp, zno, nr);
+	free(zno);
+
+	return ret;
+}
+
+/**
+ * zbd_fpolicy_update - Account for data written to a zone
+ */
+int zbd_fpolicy_update(struct zbd_fpolicy *fp, off_t ofst, size_t len)
+{
+	struct zbd_fp_zone *fpz;
+	unsigned long long end;
+	unsigned int zno;
+	bool run;
+
+	if (!fp || ofst < 0 ||
+	    (unsigned long long)ofst >= fp->info.nr_sectors << SECTOR_SHIFT) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	zno = ofst / fp->info.zone_size;
+	fpz = &fp->zones[zno];
+	if (!fpz->seq)
+		return 0;
+
+	pthread_mutex_lock(&fp->lock);
+
+	fpz->atime = zbd_now_ns();
+	end = ofst + len;
+	if (end > fpz->wp)
+		fpz->wp = end;
+
+	if (fpz->wp >= fpz->start + fpz->capacity) {
+		/* The zone is full and not active anymore */
+		zbd_fp_deactivate(fp, zno);
+	} else {
+		zbd_fp_activate(fp, zno);
+		if (!fpz->pending && zbd_fp_fill_reached(fp, fpz)) {
+			fpz->pending = true;
+			fp->nr_pending++;
+		}
+	}
+
+	run = fp->nr_pending &&
+		fp->nr_pending >= fp->params.batch_size;
+
+	pthread_mutex_unlock(&fp->lock);
+
+	if (run && zbd_fp_run(fp, false) < 0)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * zbd_fpolicy_reset - Account for a zone reset
+ */
+int zbd_fpolicy_reset(struct zbd_fpolicy *fp, off_t ofst)
+{
+	struct zbd_fp_zone *fpz;
+	unsigned int zno;
+
+	if (!fp || ofst < 0 ||
+	    (unsigned long long)ofst >= fp->info.nr_sectors << SECTOR_SHIFT) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	zno = ofst / fp->info.zone_size;
+	fpz = &fp->zones[zno];
+
+	pthread_mutex_lock(&fp->lock);
+	zbd_fp_deactivate(fp, zno);
+	fpz->wp = fpz->start;
+	fpz->finishing = false;
+	pthread_mutex_unlock(&fp->lock);
+
+	return 0;
+}
+
+/**
+ * zbd_fpolicy_run - Finish zones according to a finish policy
+ */
+int zbd_fpolicy_run(struct zbd_fpolicy *fp)
+{
+	if (!fp) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return zbd_fp_run(fp, true);
+}
+
+/**
+ * zbd_fpolicy_get_stats - Get a finish policy counters
+ */
+int zbd_fpolicy_get_stats(struct zbd_fpolicy *fp,
+			  struct zbd_fpolicy_stats *stats)
+{
+	if (!fp || !stats) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&fp->lock);
+	memcpy(stats, &fp->stats, sizeof(struct zbd_fpolicy_stats));
+	stats->nr_active_zones = fp->nr_active;
+	pthread_mutex_unlock(&fp->lock);
+
+	return 0;
+}
@@ -0,0 +1,463 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+/*
+ * Number of valid ratio buckets. Zones in bucket b have a valid data ratio
+ * in the range [b / ZBD_GC_NR_BUCKETS, (b + 1) / ZBD_GC_NR_BUCKETS[, with
+ * the last bucket also holding zones with all data valid.
+ */
+#define ZBD_GC_NR_BUCKETS	256
+#define ZBD_GC_BITMAP_LEN	(ZBD_GC_NR_BUCKETS / 64)
+
+#define ZBD_GC_NONE		UINT_MAX
+
+/*
+ * Per zone GC information.
+ */
+struct zbd_gc_zone {
+	unsigned long long	capacity;
+	unsigned long long	written;
+	unsigned long long	valid;
+	unsigned long long	mtime;
+	unsigned int		bucket;
+	unsigned int		prev;
+	unsigned int		next;
+	bool			tracked;
+	bool			candidate;
+};
+
+/*
+ * Zones of a bucket are kept in a list ordered by modification time:
+ * a modified zone is always moved to the tail of its bucket list, so
+ * that the head of a bucket list is the oldest zone of the bucket.
+ */
+struct zbd_gc_bucket {
+	unsigned int		head;
+	unsigned int		tail;
+};
+
+struct zbd_gc_index {
+	unsigned int		nr_zones;
+	struct zbd_gc_zone	*zones;
+	struct zbd_gc_bucket	buckets[ZBD_GC_NR_BUCKETS];
+	uint64_t		bitmap[ZBD_GC_BITMAP_LEN];
+};
+
+static unsigned int zbd_gc_bucket(struct zbd_gc_zone *gcz)
+{
+	unsigned long long b;
+
+	b = gcz->valid * ZBD_GC_NR_BUCKETS / gcz->capacity;
+	if (b >= ZBD_GC_NR_BUCKETS)
+		b = ZBD_GC_NR_BUCKETS - 1;
+
+	return b;
+}
+
+static void zbd_gc_bucket_add(struct zbd_gc_index *idx, unsigned int zno)
+{
+	struct zbd_gc_zone *gcz = &idx->zones[zno];
+	struct zbd_gc_bucket *bkt;
+
+	gcz->bucket = zbd_gc_bucket(gcz);
+	bkt = &idx->buckets[gcz->bucket];
+
+	gcz->next = ZBD_GC_NONE;
+	gcz->prev = bkt->tail;
+	if (bkt->tail == ZBD_GC_NONE)
+		bkt->head = zno;
+	else
+		idx->zones[bkt->tail].next = zno;
+	bkt->tail = zno;
+
+	idx->bitmap[gcz->bucket / 64] |= 1ULL << (gcz->bucket % 64);
+}
+
+static void zbd_gc_bucket_del(struct zbd_gc_index *idx, unsigned int zno)
+{
+	struct zbd_gc_zone *gcz = &idx->zones[zno];
+	struct zbd_gc_bucket *bkt = &idx->buckets[gcz->bucket];
+
+	if (gcz->prev == ZBD_GC_NONE)
+		bkt->head = gcz->next;
+	else
+		idx->zones[gcz->prev].next = gcz->next;
+
+	if (gcz->next == ZBD_GC_NONE)
+		bkt->tail = gcz->prev;
+	else
+		idx->zones[gcz->next].prev = gcz->prev;
+
+	if (bkt->head == ZBD_GC_NONE)
+		idx->bitmap[gcz->bucket / 64] &= ~(1ULL << (gcz->bucket % 64));
+
+	gcz->prev = ZBD_GC_NONE;
+	gcz->next = ZBD_GC_NONE;
+}
+
+/*
+ * Get the first non-empty bucket at or after bucket b.
+ */
+static unsigned int zbd_gc_next_bucket(struct zbd_gc_index *idx,
+				       unsigned int b)
+{
+	unsigned int i = b / 64;
+	uint64_t bits;
+
+	if (b >= ZBD_GC_NR_BUCKETS)
+		return ZBD_GC_NONE;
+
+	bits = idx->bitmap[i] & (~0ULL << (b % 64));
+	while (!bits) {
+		if (++i >= ZBD_GC_BITMAP_LEN)
+			return ZBD_GC_NONE;
+		bits = idx->bitmap[i];
+	}
+
+	return i * 64 + __builtin_ctzll(bits);
+}
+
+static struct zbd_gc_zone *zbd_gc_get_zone(struct zbd_gc_index *idx,
+					   unsigned int zno)
+{
+	if (!idx || zno >= idx->nr_zones || !idx->zones[zno].tracked) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return &idx->zones[zno];
+}
+
+/*
+ * Update a zone valid and written byte counts and requeue the zone.
+ */
+static void zbd_gc_update(struct zbd_gc_index *idx, unsigned int zno,
+			  unsigned long long written, unsigned long long valid,
+			  bool candidate)
+{
+	struct zbd_gc_zone *gcz = &idx->zones[zno];
+
+	if (gcz->candidate)
+		zbd_gc_bucket_del(idx, zno);
+
+	gcz->written = written;
+	gcz->valid = valid;
+	gcz->mtime = zbd_now_ns();
+	gcz->candidate = candidate;
+
+	if (gcz->candidate)
+		zbd_gc_bucket_add(idx, zno);
+}
+
+/**
+ * zbd_gc_index_alloc - Allocate a GC victim selection index
+ */
+struct zbd_gc_index *zbd_gc_index_alloc(struct zbd_zone *zones,
+					unsigned int nr_zones)
+{
+	struct zbd_gc_index *idx;
+	struct zbd_gc_zone *gcz;
+	struct zbd_zone *z;
+	unsigned int i;
+
+	if (!zones || !nr_zones) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	idx = calloc(1, sizeof(struct zbd_gc_index));
+	if (!idx)
+		return NULL;
+
+	idx->zones = calloc(nr_zones, sizeof(struct zbd_gc_zone));
+	if (!idx->zones) {
+		free(idx);
+		return NULL;
+	}
+	idx->nr_zones = nr_zones;
+
+	for (i = 0; i < ZBD_GC_NR_BUCKETS; i++) {
+		idx->buckets[i].head = ZBD_GC_NONE;
+		idx->buckets[i].tail = ZBD_GC_NONE;
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		z = &zones[i];
+		gcz = &idx->zones[i];
+		gcz->prev = ZBD_GC_NONE;
+		gcz->next = ZBD_GC_NONE;
+
+		/*
+		 * Only sequential zones that can be written are tracked.
+		 * Data already written in a zone is assumed to be valid.
+		 */
+		if (!zbd_zone_seq(z) || zbd_zone_offline(z) ||
+		    zbd_zone_rdonly(z) || !zbd_zone_capacity(z))
+			continue;
+
+		gcz->tracked = true;
+		gcz->capacity = zbd_zone_capacity(z);
+		if (zbd_zone_full(z))
+			gcz->written = gcz->capacity;
+		else
+			gcz->written = zbd_zone_wp(z) - zbd_zone_start(z);
+		zbd_gc_update(idx, i, gcz->written, gcz->written,
+			      zbd_zone_full(z));
+	}
+
+	return idx;
+}
+
+/**
+ * zbd_gc_index_free - Free a GC victim selection index
+ */
+void zbd_gc_index_free(struct zbd_gc_index *idx)
+{
+	if (!idx)
+		return;
+
+	free(idx->zones);
+	free(idx);
+}
+
+/**
+ * zbd_gc_index_write - Account for data written to a zone
+ */
+int zbd_gc_index_write(struct zbd_gc_index *idx, unsigned int zno,
+		       unsigned long long len)
+{
+	struct zbd_gc_zone *gcz = zbd_gc_get_zone(idx, zno);
+	unsigned long long written;
+
+	if (!gcz)
+		return -1;
+
+	written = gcz->written + len;
+	if (written > gcz->capacity) {
+		zbd_error("GC index: zone %u write of %llu B overflows capacity\n",
+			  zno, len);
+		errno = EINVAL;
+		return -1;
+	}
+
+	zbd_gc_update(idx, zno, written, gcz->valid + len,
+		      gcz->candidate || written == gcz->capacity);
+
+	return 0;
+}
+
+/**
+ * zbd_gc_index_invalidate - Account for invalidated data of a zone
+ */
+int zbd_gc_index_invalidate(struct zbd_gc_index *idx, unsigned int zno,
+			    unsigned long long len)
+{
+	struct zbd_gc_zone *gcz = zbd_gc_get_zone(idx, zno);
+
+	if (!gcz)
+		return -1;
+
+	if (len > gcz->valid) {
+		zbd_error("GC index: zone %u invalidation of %llu B exceeds %llu B of valid data\n",
+			  zno, len, gcz->valid);
+		errno = EINVAL;
+		return -1;
+	}
+
+	zbd_gc_update(idx, zno, gcz->written, gcz->valid - len,
+		      gcz->candidate);
+
+	return 0;
+}
+
+/**
+ * zbd_gc_index_finish - Make a zone a GC victim candidate
+ */
+int zbd_gc_index_finish(struct zbd_gc_index *idx, unsigned int zno)
+{
+	struct zbd_gc_zone *gcz = zbd_gc_get_zone(idx, zno);
+
+	if (!gcz)
+		return -1;
+
+	if (!gcz->candidate)
+		zbd_gc_update(idx, zno, gcz->written, gcz->valid, true);
+
+	return 0;
+}
+
+/**
+ * zbd_gc_index_reset - Account for a zone reset
+ */
+int zbd_gc_index_reset(struct zbd_gc_index *idx, unsigned int zno)
+{
+	struct zbd_gc_zone *gcz = zbd_gc_get_zone(idx, zno);
+
+	if (!gcz)
+		return -1;
+
+	zbd_gc_update(idx, zno, 0, 0, false);
+
+	return 0;
+}
+
+/**
+ * zbd_gc_index_get_zone - Get a zone valid data and age
+ */
+int zbd_gc_index_get_zone(struct zbd_gc_index *idx, unsigned int zno,
+			  unsigned long long *valid, unsigned long long *age_ms)
+{
+	struct zbd_gc_zone *gcz = zbd_gc_get_zone(idx, zno);
+
+	if (!gcz)
+		return -1;
+
+	if (valid)
+		*valid = gcz->valid;
+	if (age_ms)
+		*age_ms = (zbd_now_ns() - gcz->mtime) / 1000000ULL;
+
+	return 0;
+}
+
+/*
+ * Greedy selection: zones with the lowest valid ratio first, and for zones
+ * in the same bucket, the oldest zones first.
+ */
+static unsigned int zbd_gc_greedy(struct zbd_gc_index *idx,
+				  unsigned int *znos, unsigned int nr)
+{
+	unsigned int b, zno, n = 0;
+
+	b = zbd_gc_next_bucket(idx, 0);
+	while (b != ZBD_GC_NONE && n < nr) {
+		zno = idx->buckets[b].head;
+		while (zno != ZBD_GC_NONE && n < nr) {
+			znos[n++] = zno;
+			zno = idx->zones[zno].next;
+		}
+		b = zbd_gc_next_bucket(idx, b + 1);
+	}
+
+	return n;
+}
+
+/*
+ * Cost-benefit score of a zone: (1 - u) * age / (1 + u), with u the zone
+ * valid data ratio.
+ */
+static double zbd_gc_cb_score(struct zbd_gc_zone *gcz,
+			      unsigned long long now)
+{
+	double u = (double)gcz->valid / (double)gcz->capacity;
+
+	return (1.0 - u) * (double)(now - gcz->mtime) / (1.0 + u);
+}
+
+struct zbd_gc_heap_ent {
+	double			score;
+	unsigned int		zno;
+};
+
+static void zbd_gc_heap_down(struct zbd_gc_heap_ent *heap, unsigned int n,
+			     unsigned int i)
+{
+	struct zbd_gc_heap_ent tmp;
+	unsigned int l, r, m;
+
+	for (;;) {
+		l = 2 * i + 1;
+		r = l + 1;
+		m = i;
+		if (l < n && heap[l].score > heap[m].score)
+			m = l;
+		if (r < n && heap[r].score > heap[m].score)
+			m = r;
+		if (m == i)
+			return;
+		tmp = heap[i];
+		heap[i] = heap[m];
+		heap[m] = tmp;
+		i = m;
+	}
+}
+
+/*
+ * Cost-benefit selection. Within a bucket, zones have about the same valid
+ * ratio and are ordered by age, so the best candidate of a bucket is always
+ * its head. A max-heap of the bucket heads gives the top-k zones with
+ * O(k log(nr buckets)) operations.
+ */
+static unsigned int zbd_gc_cost_benefit(struct zbd_gc_index *idx,
+					unsigned int *znos, unsigned int nr)
+{
+	struct zbd_gc_heap_ent heap[ZBD_GC_NR_BUCKETS];
+	unsigned long long now = zbd_now_ns();
+	unsigned int b, zno, nh = 0, n = 0;
+	int i;
+
+	b = zbd_gc_next_bucket(idx, 0);
+	while (b != ZBD_GC_NONE) {
+		zno = idx->buckets[b].head;
+		heap[nh].zno = zno;
+		heap[nh].score = zbd_gc_cb_score(&idx->zones[zno], now);
+		nh++;
+		b = zbd_gc_next_bucket(idx, b + 1);
+	}
+
+	for (i = nh / 2 - 1; i >= 0; i--)
+		zbd_gc_heap_down(heap, nh, i);
+
+	while (nh && n < nr) {
+		zno = heap[0].zno;
+		znos[n++] = zno;
+
+		zno = idx->zones[zno].next;
+		if (zno != ZBD_GC_NONE) {
+			heap[0].zno = zno;
+			heap[0].score = zbd_gc_cb_score(&idx->zones[zno], now);
+		} else {
+			heap[0] = heap[--nh];
+		}
+		zbd_gc_heap_down(heap, nh, 0);
+	}
+
+	return n;
+}
+
+/**
+ * zbd_gc_index_get_victims - Get the best GC victim zones
+ */
+int zbd_gc_index_get_victims(struct zbd_gc_index *idx,
+			     enum zbd_gc_policy policy,
+			     unsigned int *znos, unsigned int *nr_zones)
+{
+	if (!idx || !znos || !nr_zones) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch (policy) {
+	case ZBD_GC_GREEDY:
+		*nr_zones = zbd_gc_greedy(idx, znos, *nr_zones);
+		break;
+	case ZBD_GC_COST_BENEFIT:
+		*nr_zones = zbd_gc_cost_benefit(idx, znos, *nr_zones);
+		break;
+	default:
+		zbd_error("Invalid GC policy %d\n", policy);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,496 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+ * Maximum length of a message queued in a ring buffer and of a message
+ * formatted without memory allocation, including the terminating null byte.
+ */
+#define ZBD_LOG_MSG_MAX		256
+
+/*
+ * Number of messages of a thread ring buffer (must be a power of 2) and
+ * period in milli-seconds of the drain thread.
+ */
+#define ZBD_LOG_RING_SIZE	128
+#define ZBD_LOG_DRAIN_MS	10
+
+struct zbd_log_slot {
+	enum zbd_log_level	level;
+	int			fd;
+	int			err;
+	unsigned long long	time_ns;
+	const char		*func;
+	char			msg[ZBD_LOG_MSG_MAX];
+};
+
+/*
+ * Per thread ring buffer. The thread generating messages is the only
+ * producer, advancing head. The drain thread, or a thread flushing
+ * messages, is the only consumer, advancing tail with the drain lock held.
+ * The producer sets busy while checking the asynchronous mode and queueing
+ * a message, so that the asynchronous mode can be stopped without the
+ * producer taking any lock.
+ */
+struct zbd_log_ring {
+	struct zbd_log_ring	*next;
+	pid_t			tid;
+	bool			dead;
+	bool			busy;
+	unsigned int		head;
+	unsigned int		tail __attribute__((aligned(64)));
+	struct zbd_log_slot	slots[ZBD_LOG_RING_SIZE];
+};
+
+/*
+ * Log handler configuration. The handler and its data are changed with
+ * zbd_log_cfg_lock held for writing and the drain lock held, and copied with
+ * zbd_log_cfg_lock held for reading by threads calling the handler
+ * synchronously. Configuration changes are serialized with zbd_log_set_lock.
+ * The configuration lock must be taken before the drain lock.
+ */
+static pthread_mutex_t zbd_log_set_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t zbd_log_cfg_lock = PTHREAD_RWLOCK_INITIALIZER;
+static zbd_log_handler_t zbd_log_handler;
+static void *zbd_log_data;
+static bool zbd_log_async;
+
+/*
+ * Asynchronous logging state.
+ */
+static pthread_mutex_t zbd_log_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t zbd_log_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zbd_log_ring *zbd_log_rings;
+static unsigned long long zbd_log_dropped;
+static pthread_t zbd_log_thread;
+static bool zbd_log_thread_run;
+static sem_t zbd_log_sem;
+
+static pthread_once_t zbd_log_once = PTHREAD_ONCE_INIT;
+static pthread_key_t zbd_log_key;
+static __thread struct zbd_log_ring *zbd_log_ring;
+static __thread pid_t zbd_log_tid;
+static __thread bool zbd_log_draining;
+
+static pid_t zbd_log_gettid(void)
+{
+	if (!zbd_log_tid)
+		zbd_log_tid = syscall(SYS_gettid);
+
+	return zbd_log_tid;
+}
+
+/*
+ * Default handler: print messages to stderr (errors) or stdout.
+ */
+static void zbd_log_default_handler(const struct zbd_log_record *rec,
+				    void *data)
+{
+	if (rec->level == ZBD_LOG_ERROR)
+		zbd_print(stderr, "(libzbd) [ERROR] %s\n", rec->msg);
+	else
+		zbd_print(stdout, "(libzbd) %s\n", rec->msg);
+}
+
+static void zbd_log_call_handler(zbd_log_handler_t handler, void *data,
+				 const struct zbd_log_record *rec)
+{
+	if (handler)
+		handler(rec, data);
+	else
+		zbd_log_default_handler(rec, data);
+}
+
+static void zbd_log_ring_exit(void *ring)
+{
+	/* The ring is freed by the consumer once drained */
+	zbd_log_ring = NULL;
+	__atomic_store_n(&((struct zbd_log_ring *)ring)->dead, true,
+			 __ATOMIC_RELEASE);
+}
+
+static void zbd_log_init(void)
+{
+	pthread_key_create(&zbd_log_key, zbd_log_ring_exit);
+	sem_init(&zbd_log_sem, 0, 0);
+}
+
+static struct zbd_log_ring *zbd_log_get_ring(void)
+{
+	struct zbd_log_ring *ring = zbd_log_ring;
+
+	if (ring)
+		return ring;
+
+	pthread_once(&zbd_log_once, zbd_log_init);
+
+	ring = calloc(1, sizeof(struct zbd_log_ring));
+	if (!ring)
+		return NULL;
+	ring->tid = zbd_log_gettid();
+	pthread_setspecific(zbd_log_key, ring);
+
+	pthread_mutex_lock(&zbd_log_rings_lock);
+	ring->next = zbd_log_rings;
+	zbd_log_rings = ring;
+	pthread_mutex_unlock(&zbd_log_rings_lock);
+
+	zbd_log_ring = ring;
+
+	return ring;
+}
+
+/*
+ * Remove trailing new lines of a message.
+ */
+static void zbd_log_strip(char *msg)
+{
+	size_t len = strlen(msg);
+
+	while (len && msg[len - 1] == '\n')
+		msg[--len] = '\0';
+}
+
+static unsigned long long zbd_log_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Queue a message in the calling thread ring buffer. The asynchronous mode
+ * is checked again with the ring marked busy: zbd_log_stop_async() clears
+ * the asynchronous mode and then waits for all rings not to be busy before
+ * its last drain, so either the message is queued before that drain, or
+ * the asynchronous mode stop is seen here. Returns -1 in the latter case,
+ * for the message to be delivered synchronously, and 0 otherwise.
+ */
+static int zbd_log_queue(enum zbd_log_level level, int fd, int err,
+			 const char *func, const char *format, va_list ap)
+{
+	struct zbd_log_ring *ring = zbd_log_get_ring();
+	struct zbd_log_slot *slot;
+	unsigned int head, tail;
+
+	if (!ring) {
+		__atomic_fetch_add(&zbd_log_dropped, 1, __ATOMIC_RELAXED);
+		return 0;
+	}
+
+	__atomic_store_n(&ring->busy, true, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&zbd_log_async, __ATOMIC_SEQ_CST)) {
+		__atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= ZBD_LOG_RING_SIZE) {
+		__atomic_fetch_add(&zbd_log_dropped, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+		return 0;
+	}
+
+	slot = &ring->slots[head & (ZBD_LOG_RING_SIZE - 1)];
+	slot->level = level;
+	slot->fd = fd;
+	slot->err = err;
+	slot->time_ns = __atomic_load_n(&zbd_log_handler, __ATOMIC_RELAXED) ?
+		zbd_log_time_ns() : 0;
+	slot->func = func;
+	vsnprintf(slot->msg, ZBD_LOG_MSG_MAX, format, ap);
+	zbd_log_strip(slot->msg);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+
+	/* Wake up the drain thread early if the ring is filling up */
+	if (head + 1 - tail == ZBD_LOG_RING_SIZE / 2)
+		sem_post(&zbd_log_sem);
+
+	return 0;
+}
+
+/*
+ * Wait for the threads queueing a message to be done. Rings added after
+ * the asynchronous mode was cleared cannot be used to queue messages.
+ */
+static void zbd_log_wait_rings(void)
+{
+	struct zbd_log_ring *ring;
+
+	pthread_mutex_lock(&zbd_log_rings_lock);
+	for (ring = zbd_log_rings; ring; ring = ring->next) {
+		while (__atomic_load_n(&ring->busy, __ATOMIC_SEQ_CST))
+			sched_yield();
+	}
+	pthread_mutex_unlock(&zbd_log_rings_lock);
+}
+
+/*
+ * Deliver the messages of all ring buffers. Called with the drain lock held.
+ * New rings are only added at the head of the
+ * ring list, so the list is walked without the rings lock, which is needed
+ * only to remove the rings of exited threads.
+ */
+static void zbd_log_drain(void)
+{
+	struct zbd_log_ring *ring, *next, **prev;
+	struct zbd_log_record rec;
+	struct zbd_log_slot *slot;
+	unsigned int head, tail;
+	unsigned long long dropped;
+	char msg[64];
+	bool dead;
+
+	zbd_log_draining = true;
+
+	pthread_mutex_lock(&zbd_log_rings_lock);
+	ring = zbd_log_rings;
+	pthread_mutex_unlock(&zbd_log_rings_lock);
+
+	while (ring) {
+		dead = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+		for (tail = ring->tail; tail != head; tail++) {
+			slot = &ring->slots[tail & (ZBD_LOG_RING_SIZE - 1)];
+			rec.level = slot->level;
+			rec.fd = slot->fd;
+			rec.err = slot->err;
+			rec.tid = ring->tid;
+			rec.time_ns = slot->time_ns;
+			rec.func = slot->func;
+			rec.msg = slot->msg;
+			zbd_log_call_handler(zbd_log_handler, zbd_log_data,
+					     &rec);
+		}
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+		next = ring->next;
+		if (dead) {
+			pthread_mutex_lock(&zbd_log_rings_lock);
+			for (prev = &zbd_log_rings; *prev != ring;
+			     prev = &(*prev)->next)
+				;
+			*prev = next;
+			pthread_mutex_unlock(&zbd_log_rings_lock);
+			free(ring);
+		}
+		ring = next;
+	}
+
+	dropped = __atomic_exchange_n(&zbd_log_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		snprintf(msg, sizeof(msg), "%llu log messages dropped",
+			 dropped);
+		memset(&rec, 0, sizeof(rec));
+		rec.level = ZBD_LOG_ERROR;
+		rec.fd = -1;
+		rec.tid = zbd_log_gettid();
+		rec.time_ns = zbd_log_handler ? zbd_log_time_ns() : 0;
+		rec.func = __func__;
+		rec.msg = msg;
+		zbd_log_call_handler(zbd_log_handler, zbd_log_data, &rec);
+	}
+
+	zbd_log_draining = false;
+}
+
+static void *zbd_log_drain_thread(void *arg)
+{
+	struct timespec ts;
+	bool run;
+
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += ZBD_LOG_DRAIN_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		sem_timedwait(&zbd_log_sem, &ts);
+
+		pthread_mutex_lock(&zbd_log_drain_lock);
+		zbd_log_drain();
+		run = zbd_log_thread_run;
+		pthread_mutex_unlock(&zbd_log_drain_lock);
+		if (!run)
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Stop the drain thread, delivering all pending messages. Called with the
+ * set lock held.
+ */
+static void zbd_log_stop_async(void)
+{
+	if (!zbd_log_async)
+		return;
+
+	__atomic_store_n(&zbd_log_async, false, __ATOMIC_SEQ_CST);
+	zbd_log_wait_rings();
+
+	pthread_mutex_lock(&zbd_log_drain_lock);
+	zbd_log_thread_run = false;
+	pthread_mutex_unlock(&zbd_log_drain_lock);
+	sem_post(&zbd_log_sem);
+	pthread_join(zbd_log_thread, NULL);
+
+	pthread_mutex_lock(&zbd_log_drain_lock);
+	zbd_log_drain();
+	pthread_mutex_unlock(&zbd_log_drain_lock);
+}
+
+/**
+ * zbd_set_log_handler - Set the library log message handler
+ */
+int zbd_set_log_handler(zbd_log_handler_t handler, void *data,
+			unsigned int flags)
+{
+	int ret = 0;
+
+	if (flags & ~ZBD_LOG_ASYNC) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Called from an asynchronous handler */
+	if (zbd_log_draining) {
+		errno = EDEADLK;
+		return -1;
+	}
+
+	pthread_once(&zbd_log_once, zbd_log_init);
+
+	pthread_mutex_lock(&zbd_log_set_lock);
+
+	zbd_log_stop_async();
+
+	pthread_rwlock_wrlock(&zbd_log_cfg_lock);
+	pthread_mutex_lock(&zbd_log_drain_lock);
+	__atomic_store_n(&zbd_log_handler, handler, __ATOMIC_RELAXED);
+	zbd_log_data = data;
+	pthread_mutex_unlock(&zbd_log_drain_lock);
+	pthread_rwlock_unlock(&zbd_log_cfg_lock);
+
+	if (flags & ZBD_LOG_ASYNC) {
+		zbd_log_thread_run = true;
+		ret = pthread_create(&zbd_log_thread, NULL,
+				     zbd_log_drain_thread, NULL);
+		if (ret) {
+			errno = ret;
+			ret = -1;
+		} else {
+			__atomic_store_n(&zbd_log_async, true,
+					 __ATOMIC_SEQ_CST);
+		}
+	}
+
+	pthread_mutex_unlock(&zbd_log_set_lock);
+
+	return ret;
+}
+
+/**
+ * zbd_log_flush - Deliver pending log messages
+ */
+void zbd_log_flush(void)
+{
+	/* Called from an asynchronous handler: messages are being delivered */
+	if (zbd_log_draining)
+		return;
+
+	pthread_mutex_lock(&zbd_log_drain_lock);
+	if (__atomic_load_n(&zbd_log_async, __ATOMIC_ACQUIRE))
+		zbd_log_drain();
+	pthread_mutex_unlock(&zbd_log_drain_lock);
+}
+
+/*
+ * Deliver pending messages when the library is unloaded.
+ */
+static void __attribute__((destructor)) zbd_log_exit(void)
+{
+	pthread_mutex_lock(&zbd_log_set_lock);
+	zbd_log_stop_async();
+	pthread_mutex_unlock(&zbd_log_set_lock);
+}
+
+/*
+ * Generate a log message. In asynchronous mode, messages are queued without
+ * taking any lock. Otherwise, the handler is called without any lock held
+ * so that it can change the handler or flush messages.
+ */
+void zbd_log(enum zbd_log_level level, int fd, int err, const char *func,
+	     const char *format, ...)
+{
+	int len, saved_errno = errno;
+	struct zbd_log_record rec;
+	char buf[ZBD_LOG_MSG_MAX];
+	zbd_log_handler_t handler;
+	char *msg = buf;
+	va_list ap, aq;
+	void *data;
+
+	va_start(ap, format);
+
+	if (__atomic_load_n(&zbd_log_async, __ATOMIC_RELAXED) &&
+	    !zbd_log_queue(level, fd, err, func, format, ap))
+		goto out;
+
+	pthread_rwlock_rdlock(&zbd_log_cfg_lock);
+	handler = zbd_log_handler;
+	data = zbd_log_data;
+	pthread_rwlock_unlock(&zbd_log_cfg_lock);
+
+	/* Format long messages in an allocated buffer */
+	va_copy(aq, ap);
+	len = vsnprintf(buf, sizeof(buf), format, aq);
+	va_end(aq);
+	if (len >= (int)sizeof(buf)) {
+		msg = malloc(len + 1);
+		if (msg)
+			vsnprintf(msg, len + 1, format, ap);
+		else
+			msg = buf;
+	}
+	zbd_log_strip(msg);
+
+	rec.level = level;
+	rec.fd = fd;
+	rec.err = err;
+	rec.tid = zbd_log_gettid();
+	rec.time_ns = handler ? zbd_log_time_ns() : 0;
+	rec.func = func;
+	rec.msg = msg;
+
+	zbd_log_call_handler(handler, data, &rec);
+
+	if (msg != buf)
+		free(msg);
+
+out:
+	va_end(ap);
+
+	errno = saved_errno;
+}
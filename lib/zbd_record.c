@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+/*
+ * Call trace file buffer size.
+ */
+#define ZBD_REC_BUF_SIZE	(64 * 1024)
+
+/*
+ * Call trace file. Records are appended with the lock held, and buffered
+ * so that recording a call does not add a system call.
+ */
+static pthread_mutex_t zbd_rec_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *zbd_rec_file;
+static unsigned long long zbd_rec_start_ns;
+int zbd_rec_active;
+
+static __thread pid_t zbd_rec_tid;
+
+/*
+ * Record a library call that started at the time start.
+ */
+void zbd_rec(enum zbd_rec_type type, int fd, unsigned int op,
+	     unsigned long long ofst, unsigned long long len,
+	     unsigned int nr_zones, int ret, unsigned long long start)
+{
+	unsigned long long now = zbd_now_ns();
+	int err = ret < 0 ? errno : 0;
+	struct zbd_rec rec;
+
+	if (!zbd_rec_tid)
+		zbd_rec_tid = syscall(SYS_gettid);
+
+	memset(&rec, 0, sizeof(struct zbd_rec));
+	rec.lat_ns = now - start;
+	rec.ofst = ofst;
+	rec.len = len;
+	rec.nr_zones = nr_zones;
+	rec.ret = ret;
+	rec.fd = fd;
+	rec.type = type;
+	rec.op = op;
+	rec.err = err;
+	rec.tid = zbd_rec_tid;
+
+	pthread_mutex_lock(&zbd_rec_lock);
+	if (zbd_rec_file) {
+		if (start > zbd_rec_start_ns)
+			rec.time_ns = start - zbd_rec_start_ns;
+		fwrite(&rec, sizeof(struct zbd_rec), 1, zbd_rec_file);
+	}
+	pthread_mutex_unlock(&zbd_rec_lock);
+
+	errno = err;
+}
+
+/**
+ * zbd_record_start - Start recording library calls
+ */
+int zbd_record_start(const char *path)
+{
+	struct zbd_rec_hdr hdr;
+	struct timespec ts;
+	FILE *f;
+
+	if (!path) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&zbd_rec_lock);
+
+	if (zbd_rec_file) {
+		pthread_mutex_unlock(&zbd_rec_lock);
+		zbd_error("Call recording already started\n");
+		errno = EBUSY;
+		return -1;
+	}
+
+	f = fopen(path, "w");
+	if (!f) {
+		pthread_mutex_unlock(&zbd_rec_lock);
+		zbd_error("Create call trace file %s failed %d (%s)\n",
+			  path, errno, strerror(errno));
+		return -1;
+	}
+	setvbuf(f, NULL, _IOFBF, ZBD_REC_BUF_SIZE);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memset(&hdr, 0, sizeof(struct zbd_rec_hdr));
+	memcpy(hdr.magic, ZBD_REC_MAGIC, sizeof(hdr.magic));
+	hdr.version = ZBD_REC_VERSION;
+	hdr.rec_size = sizeof(struct zbd_rec);
+	hdr.start_time_ns = (unsigned long long)ts.tv_sec * 1000000000ULL +
+		ts.tv_nsec;
+	if (fwrite(&hdr, sizeof(struct zbd_rec_hdr), 1, f) != 1) {
+		pthread_mutex_unlock(&zbd_rec_lock);
+		zbd_error("Write call trace file %s failed %d (%s)\n",
+			  path, errno, strerror(errno));
+		fclose(f);
+		return -1;
+	}
+
+	zbd_rec_file = f;
+	zbd_rec_start_ns = zbd_now_ns();
+	__atomic_store_n(&zbd_rec_active, 1, __ATOMIC_RELEASE);
+
+	pthread_mutex_unlock(&zbd_rec_lock);
+
+	return 0;
+}
+
+/**
+ * zbd_record_stop - Stop recording library calls
+ */
+int zbd_record_stop(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&zbd_rec_lock);
+
+	__atomic_store_n(&zbd_rec_active, 0, __ATOMIC_RELEASE);
+	if (zbd_rec_file) {
+		if (ferror(zbd_rec_file))
+			ret = -1;
+		if (fclose(zbd_rec_file))
+			ret = -1;
+		zbd_rec_file = NULL;
+		if (ret)
+			zbd_error("Write call trace file failed\n");
+	}
+
+	pthread_mutex_unlock(&zbd_rec_lock);
+
+	return ret;
+}
+
+/*
+ * Start recording to the file specified with the LIBZBD_RECORD environment
+ * variable.
+ */
+static void __attribute__((constructor)) zbd_record_init(void)
+{
+	const char *path = getenv("LIBZBD_RECORD");
+
+	if (path && *path)
+		zbd_record_start(path);
+}
+
+static void __attribute__((destructor)) zbd_record_exit(void)
+{
+	zbd_record_stop();
+}
@@ -0,0 +1,295 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+
+#define ZBD_RSTREAM_DEFAULT_RA_SIZE	(1024 * 1024)
+
+struct zbd_rstream {
+	int			fd;
+	int			rfd;
+	unsigned int		flags;
+	struct zbd_info		info;
+	size_t			align;
+
+	/* Cached information of the zone last read */
+	struct zbd_zone		zone;
+	bool			zone_valid;
+
+	/* Readahead buffer */
+	void			*ra_buf;
+	size_t			ra_size;
+	unsigned long long	ra_ofst;
+	size_t			ra_len;
+
+	/* End offset of the last read, to detect sequential reads */
+	unsigned long long	next_ofst;
+};
+
+/*
+ * End of the readable data of a zone: the write pointer position for
+ * sequential zones that are not full, the zone capacity otherwise.
+ */
+static unsigned long long zbd_rstream_data_end(struct zbd_zone *z)
+{
+	if (zbd_zone_seq(z) && !zbd_zone_full(z))
+		return zbd_zone_wp(z);
+
+	return zbd_zone_start(z) + zbd_zone_capacity(z);
+}
+
+static int zbd_rstream_get_zone(struct zbd_rstream *rs, unsigned long long ofst)
+{
+	unsigned long long old_start = zbd_zone_start(&rs->zone);
+	unsigned int old_cond = zbd_zone_cond(&rs->zone);
+	bool was_valid = rs->zone_valid;
+	unsigned int nz = 1;
+	int ret;
+
+	rs->zone_valid = false;
+	ret = zbd_report_zones(rs->fd, ofst, rs->info.zone_size, ZBD_RO_ALL,
+			       &rs->zone, &nz);
+	if (ret || nz != 1) {
+		rs->ra_len = 0;
+		if (!ret)
+			errno = EIO;
+		return -1;
+	}
+	rs->zone_valid = true;
+
+	/*
+	 * The readahead data is only valid for the zone it was read from,
+	 * as long as the zone was not reset, that is, if the zone condition
+	 * did not change and the data read ahead is still below the end of
+	 * the zone readable data.
+	 */
+	if (!was_valid || zbd_zone_start(&rs->zone) != old_start ||
+	    zbd_zone_cond(&rs->zone) != old_cond ||
+	    rs->ra_ofst + rs->ra_len > zbd_rstream_data_end(&rs->zone))
+		rs->ra_len = 0;
+
+	return 0;
+}
+
+/**
+ * zbd_rstream_alloc - Allocate a zone read stream
+ */
+struct zbd_rstream *zbd_rstream_alloc(int fd, size_t ra_size,
+				      unsigned int flags)
+{
+	struct zbd_rstream *rs;
+	char path[64];
+	int ret;
+
+	rs = calloc(1, sizeof(struct zbd_rstream));
+	if (!rs)
+		return NULL;
+
+	rs->fd = fd;
+	rs->rfd = fd;
+	rs->flags = flags;
+	ret = zbd_get_info(fd, &rs->info);
+	if (ret) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	/* Readahead is done in units of the device physical block size */
+	rs->align = sysconf(_SC_PAGESIZE);
+	if (rs->info.pblock_size > rs->align)
+		rs->align = rs->info.pblock_size;
+	if (!ra_size)
+		ra_size = ZBD_RSTREAM_DEFAULT_RA_SIZE;
+	rs->ra_size = (ra_size + rs->align - 1) & ~(rs->align - 1);
+
+	ret = posix_memalign(&rs->ra_buf, rs->align, rs->ra_size);
+	if (ret) {
+		rs->ra_buf = NULL;
+		errno = ret;
+		goto err;
+	}
+
+	if (flags & ZBD_RSTREAM_DIRECT) {
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		rs->rfd = open(path, O_RDONLY | O_DIRECT | O_LARGEFILE);
+		if (rs->rfd < 0) {
+			zbd_error_fd(fd, errno,
+				     "%d: Open for direct I/O failed %d (%s)\n",
+				     fd, errno, strerror(errno));
+			goto err;
+		}
+	}
+
+	return rs;
+
+err:
+	free(rs->ra_buf);
+	free(rs);
+	return NULL;
+}
+
+/**
+ * zbd_rstream_free - Free a zone read stream
+ */
+void zbd_rstream_free(struct zbd_rstream *rs)
+{
+	if (!rs)
+		return;
+
+	if (rs->rfd != rs->fd)
+		close(rs->rfd);
+	free(rs->ra_buf);
+	free(rs);
+}
+
+static ssize_t zbd_rstream_pread(struct zbd_rstream *rs, void *buf,
+				 size_t count, unsigned long long ofst)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < count) {
+		ret = pread(rs->rfd, buf + done, count - done, ofst + done);
+		if (ret < 0) {
+			zbd_error_fd(rs->fd, errno,
+				     "%d: read at %llu failed %d (%s)\n",
+				     rs->fd, ofst + done, errno, strerror(errno));
+			zbd_stats_error(rs->fd, errno);
+			return -1;
+		}
+		if (!ret)
+			break;
+		done += ret;
+	}
+
+	zbd_stats_add(rs->fd, ZBD_STAT_BYTES_READ, done);
+
+	return done;
+}
+
+/*
+ * Fill the readahead buffer with at least count bytes of zone data starting
+ * from ofst, or with ra_size bytes for sequential reads, stopping at the end
+ * of the zone readable data.
+ */
+static int zbd_rstream_readahead(struct zbd_rstream *rs,
+				 unsigned long long ofst, size_t count,
+				 unsigned long long end, bool seq)
+{
+	unsigned long long start;
+	ssize_t ret;
+	size_t len;
+
+	start = ofst & ~((unsigned long long)rs->align - 1);
+	if (start < zbd_zone_start(&rs->zone))
+		start = zbd_zone_start(&rs->zone);
+	len = rs->ra_size;
+	if (!seq && ofst - start + count < len)
+		len = (ofst - start + count + rs->info.lblock_size - 1) &
+			~((size_t)rs->info.lblock_size - 1);
+	ofst = start;
+	if (ofst + len > end)
+		len = end - ofst;
+
+	/* Direct I/Os must be aligned on the device logical block size */
+	if (rs->rfd != rs->fd)
+		len = (len + rs->info.lblock_size - 1) &
+			~((size_t)rs->info.lblock_size - 1);
+
+	ret = zbd_rstream_pread(rs, rs->ra_buf, len, ofst);
+	if (ret < 0) {
+		rs->ra_len = 0;
+		return -1;
+	}
+
+	rs->ra_ofst = ofst;
+	rs->ra_len = ret;
+	if (rs->ra_ofst + rs->ra_len > end)
+		rs->ra_len = end - rs->ra_ofst;
+
+	return 0;
+}
+
+/**
+ * zbd_zone_read - Read zone data
+ */
+ssize_t zbd_zone_read(struct zbd_rstream *rs, void *buf, size_t count,
+		      off_t ofst)
+{
+	unsigned long long pos = ofst, end;
+	size_t done = 0, len;
+	bool cached, seq;
+	ssize_t ret;
+
+	if (!rs || !buf || ofst < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (pos >= rs->info.nr_sectors << SECTOR_SHIFT || !count)
+		return 0;
+
+	/* Use the cached zone information if it covers the read */
+	if (!rs->zone_valid || pos < zbd_zone_start(&rs->zone) ||
+	    pos >= zbd_zone_start(&rs->zone) + zbd_zone_len(&rs->zone) ||
+	    (pos + count > zbd_rstream_data_end(&rs->zone) &&
+	     zbd_zone_seq(&rs->zone) && !zbd_zone_full(&rs->zone))) {
+		if (zbd_rstream_get_zone(rs, pos))
+			return -1;
+	}
+
+	/* Clamp the read to the zone readable data */
+	end = zbd_rstream_data_end(&rs->zone);
+	if (zbd_zone_offline(&rs->zone) || pos >= end)
+		return 0;
+	if (pos + count > end)
+		count = end - pos;
+
+	/* Only read ahead for reads continuing the previous one */
+	seq = pos == rs->next_ofst;
+
+	while (done < count) {
+		cached = rs->ra_len && pos + done >= rs->ra_ofst &&
+			pos + done < rs->ra_ofst + rs->ra_len;
+
+		/* Large aligned reads bypass the readahead buffer */
+		if (!cached && count - done >= rs->ra_size &&
+		    (rs->rfd == rs->fd ||
+		     !(((uintptr_t)buf + done) % rs->align ||
+		       (pos + done) % rs->info.lblock_size ||
+		       (count - done) % rs->info.lblock_size))) {
+			ret = zbd_rstream_pread(rs, buf + done, count - done,
+						pos + done);
+			if (ret < 0)
+				return -1;
+			done += ret;
+			break;
+		}
+
+		if (!cached) {
+			if (zbd_rstream_readahead(rs, pos + done,
+						  count - done, end, seq))
+				return -1;
+			if (!rs->ra_len)
+				break;
+		}
+
+		len = rs->ra_ofst + rs->ra_len - (pos + done);
+		if (len > count - done)
+			len = count - done;
+		memcpy(buf + done, rs->ra_buf + (pos + done - rs->ra_ofst),
+		       len);
+		done += len;
+	}
+
+	rs->next_ofst = pos + done;
+
+	return done;
+}
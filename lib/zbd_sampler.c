@@ -0,0 +1,558 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+
+/*
+ * Maximum size of a LEB128 encoded 64-bits value.
+ */
+#define ZBD_TL_VARINT_MAX	10
+
+struct zbd_sampler {
+	int				fd;
+	struct zbd_info			info;
+	unsigned long long		ofst;
+	unsigned long long		len;
+	unsigned int			nr_zones;
+	unsigned int			nr_samples;
+	unsigned long long		start_ns;
+	unsigned long long		last_ns;
+
+	struct zbd_zone			*zones;
+	struct zbd_zone			*prev;
+	struct zbd_zone_activity	*activity;
+
+	/* Timeline file, previous sample and column encoding buffers */
+	FILE				*tl;
+	uint8_t				*state;
+	uint64_t			*wp;
+	uint64_t			*val;
+	uint8_t				*col;
+};
+
+struct zbd_timeline {
+	FILE				*f;
+	struct zbd_tl_hdr		hdr;
+	uint32_t			*capacity;
+	uint8_t				*state;
+	uint64_t			*wp;
+	uint64_t			*val;
+	uint8_t				*col;
+	size_t				col_size;
+};
+
+/*
+ * Zone state and write pointer offset (512B sectors) saved in timelines.
+ */
+static inline uint8_t zbd_tl_zone_state(struct zbd_zone *z)
+{
+	return (z->cond & 0x0f) |
+		(zbd_zone_rwp_recommended(z) ? 0x10 : 0) |
+		(zbd_zone_non_seq_resources(z) ? 0x20 : 0) |
+		((z->type & 0x03) << 6);
+}
+
+static inline uint64_t zbd_tl_zone_wp(struct zbd_zone *z)
+{
+	switch (zbd_zone_cond(z)) {
+	case ZBD_ZONE_COND_IMP_OPEN:
+	case ZBD_ZONE_COND_EXP_OPEN:
+	case ZBD_ZONE_COND_CLOSED:
+		return (zbd_zone_wp(z) - zbd_zone_start(z)) >> SECTOR_SHIFT;
+	case ZBD_ZONE_COND_FULL:
+		return zbd_zone_capacity(z) >> SECTOR_SHIFT;
+	default:
+		return 0;
+	}
+}
+
+static inline uint8_t *zbd_tl_put_varint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+
+	return p;
+}
+
+static inline const uint8_t *zbd_tl_get_varint(const uint8_t *p,
+					       const uint8_t *end,
+					       uint64_t *v)
+{
+	unsigned int shift = 0;
+
+	*v = 0;
+	while (p < end && shift < 64) {
+		*v |= (uint64_t)(*p & 0x7f) << shift;
+		if (!(*p++ & 0x80))
+			return p;
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+/*
+ * Encode a column of values with zero runs.
+ */
+static size_t zbd_tl_encode(uint8_t *col, const uint64_t *v, unsigned int n)
+{
+	uint8_t *p = col;
+	unsigned int i = 0, run;
+
+	while (i < n) {
+		if (v[i]) {
+			p = zbd_tl_put_varint(p, v[i]);
+			i++;
+			continue;
+		}
+		for (run = 1; i + run < n && !v[i + run]; run++)
+			;
+		*p++ = 0;
+		p = zbd_tl_put_varint(p, run - 1);
+		i += run;
+	}
+
+	return p - col;
+}
+
+/*
+ * Decode a column of n values.
+ */
+static int zbd_tl_decode(const uint8_t *col, size_t len, uint64_t *v,
+			 unsigned int n)
+{
+	const uint8_t *p = col, *end = col + len;
+	unsigned int i = 0;
+	uint64_t val, run;
+
+	while (i < n) {
+		p = zbd_tl_get_varint(p, end, &val);
+		if (!p)
+			return -1;
+		if (val) {
+			v[i++] = val;
+			continue;
+		}
+		p = zbd_tl_get_varint(p, end, &run);
+		if (!p || run >= n - i)
+			return -1;
+		memset(&v[i], 0, (run + 1) * sizeof(uint64_t));
+		i += run + 1;
+	}
+
+	return p == end ? 0 : -1;
+}
+
+static inline uint64_t zbd_tl_zigzag(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t zbd_tl_unzigzag(uint64_t v)
+{
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int zbd_sampler_tl_open(struct zbd_sampler *s, const char *path)
+{
+	struct zbd_tl_hdr hdr;
+	struct timespec ts;
+	uint32_t cap;
+	unsigned int i;
+
+	s->state = calloc(s->nr_zones, sizeof(uint8_t));
+	s->wp = calloc(s->nr_zones, sizeof(uint64_t));
+	s->val = calloc(s->nr_zones, sizeof(uint64_t));
+	s->col = malloc((size_t)s->nr_zones * ZBD_TL_VARINT_MAX * 2);
+	if (!s->state || !s->wp || !s->val || !s->col) {
+		zbd_error("%d: No memory for zone timeline\n", s->fd);
+		errno = ENOMEM;
+		return -1;
+	}
+
+	s->tl = fopen(path, "w");
+	if (!s->tl) {
+		zbd_error("%d: Create zone timeline file %s failed %d (%s)\n",
+			  s->fd, path, errno, strerror(errno));
+		return -1;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	memset(&hdr, 0, sizeof(struct zbd_tl_hdr));
+	memcpy(hdr.magic, ZBD_TL_MAGIC, sizeof(hdr.magic));
+	hdr.version = ZBD_TL_VERSION;
+	hdr.nr_zones = s->nr_zones;
+	hdr.zone_size = s->info.zone_size;
+	hdr.start = s->ofst;
+	hdr.start_time_ns = (unsigned long long)ts.tv_sec * 1000000000ULL +
+		ts.tv_nsec;
+	if (fwrite(&hdr, sizeof(struct zbd_tl_hdr), 1, s->tl) != 1)
+		goto err;
+
+	for (i = 0; i < s->nr_zones; i++) {
+		cap = zbd_zone_capacity(&s->zones[i]) >> SECTOR_SHIFT;
+		if (fwrite(&cap, sizeof(uint32_t), 1, s->tl) != 1)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	zbd_error("%d: Write zone timeline file %s failed\n", s->fd, path);
+	errno = EIO;
+	return -1;
+}
+
+/*
+ * Append the last sample to the timeline file.
+ */
+static int zbd_sampler_tl_write(struct zbd_sampler *s)
+{
+	struct zbd_tl_sample smp;
+	struct zbd_zone *z;
+	unsigned int i;
+	uint8_t state;
+	uint64_t wp;
+
+	smp.time_ns = s->last_ns - s->start_ns;
+
+	for (i = 0; i < s->nr_zones; i++) {
+		state = zbd_tl_zone_state(&s->zones[i]);
+		s->val[i] = state ^ s->state[i];
+		s->state[i] = state;
+	}
+	smp.state_len = zbd_tl_encode(s->col, s->val, s->nr_zones);
+
+	for (i = 0; i < s->nr_zones; i++) {
+		z = &s->zones[i];
+		wp = zbd_tl_zone_wp(z);
+		s->val[i] = zbd_tl_zigzag((int64_t)(wp - s->wp[i]));
+		s->wp[i] = wp;
+	}
+	smp.wp_len = zbd_tl_encode(s->col + smp.state_len, s->val,
+				   s->nr_zones);
+
+	if (fwrite(&smp, sizeof(struct zbd_tl_sample), 1, s->tl) != 1 ||
+	    fwrite(s->col, smp.state_len + smp.wp_len, 1, s->tl) != 1 ||
+	    fflush(s->tl)) {
+		zbd_error("%d: Write zone timeline file failed\n", s->fd);
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Update the activity of a zone from its previous and current information.
+ */
+static void zbd_sampler_update(struct zbd_zone_activity *za,
+			       struct zbd_zone *prev, struct zbd_zone *z,
+			       unsigned long long ns)
+{
+	unsigned long long pwp, wp, written;
+
+	if (zbd_zone_cnv(z))
+		return;
+
+	pwp = zbd_tl_zone_wp(prev) << SECTOR_SHIFT;
+	wp = zbd_tl_zone_wp(z) << SECTOR_SHIFT;
+
+	if (wp < pwp) {
+		/* The zone was reset, and possibly written again */
+		za->nr_resets++;
+		written = wp;
+	} else {
+		written = wp - pwp;
+	}
+
+	za->bytes_written += written;
+	za->write_rate = ns ? written * 1000000000ULL / ns : 0;
+
+	if (zbd_zone_is_open(z) && !zbd_zone_is_open(prev))
+		za->nr_opens++;
+	if (zbd_zone_closed(z) && !zbd_zone_closed(prev))
+		za->nr_closes++;
+	if (zbd_zone_full(z) && !zbd_zone_full(prev))
+		za->nr_fulls++;
+}
+
+/**
+ * zbd_sampler_sample - Take a zone activity sample
+ */
+int zbd_sampler_sample(struct zbd_sampler *s)
+{
+	unsigned int i, nz = s->nr_zones;
+	struct zbd_zone *zones;
+	unsigned long long now;
+	int ret;
+
+	/* Report into the previous sample array and swap */
+	ret = zbd_report_zones(s->fd, s->ofst, s->len, ZBD_RO_ALL,
+			       s->prev, &nz);
+	if (ret)
+		return -1;
+	if (nz != s->nr_zones) {
+		zbd_error("%d: Invalid number of zones sampled %u / %u\n",
+			  s->fd, nz, s->nr_zones);
+		errno = EIO;
+		return -1;
+	}
+
+	now = zbd_now_ns();
+	zones = s->zones;
+	s->zones = s->prev;
+	s->prev = zones;
+
+	for (i = 0; i < nz; i++)
+		zbd_sampler_update(&s->activity[i], &s->prev[i],
+				   &s->zones[i], now - s->last_ns);
+	s->last_ns = now;
+	s->nr_samples++;
+
+	if (s->tl)
+		return zbd_sampler_tl_write(s);
+
+	return 0;
+}
+
+/**
+ * zbd_sampler_free - Free a zone activity sampler
+ */
+void zbd_sampler_free(struct zbd_sampler *s)
+{
+	if (!s)
+		return;
+
+	if (s->tl)
+		fclose(s->tl);
+	free(s->col);
+	free(s->val);
+	free(s->wp);
+	free(s->state);
+	free(s->activity);
+	free(s->prev);
+	free(s->zones);
+	free(s);
+}
+
+/**
+ * zbd_sampler_alloc - Allocate a zone activity sampler
+ */
+struct zbd_sampler *zbd_sampler_alloc(int fd, off_t ofst, off_t len,
+				      const char *path)
+{
+	unsigned long long capacity, zone_size;
+	struct zbd_sampler *s;
+	unsigned int nz;
+
+	s = calloc(1, sizeof(struct zbd_sampler));
+	if (!s)
+		return NULL;
+
+	s->fd = fd;
+	if (zbd_get_info(fd, &s->info) || ofst < 0 || len < 0) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	zone_size = s->info.zone_size;
+	capacity = s->info.nr_sectors << SECTOR_SHIFT;
+	s->ofst = ofst & ~(zone_size - 1);
+	if (!len || (unsigned long long)(ofst + len) > capacity)
+		len = capacity - ofst;
+	s->len = ofst + len - s->ofst;
+	if (s->ofst >= capacity || !s->len) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	if (zbd_report_nr_zones(fd, s->ofst, s->len, ZBD_RO_ALL, &nz))
+		goto err;
+	s->nr_zones = nz;
+
+	s->zones = calloc(nz, sizeof(struct zbd_zone));
+	s->prev = calloc(nz, sizeof(struct zbd_zone));
+	s->activity = calloc(nz, sizeof(struct zbd_zone_activity));
+	if (!s->zones || !s->prev || !s->activity) {
+		errno = ENOMEM;
+		goto err;
+	}
+
+	/* Take the first sample */
+	if (zbd_report_zones(fd, s->ofst, s->len, ZBD_RO_ALL, s->zones, &nz))
+		goto err;
+	if (nz != s->nr_zones) {
+		errno = EIO;
+		goto err;
+	}
+	s->start_ns = zbd_now_ns();
+	s->last_ns = s->start_ns;
+	s->nr_samples = 1;
+
+	if (path &&
+	    (zbd_sampler_tl_open(s, path) || zbd_sampler_tl_write(s)))
+		goto err;
+
+	return s;
+
+err:
+	zbd_sampler_free(s);
+
+	return NULL;
+}
+
+/**
+ * zbd_sampler_activity - Get the activity of the zones of a sampler
+ */
+const struct zbd_zone_activity *
+zbd_sampler_activity(struct zbd_sampler *s, unsigned int *nr_zones)
+{
+	if (nr_zones)
+		*nr_zones = s->nr_zones;
+
+	return s->activity;
+}
+
+/**
+ * zbd_timeline_open - Open a zone timeline file
+ */
+struct zbd_timeline *zbd_timeline_open(const char *path,
+				       struct zbd_tl_hdr *hdr)
+{
+	struct zbd_timeline *tl;
+	unsigned int n;
+
+	tl = calloc(1, sizeof(struct zbd_timeline));
+	if (!tl)
+		return NULL;
+
+	tl->f = fopen(path, "r");
+	if (!tl->f)
+		goto err;
+
+	if (fread(&tl->hdr, sizeof(struct zbd_tl_hdr), 1, tl->f) != 1 ||
+	    memcmp(tl->hdr.magic, ZBD_TL_MAGIC, sizeof(tl->hdr.magic)) ||
+	    tl->hdr.version != ZBD_TL_VERSION || !tl->hdr.nr_zones ||
+	    !tl->hdr.zone_size) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	n = tl->hdr.nr_zones;
+	tl->capacity = calloc(n, sizeof(uint32_t));
+	tl->state = calloc(n, sizeof(uint8_t));
+	tl->wp = calloc(n, sizeof(uint64_t));
+	tl->val = calloc(n, sizeof(uint64_t));
+	if (!tl->capacity || !tl->state || !tl->wp || !tl->val) {
+		errno = ENOMEM;
+		goto err;
+	}
+
+	if (fread(tl->capacity, sizeof(uint32_t), n, tl->f) != n) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	if (hdr)
+		memcpy(hdr, &tl->hdr, sizeof(struct zbd_tl_hdr));
+
+	return tl;
+
+err:
+	zbd_timeline_close(tl);
+
+	return NULL;
+}
+
+/**
+ * zbd_timeline_close - Close a zone timeline file
+ */
+void zbd_timeline_close(struct zbd_timeline *tl)
+{
+	if (!tl)
+		return;
+
+	if (tl->f)
+		fclose(tl->f);
+	free(tl->col);
+	free(tl->val);
+	free(tl->wp);
+	free(tl->state);
+	free(tl->capacity);
+	free(tl);
+}
+
+/**
+ * zbd_timeline_next - Read the next sample of a zone timeline file
+ */
+int zbd_timeline_next(struct zbd_timeline *tl, unsigned long long *time_ns,
+		      struct zbd_zone *zones)
+{
+	unsigned int i, n = tl->hdr.nr_zones;
+	struct zbd_tl_sample smp;
+	struct zbd_zone *z;
+	size_t len;
+	uint8_t *col;
+
+	if (fread(&smp, sizeof(struct zbd_tl_sample), 1, tl->f) != 1)
+		return ferror(tl->f) ? -1 : 0;
+
+	len = (size_t)smp.state_len + smp.wp_len;
+	if (len > tl->col_size) {
+		col = realloc(tl->col, len);
+		if (!col) {
+			errno = ENOMEM;
+			return -1;
+		}
+		tl->col = col;
+		tl->col_size = len;
+	}
+
+	if (fread(tl->col, len, 1, tl->f) != 1)
+		goto err;
+
+	if (zbd_tl_decode(tl->col, smp.state_len, tl->val, n))
+		goto err;
+	for (i = 0; i < n; i++)
+		tl->state[i] ^= tl->val[i];
+
+	if (zbd_tl_decode(tl->col + smp.state_len, smp.wp_len, tl->val, n))
+		goto err;
+	for (i = 0; i < n; i++)
+		tl->wp[i] += zbd_tl_unzigzag(tl->val[i]);
+
+	for (i = 0; i < n; i++) {
+		z = &zones[i];
+		memset(z, 0, sizeof(struct zbd_zone));
+		z->start = tl->hdr.start + (unsigned long long)i *
+			tl->hdr.zone_size;
+		z->len = tl->hdr.zone_size;
+		z->capacity = (unsigned long long)tl->capacity[i] <<
+			SECTOR_SHIFT;
+		z->wp = z->start + (tl->wp[i] << SECTOR_SHIFT);
+		z->cond = tl->state[i] & 0x0f;
+		if (tl->state[i] & 0x10)
+			z->flags |= ZBD_ZONE_RWP_RECOMMENDED;
+		if (tl->state[i] & 0x20)
+			z->flags |= ZBD_ZONE_NON_SEQ_RESOURCES;
+		z->type = tl->state[i] >> 6;
+	}
+
+	*time_ns = smp.time_ns;
+
+	return 1;
+
+err:
+	errno = EINVAL;
+	return -1;
+}
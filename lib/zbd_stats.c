@@ -0,0 +1,333 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#define ZBD_LAT_HIST_SUB	(1U << ZBD_LAT_HIST_SUB_BITS)
+
+static const char *zbd_lat_op_names[ZBD_LAT_NR_OPS] = {
+	[ZBD_LAT_REPORT]	= "report",
+	[ZBD_LAT_RESET]		= "reset",
+	[ZBD_LAT_OPEN]		= "open",
+	[ZBD_LAT_CLOSE]		= "close",
+	[ZBD_LAT_FINISH]	= "finish",
+};
+
+/**
+ * zbd_lat_op_str - Returns a string describing a latency operation type
+ */
+const char *zbd_lat_op_str(enum zbd_lat_op op)
+{
+	if (op >= ZBD_LAT_NR_OPS)
+		return "unknown";
+
+	return zbd_lat_op_names[op];
+}
+
+/*
+ * Latency histogram bucket of a value.
+ */
+static inline unsigned int zbd_lat_hist_idx(unsigned long long v)
+{
+	unsigned int shift;
+
+	if (v < ZBD_LAT_HIST_SUB)
+		return v;
+
+	shift = 63 - __builtin_clzll(v) - ZBD_LAT_HIST_SUB_BITS;
+
+	return (shift + 1) * ZBD_LAT_HIST_SUB + (v >> shift) - ZBD_LAT_HIST_SUB;
+}
+
+/*
+ * Value of the middle of a latency histogram bucket.
+ */
+static unsigned long long zbd_lat_hist_val(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < ZBD_LAT_HIST_SUB)
+		return idx;
+
+	shift = idx / ZBD_LAT_HIST_SUB - 1;
+
+	return ((unsigned long long)(ZBD_LAT_HIST_SUB +
+				     idx % ZBD_LAT_HIST_SUB) << shift) +
+		((1ULL << shift) - 1) / 2;
+}
+
+/**
+ * zbd_lat_hist_add - Record a latency in a latency histogram
+ */
+void zbd_lat_hist_add(struct zbd_lat_hist *hist, unsigned long long ns)
+{
+	if (!hist->count || ns < hist->min_ns)
+		hist->min_ns = ns;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+	hist->count++;
+	hist->sum_ns += ns;
+	hist->buckets[zbd_lat_hist_idx(ns)]++;
+}
+
+/**
+ * zbd_lat_hist_merge - Merge latency histograms
+ */
+void zbd_lat_hist_merge(struct zbd_lat_hist *hist,
+			const struct zbd_lat_hist *from)
+{
+	unsigned int i;
+
+	if (!from->count)
+		return;
+
+	if (!hist->count || from->min_ns < hist->min_ns)
+		hist->min_ns = from->min_ns;
+	if (from->max_ns > hist->max_ns)
+		hist->max_ns = from->max_ns;
+	hist->count += from->count;
+	hist->sum_ns += from->sum_ns;
+	for (i = 0; i < ZBD_LAT_HIST_NR_BUCKETS; i++)
+		hist->buckets[i] += from->buckets[i];
+}
+
+/**
+ * zbd_lat_hist_percentile - Get a latency histogram percentile
+ */
+unsigned long long zbd_lat_hist_percentile(const struct zbd_lat_hist *hist,
+					   double pct)
+{
+	unsigned long long n, rank, v;
+	unsigned int i;
+
+	if (!hist->count)
+		return 0;
+
+	if (pct <= 0)
+		return hist->min_ns;
+
+	rank = (pct / 100.0) * hist->count;
+	if (rank >= hist->count)
+		return hist->max_ns;
+
+	for (i = 0, n = 0; i < ZBD_LAT_HIST_NR_BUCKETS; i++) {
+		n += hist->buckets[i];
+		if (n > rank)
+			break;
+	}
+
+	if (i == ZBD_LAT_HIST_NR_BUCKETS)
+		return hist->max_ns;
+
+	v = zbd_lat_hist_val(i);
+	if (v < hist->min_ns)
+		return hist->min_ns;
+	if (v > hist->max_ns)
+		return hist->max_ns;
+
+	return v;
+}
+
+#ifdef HAVE_ZBD_STATS
+
+/*
+ * Per fd statistics counters and latency histograms.
+ */
+struct zbd_dev_stats *zbd_stats_fd[ZBD_FD_MAX];
+
+/*
+ * Allocate the counters of a newly open device.
+ */
+int zbd_stats_alloc(int fd)
+{
+	struct zbd_dev_stats *st;
+	unsigned int i;
+	int ret;
+
+	ret = posix_memalign((void **)&st, __alignof__(struct zbd_dev_stats),
+			     sizeof(struct zbd_dev_stats));
+	if (ret) {
+		zbd_error("%d: No memory for statistics counters\n", fd);
+		errno = ret;
+		return -1;
+	}
+
+	memset(st, 0, sizeof(struct zbd_dev_stats));
+	for (i = 0; i < ZBD_LAT_NR_OPS; i++)
+		st->lat[i].min_ns = ULLONG_MAX;
+	zbd_stats_fd[fd] = st;
+
+	return 0;
+}
+
+/*
+ * Free the counters of a device being closed.
+ */
+void zbd_stats_free(int fd)
+{
+	free(zbd_stats_fd[fd]);
+	zbd_stats_fd[fd] = NULL;
+}
+
+/*
+ * Record the latency of an operation. Zone operations are slow enough
+ * for a single histogram per operation type updated with atomic operations
+ * not to be a contention point.
+ */
+void zbd_stats_lat(int fd, enum zbd_lat_op op, unsigned long long ns)
+{
+	struct zbd_lat_hist *h;
+	unsigned long long v;
+
+	if (fd < 0 || fd >= ZBD_FD_MAX || !zbd_stats_fd[fd])
+		return;
+
+	h = &zbd_stats_fd[fd]->lat[op];
+
+	v = __atomic_load_n(&h->min_ns, __ATOMIC_RELAXED);
+	while (ns < v &&
+	       !__atomic_compare_exchange_n(&h->min_ns, &v, ns, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	v = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+	while (ns > v &&
+	       !__atomic_compare_exchange_n(&h->max_ns, &v, ns, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	__atomic_fetch_add(&h->buckets[zbd_lat_hist_idx(ns)], 1,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * zbd_get_stats - Get a device statistics counters
+ */
+int zbd_get_stats(int fd, struct zbd_stats *stats)
+{
+	unsigned long long cnt[ZBD_STAT_NR];
+	struct zbd_dev_stats *st;
+	unsigned int i, j;
+
+	if (fd < 0 || fd >= ZBD_FD_MAX || !zbd_stats_fd[fd] || !stats) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	st = zbd_stats_fd[fd];
+	memset(cnt, 0, sizeof(cnt));
+	for (i = 0; i < ZBD_STATS_NR_SHARDS; i++) {
+		for (j = 0; j < ZBD_STAT_NR; j++)
+			cnt[j] += __atomic_load_n(&st->shards[i].cnt[j],
+						  __ATOMIC_RELAXED);
+	}
+
+	stats->nr_report_calls = cnt[ZBD_STAT_REPORT_CALLS];
+	stats->nr_zones_reported = cnt[ZBD_STAT_ZONES_REPORTED];
+	stats->nr_ioctls = cnt[ZBD_STAT_IOCTLS];
+	stats->ioctl_time_ns = cnt[ZBD_STAT_IOCTL_NS];
+	stats->nr_reset_ops = cnt[ZBD_STAT_RESET_OPS];
+	stats->nr_open_ops = cnt[ZBD_STAT_OPEN_OPS];
+	stats->nr_close_ops = cnt[ZBD_STAT_CLOSE_OPS];
+	stats->nr_finish_ops = cnt[ZBD_STAT_FINISH_OPS];
+	stats->bytes_read = cnt[ZBD_STAT_BYTES_READ];
+	stats->bytes_written = cnt[ZBD_STAT_BYTES_WRITTEN];
+	stats->nr_errors = cnt[ZBD_STAT_ERRORS];
+	memcpy(stats->errors, &cnt[ZBD_STAT_ERRNO], sizeof(stats->errors));
+
+	return 0;
+}
+
+/**
+ * zbd_get_lat_hist - Get a device latency histogram for an operation type
+ */
+int zbd_get_lat_hist(int fd, enum zbd_lat_op op, struct zbd_lat_hist *hist)
+{
+	struct zbd_lat_hist *h;
+	unsigned int i;
+
+	if (fd < 0 || fd >= ZBD_FD_MAX || !zbd_stats_fd[fd] ||
+	    op >= ZBD_LAT_NR_OPS || !hist) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	h = &zbd_stats_fd[fd]->lat[op];
+	hist->count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	hist->sum_ns = __atomic_load_n(&h->sum_ns, __ATOMIC_RELAXED);
+	hist->min_ns = __atomic_load_n(&h->min_ns, __ATOMIC_RELAXED);
+	hist->max_ns = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+	for (i = 0; i < ZBD_LAT_HIST_NR_BUCKETS; i++)
+		hist->buckets[i] = __atomic_load_n(&h->buckets[i],
+						   __ATOMIC_RELAXED);
+
+	if (!hist->count)
+		hist->min_ns = 0;
+
+	return 0;
+}
+
+/**
+ * zbd_reset_stats - Reset a device statistics counters
+ */
+int zbd_reset_stats(int fd)
+{
+	struct zbd_dev_stats *st;
+	struct zbd_lat_hist *h;
+	unsigned int i, j;
+
+	if (fd < 0 || fd >= ZBD_FD_MAX || !zbd_stats_fd[fd]) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	st = zbd_stats_fd[fd];
+	for (i = 0; i < ZBD_STATS_NR_SHARDS; i++) {
+		for (j = 0; j < ZBD_STAT_NR; j++)
+			__atomic_store_n(&st->shards[i].cnt[j], 0,
+					 __ATOMIC_RELAXED);
+	}
+
+	for (i = 0; i < ZBD_LAT_NR_OPS; i++) {
+		h = &st->lat[i];
+		__atomic_store_n(&h->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->sum_ns, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->min_ns, ULLONG_MAX, __ATOMIC_RELAXED);
+		__atomic_store_n(&h->max_ns, 0, __ATOMIC_RELAXED);
+		for (j = 0; j < ZBD_LAT_HIST_NR_BUCKETS; j++)
+			__atomic_store_n(&h->buckets[j], 0, __ATOMIC_RELAXED);
+	}
+
+	return 0;
+}
+
+#else
+
+int zbd_get_stats(int fd, struct zbd_stats *stats)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int zbd_get_lat_hist(int fd, enum zbd_lat_op op, struct zbd_lat_hist *hist)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int zbd_reset_stats(int fd)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif /* HAVE_ZBD_STATS */
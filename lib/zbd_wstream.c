@@ -0,0 +1,457 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "zbd.h"
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define ZBD_WSTREAM_NO_ZONE	UINT_MAX
+
+/*
+ * A slot holds the zone currently being written for a write hint class.
+ * Classes sharing a zone after a spill are routed to the same slot.
+ */
+struct zbd_wstream_slot {
+	unsigned int		zno;
+	unsigned long long	wp;
+	unsigned long long	end;
+	bool			busy;
+};
+
+struct zbd_wstream {
+	int			fd;
+	struct zbd_info		info;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+
+	/* Zones of the target range */
+	off_t			ofst;
+	off_t			len;
+	struct zbd_zone		*zones;
+	unsigned int		nr_zones;
+	unsigned int		cursor;
+
+	/* Zone information refresh, done without the stream lock held */
+	struct zbd_zone		*rzones;
+	bool			refreshing;
+
+	/* Active zone accounting */
+	unsigned int		max_zones;
+	unsigned int		nr_zones_used;
+
+	struct zbd_wstream_slot	slots[ZBD_NR_WRITE_HINTS];
+	unsigned int		route[ZBD_NR_WRITE_HINTS];
+};
+
+static bool zbd_wstream_slot_ready(struct zbd_wstream_slot *slot)
+{
+	return slot->zno != ZBD_WSTREAM_NO_ZONE && slot->wp < slot->end;
+}
+
+/*
+ * Refresh the zone information to catch zones that were reset. Called with
+ * the stream lock held, which is released during the zone report so that
+ * writes to the zones in use are not stalled.
+ */
+static int zbd_wstream_refresh(struct zbd_wstream *ws)
+{
+	unsigned int i, nz = ws->nr_zones;
+	int ret, err = 0;
+
+	if (ws->refreshing) {
+		/* Wait for the refresh of another thread */
+		while (ws->refreshing)
+			pthread_cond_wait(&ws->cond, &ws->lock);
+		return 0;
+	}
+
+	ws->refreshing = true;
+	pthread_mutex_unlock(&ws->lock);
+
+	ret = zbd_report_zones(ws->fd, ws->ofst, ws->len, ZBD_RO_ALL,
+			       ws->rzones, &nz);
+	if (ret)
+		err = errno;
+
+	pthread_mutex_lock(&ws->lock);
+
+	ws->refreshing = false;
+	pthread_cond_broadcast(&ws->cond);
+
+	if (ret) {
+		errno = err;
+		return -1;
+	}
+
+	memcpy(ws->zones, ws->rzones, nz * sizeof(struct zbd_zone));
+	ws->nr_zones = nz;
+
+	/* Do not reuse zones that are still owned by a slot */
+	for (i = 0; i < ZBD_NR_WRITE_HINTS; i++) {
+		if (ws->slots[i].zno != ZBD_WSTREAM_NO_ZONE)
+			ws->zones[ws->slots[i].zno].cond =
+				ZBD_ZONE_COND_IMP_OPEN;
+	}
+
+	return 0;
+}
+
+/*
+ * Find an empty zone in the stream range, starting from the cursor. If none
+ * is found and the zone information was not refreshed, fail with EAGAIN for
+ * the caller to refresh the zone information and retry.
+ */
+static int zbd_wstream_get_empty_zone(struct zbd_wstream *ws, bool refreshed)
+{
+	unsigned int i, zno;
+	struct zbd_zone *z;
+
+	for (i = 0; i < ws->nr_zones; i++) {
+		zno = (ws->cursor + i) % ws->nr_zones;
+		z = &ws->zones[zno];
+		if (!zbd_zone_seq(z) || !zbd_zone_empty(z))
+			continue;
+
+		/* Mark the zone as used until the next refresh */
+		z->cond = ZBD_ZONE_COND_IMP_OPEN;
+		ws->cursor = (zno + 1) % ws->nr_zones;
+		return zno;
+	}
+
+	errno = refreshed ? ENOSPC : EAGAIN;
+
+	return -1;
+}
+
+/*
+ * Get the slot to use for a write hint class. Classes are spilled together
+ * when the active zone limit is reached: a class with no zone to write uses
+ * the zone of the class with the nearest expected lifetime, preferring the
+ * shorter lifetime class on ties. A spilled class stays with the zone it was
+ * spilled to until this zone is full.
+ */
+static int zbd_wstream_route(struct zbd_wstream *ws, unsigned int hint,
+			     bool refreshed)
+{
+	struct zbd_wstream_slot *slot = &ws->slots[hint];
+	unsigned int d, s;
+	int zno;
+
+	if (zbd_wstream_slot_ready(slot)) {
+		ws->route[hint] = hint;
+		return hint;
+	}
+
+	s = ws->route[hint];
+	if (s != hint && zbd_wstream_slot_ready(&ws->slots[s]))
+		return s;
+
+	if (ws->nr_zones_used < ws->max_zones) {
+		zno = zbd_wstream_get_empty_zone(ws, refreshed);
+		if (zno >= 0) {
+			slot->zno = zno;
+			slot->wp = zbd_zone_start(&ws->zones[zno]);
+			slot->end = slot->wp +
+				zbd_zone_capacity(&ws->zones[zno]);
+			ws->nr_zones_used++;
+			ws->route[hint] = hint;
+
+			zbd_debug_fd(ws->fd,
+				     "%d: write hint %u: using zone at %llu\n",
+				     ws->fd, hint, slot->wp);
+
+			return hint;
+		}
+
+		/* Without empty zones, try to share a zone in use */
+		if (errno != ENOSPC)
+			return -1;
+	}
+
+	for (d = 1; d < ZBD_NR_WRITE_HINTS; d++) {
+		if (hint >= d && zbd_wstream_slot_ready(&ws->slots[hint - d])) {
+			s = hint - d;
+			break;
+		}
+		if (hint + d < ZBD_NR_WRITE_HINTS &&
+		    zbd_wstream_slot_ready(&ws->slots[hint + d])) {
+			s = hint + d;
+			break;
+		}
+	}
+
+	if (d == ZBD_NR_WRITE_HINTS) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	zbd_debug_fd(ws->fd, "%d: write hint %u: spilled to write hint %u zone\n",
+		     ws->fd, hint, s);
+
+	ws->route[hint] = s;
+
+	return s;
+}
+
+/**
+ * zbd_wstream_alloc - Allocate a lifetime hint based write stream
+ */
+struct zbd_wstream *zbd_wstream_alloc(int fd, off_t ofst, off_t len,
+				      unsigned int max_zones)
+{
+	unsigned int i, nr_active = 0, max_active, nr_open = 0, max_open;
+	struct zbd_zone *zones = NULL;
+	struct zbd_wstream *ws;
+	unsigned int nz;
+	int ret;
+
+	ws = calloc(1, sizeof(struct zbd_wstream));
+	if (!ws)
+		return NULL;
+
+	ws->fd = fd;
+	ws->ofst = ofst;
+	ws->len = len;
+	ret = zbd_get_info(fd, &ws->info);
+	if (ret) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	/* Count the zones already using device resources */
+	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &zones, &nz);
+	if (ret)
+		goto err;
+	for (i = 0; i < nz; i++) {
+		if (zbd_zone_is_open(&zones[i]))
+			nr_open++;
+		if (zbd_zone_is_active(&zones[i]))
+			nr_active++;
+	}
+	free(zones);
+
+	/*
+	 * Limit the number of zones used to the device resources available.
+	 * A zone being written is implicitly open, so both the open and
+	 * active zone limits apply.
+	 */
+	max_active = ZBD_NR_WRITE_HINTS;
+	if (ws->info.max_nr_active_zones) {
+		max_active = 0;
+		if (ws->info.max_nr_active_zones > nr_active)
+			max_active = ws->info.max_nr_active_zones - nr_active;
+	}
+	max_open = ZBD_NR_WRITE_HINTS;
+	if (ws->info.max_nr_open_zones) {
+		max_open = 0;
+		if (ws->info.max_nr_open_zones > nr_open)
+			max_open = ws->info.max_nr_open_zones - nr_open;
+	}
+	if (!max_zones || max_zones > ZBD_NR_WRITE_HINTS)
+		max_zones = ZBD_NR_WRITE_HINTS;
+	if (max_zones > max_active)
+		max_zones = max_active;
+	if (max_zones > max_open)
+		max_zones = max_open;
+	if (!max_zones) {
+		zbd_error_fd(fd, EBUSY, "%d: No zone resources available\n", fd);
+		errno = EBUSY;
+		goto err;
+	}
+	ws->max_zones = max_zones;
+
+	ret = zbd_list_zones(fd, ofst, len, ZBD_RO_ALL,
+			     &ws->zones, &ws->nr_zones);
+	if (ret)
+		goto err;
+	if (!ws->nr_zones) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	ws->rzones = calloc(ws->nr_zones, sizeof(struct zbd_zone));
+	if (!ws->rzones) {
+		errno = ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < ZBD_NR_WRITE_HINTS; i++) {
+		ws->slots[i].zno = ZBD_WSTREAM_NO_ZONE;
+		ws->route[i] = i;
+	}
+
+	pthread_mutex_init(&ws->lock, NULL);
+	pthread_cond_init(&ws->cond, NULL);
+
+	return ws;
+
+err:
+	free(ws->rzones);
+	free(ws->zones);
+	free(ws);
+	return NULL;
+}
+
+/**
+ * zbd_wstream_free - Free a write stream
+ */
+void zbd_wstream_free(struct zbd_wstream *ws)
+{
+	if (!ws)
+		return;
+
+	pthread_cond_destroy(&ws->cond);
+	pthread_mutex_destroy(&ws->lock);
+	free(ws->rzones);
+	free(ws->zones);
+	free(ws);
+}
+
+/*
+ * Get the write pointer of the zone of a slot after a failed or short write
+ * at wp. Zones that cannot be written anymore are reported as full.
+ */
+static int zbd_wstream_get_wp(struct zbd_wstream *ws,
+			      struct zbd_wstream_slot *slot,
+			      unsigned long long *wp)
+{
+	unsigned long long start = *wp - *wp % ws->info.zone_size;
+	struct zbd_zone zone;
+	unsigned int nz = 1;
+
+	if (zbd_report_zones(ws->fd, start, ws->info.zone_size,
+			     ZBD_RO_ALL, &zone, &nz))
+		return -1;
+	if (nz != 1) {
+		errno = EIO;
+		return -1;
+	}
+
+	if (zbd_zone_full(&zone) || zbd_zone_rdonly(&zone) ||
+	    zbd_zone_offline(&zone))
+		*wp = slot->end;
+	else
+		*wp = zbd_zone_wp(&zone);
+
+	return 0;
+}
+
+/**
+ * zbd_wstream_write - Write data according to a write lifetime hint
+ */
+ssize_t zbd_wstream_write(struct zbd_wstream *ws, enum zbd_write_hint hint,
+			  const void *buf, size_t count, off_t *ofst)
+{
+	struct zbd_wstream_slot *slot;
+	unsigned long long wp, new_wp;
+	bool refreshed = false;
+	unsigned int i;
+	int s, err = 0;
+	ssize_t ret;
+
+	if (!ws || !buf || !ofst || hint >= ZBD_NR_WRITE_HINTS) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!count)
+		return 0;
+
+	/* The write pointer can only advance by logical blocks */
+	if (count % ws->info.lblock_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&ws->lock);
+
+	for (;;) {
+		s = zbd_wstream_route(ws, hint, refreshed);
+		if (s < 0 && errno == EAGAIN) {
+			if (zbd_wstream_refresh(ws)) {
+				pthread_mutex_unlock(&ws->lock);
+				return -1;
+			}
+			refreshed = true;
+			continue;
+		}
+		if (s < 0) {
+			pthread_mutex_unlock(&ws->lock);
+			return -1;
+		}
+		if (!ws->slots[s].busy)
+			break;
+		pthread_cond_wait(&ws->cond, &ws->lock);
+	}
+
+	/* Writes to the same zone are serialized to keep them sequential */
+	slot = &ws->slots[s];
+	slot->busy = true;
+	wp = slot->wp;
+	if (count > slot->end - wp)
+		count = slot->end - wp;
+
+	pthread_mutex_unlock(&ws->lock);
+
+	ret = pwrite(ws->fd, buf, count, wp);
+	if (ret < 0) {
+		err = errno;
+		zbd_error_fd(ws->fd, err,
+			     "%d: write hint %u: write at %llu failed %d (%s)\n",
+			     ws->fd, hint, wp, err, strerror(err));
+		zbd_stats_error(ws->fd, err);
+	} else {
+		zbd_stats_add(ws->fd, ZBD_STAT_BYTES_WRITTEN, ret);
+	}
+
+	/*
+	 * After a failed or short write, the zone write pointer may not
+	 * have advanced by the number of bytes written: get it from the
+	 * device. If that fails, the zone is kept with its write pointer
+	 * unchanged as it may still be active.
+	 */
+	new_wp = wp;
+	if (ret == (ssize_t)count) {
+		new_wp += ret;
+	} else if (zbd_wstream_get_wp(ws, slot, &new_wp)) {
+		err = errno;
+		new_wp = wp;
+		ret = -1;
+	}
+
+	pthread_mutex_lock(&ws->lock);
+
+	slot->busy = false;
+	if (ret > 0)
+		*ofst = wp;
+	if (new_wp != wp) {
+		slot->wp = new_wp;
+		if (slot->wp >= slot->end) {
+			/*
+			 * The zone is now full and not active anymore: classes
+			 * spilled to it go back to using their own zone.
+			 */
+			slot->zno = ZBD_WSTREAM_NO_ZONE;
+			ws->nr_zones_used--;
+			for (i = 0; i < ZBD_NR_WRITE_HINTS; i++) {
+				if (ws->route[i] == (unsigned int)s)
+					ws->route[i] = i;
+			}
+		}
+	}
+
+	pthread_cond_broadcast(&ws->cond);
+	pthread_mutex_unlock(&ws->lock);
+
+	if (ret < 0)
+		errno = err;
+
+	return ret;
+}
@@ -12,6 +12,8 @@ BuildRequires:	gtk3-devel
 BuildRequires:	autoconf
 BuildRequires:	automake
 BuildRequires:	libtool
+BuildRequires:	zlib-devel
+BuildRequires:	libzstd-devel
 BuildRequires:	make
 BuildRequires:	gcc
 
@@ -183,11 +183,18 @@ static struct zbd_action zact[] = {
 	{ zbd_mgmt,	O_WRONLY },	/* ZBD_FINISH */
 	{ zbd_dump,	O_RDONLY },	/* ZBD_DUMP */
 	{ zbd_restore,	O_RDWR | O_DIRECT },	/* ZBD_RESTORE */
+	{ zbd_verify,	O_RDONLY },	/* ZBD_VERIFY */
+	{ zbd_copy,	O_RDWR | O_DIRECT },	/* ZBD_COPY */
+	{ zbd_bench,	O_RDWR | O_DIRECT },	/* ZBD_BENCH */
+	{ zbd_exporter,	O_RDONLY },	/* ZBD_EXPORTER */
+	{ zbd_replay,	O_RDWR },	/* ZBD_REPLAY */
+	{ zbd_monitor,	O_RDONLY },	/* ZBD_MONITOR */
 };
 
 static void zbd_print_dev_info(struct zbd_opts *opts)
 {
-	if (opts->cmd == ZBD_REPORT && opts->rep_csv)
+	if ((opts->cmd == ZBD_REPORT && opts->rep_csv) ||
+	    (opts->cmd == ZBD_BENCH && opts->bench_json))
 		return;
 
 	printf("Device %s:\n", opts->dev_path);
@@ -223,6 +230,8 @@ static void zbd_print_dev_info(struct zbd_opts *opts)
 static int zbd_usage(char *cmd)
 {
 	printf("Usage: %s <command> [options] <device path | dump file>\n"
+	       "       %s copy [options] <source device> <target device>\n"
+	       "       %s replay [options] <trace file> <device>\n"
 	       "Commands:\n"
 	       "  report : Get zone information from a device or from\n"
 	       "           a zone information dump file\n"
@@ -234,6 +243,19 @@ static int zbd_usage(char *cmd)
 	       "           files (see -d and -f options).\n"
 	       "  restore : Restore a device zones status and data from dump\n"
 	       "            files (see -d and -f options).\n"
+	       "  verify : Check the zone data of dump files against the\n"
+	       "           zone data checksums saved in the dump\n"
+	       "  copy   : Copy the zones status and data of a device to\n"
+	       "           a compatible device\n"
+	       "  bench  : Run a benchmark workload on zone(s) of a device.\n"
+	       "           All data in the zones used is lost.\n"
+	       "  exporter : Export zone metrics of a device for\n"
+	       "             monitoring systems (Prometheus format)\n"
+	       "  replay : Replay a library call trace on a device.\n"
+	       "           All data in the zones used may be lost.\n"
+	       "  monitor : Sample the zones of a device periodically and\n"
+	       "            report the zone activity, or print the zone\n"
+	       "            changes of a zone timeline file\n"
 	       "Common options:\n"
 	       "  -v		   : Verbose mode (for debug)\n"
 	       "  -i		   : Display device information\n"
@@ -263,8 +285,72 @@ static int zbd_usage(char *cmd)
 	       "  -d <path> : Path where to save dump files.\n"
 	       "  -f <name> : Name prefix for the dump files. If not\n"
 	       "              specified, the device base name is used\n"
-	       "              as a dump file name prefix\n",
-	       cmd);
+	       "              as a dump file name prefix\n"
+	       "  -bs <size (B)> : Size of zone data read and write\n"
+	       "                   operations (default: 1 MiB)\n"
+	       "  -qd <num>      : Number of zone data buffers in flight\n"
+	       "                   between reads and writes (default: 2)\n"
+	       "  -j <num>       : Number of zone data dump or restore\n"
+	       "                   workers (default: 1)\n"
+	       "                   The -bs, -qd and -j options also apply\n"
+	       "                   to the copy command\n"
+	       "  -stream        : Dump to the standard output or restore\n"
+	       "                   from the standard input using a single\n"
+	       "                   stream of zone information and data\n"
+	       "dump command options:\n"
+	       "  -zc       : Copy zone data without user buffers when\n"
+	       "              supported (copy_file_range, sendfile, splice)\n"
+	       "  -z <method> : Compress zone data by chunks of -bs bytes.\n"
+	       "                Possible values are \"zlib\" and \"zstd\",\n"
+	       "                if supported by the build\n"
+	       "  -inc, --incremental <path> : Only save the zone data\n"
+	       "                written since the dump with the zone\n"
+	       "                information file <path>\n"
+	       "bench command options:\n"
+	       "  -w <workload> : Workload to run (default: \"fill\"):\n"
+	       "                  * \"fill\": sequential zone fill at the\n"
+	       "                    queue depth set with -qd\n"
+	       "                  * \"writers\": fill of -j zones\n"
+	       "                    concurrently\n"
+	       "                  * \"mgmt\": zone open, close, finish\n"
+	       "                    and reset latency\n"
+	       "                  * \"report\": zone report latency for\n"
+	       "                    an increasing number of zones\n"
+	       "                  * \"mixed\": fill of -j zones with\n"
+	       "                    random reads of the written data\n"
+	       "  -bs <size (B)> : Size of read and write operations\n"
+	       "                   (default: 1 MiB)\n"
+	       "  -qd <num>      : Number of writes in flight per zone\n"
+	       "                   (default: 1)\n"
+	       "  -j <num>       : Number of zones written concurrently\n"
+	       "                   (default: 1)\n"
+	       "  -loops <num>   : Number of zone reports for each number\n"
+	       "                   of zones (default: 100)\n"
+	       "  -rwmix <pct>   : Percentage of reads of the mixed\n"
+	       "                   workload (default: 0)\n"
+	       "  -json          : Output results in JSON format\n"
+	       "exporter command options:\n"
+	       "  -interval <ms>   : Interval of the refresh of all zones\n"
+	       "                     (default: 10000 ms)\n"
+	       "  -listen <[addr:]port> : Serve the metrics over HTTP\n"
+	       "                     (default: 127.0.0.1:9754)\n"
+	       "  -textfile <dir>  : Write the metrics to the file\n"
+	       "                     <dir>/zbd_<devname>.prom after each\n"
+	       "                     refresh of all zones\n"
+	       "replay command options:\n"
+	       "  -afap            : Replay calls as fast as possible instead\n"
+	       "                     of at their original timing\n"
+	       "  -fd <num>        : Replay only the calls of the trace file\n"
+	       "                     descriptor <num> (default: the file\n"
+	       "                     descriptor of the first device open)\n"
+	       "monitor command options:\n"
+	       "  -interval <ms>   : Interval between samples\n"
+	       "                     (default: 1000 ms)\n"
+	       "  -count <num>     : Number of samples to take\n"
+	       "                     (default: until interrupted)\n"
+	       "  -o <path>        : Save the samples to the zone timeline\n"
+	       "                     file <path>\n",
+	       cmd, cmd, cmd);
 	return 1;
 }
 
@@ -272,14 +358,17 @@ int main(int argc, char **argv)
 {
 	struct zbd_opts opts;
 	bool dev_info = false;
-	int dev_fd = 0, i, ret = 1;
+	int dev_fd = 0, i, last, ret = 1;
 	long long capacity;
 	char dev_path[PATH_MAX];
+	char src_path[PATH_MAX];
 
 	memset(&opts, 0, sizeof(struct zbd_opts));
 	opts.rep_opt = ZBD_RO_ALL;
 	opts.rep_dump = false;
 	opts.unit = 1;
+	opts.nr_jobs = 1;
+	opts.replay_fd = -1;
 
 	/* Parse options */
 	if (argc < 3)
@@ -299,12 +388,32 @@ int main(int argc, char **argv)
 		opts.cmd = ZBD_DUMP;
 	} else if (strcmp(argv[1], "restore") == 0) {
 		opts.cmd = ZBD_RESTORE;
+	} else if (strcmp(argv[1], "verify") == 0) {
+		opts.cmd = ZBD_VERIFY;
+	} else if (strcmp(argv[1], "copy") == 0) {
+		opts.cmd = ZBD_COPY;
+	} else if (strcmp(argv[1], "bench") == 0) {
+		opts.cmd = ZBD_BENCH;
+	} else if (strcmp(argv[1], "exporter") == 0) {
+		opts.cmd = ZBD_EXPORTER;
+	} else if (strcmp(argv[1], "replay") == 0) {
+		opts.cmd = ZBD_REPLAY;
+	} else if (strcmp(argv[1], "monitor") == 0) {
+		opts.cmd = ZBD_MONITOR;
 	} else {
 		fprintf(stderr, "Invalid command \"%s\"\n", argv[1]);
 		return 1;
 	}
 
-	for (i = 2; i < (argc - 1); i++) {
+	/*
+	 * The copy command takes a source and a target device, and the replay
+	 * command a trace file and a target device.
+	 */
+	last = argc - 1;
+	if (opts.cmd == ZBD_COPY || opts.cmd == ZBD_REPLAY)
+		last--;
+
+	for (i = 2; i < last; i++) {
 
 		/*
 		 * Common options.
@@ -319,7 +428,7 @@ int main(int argc, char **argv)
 
 		} else if (strcmp(argv[i], "-ofst") == 0) {
 
-			if (i >= (argc - 1)) {
+			if (i >= last) {
 				fprintf(stderr, "Invalid command line\n");
 				return 1;
 			}
@@ -329,7 +438,7 @@ int main(int argc, char **argv)
 
 		} else if (strcmp(argv[i], "-len") == 0) {
 
-			if (i >= (argc - 1)) {
+			if (i >= last) {
 				fprintf(stderr, "Invalid command line\n");
 				return 1;
 			}
@@ -339,7 +448,7 @@ int main(int argc, char **argv)
 
 		} else if (strcmp(argv[i], "-u") == 0) {
 
-			if (i >= (argc - 1)) {
+			if (i >= last) {
 				fprintf(stderr, "Invalid command line\n");
 				return 1;
 			}
@@ -364,7 +473,7 @@ int main(int argc, char **argv)
 
 		} else if (strcmp(argv[i], "-ro") == 0) {
 
-			if (i >= (argc - 1)) {
+			if (i >= last) {
 				fprintf(stderr, "Invalid command line\n");
 				return 1;
 			}
@@ -402,7 +511,7 @@ int main(int argc, char **argv)
 		 */
 		} else if (strcmp(argv[i], "-d") == 0) {
 
-			if (i >= (argc - 1)) {
+			if (i >= last) {
 				fprintf(stderr, "Invalid command line\n");
 				return 1;
 			}
@@ -412,7 +521,7 @@ int main(int argc, char **argv)
 
 		} else if (strcmp(argv[i], "-f") == 0) {
 
-			if (i >= (argc - 1)) {
+			if (i >= last) {
 				fprintf(stderr, "Invalid command line\n");
 				return 1;
 			}
@@ -420,6 +529,222 @@ int main(int argc, char **argv)
 
 			opts.dump_prefix = argv[i];
 
+		} else if (strcmp(argv[i], "-bs") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.io_size = strtoull(argv[i], NULL, 10);
+			if (!opts.io_size) {
+				fprintf(stderr, "Invalid I/O size\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-qd") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.io_depth = strtoul(argv[i], NULL, 10);
+			if (!opts.io_depth) {
+				fprintf(stderr, "Invalid I/O depth\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-z") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			if (zbd_comp_parse(argv[i], &opts.comp)) {
+				fprintf(stderr,
+					"Unsupported compression method \"%s\"\n",
+					argv[i]);
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-stream") == 0) {
+
+			opts.stream = true;
+
+		} else if (strcmp(argv[i], "-zc") == 0) {
+
+			opts.zero_copy = true;
+
+		} else if (strcmp(argv[i], "-inc") == 0 ||
+			   strcmp(argv[i], "--incremental") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.base_path = argv[i];
+
+		} else if (strcmp(argv[i], "-j") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.nr_jobs = strtoul(argv[i], NULL, 10);
+			if (!opts.nr_jobs) {
+				fprintf(stderr, "Invalid number of jobs\n");
+				return 1;
+			}
+
+		/*
+		 * Benchmark command options.
+		 */
+		} else if (strcmp(argv[i], "-w") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			if (zbd_bench_parse(argv[i], &opts.bench_wl)) {
+				fprintf(stderr, "Unknown workload \"%s\"\n",
+					argv[i]);
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-loops") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.bench_loops = strtoul(argv[i], NULL, 10);
+			if (!opts.bench_loops) {
+				fprintf(stderr, "Invalid number of loops\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-rwmix") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.bench_rwmix = strtoul(argv[i], NULL, 10);
+
+		} else if (strcmp(argv[i], "-json") == 0) {
+
+			opts.bench_json = true;
+
+		/*
+		 * Exporter command options.
+		 */
+		} else if (strcmp(argv[i], "-interval") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			if (opts.cmd == ZBD_MONITOR) {
+				opts.mon_interval = strtoul(argv[i], NULL, 10);
+				if (!opts.mon_interval) {
+					fprintf(stderr,
+						"Invalid sampling interval\n");
+					return 1;
+				}
+			} else {
+				opts.exp_interval = strtoul(argv[i], NULL, 10);
+				if (!opts.exp_interval) {
+					fprintf(stderr,
+						"Invalid refresh interval\n");
+					return 1;
+				}
+			}
+
+		} else if (strcmp(argv[i], "-listen") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.exp_listen = argv[i];
+
+		} else if (strcmp(argv[i], "-textfile") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.exp_textfile = argv[i];
+
+		/*
+		 * Replay command options.
+		 */
+		} else if (strcmp(argv[i], "-afap") == 0) {
+
+			opts.replay_afap = true;
+
+		} else if (strcmp(argv[i], "-fd") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.replay_fd = strtol(argv[i], NULL, 10);
+			if (opts.replay_fd < 0) {
+				fprintf(stderr, "Invalid file descriptor\n");
+				return 1;
+			}
+
+		/*
+		 * Monitor command options.
+		 */
+		} else if (strcmp(argv[i], "-count") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.mon_count = strtoul(argv[i], NULL, 10);
+			if (!opts.mon_count) {
+				fprintf(stderr, "Invalid number of samples\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-o") == 0) {
+
+			if (i >= last) {
+				fprintf(stderr, "Invalid command line\n");
+				return 1;
+			}
+			i++;
+
+			opts.mon_path = argv[i];
+
 		} else if (argv[i][0] == '-') {
 
 			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
@@ -431,17 +756,70 @@ int main(int argc, char **argv)
 
 	}
 
-	if (i != (argc - 1)) {
+	if (i != last) {
 		fprintf(stderr, "No device specified\n");
 		return 1;
 	}
 
+	if (opts.cmd == ZBD_COPY) {
+		if (!realpath(argv[i], src_path)) {
+			fprintf(stderr, "Invalid source device path %s\n",
+				argv[i]);
+			return 1;
+		}
+		opts.src_path = src_path;
+		i++;
+	} else if (opts.cmd == ZBD_REPLAY) {
+		if (!realpath(argv[i], src_path)) {
+			fprintf(stderr, "Invalid trace file path %s\n",
+				argv[i]);
+			return 1;
+		}
+		opts.src_path = src_path;
+		i++;
+	}
+
 	if (!realpath(argv[i], dev_path)) {
 		fprintf(stderr, "Invalid device path %s\n", argv[i]);
 		return 1;
 	}
 	opts.dev_path = dev_path;
 
+	if (opts.src_path && strcmp(opts.src_path, opts.dev_path) == 0) {
+		fprintf(stderr, "Source and target devices are identical\n");
+		return 1;
+	}
+
+	/*
+	 * A dump stream is written to the standard output, so print all
+	 * messages to the standard error.
+	 */
+	if (opts.stream && opts.cmd == ZBD_DUMP) {
+		if (isatty(STDOUT_FILENO)) {
+			fprintf(stderr,
+				"Not writing a dump stream to a terminal\n");
+			return 1;
+		}
+		opts.stream_fd = dup(STDOUT_FILENO);
+		if (opts.stream_fd < 0 ||
+		    dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+			fprintf(stderr, "Redirect standard output failed\n");
+			return 1;
+		}
+	} else if (opts.stream) {
+		opts.stream_fd = STDIN_FILENO;
+	}
+
+	/*
+	 * Special case for monitor using a zone timeline file.
+	 */
+	if (opts.cmd == ZBD_MONITOR) {
+		ret = zbd_monitor_timeline(&opts);
+		if (ret >= 0)
+			return ret;
+		ret = 1;
+	}
+
 	/*
 	 * Special case for zone report using zone info dump file.
 	 */
@@ -451,6 +829,20 @@ int main(int argc, char **argv)
 			return 1;
 	}
 
+	/*
+	 * Dump verification: only zone information dump files are accepted.
+	 */
+	if (opts.cmd == ZBD_VERIFY) {
+		dev_fd = zbd_open_dump(&opts);
+		if (dev_fd < 0)
+			return 1;
+		if (!dev_fd) {
+			fprintf(stderr, "%s is not a zone information dump file\n",
+				opts.dev_path);
+			return 1;
+		}
+	}
+
 	if (!dev_fd) {
 		/* Open device */
 		dev_fd = zbd_open(opts.dev_path,
@@ -499,7 +891,7 @@ out:
 	if (!opts.rep_dump)
 		zbd_close(dev_fd);
 	else
-		close(dev_fd);
+		zbd_dump_map_close(opts.rep_map);
 
 	return ret;
 }
@@ -10,20 +10,42 @@
 #define _LARGEFILE64_SOURCE
 #define _GNU_SOURCE
 
+#include "config.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
 #include <libgen.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <malloc.h>
+#include <pthread.h>
 
 #include "libzbd/zbd.h"
 
+/*
+ * Default I/O size and number of I/O buffers in flight for
+ * dump and restore zone data copy.
+ */
+#define ZBD_DUMP_IO_SIZE	(1024 * 1024)
+#define ZBD_DUMP_IO_DEPTH	2
+
+/*
+ * Zone data dump compression methods.
+ */
+enum zbd_dump_comp {
+	ZBD_DUMP_COMP_NONE = 0,
+	ZBD_DUMP_COMP_ZLIB,
+	ZBD_DUMP_COMP_ZSTD,
+	ZBD_DUMP_COMP_MAX,
+};
+
 enum zbd_cmd {
 	ZBD_REPORT,
 	ZBD_RESET,
@@ -32,14 +54,46 @@ enum zbd_cmd {
 	ZBD_FINISH,
 	ZBD_DUMP,
 	ZBD_RESTORE,
+	ZBD_VERIFY,
+	ZBD_COPY,
+	ZBD_BENCH,
+	ZBD_EXPORTER,
+	ZBD_REPLAY,
+	ZBD_MONITOR,
+};
+
+/*
+ * Default exporter zone snapshot refresh interval (ms) and listen address.
+ */
+#define ZBD_EXP_INTERVAL	10000
+#define ZBD_EXP_LISTEN		"9754"
+
+/*
+ * Default monitor sampling interval (ms).
+ */
+#define ZBD_MON_INTERVAL	1000
+
+/*
+ * Benchmark workloads.
+ */
+enum zbd_bench_workload {
+	ZBD_BENCH_FILL = 0,
+	ZBD_BENCH_WRITERS,
+	ZBD_BENCH_MGMT,
+	ZBD_BENCH_REPORT,
+	ZBD_BENCH_MIXED,
+	ZBD_BENCH_MAX,
 };
 
+struct zbd_dump_map;
+
 /*
  * Command line options and device information.
  */
 struct zbd_opts {
 	/* Common options */
 	char			*dev_path;
+	char			*src_path;
 	char			*dump_path;
 	char			*dump_prefix;
 	struct zbd_info		dev_info;
@@ -53,7 +107,38 @@ struct zbd_opts {
 	bool			rep_num_zones;
 	bool			rep_capacity;
 	bool			rep_dump;
+	struct zbd_dump_map	*rep_map;
 	enum zbd_report_option	rep_opt;
+
+	/* Dump and restore options */
+	unsigned int		nr_jobs;
+	size_t			io_size;
+	unsigned int		io_depth;
+	bool			zero_copy;
+	enum zbd_dump_comp	comp;
+	char			*base_path;
+	bool			stream;
+	int			stream_fd;
+
+	/* Benchmark options */
+	enum zbd_bench_workload	bench_wl;
+	unsigned int		bench_loops;
+	unsigned int		bench_rwmix;
+	bool			bench_json;
+
+	/* Exporter options */
+	unsigned int		exp_interval;
+	char			*exp_listen;
+	char			*exp_textfile;
+
+	/* Replay options */
+	bool			replay_afap;
+	int			replay_fd;
+
+	/* Monitor options */
+	unsigned int		mon_interval;
+	unsigned int		mon_count;
+	char			*mon_path;
 };
 
 /*
@@ -65,13 +150,146 @@ struct zbd_dump {
 	unsigned int		zstart;		/* 132 */
 	unsigned int		zend;		/* 136 */
 
-	uint8_t			reserved[56];	/* 192 */
+	/*
+	 * Zone data compression method and chunk size. Both are 0 for
+	 * uncompressed sparse zone data files.
+	 */
+	uint32_t		comp;		/* 140 */
+	uint32_t		chunk_size;	/* 144 */
+
+	uint32_t		flags;		/* 148 */
+
+	uint8_t			reserved[44];	/* 192 */
 } __attribute__((packed));
 
+/*
+ * Zone information dump flags.
+ */
+enum zbd_dump_flags {
+	/* The zone array is followed by extensions */
+	ZBD_DUMP_EXT		= (1 << 0),
+
+	/* Only zone data written since the base dump is saved */
+	ZBD_DUMP_INCREMENTAL	= (1 << 1),
+
+	/* The zone information is followed by the zone data records */
+	ZBD_DUMP_STREAM		= (1 << 2),
+};
+
+/*
+ * Zone information dump extensions. Each extension is a header followed by
+ * len bytes of data. The last extension has the type ZBD_DUMP_EXT_END.
+ * Extensions with an unknown type are ignored.
+ */
+enum zbd_dump_ext_type {
+	ZBD_DUMP_EXT_END	= 0,
+
+	/* Path of the zone information dump file of the base dump */
+	ZBD_DUMP_EXT_BASE	= 1,
+
+	/* Start offset of the zone data saved for each device zone */
+	ZBD_DUMP_EXT_DELTA	= 2,
+
+	/*
+	 * CRC32C of the data of each device zone, from the zone start. For
+	 * incremental dumps, this includes the zone data of the base dumps.
+	 */
+	ZBD_DUMP_EXT_CRC32C	= 3,
+};
+
+struct zbd_dump_ext {
+	uint32_t		type;		/* 4 */
+	uint32_t		len;		/* 8 */
+} __attribute__((packed));
+
+/*
+ * Dump stream format: the zone information dump (header, zone array and
+ * extensions) is followed by one record per zone with data, each record
+ * header being followed by len bytes of zone data starting from the zone
+ * start. The last record has the flag ZBD_DUMP_STREAM_END set. Records are
+ * written in the order in which zones must be restored. The zone data of
+ * records with the flag ZBD_DUMP_STREAM_CRC32C set is followed by the
+ * 32-bits CRC32C of the data.
+ */
+#define ZBD_DUMP_STREAM_END	(1 << 0)
+#define ZBD_DUMP_STREAM_CRC32C	(1 << 1)
+
+struct zbd_dump_stream_zone {
+	uint32_t		zno;		/* 4 */
+	uint32_t		flags;		/* 8 */
+	uint64_t		len;		/* 16 */
+} __attribute__((packed));
+
+/*
+ * Compressed zone data file format: the file header is followed by the
+ * compressed chunks of zone data and by the index of the chunks. The index
+ * has one entry per device zone followed by one entry per chunk. The chunks
+ * of a zone are indexed from the zone first_chunk entry, in zone offset order.
+ */
+#define ZBD_CDUMP_MAGIC		"ZBDCDUMP"
+
+struct zbd_cdump_hdr {
+	char			magic[8];	/* 8 */
+	uint32_t		comp;		/* 12 */
+	uint32_t		chunk_size;	/* 16 */
+	uint32_t		nr_zones;	/* 20 */
+	uint32_t		nr_chunks;	/* 24 */
+	uint64_t		index_ofst;	/* 32 */
+	uint8_t			reserved[32];	/* 64 */
+} __attribute__((packed));
+
+struct zbd_cdump_zone {
+	uint64_t		data_len;	/* 8 */
+	uint32_t		first_chunk;	/* 12 */
+	uint32_t		nr_chunks;	/* 16 */
+} __attribute__((packed));
+
+/* The chunk data is stored uncompressed */
+#define ZBD_CDUMP_CHUNK_RAW	(1 << 0)
+
+struct zbd_cdump_chunk {
+	uint64_t		ofst;		/* 8 */
+	uint32_t		len;		/* 12 */
+	uint32_t		flags;		/* 16 */
+} __attribute__((packed));
+
+struct zbd_dump_map *zbd_dump_map_open(const char *path);
+void zbd_dump_map_close(struct zbd_dump_map *map);
+const struct zbd_dump *zbd_dump_map_header(struct zbd_dump_map *map);
+int zbd_dump_map_report_zones(struct zbd_dump_map *map, off_t ofst, off_t len,
+			      enum zbd_report_option ro,
+			      struct zbd_zone *zones, unsigned int *nr_zones);
+int zbd_dump_map_list_zones(struct zbd_dump_map *map, off_t ofst, off_t len,
+			    enum zbd_report_option ro,
+			    struct zbd_zone **zones, unsigned int *nr_zones);
+
 int zbd_open_dump(struct zbd_opts *opts);
 int zbd_dump_report_zones(int fd, struct zbd_opts *opts,
 			  struct zbd_zone *zones, unsigned int *nr_zones);
 int zbd_dump(int fd, struct zbd_opts *opts);
 int zbd_restore(int fd, struct zbd_opts *opts);
+int zbd_verify(int fd, struct zbd_opts *opts);
+int zbd_copy(int fd, struct zbd_opts *opts);
+
+int zbd_bench_parse(const char *name, enum zbd_bench_workload *wl);
+int zbd_bench(int fd, struct zbd_opts *opts);
+
+int zbd_exporter(int fd, struct zbd_opts *opts);
+
+int zbd_replay(int fd, struct zbd_opts *opts);
+
+int zbd_monitor(int fd, struct zbd_opts *opts);
+int zbd_monitor_timeline(struct zbd_opts *opts);
+
+uint32_t zbd_crc32c(uint32_t crc, const void *buf, size_t len);
+
+const char *zbd_comp_name(enum zbd_dump_comp comp);
+bool zbd_comp_supported(enum zbd_dump_comp comp);
+int zbd_comp_parse(const char *name, enum zbd_dump_comp *comp);
+size_t zbd_comp_bound(enum zbd_dump_comp comp, size_t len);
+ssize_t zbd_compress(enum zbd_dump_comp comp, void *dst, size_t dst_size,
+		     const void *src, size_t len);
+ssize_t zbd_decompress(enum zbd_dump_comp comp, void *dst, size_t dst_size,
+		       const void *src, size_t len);
 
 #endif /* _ZBD_TOOL_H_ */
@@ -0,0 +1,820 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "./zbd.h"
+
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+static const char *zbd_bench_names[] = {
+	[ZBD_BENCH_FILL]	= "fill",
+	[ZBD_BENCH_WRITERS]	= "writers",
+	[ZBD_BENCH_MGMT]	= "mgmt",
+	[ZBD_BENCH_REPORT]	= "report",
+	[ZBD_BENCH_MIXED]	= "mixed",
+};
+
+int zbd_bench_parse(const char *name, enum zbd_bench_workload *wl)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZBD_BENCH_MAX; i++) {
+		if (strcmp(name, zbd_bench_names[i]) == 0) {
+			*wl = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static unsigned long long zbd_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Native Linux AIO, used to issue sequential writes to a zone at the
+ * requested queue depth from a single thread, in order.
+ */
+static inline int zbd_bench_io_setup(unsigned int nr, aio_context_t *ctx)
+{
+	return syscall(__NR_io_setup, nr, ctx);
+}
+
+static inline int zbd_bench_io_destroy(aio_context_t ctx)
+{
+	return syscall(__NR_io_destroy, ctx);
+}
+
+static inline int zbd_bench_io_submit(aio_context_t ctx, long nr,
+				      struct iocb **iocbs)
+{
+	return syscall(__NR_io_submit, ctx, nr, iocbs);
+}
+
+static inline int zbd_bench_io_getevents(aio_context_t ctx, long min_nr,
+					 long nr, struct io_event *events)
+{
+	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, NULL);
+}
+
+enum zbd_bench_op {
+	ZBD_BENCH_OP_WRITE,
+	ZBD_BENCH_OP_READ,
+	ZBD_BENCH_OP_OPEN,
+	ZBD_BENCH_OP_CLOSE,
+	ZBD_BENCH_OP_FINISH,
+	ZBD_BENCH_OP_RESET,
+	ZBD_BENCH_OP_MAX,
+};
+
+static const char *zbd_bench_op_names[] = {
+	[ZBD_BENCH_OP_WRITE]	= "write",
+	[ZBD_BENCH_OP_READ]	= "read",
+	[ZBD_BENCH_OP_OPEN]	= "open",
+	[ZBD_BENCH_OP_CLOSE]	= "close",
+	[ZBD_BENCH_OP_FINISH]	= "finish",
+	[ZBD_BENCH_OP_RESET]	= "reset",
+};
+
+/*
+ * Per worker statistics, merged once all workers are done.
+ */
+struct zbd_bench_stats {
+	struct zbd_lat_hist	lat[ZBD_BENCH_OP_MAX];
+	unsigned long long	bytes[ZBD_BENCH_OP_MAX];
+	unsigned int		nr_zones;
+};
+
+struct zbd_bench {
+	int			fd;
+	struct zbd_opts		*opts;
+	struct zbd_zone		*zones;
+	unsigned int		zstart;
+	unsigned int		zend;
+	struct zbd_buf_pool	*pool;
+	unsigned int		nr_jobs;
+
+	pthread_mutex_t		lock;
+	unsigned int		next_zone;
+	int			ret;
+
+	struct zbd_bench_stats	stats;
+	unsigned long long	runtime;
+};
+
+struct zbd_bench_worker {
+	struct zbd_bench	*b;
+	pthread_t		thread;
+	unsigned int		id;
+	void			**bufs;
+	struct zbd_bench_stats	stats;
+};
+
+static bool zbd_bench_zone_writable(struct zbd_zone *z)
+{
+	return zbd_zone_seq(z) && !zbd_zone_offline(z) && !zbd_zone_rdonly(z);
+}
+
+/*
+ * Get the next sequential zone to write, or NULL if all zones of the
+ * benchmark range were handled or an error was detected.
+ */
+static struct zbd_zone *zbd_bench_next_zone(struct zbd_bench *b)
+{
+	struct zbd_zone *z = NULL;
+
+	pthread_mutex_lock(&b->lock);
+	while (!b->ret && b->next_zone < b->zend) {
+		z = &b->zones[b->next_zone++];
+		if (zbd_bench_zone_writable(z))
+			break;
+		z = NULL;
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	return z;
+}
+
+static void zbd_bench_error(struct zbd_bench *b)
+{
+	pthread_mutex_lock(&b->lock);
+	b->ret = -1;
+	pthread_mutex_unlock(&b->lock);
+}
+
+/*
+ * Reset the written sequential zones of the benchmark range, using a single
+ * reset operation for each range of consecutive zones.
+ */
+static int zbd_bench_reset_zones(struct zbd_bench *b)
+{
+	unsigned int i, first = 0, nr = 0;
+	struct zbd_zone *z;
+	long long ofst, len;
+
+	for (i = b->zstart; i <= b->zend; i++) {
+		z = &b->zones[i];
+		if (i < b->zend && zbd_bench_zone_writable(z) &&
+		    !zbd_zone_empty(z)) {
+			if (!nr)
+				first = i;
+			nr++;
+			continue;
+		}
+
+		if (!nr)
+			continue;
+
+		ofst = zbd_zone_start(&b->zones[first]);
+		len = (long long)nr * b->opts->dev_info.zone_size;
+		if (zbd_reset_zones(b->fd, ofst, len)) {
+			fprintf(stderr,
+				"Reset zones %u..%u failed %d (%s)\n",
+				first, first + nr - 1, errno, strerror(errno));
+			return -1;
+		}
+		nr = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Write a zone up to its capacity from the zone start, keeping up to
+ * io_depth writes in flight.
+ */
+static int zbd_bench_fill_zone(struct zbd_bench_worker *w, aio_context_t ctx,
+			       struct iocb *iocbs, unsigned long long *stime,
+			       struct zbd_zone *z)
+{
+	struct zbd_bench *b = w->b;
+	unsigned int qd = b->opts->io_depth;
+	long long ofst = zbd_zone_start(z);
+	long long end = ofst + zbd_zone_capacity(z);
+	struct io_event events[qd];
+	struct iocb *submit[qd];
+	unsigned int free_slots[qd];
+	unsigned int i, nr_free = qd, nr, slot;
+	unsigned long long now;
+	size_t len;
+	int ret;
+
+	for (i = 0; i < qd; i++)
+		free_slots[i] = i;
+
+	while (ofst < end || nr_free < qd) {
+		/* Submit as many writes as possible, in order */
+		nr = 0;
+		now = zbd_bench_now();
+		while (nr_free && ofst < end) {
+			slot = free_slots[--nr_free];
+			len = b->opts->io_size;
+			if (ofst + (long long)len > end)
+				len = end - ofst;
+
+			memset(&iocbs[slot], 0, sizeof(struct iocb));
+			iocbs[slot].aio_fildes = b->fd;
+			iocbs[slot].aio_lio_opcode = IOCB_CMD_PWRITE;
+			iocbs[slot].aio_buf = (uintptr_t)w->bufs[slot];
+			iocbs[slot].aio_nbytes = len;
+			iocbs[slot].aio_offset = ofst;
+			iocbs[slot].aio_data = slot;
+			stime[slot] = now;
+			submit[nr++] = &iocbs[slot];
+			ofst += len;
+		}
+
+		if (nr) {
+			ret = zbd_bench_io_submit(ctx, nr, submit);
+			if (ret != (int)nr) {
+				fprintf(stderr,
+					"Submit writes to zone at %llu failed %d (%s)\n",
+					zbd_zone_start(z), errno,
+					strerror(errno));
+				return -1;
+			}
+		}
+
+		/* Reap completions */
+		ret = zbd_bench_io_getevents(ctx, 1, qd, events);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "Get write completions failed %d (%s)\n",
+				errno, strerror(errno));
+			return -1;
+		}
+
+		now = zbd_bench_now();
+		for (i = 0; i < (unsigned int)ret; i++) {
+			slot = events[i].data;
+			if (events[i].res != (long long)iocbs[slot].aio_nbytes) {
+				fprintf(stderr,
+					"Write at %llu failed %lld\n",
+					(unsigned long long)iocbs[slot].aio_offset,
+					(long long)events[i].res);
+				return -1;
+			}
+			zbd_lat_hist_add(&w->stats.lat[ZBD_BENCH_OP_WRITE],
+					   now - stime[slot]);
+			w->stats.bytes[ZBD_BENCH_OP_WRITE] +=
+				iocbs[slot].aio_nbytes;
+			free_slots[nr_free++] = slot;
+		}
+	}
+
+	w->stats.nr_zones++;
+
+	return 0;
+}
+
+/*
+ * Fill and writers workloads: fill zones one at a time.
+ */
+static void *zbd_bench_fill_worker(void *arg)
+{
+	struct zbd_bench_worker *w = arg;
+	struct zbd_bench *b = w->b;
+	unsigned int qd = b->opts->io_depth;
+	unsigned long long *stime;
+	aio_context_t ctx = 0;
+	struct iocb *iocbs;
+	struct zbd_zone *z;
+
+	iocbs = calloc(qd, sizeof(struct iocb));
+	stime = calloc(qd, sizeof(unsigned long long));
+	if (!iocbs || !stime) {
+		fprintf(stderr, "No memory\n");
+		goto err;
+	}
+
+	if (zbd_bench_io_setup(qd, &ctx)) {
+		fprintf(stderr, "Setup AIO context failed %d (%s)\n",
+			errno, strerror(errno));
+		goto err;
+	}
+
+	while ((z = zbd_bench_next_zone(b))) {
+		if (zbd_bench_fill_zone(w, ctx, iocbs, stime, z)) {
+			zbd_bench_error(b);
+			break;
+		}
+	}
+
+	/* This also waits for the writes left in flight after an error */
+	zbd_bench_io_destroy(ctx);
+	free(iocbs);
+	free(stime);
+
+	return NULL;
+
+err:
+	free(iocbs);
+	free(stime);
+	zbd_bench_error(b);
+
+	return NULL;
+}
+
+/*
+ * Mixed workload: fill zones one at a time, with a random read of the zone
+ * written data issued in place of a write according to the read ratio.
+ */
+static void *zbd_bench_mixed_worker(void *arg)
+{
+	struct zbd_bench_worker *w = arg;
+	struct zbd_bench *b = w->b;
+	unsigned int seed = w->id + 1;
+	long long ofst, wp, end, start, nr_blocks;
+	unsigned long long t;
+	struct zbd_zone *z;
+	enum zbd_bench_op op;
+	size_t bs = b->opts->io_size;
+	unsigned int lbs = b->opts->dev_info.lblock_size;
+	ssize_t ret;
+	size_t len;
+
+	while ((z = zbd_bench_next_zone(b))) {
+		start = zbd_zone_start(z);
+		end = start + zbd_zone_capacity(z);
+		wp = start;
+
+		while (wp < end) {
+			if (wp - start >= (long long)bs &&
+			    (unsigned int)(rand_r(&seed) % 100) <
+			    b->opts->bench_rwmix) {
+				op = ZBD_BENCH_OP_READ;
+				len = bs;
+				nr_blocks = (wp - start - bs) / lbs + 1;
+				ofst = start +
+					(rand_r(&seed) % nr_blocks) * lbs;
+			} else {
+				op = ZBD_BENCH_OP_WRITE;
+				len = bs;
+				if (wp + (long long)len > end)
+					len = end - wp;
+				ofst = wp;
+			}
+
+			t = zbd_bench_now();
+			if (op == ZBD_BENCH_OP_READ)
+				ret = pread(b->fd, w->bufs[0], len, ofst);
+			else
+				ret = pwrite(b->fd, w->bufs[0], len, ofst);
+			t = zbd_bench_now() - t;
+			if (ret != (ssize_t)len) {
+				fprintf(stderr, "%s at %lld failed %d (%s)\n",
+					op == ZBD_BENCH_OP_READ ?
+					"Read" : "Write",
+					ofst, errno, strerror(errno));
+				zbd_bench_error(b);
+				return NULL;
+			}
+
+			zbd_lat_hist_add(&w->stats.lat[op], t);
+			w->stats.bytes[op] += len;
+			if (op == ZBD_BENCH_OP_WRITE)
+				wp += len;
+		}
+
+		w->stats.nr_zones++;
+	}
+
+	return NULL;
+}
+
+static int zbd_bench_zone_op(struct zbd_bench *b, struct zbd_bench_stats *st,
+			     enum zbd_bench_op op, struct zbd_zone *z)
+{
+	long long ofst = zbd_zone_start(z), len = zbd_zone_len(z);
+	unsigned long long t;
+	int ret;
+
+	t = zbd_bench_now();
+	switch (op) {
+	case ZBD_BENCH_OP_OPEN:
+		ret = zbd_open_zones(b->fd, ofst, len);
+		break;
+	case ZBD_BENCH_OP_CLOSE:
+		ret = zbd_close_zones(b->fd, ofst, len);
+		break;
+	case ZBD_BENCH_OP_FINISH:
+		ret = zbd_finish_zones(b->fd, ofst, len);
+		break;
+	case ZBD_BENCH_OP_RESET:
+		ret = zbd_reset_zones(b->fd, ofst, len);
+		break;
+	default:
+		return -1;
+	}
+	t = zbd_bench_now() - t;
+
+	if (ret) {
+		fprintf(stderr, "Zone %s at %lld failed %d (%s)\n",
+			zbd_bench_op_names[op], ofst, errno, strerror(errno));
+		return -1;
+	}
+
+	zbd_lat_hist_add(&st->lat[op], t);
+
+	return 0;
+}
+
+/*
+ * Zone management workload: open, close, finish and reset each zone.
+ */
+static int zbd_bench_mgmt(struct zbd_bench *b)
+{
+	struct zbd_bench_stats *st = &b->stats;
+	struct zbd_zone *z;
+	int op;
+
+	while ((z = zbd_bench_next_zone(b))) {
+		for (op = ZBD_BENCH_OP_OPEN; op <= ZBD_BENCH_OP_RESET; op++) {
+			if (zbd_bench_zone_op(b, st, op, z))
+				return -1;
+		}
+		st->nr_zones++;
+	}
+
+	return 0;
+}
+
+/*
+ * Run workers for the fill, writers and mixed workloads.
+ */
+static int zbd_bench_run_workers(struct zbd_bench *b,
+				 void *(*worker)(void *))
+{
+	struct zbd_bench_worker *workers;
+	unsigned int i, j, nr_jobs = b->nr_jobs;
+	int ret = 0;
+
+	workers = calloc(nr_jobs, sizeof(struct zbd_bench_worker));
+	if (!workers) {
+		fprintf(stderr, "No memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < nr_jobs; i++) {
+		workers[i].b = b;
+		workers[i].id = i;
+		workers[i].bufs = calloc(b->opts->io_depth, sizeof(void *));
+		if (!workers[i].bufs) {
+			fprintf(stderr, "No memory\n");
+			ret = -1;
+			goto out;
+		}
+		for (j = 0; j < b->opts->io_depth; j++) {
+			workers[i].bufs[j] = zbd_buf_get(b->pool);
+			if (!workers[i].bufs[j]) {
+				fprintf(stderr, "Get I/O buffer failed (%s)\n",
+					strerror(errno));
+				ret = -1;
+				goto out;
+			}
+			memset(workers[i].bufs[j], 0xa5, b->opts->io_size);
+		}
+	}
+
+	for (i = 0; i < nr_jobs; i++) {
+		ret = pthread_create(&workers[i].thread, NULL, worker,
+				     &workers[i]);
+		if (ret) {
+			fprintf(stderr, "Create worker failed %d (%s)\n",
+				ret, strerror(ret));
+			zbd_bench_error(b);
+			break;
+		}
+	}
+
+	nr_jobs = i;
+	for (i = 0; i < nr_jobs; i++) {
+		pthread_join(workers[i].thread, NULL);
+		for (j = 0; j < ZBD_BENCH_OP_MAX; j++) {
+			zbd_lat_hist_merge(&b->stats.lat[j],
+					   &workers[i].stats.lat[j]);
+			b->stats.bytes[j] += workers[i].stats.bytes[j];
+		}
+		b->stats.nr_zones += workers[i].stats.nr_zones;
+	}
+
+	ret = b->ret;
+
+out:
+	for (i = 0; i < b->nr_jobs; i++) {
+		if (!workers[i].bufs)
+			continue;
+		for (j = 0; j < b->opts->io_depth; j++) {
+			if (workers[i].bufs[j])
+				zbd_buf_put(b->pool, workers[i].bufs[j]);
+		}
+		free(workers[i].bufs);
+	}
+	free(workers);
+
+	return ret;
+}
+
+static void zbd_bench_print_lat(struct zbd_opts *opts,
+				struct zbd_lat_hist *h)
+{
+	if (opts->bench_json) {
+		printf("\"lat_ns\": { \"min\": %llu, \"mean\": %llu, "
+		       "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+		       "\"p99.9\": %llu, \"max\": %llu }",
+		       h->min_ns, h->sum_ns / h->count,
+		       zbd_lat_hist_percentile(h, 50),
+		       zbd_lat_hist_percentile(h, 90),
+		       zbd_lat_hist_percentile(h, 99),
+		       zbd_lat_hist_percentile(h, 99.9),
+		       h->max_ns);
+		return;
+	}
+
+	printf("      lat (usec): min %.1f, avg %.1f, p50 %.1f, p90 %.1f, "
+	       "p99 %.1f, p99.9 %.1f, max %.1f\n",
+	       (double)h->min_ns / 1000,
+	       (double)h->sum_ns / h->count / 1000,
+	       (double)zbd_lat_hist_percentile(h, 50) / 1000,
+	       (double)zbd_lat_hist_percentile(h, 90) / 1000,
+	       (double)zbd_lat_hist_percentile(h, 99) / 1000,
+	       (double)zbd_lat_hist_percentile(h, 99.9) / 1000,
+	       (double)h->max_ns / 1000);
+}
+
+static void zbd_bench_print_stats(struct zbd_bench *b)
+{
+	struct zbd_opts *opts = b->opts;
+	struct zbd_bench_stats *st = &b->stats;
+	double secs = (double)b->runtime / 1000000000.0;
+	struct zbd_lat_hist *h;
+	bool first = true;
+	int op;
+
+	if (opts->bench_json)
+		printf(",\n  \"nr_zones\": %u,\n  \"runtime_ns\": %llu,\n"
+		       "  \"ops\": {",
+		       st->nr_zones, b->runtime);
+	else
+		printf("    %u zones in %.3f s\n", st->nr_zones, secs);
+
+	for (op = 0; op < ZBD_BENCH_OP_MAX; op++) {
+		h = &st->lat[op];
+		if (!h->count)
+			continue;
+
+		if (opts->bench_json) {
+			printf("%s\n    \"%s\": { \"count\": %llu, ",
+			       first ? "" : ",", zbd_bench_op_names[op],
+			       h->count);
+			if (st->bytes[op])
+				printf("\"bytes\": %llu, \"bw_bps\": %.0f, "
+				       "\"iops\": %.0f, ",
+				       st->bytes[op], st->bytes[op] / secs,
+				       h->count / secs);
+			zbd_bench_print_lat(opts, h);
+			printf(" }");
+			first = false;
+			continue;
+		}
+
+		if (st->bytes[op])
+			printf("    %s: %llu B in %llu ops, %.2f MB/s, %.0f IOPS\n",
+			       zbd_bench_op_names[op], st->bytes[op], h->count,
+			       st->bytes[op] / secs / 1000000, h->count / secs);
+		else
+			printf("    %s: %llu ops, %.0f ops/s\n",
+			       zbd_bench_op_names[op], h->count,
+			       h->count / secs);
+		zbd_bench_print_lat(opts, h);
+	}
+
+	if (opts->bench_json)
+		printf("\n  }");
+}
+
+/*
+ * Report workload: zone report latency for an increasing number of zones,
+ * from 1 zone up to all zones of the benchmark range.
+ */
+static int zbd_bench_report(struct zbd_bench *b)
+{
+	struct zbd_opts *opts = b->opts;
+	unsigned int nz, nr_zones, range = b->zend - b->zstart;
+	struct zbd_lat_hist *h;
+	struct zbd_zone *zones;
+	unsigned long long t;
+	unsigned int i;
+	bool first = true;
+	int ret = 0;
+
+	zones = calloc(range, sizeof(struct zbd_zone));
+	h = malloc(sizeof(struct zbd_lat_hist));
+	if (!zones || !h) {
+		fprintf(stderr, "No memory\n");
+		ret = -1;
+		goto out;
+	}
+
+	if (opts->bench_json)
+		printf(",\n  \"report\": [");
+
+	for (nz = 1; nz; nz = nz < range && nz * 4 > range ? range : nz * 4) {
+		memset(h, 0, sizeof(struct zbd_lat_hist));
+		for (i = 0; i < opts->bench_loops; i++) {
+			nr_zones = nz;
+			t = zbd_bench_now();
+			ret = zbd_report_zones(b->fd,
+				zbd_zone_start(&b->zones[b->zstart]),
+				(long long)nz * opts->dev_info.zone_size,
+				ZBD_RO_ALL, zones, &nr_zones);
+			t = zbd_bench_now() - t;
+			if (ret || nr_zones != nz) {
+				fprintf(stderr,
+					"Report %u zones failed %d (%s)\n",
+					nz, errno, strerror(errno));
+				ret = -1;
+				goto out;
+			}
+			zbd_lat_hist_add(h, t);
+		}
+
+		if (opts->bench_json) {
+			printf("%s\n    { \"nr_zones\": %u, \"count\": %llu, ",
+			       first ? "" : ",", nz, h->count);
+			zbd_bench_print_lat(opts, h);
+			printf(" }");
+		} else {
+			printf("    report %u zones: %llu ops\n",
+			       nz, h->count);
+			zbd_bench_print_lat(opts, h);
+		}
+		first = false;
+
+		if (nz == range)
+			break;
+	}
+
+	if (opts->bench_json)
+		printf("\n  ]");
+
+out:
+	free(zones);
+	free(h);
+
+	return ret;
+}
+
+/*
+ * Run a benchmark workload on the zones of the operation range. All
+ * sequential zones of the range are reset before and after running the
+ * fill, writers, mgmt and mixed workloads.
+ */
+int zbd_bench(int fd, struct zbd_opts *opts)
+{
+	enum zbd_bench_workload wl = opts->bench_wl;
+	unsigned int nz, max_jobs;
+	struct zbd_bench b;
+	int ret;
+
+	if (!opts->io_size)
+		opts->io_size = ZBD_DUMP_IO_SIZE;
+	if (!opts->io_depth)
+		opts->io_depth = 1;
+	if (opts->io_size % opts->dev_info.lblock_size) {
+		fprintf(stderr,
+			"I/O size must be a multiple of the logical block size\n");
+		return 1;
+	}
+	if (!opts->bench_loops)
+		opts->bench_loops = 100;
+	if (opts->bench_rwmix > 100) {
+		fprintf(stderr, "Invalid read ratio\n");
+		return 1;
+	}
+
+	memset(&b, 0, sizeof(struct zbd_bench));
+	b.fd = fd;
+	b.opts = opts;
+	b.zstart = opts->ofst / opts->dev_info.zone_size;
+	b.zend = (opts->ofst + opts->len + opts->dev_info.zone_size - 1) /
+		opts->dev_info.zone_size;
+	b.next_zone = b.zstart;
+	pthread_mutex_init(&b.lock, NULL);
+
+	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &b.zones, &nz);
+	if (ret != 0) {
+		fprintf(stderr, "zbd_list_zones() failed %d\n", ret);
+		goto out;
+	}
+	if (nz != opts->dev_info.nr_zones) {
+		fprintf(stderr,
+			"Invalid number of zones: expected %u, got %u\n",
+			opts->dev_info.nr_zones, nz);
+		ret = -1;
+		goto out;
+	}
+
+	/*
+	 * Zones are written by one worker each: limit the number of workers
+	 * to the device open and active zone limits.
+	 */
+	b.nr_jobs = 1;
+	if (wl == ZBD_BENCH_WRITERS || wl == ZBD_BENCH_MIXED) {
+		b.nr_jobs = opts->nr_jobs;
+		max_jobs = opts->dev_info.max_nr_open_zones;
+		if (opts->dev_info.max_nr_active_zones &&
+		    (!max_jobs ||
+		     opts->dev_info.max_nr_active_zones < max_jobs))
+			max_jobs = opts->dev_info.max_nr_active_zones;
+		if (max_jobs && b.nr_jobs > max_jobs) {
+			if (!opts->bench_json)
+				printf("Limiting to %u workers (device zone resources)\n",
+				       max_jobs);
+			b.nr_jobs = max_jobs;
+		}
+	}
+
+	if (opts->bench_json)
+		printf("{\n  \"device\": \"%s\",\n  \"workload\": \"%s\",\n"
+		       "  \"first_zone\": %u,\n  \"last_zone\": %u,\n"
+		       "  \"bs\": %zu,\n  \"qd\": %u,\n  \"jobs\": %u",
+		       opts->dev_path, zbd_bench_names[wl],
+		       b.zstart, b.zend - 1, opts->io_size, opts->io_depth,
+		       b.nr_jobs);
+	else if (wl == ZBD_BENCH_MGMT || wl == ZBD_BENCH_REPORT)
+		printf("%s: %s workload on zones [%u..%u]\n",
+		       opts->dev_path, zbd_bench_names[wl],
+		       b.zstart, b.zend - 1);
+	else
+		printf("%s: %s workload on zones [%u..%u], bs %zu B, qd %u, %u job%s\n",
+		       opts->dev_path, zbd_bench_names[wl],
+		       b.zstart, b.zend - 1, opts->io_size, opts->io_depth,
+		       b.nr_jobs, b.nr_jobs > 1 ? "s" : "");
+
+	if (wl == ZBD_BENCH_REPORT) {
+		ret = zbd_bench_report(&b);
+		goto out;
+	}
+
+	b.pool = zbd_buf_pool_alloc(fd, opts->io_size,
+				    b.nr_jobs * opts->io_depth, 0);
+	if (!b.pool) {
+		fprintf(stderr, "No memory\n");
+		ret = -1;
+		goto out;
+	}
+
+	ret = zbd_bench_reset_zones(&b);
+	if (ret)
+		goto out;
+
+	b.runtime = zbd_bench_now();
+	switch (wl) {
+	case ZBD_BENCH_FILL:
+	case ZBD_BENCH_WRITERS:
+		ret = zbd_bench_run_workers(&b, zbd_bench_fill_worker);
+		break;
+	case ZBD_BENCH_MIXED:
+		ret = zbd_bench_run_workers(&b, zbd_bench_mixed_worker);
+		break;
+	case ZBD_BENCH_MGMT:
+		ret = zbd_bench_mgmt(&b);
+		break;
+	default:
+		ret = -1;
+		break;
+	}
+	b.runtime = zbd_bench_now() - b.runtime;
+	if (ret)
+		goto out;
+
+	zbd_bench_print_stats(&b);
+
+	/* Leave the zones of the range empty */
+	free(b.zones);
+	b.zones = NULL;
+	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &b.zones, &nz);
+	if (!ret)
+		ret = zbd_bench_reset_zones(&b);
+
+out:
+	if (opts->bench_json)
+		printf("\n}\n");
+	zbd_buf_pool_free(b.pool);
+	pthread_mutex_destroy(&b.lock);
+	free(b.zones);
+
+	return ret;
+}
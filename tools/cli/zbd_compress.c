@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "./zbd.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static const char *zbd_comp_names[] = {
+	[ZBD_DUMP_COMP_NONE]	= "none",
+	[ZBD_DUMP_COMP_ZLIB]	= "zlib",
+	[ZBD_DUMP_COMP_ZSTD]	= "zstd",
+};
+
+const char *zbd_comp_name(enum zbd_dump_comp comp)
+{
+	if (comp >= ZBD_DUMP_COMP_MAX)
+		return "unknown";
+
+	return zbd_comp_names[comp];
+}
+
+/*
+ * Test if a compression method is supported by this build.
+ */
+bool zbd_comp_supported(enum zbd_dump_comp comp)
+{
+	switch (comp) {
+	case ZBD_DUMP_COMP_NONE:
+		return true;
+#ifdef HAVE_ZLIB
+	case ZBD_DUMP_COMP_ZLIB:
+		return true;
+#endif
+#ifdef HAVE_ZSTD
+	case ZBD_DUMP_COMP_ZSTD:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+int zbd_comp_parse(const char *name, enum zbd_dump_comp *comp)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZBD_DUMP_COMP_MAX; i++) {
+		if (strcmp(name, zbd_comp_names[i]) != 0)
+			continue;
+		if (!zbd_comp_supported(i))
+			return -1;
+		*comp = i;
+		return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Maximum compressed size of len bytes of data.
+ */
+size_t zbd_comp_bound(enum zbd_dump_comp comp, size_t len)
+{
+	switch (comp) {
+#ifdef HAVE_ZLIB
+	case ZBD_DUMP_COMP_ZLIB:
+		return compressBound(len);
+#endif
+#ifdef HAVE_ZSTD
+	case ZBD_DUMP_COMP_ZSTD:
+		return ZSTD_compressBound(len);
+#endif
+	default:
+		return len;
+	}
+}
+
+/*
+ * Compress len bytes of data from src into dst. Return the compressed
+ * size of the data or -1 on error.
+ */
+ssize_t zbd_compress(enum zbd_dump_comp comp, void *dst, size_t dst_size,
+		     const void *src, size_t len)
+{
+	switch (comp) {
+#ifdef HAVE_ZLIB
+	case ZBD_DUMP_COMP_ZLIB: {
+		uLongf clen = dst_size;
+
+		if (compress2(dst, &clen, src, len, Z_BEST_SPEED) != Z_OK)
+			return -1;
+		return clen;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case ZBD_DUMP_COMP_ZSTD: {
+		size_t clen;
+
+		clen = ZSTD_compress(dst, dst_size, src, len,
+				     ZSTD_CLEVEL_DEFAULT);
+		if (ZSTD_isError(clen))
+			return -1;
+		return clen;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Decompress len bytes of data from src into dst. Return the decompressed
+ * size of the data or -1 on error.
+ */
+ssize_t zbd_decompress(enum zbd_dump_comp comp, void *dst, size_t dst_size,
+		       const void *src, size_t len)
+{
+	switch (comp) {
+#ifdef HAVE_ZLIB
+	case ZBD_DUMP_COMP_ZLIB: {
+		uLongf dlen = dst_size;
+
+		if (uncompress(dst, &dlen, src, len) != Z_OK)
+			return -1;
+		return dlen;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case ZBD_DUMP_COMP_ZSTD: {
+		size_t dlen;
+
+		dlen = ZSTD_decompress(dst, dst_size, src, len);
+		if (ZSTD_isError(dlen))
+			return -1;
+		return dlen;
+	}
+#endif
+	default:
+		return -1;
+	}
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "./zbd.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define ZBD_CRC32C_SSE42
+#endif
+
+/*
+ * CRC32C (Castagnoli) polynomial, reversed.
+ */
+#define ZBD_CRC32C_POLY		0x82F63B78
+
+static uint32_t zbd_crc32c_table[8][256];
+static pthread_once_t zbd_crc32c_once = PTHREAD_ONCE_INIT;
+static uint32_t (*zbd_crc32c_fn)(uint32_t, const uint8_t *, size_t);
+
+/*
+ * Table based implementation, processing 8 bytes at a time.
+ */
+static uint32_t zbd_crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t v;
+
+	while (len && ((uintptr_t)p & 7)) {
+		crc = zbd_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		len--;
+	}
+
+	while (len >= 8) {
+		memcpy(&v, p, sizeof(v));
+		v ^= crc;
+		crc = zbd_crc32c_table[7][v & 0xff] ^
+			zbd_crc32c_table[6][(v >> 8) & 0xff] ^
+			zbd_crc32c_table[5][(v >> 16) & 0xff] ^
+			zbd_crc32c_table[4][(v >> 24) & 0xff] ^
+			zbd_crc32c_table[3][(v >> 32) & 0xff] ^
+			zbd_crc32c_table[2][(v >> 40) & 0xff] ^
+			zbd_crc32c_table[1][(v >> 48) & 0xff] ^
+			zbd_crc32c_table[0][v >> 56];
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = zbd_crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef ZBD_CRC32C_SSE42
+/*
+ * SSE4.2 CRC32 instruction based implementation.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t zbd_crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t c = crc, v;
+
+	while (len && ((uintptr_t)p & 7)) {
+		c = _mm_crc32_u8(c, *p++);
+		len--;
+	}
+
+	while (len >= 8) {
+		memcpy(&v, p, sizeof(v));
+		c = _mm_crc32_u64(c, v);
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		c = _mm_crc32_u8(c, *p++);
+
+	return c;
+}
+#endif
+
+static void zbd_crc32c_init(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? ZBD_CRC32C_POLY : 0);
+		zbd_crc32c_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = zbd_crc32c_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = zbd_crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+			zbd_crc32c_table[j][i] = crc;
+		}
+	}
+
+	zbd_crc32c_fn = zbd_crc32c_sw;
+#ifdef ZBD_CRC32C_SSE42
+	if (__builtin_cpu_supports("sse4.2"))
+		zbd_crc32c_fn = zbd_crc32c_sse42;
+#endif
+}
+
+/*
+ * Update the CRC32C crc of a buffer with len bytes of data from buf. The
+ * CRC32C of a buffer is obtained using 0 as the initial crc, and the CRC32C
+ * of the concatenation of two buffers by updating the CRC32C of the first
+ * buffer with the second buffer.
+ */
+uint32_t zbd_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	pthread_once(&zbd_crc32c_once, zbd_crc32c_init);
+
+	return ~zbd_crc32c_fn(~crc, buf, len);
+}
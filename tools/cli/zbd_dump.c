@@ -6,20 +6,32 @@
  */
 #include "./zbd.h"
 
-static ssize_t zbd_rw(int fd, bool read, void *buf, size_t count, off_t offset)
+/*
+ * Read or write count bytes at offset. A negative offset is used for
+ * streams (pipes) and reads or writes at the current file position.
+ */
+static ssize_t zbd_rw(int fd, bool do_read, void *buf, size_t count,
+		      off_t offset)
 {
 	size_t remaining = count;
 	off_t ofst = offset;
+	char *p = buf;
 	ssize_t ret;
 
 	while (remaining) {
-		if (read)
-			ret = pread(fd, buf, remaining, ofst);
+		if (do_read && offset < 0)
+			ret = read(fd, p, remaining);
+		else if (offset < 0)
+			ret = write(fd, p, remaining);
+		else if (do_read)
+			ret = pread(fd, p, remaining, ofst);
 		else
-			ret = pwrite(fd, buf, remaining, ofst);
+			ret = pwrite(fd, p, remaining, ofst);
+		if (ret < 0 && errno == EINTR)
+			continue;
 		if (ret < 0) {
 			fprintf(stderr, "%s failed %d (%s)\n",
-				read ? "read" : "write",
+				do_read ? "read" : "write",
 				errno, strerror(errno));
 			return -1;
 		}
@@ -28,6 +40,7 @@ static ssize_t zbd_rw(int fd, bool read, void *buf, size_t count, off_t offset)
 
 		remaining -= ret;
 		ofst += ret;
+		p += ret;
 	}
 
 	return count - remaining;
@@ -43,11 +56,134 @@ static inline ssize_t zbd_write(int fd, void *buf, size_t count, off_t offset)
 	return zbd_rw(fd, false, buf, count, offset);
 }
 
+/*
+ * Read-only mapping of a zone information dump file header and zone array.
+ */
+struct zbd_dump_map {
+	int			fd;
+	void			*addr;
+	size_t			size;
+	struct zbd_dump		*hdr;
+	struct zbd_zone		*zones;
+};
+
+/*
+ * Check the zone array of a zone information dump: all zones except the last
+ * one must have the device zone size.
+ */
+static int zbd_dump_map_check(struct zbd_dump_map *map)
+{
+	struct zbd_info *info = &map->hdr->dev_info;
+	unsigned long long start = 0;
+	struct zbd_zone *z;
+	unsigned int i;
+
+	if (!info->zone_size ||
+	    map->hdr->zstart > map->hdr->zend ||
+	    map->hdr->zend > info->nr_zones)
+		return -1;
+
+	for (i = 0; i < info->nr_zones; i++) {
+		z = &map->zones[i];
+		if (zbd_zone_start(z) != start || !zbd_zone_len(z) ||
+		    zbd_zone_len(z) > info->zone_size ||
+		    (i < info->nr_zones - 1 &&
+		     zbd_zone_len(z) != info->zone_size) ||
+		    zbd_zone_capacity(z) > zbd_zone_len(z))
+			return -1;
+		start += zbd_zone_len(z);
+	}
+
+	if (start != info->nr_sectors << 9)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Map the header and zone array of a zone information dump file, or of a
+ * dump stream saved to a file.
+ */
+struct zbd_dump_map *zbd_dump_map_open(const char *path)
+{
+	struct zbd_dump_map *map;
+	struct zbd_dump hdr;
+	struct stat st;
+	ssize_t ret;
+
+	map = calloc(1, sizeof(struct zbd_dump_map));
+	if (!map) {
+		fprintf(stderr, "No memory\n");
+		return NULL;
+	}
+
+	map->fd = open(path, O_RDONLY | O_LARGEFILE);
+	if (map->fd < 0) {
+		fprintf(stderr, "Open %s failed (%s)\n",
+			path, strerror(errno));
+		goto err;
+	}
+
+	ret = zbd_read(map->fd, &hdr, sizeof(struct zbd_dump), 0);
+	if (ret != sizeof(struct zbd_dump)) {
+		fprintf(stderr, "Read dump header failed\n");
+		goto err;
+	}
+
+	if (!hdr.dev_info.nr_zones || !hdr.dev_info.zone_size ||
+	    fstat(map->fd, &st))
+		goto err_invalid;
+
+	map->size = sizeof(struct zbd_dump) +
+		sizeof(struct zbd_zone) * hdr.dev_info.nr_zones;
+	if ((unsigned long long)st.st_size < map->size)
+		goto err_invalid;
+
+	map->addr = mmap(NULL, map->size, PROT_READ, MAP_SHARED, map->fd, 0);
+	if (map->addr == MAP_FAILED) {
+		map->addr = NULL;
+		fprintf(stderr, "mmap %s failed (%s)\n",
+			path, strerror(errno));
+		goto err;
+	}
+	madvise(map->addr, map->size, MADV_WILLNEED);
+
+	map->hdr = map->addr;
+	map->zones = map->addr + sizeof(struct zbd_dump);
+	if (memcmp(&hdr, map->hdr, sizeof(struct zbd_dump)) != 0 ||
+	    zbd_dump_map_check(map))
+		goto err_invalid;
+
+	return map;
+
+err_invalid:
+	fprintf(stderr, "Invalid zone information dump file %s\n", path);
+err:
+	zbd_dump_map_close(map);
+	return NULL;
+}
+
+void zbd_dump_map_close(struct zbd_dump_map *map)
+{
+	if (!map)
+		return;
+
+	if (map->addr)
+		munmap(map->addr, map->size);
+	if (map->fd >= 0)
+		close(map->fd);
+	free(map);
+}
+
+const struct zbd_dump *zbd_dump_map_header(struct zbd_dump_map *map)
+{
+	return map->hdr;
+}
+
 int zbd_open_dump(struct zbd_opts *opts)
 {
-	struct zbd_dump dump;
+	struct zbd_dump *dump;
 	struct stat st;
-	int dev_fd = 0;
 	ssize_t ret;
 
 	ret = stat(opts->dev_path, &st);
@@ -61,24 +197,21 @@ int zbd_open_dump(struct zbd_opts *opts)
 
 	printf("Regular file specified: assuming dump file\n");
 
-	dev_fd = open(opts->dev_path, O_RDONLY | O_LARGEFILE);
-	if (dev_fd < 0) {
-		fprintf(stderr, "Open %s failed (%s)\n",
-			opts->dev_path, strerror(errno));
-		return -1;
-	}
-
-	ret = zbd_read(dev_fd, &dump, sizeof(struct zbd_dump), 0);
-	if (ret != sizeof(struct zbd_dump)) {
-		fprintf(stderr, "Read dump header failed\n");
-		close(dev_fd);
+	opts->rep_map = zbd_dump_map_open(opts->dev_path);
+	if (!opts->rep_map)
 		return -1;
-	}
 
-	memcpy(&opts->dev_info, &dump.dev_info, sizeof(struct zbd_info));
+	dump = opts->rep_map->hdr;
+	memcpy(&opts->dev_info, &dump->dev_info, sizeof(struct zbd_info));
 	opts->rep_dump = true;
 
-	return dev_fd;
+	if (dump->comp && !opts->rep_csv)
+		printf("Zone data compressed using %s, %u B chunks\n",
+		       zbd_comp_name(dump->comp), dump->chunk_size);
+	if ((dump->flags & ZBD_DUMP_INCREMENTAL) && !opts->rep_csv)
+		printf("Incremental dump\n");
+
+	return opts->rep_map->fd;
 }
 
 static bool zbd_dump_should_report_zone(struct zbd_zone *zone,
@@ -112,32 +245,41 @@ static bool zbd_dump_should_report_zone(struct zbd_zone *zone,
 	}
 }
 
-int zbd_dump_report_zones(int fd, struct zbd_opts *opts,
-			  struct zbd_zone *zones, unsigned int *nr_zones)
+/*
+ * Get the zone information of a mapped zone information dump, with the same
+ * semantic as zbd_report_zones(): at most *nr_zones zones starting from the
+ * zone containing ofst up to the zone containing ofst + len are reported.
+ * If zones is NULL, only the number of matching zones is returned.
+ */
+int zbd_dump_map_report_zones(struct zbd_dump_map *map, off_t ofst, off_t len,
+			      enum zbd_report_option ro,
+			      struct zbd_zone *zones, unsigned int *nr_zones)
 {
+	struct zbd_info *info = &map->hdr->dev_info;
+	unsigned long long capacity = info->nr_sectors << 9;
 	unsigned int i, nz = 0, zstart, zend;
-	struct zbd_zone zone;
-	loff_t ofst;
-	ssize_t ret;
-
-	zstart = opts->ofst / opts->dev_info.zone_size;
-	zend = (opts->ofst + opts->len + opts->dev_info.zone_size - 1)
-		/ opts->dev_info.zone_size;
 
-	ofst = sizeof(struct zbd_dump) + zstart * sizeof(struct zbd_zone);
-	for (i = zstart; i < zend; i++) {
-		ret = zbd_read(fd, &zone, sizeof(struct zbd_zone), ofst);
-		if (ret != sizeof(struct zbd_zone)) {
-			fprintf(stderr, "Read zone information failed\n");
-			return -1;
-		}
+	if (ofst < 0 || (unsigned long long)ofst >= capacity) {
+		*nr_zones = 0;
+		return 0;
+	}
+	if (!len || (unsigned long long)(ofst + len) > capacity)
+		len = capacity - ofst;
 
-		if (zbd_dump_should_report_zone(&zone, opts->rep_opt)) {
-			memcpy(&zones[nz], &zone, sizeof(struct zbd_zone));
-			nz++;
-		}
+	zstart = ofst / info->zone_size;
+	zend = (ofst + len + info->zone_size - 1) / info->zone_size;
+	if (zend > info->nr_zones)
+		zend = info->nr_zones;
 
-		ofst += sizeof(struct zbd_zone);
+	for (i = zstart; i < zend; i++) {
+		if (zones && nz >= *nr_zones)
+			break;
+		if (!zbd_dump_should_report_zone(&map->zones[i], ro))
+			continue;
+		if (zones)
+			memcpy(&zones[nz], &map->zones[i],
+			       sizeof(struct zbd_zone));
+		nz++;
 	}
 
 	*nr_zones = nz;
@@ -145,183 +287,1592 @@ int zbd_dump_report_zones(int fd, struct zbd_opts *opts,
 	return 0;
 }
 
-#define ZBD_DUMP_IO_SIZE	(1024 * 1024)
+/*
+ * Same as zbd_dump_map_report_zones(), allocating the zone array like
+ * zbd_list_zones().
+ */
+int zbd_dump_map_list_zones(struct zbd_dump_map *map, off_t ofst, off_t len,
+			    enum zbd_report_option ro,
+			    struct zbd_zone **pzones, unsigned int *pnr_zones)
+{
+	struct zbd_zone *zones;
+	unsigned int nz;
+
+	zbd_dump_map_report_zones(map, ofst, len, ro, NULL, &nz);
+
+	zones = calloc(nz ? nz : 1, sizeof(struct zbd_zone));
+	if (!zones)
+		return -ENOMEM;
 
-static ssize_t zbd_dump_one_zone(int fd, struct zbd_opts *opts,
-				 struct zbd_zone *zone, int dump_fd, void *buf)
+	zbd_dump_map_report_zones(map, ofst, len, ro, zones, &nz);
+
+	*pzones = zones;
+	*pnr_zones = nz;
+
+	return 0;
+}
+
+int zbd_dump_report_zones(int fd, struct zbd_opts *opts,
+			  struct zbd_zone *zones, unsigned int *nr_zones)
 {
-	long long ofst, end;
-	ssize_t ret, iosize;
+	return zbd_dump_map_report_zones(opts->rep_map, opts->ofst, opts->len,
+					 opts->rep_opt, zones, nr_zones);
+}
 
-	/* Ignore offline zones */
-	if (zbd_zone_offline(zone))
-		return 0;
+/*
+ * Zone information dump file content.
+ */
+struct zbd_dump_info {
+	struct zbd_dump		hdr;
+	struct zbd_zone		*zones;
 
-	/* Copy zone data */
-	ofst = zbd_zone_start(zone);
-	if (zbd_zone_seq(zone) && !zbd_zone_full(zone))
-		end = zbd_zone_wp(zone);
-	else
-		end = ofst + zbd_zone_capacity(zone);
+	/* Incremental dumps only */
+	char			*base;
+	unsigned long long	*delta;
 
-	while (ofst < end) {
+	/* Zone data checksums */
+	uint32_t		*crc;
+};
 
-		if (ofst + ZBD_DUMP_IO_SIZE > end)
-			iosize = end - ofst;
-		else
-			iosize = ZBD_DUMP_IO_SIZE;
+static void zbd_dump_free_info(struct zbd_dump_info *di)
+{
+	free(di->zones);
+	free(di->base);
+	free(di->delta);
+	free(di->crc);
+	memset(di, 0, sizeof(struct zbd_dump_info));
+}
 
-		ret = zbd_read(fd, buf, iosize, ofst);
-		if (ret != iosize) {
-			fprintf(stderr, "Read zone data failed\n");
+/*
+ * Read or write count bytes at *ofst and advance *ofst, unless *ofst is
+ * negative, that is, for streams.
+ */
+static ssize_t zbd_dump_read_at(int fd, void *buf, size_t count, loff_t *ofst)
+{
+	ssize_t ret = zbd_read(fd, buf, count, *ofst);
+
+	if (ret > 0 && *ofst >= 0)
+		*ofst += ret;
+
+	return ret;
+}
+
+static ssize_t zbd_dump_write_at(int fd, void *buf, size_t count,
+				 loff_t *ofst)
+{
+	ssize_t ret = zbd_write(fd, buf, count, *ofst);
+
+	if (ret > 0 && *ofst >= 0)
+		*ofst += ret;
+
+	return ret;
+}
+
+/*
+ * Skip len bytes of data at *ofst.
+ */
+static int zbd_dump_skip(int fd, size_t len, loff_t *ofst)
+{
+	char buf[4096];
+	size_t sz;
+
+	if (*ofst >= 0) {
+		*ofst += len;
+		return 0;
+	}
+
+	while (len) {
+		sz = len < sizeof(buf) ? len : sizeof(buf);
+		if (zbd_read(fd, buf, sz, -1) != (ssize_t)sz)
 			return -1;
+		len -= sz;
+	}
+
+	return 0;
+}
+
+static int zbd_dump_read_ext(int fd, const char *path, loff_t *ofst,
+			     struct zbd_dump_info *di)
+{
+	unsigned int nr_zones = di->hdr.dev_info.nr_zones;
+	struct zbd_dump_ext ext;
+	ssize_t ret;
+	void *data;
+
+	for (;;) {
+		ret = zbd_dump_read_at(fd, &ext, sizeof(struct zbd_dump_ext),
+				       ofst);
+		if (ret != (ssize_t)sizeof(struct zbd_dump_ext))
+			goto err;
+
+		if (ext.type == ZBD_DUMP_EXT_END)
+			break;
+
+		if (ext.type != ZBD_DUMP_EXT_BASE &&
+		    ext.type != ZBD_DUMP_EXT_DELTA &&
+		    ext.type != ZBD_DUMP_EXT_CRC32C) {
+			if (zbd_dump_skip(fd, ext.len, ofst))
+				goto err;
+			continue;
 		}
 
-		ret = zbd_write(dump_fd, buf, iosize, ofst);
-		if (ret != iosize) {
-			fprintf(stderr, "Write zone data failed\n");
+		if ((ext.type == ZBD_DUMP_EXT_BASE &&
+		     (!ext.len || ext.len > PATH_MAX)) ||
+		    (ext.type == ZBD_DUMP_EXT_DELTA &&
+		     ext.len != sizeof(unsigned long long) * nr_zones) ||
+		    (ext.type == ZBD_DUMP_EXT_CRC32C &&
+		     ext.len != sizeof(uint32_t) * nr_zones))
+			goto err;
+
+		data = calloc(1, ext.len + 1);
+		if (!data) {
+			fprintf(stderr, "No memory\n");
 			return -1;
 		}
+		ret = zbd_dump_read_at(fd, data, ext.len, ofst);
+		if (ret != ext.len) {
+			free(data);
+			goto err;
+		}
 
-		ofst += iosize;
+		if (ext.type == ZBD_DUMP_EXT_BASE) {
+			free(di->base);
+			di->base = data;
+		} else if (ext.type == ZBD_DUMP_EXT_DELTA) {
+			free(di->delta);
+			di->delta = data;
+		} else {
+			free(di->crc);
+			di->crc = data;
+		}
 	}
 
-	return end - zbd_zone_start(zone);
+	if ((di->hdr.flags & ZBD_DUMP_INCREMENTAL) &&
+	    (!di->base || !di->delta))
+		goto err;
+
+	return 0;
+
+err:
+	fprintf(stderr, "Invalid zone information dump %s extensions\n", path);
+	return -1;
 }
 
-static int zbd_dump_zone_data(int fd, struct zbd_opts *opts,
-			      struct zbd_zone *zones, struct zbd_dump *dump)
+/*
+ * Read a zone information dump header, zone array and extensions from a
+ * file (ofst = 0) or from a stream (ofst = -1).
+ */
+static int zbd_dump_load_info(int fd, const char *path, loff_t ofst,
+			      struct zbd_dump_info *di)
 {
-	long long dumped_bytes = 0;
-	unsigned int dumped_zones = 0;
-	char *data_path = NULL;
-	int data_fd = 0;
-	unsigned int i;
-	ssize_t ret;
-	void *buf;
+	ssize_t ret, sz;
 
-	/* Get an IO buffer */
-	ret = posix_memalign(&buf, sysconf(_SC_PAGESIZE), ZBD_DUMP_IO_SIZE);
-	if (ret) {
-		fprintf(stderr, "No memory\n");
-		return -1;
-	}
+	memset(di, 0, sizeof(struct zbd_dump_info));
 
-	/* Dump zone data */
-	ret = asprintf(&data_path, "%s/%s_zone_data.dump",
-		       opts->dump_path, opts->dump_prefix);
+	ret = zbd_dump_read_at(fd, &di->hdr, sizeof(struct zbd_dump), &ofst);
+	if (ret != (ssize_t)sizeof(struct zbd_dump)) {
+		fprintf(stderr, "Read dump header failed\n");
+		goto err;
+	}
 
-	if (ret < 0) {
+	di->zones = calloc(di->hdr.dev_info.nr_zones, sizeof(struct zbd_zone));
+	if (!di->zones) {
 		fprintf(stderr, "No memory\n");
-		goto out;
+		goto err;
 	}
 
-	printf("    Dumping zones [%u..%u] data to %s (this may take a while)...\n",
-	       dump->zstart, dump->zend - 1, data_path);
-
-	data_fd = open(data_path, O_WRONLY | O_LARGEFILE | O_TRUNC | O_CREAT,
-		       0644);
-	if (data_fd < 0) {
-		fprintf(stderr, "Create data file %s failed %d (%s)\n",
-			data_path, errno, strerror(errno));
-		ret = -1;
-		goto out;
+	sz = sizeof(struct zbd_zone) * di->hdr.dev_info.nr_zones;
+	ret = zbd_dump_read_at(fd, di->zones, sz, &ofst);
+	if (ret != sz) {
+		fprintf(stderr, "Read zone information failed %zd %zd\n",
+			ret, sz);
+		goto err;
 	}
 
-	/*
-	 * Make sure that the zone data dump file size is always equal
-	 * to the device capacity, even for partial dumps.
-	 */
-	ret = ftruncate(data_fd, opts->dev_info.nr_sectors << 9);
-	if (ret) {
-		fprintf(stderr, "Truncate data file %s failed %d (%s)\n",
-			data_path, errno, strerror(errno));
-		goto out;
-	}
+	if ((di->hdr.flags & ZBD_DUMP_EXT) &&
+	    zbd_dump_read_ext(fd, path, &ofst, di))
+		goto err;
 
-	for (i = dump->zstart; i < dump->zend; i++) {
-		ret = zbd_dump_one_zone(fd, opts, &zones[i], data_fd, buf);
-		if (ret < 0)
-			goto out;
-		if (ret) {
-			dumped_bytes += ret;
-			dumped_zones++;
-		}
-	}
+	return 0;
 
-	printf("    Dumped %lld B from %u zones\n",
-	       dumped_bytes, dumped_zones);
+err:
+	zbd_dump_free_info(di);
+	return -1;
+}
 
-	ret = fsync(data_fd);
-	if (ret)
-		fprintf(stderr, "fsync data file %s failed %d (%s)\n",
-			data_path, errno, strerror(errno));
+static int zbd_dump_read_info(const char *path, struct zbd_dump_info *di)
+{
+	int fd, ret;
 
-out:
-	if (data_fd > 0)
-		close(data_fd);
-	free(data_path);
-	free(buf);
+	fd = open(path, O_RDONLY | O_LARGEFILE);
+	if (fd < 0) {
+		fprintf(stderr,
+			"Open zone information dump file %s failed %d (%s)\n",
+			path, errno, strerror(errno));
+		return -1;
+	}
+
+	ret = zbd_dump_load_info(fd, path, 0, di);
+	close(fd);
 
 	return ret;
 }
 
-static int zbd_dump_zone_info(int fd, struct zbd_opts *opts,
-			      struct zbd_zone *zones, struct zbd_dump *dump)
+static int zbd_dump_write_ext(int fd, loff_t *ofst, uint32_t type,
+			      void *data, uint32_t len)
 {
-	char *info_path = NULL;
-	int info_fd = 0;
-	ssize_t ret, sz;
+	struct zbd_dump_ext ext = {
+		.type = type,
+		.len = len,
+	};
+	ssize_t ret;
 
-	/* Dump zone information */
-	ret = asprintf(&info_path, "%s/%s_zone_info.dump",
-		       opts->dump_path, opts->dump_prefix);
-	if (ret < 0) {
-		fprintf(stderr, "No memory\n");
+	ret = zbd_dump_write_at(fd, &ext, sizeof(struct zbd_dump_ext), ofst);
+	if (ret != (ssize_t)sizeof(struct zbd_dump_ext))
 		return -1;
+
+	if (len) {
+		ret = zbd_dump_write_at(fd, data, len, ofst);
+		if (ret != len)
+			return -1;
 	}
 
-	printf("    Dumping zone information to %s\n", info_path);
+	return 0;
+}
 
-	info_fd = open(info_path, O_WRONLY | O_LARGEFILE | O_TRUNC | O_CREAT,
-		       0644);
-	if (info_fd < 0) {
-		fprintf(stderr, "Create file %s failed %d (%s)\n",
-			info_path, errno, strerror(errno));
-		ret = -1;
-		goto out;
-	}
+/*
+ * Write a zone information dump header, zone array and extensions to a
+ * file (ofst = 0) or to a stream (ofst = -1).
+ */
+static int zbd_dump_write_info(int fd, loff_t ofst, struct zbd_dump_info *di)
+{
+	unsigned int nr_zones = di->hdr.dev_info.nr_zones;
+	ssize_t ret, sz;
 
-	ret = zbd_write(info_fd, dump, sizeof(struct zbd_dump), 0);
+	ret = zbd_dump_write_at(fd, &di->hdr, sizeof(struct zbd_dump), &ofst);
 	if (ret != (ssize_t)sizeof(struct zbd_dump)) {
 		fprintf(stderr, "Write dump header failed\n");
-		ret = -1;
-		goto out;
+		return -1;
 	}
 
-	sz = sizeof(struct zbd_zone) * opts->dev_info.nr_zones;
-	ret = zbd_write(info_fd, zones, sz, sizeof(struct zbd_dump));
+	sz = sizeof(struct zbd_zone) * nr_zones;
+	ret = zbd_dump_write_at(fd, di->zones, sz, &ofst);
 	if (ret != sz) {
 		fprintf(stderr, "Write zone information failed\n");
-		ret = -1;
-		goto out;
+		return -1;
 	}
 
-	ret = fsync(info_fd);
-	if (ret)
-		fprintf(stderr, "fsync zone information file %s failed %d (%s)\n",
-			info_path, errno, strerror(errno));
+	if (!(di->hdr.flags & ZBD_DUMP_EXT))
+		return 0;
 
-out:
-	if (info_fd > 0)
-		close(info_fd);
-	free(info_path);
+	ret = 0;
+	if (di->hdr.flags & ZBD_DUMP_INCREMENTAL) {
+		ret = zbd_dump_write_ext(fd, &ofst, ZBD_DUMP_EXT_BASE,
+					 di->base, strlen(di->base) + 1);
+		if (!ret)
+			ret = zbd_dump_write_ext(fd, &ofst, ZBD_DUMP_EXT_DELTA,
+					di->delta,
+					sizeof(unsigned long long) * nr_zones);
+	}
+	if (!ret && di->crc)
+		ret = zbd_dump_write_ext(fd, &ofst, ZBD_DUMP_EXT_CRC32C,
+					 di->crc, sizeof(uint32_t) * nr_zones);
+	if (!ret)
+		ret = zbd_dump_write_ext(fd, &ofst, ZBD_DUMP_EXT_END, NULL, 0);
+	if (ret) {
+		fprintf(stderr, "Write zone information extensions failed\n");
+		return -1;
+	}
 
-	return ret;
+	return 0;
 }
 
-static void zbd_dump_prep_path(struct zbd_opts *opts)
-{
+/*
+ * Get the zone data file path corresponding to a zone information file path.
+ */
+static char *zbd_dump_data_path(const char *info_path,
+				enum zbd_dump_comp comp)
+{
+	const char *sfx = "_zone_info.dump";
+	size_t len = strlen(info_path), sfx_len = strlen(sfx);
+	char *data_path;
+
+	if (len < sfx_len || strcmp(info_path + len - sfx_len, sfx) != 0) {
+		fprintf(stderr, "Invalid zone information dump file name %s\n",
+			info_path);
+		return NULL;
+	}
+
+	if (asprintf(&data_path, "%.*s_zone_data.%s",
+		     (int)(len - sfx_len), info_path,
+		     comp ? "zdump" : "dump") < 0) {
+		fprintf(stderr, "No memory\n");
+		return NULL;
+	}
+
+	return data_path;
+}
+
+/*
+ * Compressed zone data file context.
+ */
+struct zbd_cdump {
+	int			fd;
+	enum zbd_dump_comp	comp;
+	size_t			chunk_size;
+	size_t			cbuf_size;
+	unsigned long long	zone_size;
+	unsigned int		nr_zones;
+	unsigned int		nr_chunks;
+	struct zbd_cdump_zone	*zones;
+	struct zbd_cdump_chunk	*chunks;
+
+	/* Start offset of the data saved for each zone */
+	unsigned long long	*data_start;
+
+	pthread_mutex_t		lock;
+	unsigned long long	data_end;
+	unsigned long long	data_len;
+};
+
+/*
+ * Get the end of a zone data, that is, the zone write pointer for sequential
+ * zones that are not full and the end of the zone capacity for other zones.
+ */
+static long long zbd_dump_zone_end(struct zbd_zone *zone)
+{
+	if (zbd_zone_seq(zone) && !zbd_zone_full(zone))
+		return zbd_zone_wp(zone);
+
+	return zbd_zone_start(zone) + zbd_zone_capacity(zone);
+}
+
+/*
+ * Get the restore pass of a zone. To avoid hitting the max active or max
+ * open zone limits of the target device, zones are restored in several
+ * passes, each pass handling one condition: conventional and full zones
+ * first, then closed zones, explicitly open zones and implicitly open zones.
+ * Return -1 for zones without data.
+ */
+static int zbd_dump_zone_pass(struct zbd_zone *zone)
+{
+	if (zbd_zone_offline(zone))
+		return -1;
+	if (zbd_zone_cnv(zone) || zbd_zone_full(zone))
+		return 0;
+	if (zbd_zone_closed(zone))
+		return 1;
+	if (zbd_zone_exp_open(zone))
+		return 2;
+	if (zbd_zone_imp_open(zone))
+		return 3;
+	return -1;
+}
+
+#define ZBD_DUMP_NR_PASSES	4
+
+static void zbd_cdump_free(struct zbd_cdump *cd)
+{
+	if (!cd)
+		return;
+
+	pthread_mutex_destroy(&cd->lock);
+	free(cd->zones);
+	free(cd->chunks);
+	free(cd->data_start);
+	free(cd);
+}
+
+static struct zbd_cdump *zbd_cdump_alloc(int fd, enum zbd_dump_comp comp,
+					 size_t chunk_size,
+					 struct zbd_zone *zones,
+					 unsigned int nr_zones,
+					 unsigned long long *delta)
+{
+	struct zbd_cdump *cd;
+	unsigned int i;
+
+	cd = calloc(1, sizeof(struct zbd_cdump));
+	if (!cd)
+		return NULL;
+
+	cd->fd = fd;
+	cd->comp = comp;
+	cd->chunk_size = chunk_size;
+	cd->cbuf_size = zbd_comp_bound(comp, chunk_size);
+	cd->nr_zones = nr_zones;
+	cd->zone_size = zbd_zone_len(&zones[0]);
+	pthread_mutex_init(&cd->lock, NULL);
+
+	cd->zones = calloc(nr_zones, sizeof(struct zbd_cdump_zone));
+	cd->data_start = calloc(nr_zones, sizeof(unsigned long long));
+	if (!cd->zones || !cd->data_start) {
+		zbd_cdump_free(cd);
+		return NULL;
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		if (delta)
+			cd->data_start[i] = delta[i];
+		else
+			cd->data_start[i] = zbd_zone_start(&zones[i]);
+	}
+
+	return cd;
+}
+
+/*
+ * Prepare a compressed zone data file for dumping the zones [zstart..zend).
+ * The chunks of all zones are indexed in advance using the zone data size.
+ */
+static struct zbd_cdump *zbd_cdump_create(int fd, struct zbd_opts *opts,
+					  struct zbd_zone *zones,
+					  struct zbd_dump *dump,
+					  unsigned long long *delta)
+{
+	struct zbd_cdump *cd;
+	unsigned long long len;
+	unsigned int i;
+
+	cd = zbd_cdump_alloc(fd, opts->comp, opts->io_size,
+			     zones, opts->dev_info.nr_zones, delta);
+	if (!cd)
+		return NULL;
+
+	for (i = dump->zstart; i < dump->zend; i++) {
+		if (zbd_zone_offline(&zones[i]))
+			continue;
+		len = zbd_dump_zone_end(&zones[i]) - cd->data_start[i];
+		cd->zones[i].data_len = len;
+		cd->zones[i].first_chunk = cd->nr_chunks;
+		cd->zones[i].nr_chunks =
+			(len + cd->chunk_size - 1) / cd->chunk_size;
+		cd->nr_chunks += cd->zones[i].nr_chunks;
+	}
+
+	cd->chunks = calloc(cd->nr_chunks + 1, sizeof(struct zbd_cdump_chunk));
+	if (!cd->chunks) {
+		zbd_cdump_free(cd);
+		return NULL;
+	}
+
+	/* Chunks data start after the file header */
+	cd->data_end = sizeof(struct zbd_cdump_hdr);
+
+	return cd;
+}
+
+/*
+ * Write the chunk index and the header of a compressed zone data file.
+ */
+static int zbd_cdump_finish(struct zbd_cdump *cd)
+{
+	struct zbd_cdump_hdr hdr;
+	ssize_t ret, sz;
+
+	memset(&hdr, 0, sizeof(struct zbd_cdump_hdr));
+	memcpy(hdr.magic, ZBD_CDUMP_MAGIC, sizeof(hdr.magic));
+	hdr.comp = cd->comp;
+	hdr.chunk_size = cd->chunk_size;
+	hdr.nr_zones = cd->nr_zones;
+	hdr.nr_chunks = cd->nr_chunks;
+	hdr.index_ofst = cd->data_end;
+
+	sz = sizeof(struct zbd_cdump_zone) * cd->nr_zones;
+	ret = zbd_write(cd->fd, cd->zones, sz, hdr.index_ofst);
+	if (ret != sz)
+		goto err;
+
+	sz = sizeof(struct zbd_cdump_chunk) * cd->nr_chunks;
+	ret = zbd_write(cd->fd, cd->chunks, sz,
+			hdr.index_ofst +
+			sizeof(struct zbd_cdump_zone) * cd->nr_zones);
+	if (ret != sz)
+		goto err;
+
+	ret = zbd_write(cd->fd, &hdr, sizeof(struct zbd_cdump_hdr), 0);
+	if (ret != (ssize_t)sizeof(struct zbd_cdump_hdr))
+		goto err;
+
+	return 0;
+
+err:
+	fprintf(stderr, "Write compressed zone data index failed\n");
+	return -1;
+}
+
+/*
+ * Load the header and index of a compressed zone data file.
+ */
+static struct zbd_cdump *zbd_cdump_open(int fd, struct zbd_opts *opts,
+					struct zbd_zone *zones,
+					unsigned long long *delta)
+{
+	struct zbd_cdump_hdr hdr;
+	struct zbd_cdump *cd;
+	ssize_t ret, sz;
+	unsigned int i;
+
+	ret = zbd_read(fd, &hdr, sizeof(struct zbd_cdump_hdr), 0);
+	if (ret != (ssize_t)sizeof(struct zbd_cdump_hdr) ||
+	    memcmp(hdr.magic, ZBD_CDUMP_MAGIC, sizeof(hdr.magic)) != 0) {
+		fprintf(stderr, "Invalid compressed zone data file\n");
+		return NULL;
+	}
+
+	if (!zbd_comp_supported(hdr.comp) ||
+	    hdr.comp == ZBD_DUMP_COMP_NONE) {
+		fprintf(stderr, "Unsupported zone data compression method %s\n",
+			zbd_comp_name(hdr.comp));
+		return NULL;
+	}
+
+	if (hdr.nr_zones != opts->dev_info.nr_zones || !hdr.chunk_size) {
+		fprintf(stderr, "Invalid compressed zone data file header\n");
+		return NULL;
+	}
+
+	cd = zbd_cdump_alloc(fd, hdr.comp, hdr.chunk_size,
+			     zones, hdr.nr_zones, delta);
+	if (!cd) {
+		fprintf(stderr, "No memory\n");
+		return NULL;
+	}
+	cd->nr_chunks = hdr.nr_chunks;
+
+	cd->chunks = calloc(cd->nr_chunks + 1, sizeof(struct zbd_cdump_chunk));
+	if (!cd->chunks) {
+		fprintf(stderr, "No memory\n");
+		goto err;
+	}
+
+	sz = sizeof(struct zbd_cdump_zone) * cd->nr_zones;
+	ret = zbd_read(fd, cd->zones, sz, hdr.index_ofst);
+	if (ret != sz)
+		goto err_index;
+
+	sz = sizeof(struct zbd_cdump_chunk) * cd->nr_chunks;
+	ret = zbd_read(fd, cd->chunks, sz, hdr.index_ofst +
+		       sizeof(struct zbd_cdump_zone) * cd->nr_zones);
+	if (ret != sz)
+		goto err_index;
+
+	/* Check the index against the dumped zone information */
+	for (i = 0; i < cd->nr_zones; i++) {
+		if (!cd->zones[i].data_len)
+			continue;
+		if (cd->zones[i].data_len != (unsigned long long)
+		    (zbd_dump_zone_end(&zones[i]) - cd->data_start[i]) ||
+		    cd->zones[i].nr_chunks !=
+		    (cd->zones[i].data_len + cd->chunk_size - 1) /
+		    cd->chunk_size ||
+		    cd->zones[i].first_chunk + cd->zones[i].nr_chunks >
+		    cd->nr_chunks) {
+			fprintf(stderr, "Invalid compressed zone %u index\n", i);
+			goto err;
+		}
+		cd->data_len += cd->zones[i].data_len;
+	}
+
+	cd->data_end = hdr.index_ofst;
+
+	return cd;
+
+err_index:
+	fprintf(stderr, "Read compressed zone data index failed\n");
+err:
+	zbd_cdump_free(cd);
+	return NULL;
+}
+
+/*
+ * Get the index entry of the chunk of zone data at ofst.
+ */
+static struct zbd_cdump_chunk *zbd_cdump_get_chunk(struct zbd_cdump *cd,
+						   long long ofst, size_t len)
+{
+	unsigned int zno = ofst / cd->zone_size;
+	struct zbd_cdump_zone *cz;
+	unsigned long long zofst, clen;
+	unsigned int c;
+
+	if (zno >= cd->nr_zones || ofst < (long long)cd->data_start[zno])
+		return NULL;
+	zofst = ofst - cd->data_start[zno];
+
+	/* All chunks except the last one of a zone are full */
+	cz = &cd->zones[zno];
+	c = zofst / cd->chunk_size;
+	if (zofst % cd->chunk_size || c >= cz->nr_chunks)
+		return NULL;
+	clen = cz->data_len - zofst;
+	if (clen > cd->chunk_size)
+		clen = cd->chunk_size;
+	if (len != clen)
+		return NULL;
+
+	return &cd->chunks[cz->first_chunk + c];
+}
+
+/*
+ * Compress a chunk of zone data and append it to the data file. Chunks that
+ * do not compress are stored as is.
+ */
+static int zbd_cdump_write_chunk(struct zbd_cdump *cd, void *cbuf,
+				 void *buf, size_t len, long long ofst)
+{
+	struct zbd_cdump_chunk *chunk;
+	unsigned long long data_ofst;
+	ssize_t clen, ret;
+	void *data = cbuf;
+
+	chunk = zbd_cdump_get_chunk(cd, ofst, len);
+	if (!chunk) {
+		fprintf(stderr, "Invalid zone data chunk at %lld\n", ofst);
+		return -1;
+	}
+
+	clen = zbd_compress(cd->comp, cbuf, cd->cbuf_size, buf, len);
+	if (clen < 0 || (size_t)clen >= len) {
+		chunk->flags = ZBD_CDUMP_CHUNK_RAW;
+		clen = len;
+		data = buf;
+	}
+
+	pthread_mutex_lock(&cd->lock);
+	data_ofst = cd->data_end;
+	cd->data_end += clen;
+	cd->data_len += len;
+	pthread_mutex_unlock(&cd->lock);
+
+	ret = zbd_write(cd->fd, data, clen, data_ofst);
+	if (ret != clen)
+		return -1;
+
+	chunk->ofst = data_ofst;
+	chunk->len = clen;
+
+	return 0;
+}
+
+/*
+ * Read and decompress the chunk of zone data at ofst.
+ */
+static int zbd_cdump_read_chunk(struct zbd_cdump *cd, void *cbuf,
+				void *buf, size_t len, long long ofst)
+{
+	struct zbd_cdump_chunk *chunk;
+	ssize_t ret;
+
+	chunk = zbd_cdump_get_chunk(cd, ofst, len);
+	if (!chunk || chunk->len > cd->cbuf_size ||
+	    chunk->ofst + chunk->len > cd->data_end) {
+		fprintf(stderr, "Invalid zone data chunk at %lld\n", ofst);
+		return -1;
+	}
+
+	if (chunk->flags & ZBD_CDUMP_CHUNK_RAW) {
+		if (chunk->len != len)
+			goto err;
+		ret = zbd_read(cd->fd, buf, len, chunk->ofst);
+		if (ret != (ssize_t)len)
+			goto err;
+		return 0;
+	}
+
+	ret = zbd_read(cd->fd, cbuf, chunk->len, chunk->ofst);
+	if (ret != chunk->len)
+		goto err;
+
+	ret = zbd_decompress(cd->comp, buf, len, cbuf, chunk->len);
+	if (ret != (ssize_t)len)
+		goto err;
+
+	return 0;
+
+err:
+	fprintf(stderr, "Read compressed zone data chunk at %lld failed\n",
+		ofst);
+	return -1;
+}
+
+/*
+ * Zone data copy pipeline: the caller thread reads chunks of data into a
+ * ring of buffers and a writer thread writes the buffers in the same order.
+ * This allows reads and writes to proceed concurrently, with up to io_depth
+ * chunks of data in flight. With a compressed zone data file, chunks are
+ * compressed by the writer thread or decompressed by the reader.
+ */
+struct zbd_xfer_chunk {
+	void			*buf;
+	long long		ofst;
+	size_t			len;
+	uint32_t		*crc;
+};
+
+struct zbd_xfer {
+	int			in_fd;
+	int			out_fd;
+	struct zbd_buf_pool	*pool;
+	size_t			io_size;
+	unsigned int		io_depth;
+	struct zbd_xfer_chunk	*chunks;
+
+	/* Compressed input or output zone data file and compression buffer */
+	struct zbd_cdump	*cd_in;
+	struct zbd_cdump	*cd_out;
+	void			*cbuf;
+	size_t			cbuf_size;
+
+	/* Sequential input or output stream */
+	bool			in_stream;
+	bool			out_stream;
+
+	/*
+	 * If not NULL, CRC32C of the data copied, updated by the writer
+	 * thread. This must be set only when no data is queued.
+	 */
+	uint32_t		*crc;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	pthread_t		writer;
+	unsigned int		head;
+	unsigned int		nr_queued;
+	bool			stop;
+	int			err;
+};
+
+static void *zbd_xfer_writer(void *arg)
+{
+	struct zbd_xfer *x = arg;
+	struct zbd_xfer_chunk *c;
+	unsigned int tail = 0;
+	ssize_t ret;
+
+	pthread_mutex_lock(&x->lock);
+
+	for (;;) {
+		while (!x->nr_queued && !x->stop)
+			pthread_cond_wait(&x->cond, &x->lock);
+		if (!x->nr_queued)
+			break;
+
+		c = &x->chunks[tail];
+		pthread_mutex_unlock(&x->lock);
+
+		if (c->crc)
+			*c->crc = zbd_crc32c(*c->crc, c->buf, c->len);
+
+		if (x->out_fd < 0)
+			ret = c->len;
+		else if (x->cd_out)
+			ret = zbd_cdump_write_chunk(x->cd_out, x->cbuf, c->buf,
+						    c->len, c->ofst) ?
+				-1 : (ssize_t)c->len;
+		else
+			ret = zbd_write(x->out_fd, c->buf, c->len,
+					x->out_stream ? -1 : c->ofst);
+
+		pthread_mutex_lock(&x->lock);
+		if (ret != (ssize_t)c->len && !x->err) {
+			fprintf(stderr, "Write data at %lld failed\n", c->ofst);
+			x->err = -1;
+		}
+		tail = (tail + 1) % x->io_depth;
+		x->nr_queued--;
+		pthread_cond_broadcast(&x->cond);
+	}
+
+	pthread_mutex_unlock(&x->lock);
+
+	return NULL;
+}
+
+/*
+ * Start a transfer pipeline. At most one of the input or output file can be
+ * a compressed zone data file, indicated with cd. For a pipe input or output,
+ * in_stream or out_stream must be set before the first copy. If out_fd is
+ * negative, the data is only read (e.g. to compute its checksum).
+ */
+static int zbd_xfer_start(struct zbd_xfer *x, int in_fd, int out_fd,
+			  struct zbd_buf_pool *pool, size_t io_size,
+			  unsigned int io_depth, struct zbd_cdump *cd)
+{
+	unsigned int i;
+	int ret;
+
+	memset(x, 0, sizeof(struct zbd_xfer));
+	x->in_fd = in_fd;
+	x->out_fd = out_fd;
+	x->pool = pool;
+	x->io_size = io_size;
+	x->io_depth = io_depth;
+	if (cd && cd->fd == in_fd)
+		x->cd_in = cd;
+	else
+		x->cd_out = cd;
+
+	x->chunks = calloc(io_depth, sizeof(struct zbd_xfer_chunk));
+	if (cd) {
+		x->cbuf_size = cd->cbuf_size;
+		x->cbuf = malloc(x->cbuf_size);
+	}
+	if (!x->chunks || (cd && !x->cbuf)) {
+		fprintf(stderr, "No memory\n");
+		free(x->chunks);
+		free(x->cbuf);
+		x->chunks = NULL;
+		return -1;
+	}
+
+	for (i = 0; i < io_depth; i++) {
+		x->chunks[i].buf = zbd_buf_get(pool);
+		if (!x->chunks[i].buf) {
+			fprintf(stderr, "No memory\n");
+			goto err;
+		}
+	}
+
+	pthread_mutex_init(&x->lock, NULL);
+	pthread_cond_init(&x->cond, NULL);
+
+	ret = pthread_create(&x->writer, NULL, zbd_xfer_writer, x);
+	if (ret) {
+		fprintf(stderr, "Create writer thread failed %d (%s)\n",
+			ret, strerror(ret));
+		pthread_cond_destroy(&x->cond);
+		pthread_mutex_destroy(&x->lock);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	for (i = 0; i < io_depth && x->chunks[i].buf; i++)
+		zbd_buf_put(pool, x->chunks[i].buf);
+	free(x->chunks);
+	free(x->cbuf);
+	x->chunks = NULL;
+	return -1;
+}
+
+/*
+ * Change the input file of a transfer. The compression buffer must be large
+ * enough for the new input compressed zone data file, if any. io_size must
+ * not exceed the size of the transfer buffers.
+ */
+static int zbd_xfer_set_input(struct zbd_xfer *x, int in_fd,
+			      struct zbd_cdump *cd, size_t io_size)
+{
+	void *cbuf;
+
+	if (cd && cd->cbuf_size > x->cbuf_size) {
+		cbuf = realloc(x->cbuf, cd->cbuf_size);
+		if (!cbuf) {
+			fprintf(stderr, "No memory\n");
+			return -1;
+		}
+		x->cbuf = cbuf;
+		x->cbuf_size = cd->cbuf_size;
+	}
+
+	x->in_fd = in_fd;
+	x->cd_in = cd;
+	x->io_size = io_size;
+
+	return 0;
+}
+
+/*
+ * Wait for all queued chunks to be written.
+ */
+static int zbd_xfer_wait(struct zbd_xfer *x)
+{
+	int ret;
+
+	pthread_mutex_lock(&x->lock);
+	while (x->nr_queued)
+		pthread_cond_wait(&x->cond, &x->lock);
+	ret = x->err;
+	pthread_mutex_unlock(&x->lock);
+
+	return ret;
+}
+
+static int zbd_xfer_stop(struct zbd_xfer *x)
+{
+	unsigned int i;
+
+	if (!x->chunks)
+		return -1;
+
+	pthread_mutex_lock(&x->lock);
+	x->stop = true;
+	pthread_cond_broadcast(&x->cond);
+	pthread_mutex_unlock(&x->lock);
+
+	pthread_join(x->writer, NULL);
+	pthread_cond_destroy(&x->cond);
+	pthread_mutex_destroy(&x->lock);
+
+	for (i = 0; i < x->io_depth; i++)
+		zbd_buf_put(x->pool, x->chunks[i].buf);
+	free(x->chunks);
+	free(x->cbuf);
+	x->chunks = NULL;
+
+	return x->err;
+}
+
+/*
+ * Copy the data in the range [ofst..end) from the transfer input file to
+ * the same offset of the transfer output file. The data may not be written
+ * yet when this returns: use zbd_xfer_wait() to wait for the writes.
+ */
+static int zbd_xfer_copy(struct zbd_xfer *x, long long ofst, long long end)
+{
+	struct zbd_xfer_chunk *c;
+	ssize_t ret, iosize;
+
+	while (ofst < end) {
+
+		if (ofst + (long long)x->io_size > end)
+			iosize = end - ofst;
+		else
+			iosize = x->io_size;
+
+		/* Wait for a free buffer */
+		pthread_mutex_lock(&x->lock);
+		while (x->nr_queued == x->io_depth && !x->err)
+			pthread_cond_wait(&x->cond, &x->lock);
+		ret = x->err;
+		c = &x->chunks[x->head];
+		pthread_mutex_unlock(&x->lock);
+		if (ret)
+			return -1;
+
+		if (x->cd_in)
+			ret = zbd_cdump_read_chunk(x->cd_in, x->cbuf, c->buf,
+						   iosize, ofst) ? -1 : iosize;
+		else
+			ret = zbd_read(x->in_fd, c->buf, iosize,
+				       x->in_stream ? -1 : ofst);
+		if (ret != iosize) {
+			fprintf(stderr, "Read data at %lld failed\n", ofst);
+			return -1;
+		}
+		c->ofst = ofst;
+		c->len = iosize;
+		c->crc = x->crc;
+
+		/* Queue the buffer for writing */
+		pthread_mutex_lock(&x->lock);
+		x->head = (x->head + 1) % x->io_depth;
+		x->nr_queued++;
+		pthread_cond_broadcast(&x->cond);
+		pthread_mutex_unlock(&x->lock);
+
+		ofst += iosize;
+	}
+
+	return 0;
+}
+
+/*
+ * Check the I/O size and depth options and set their default values.
+ */
+static int zbd_dump_check_io_opts(struct zbd_opts *opts)
+{
+	if (!opts->io_size)
+		opts->io_size = ZBD_DUMP_IO_SIZE;
+	if (!opts->io_depth)
+		opts->io_depth = ZBD_DUMP_IO_DEPTH;
+
+	if (opts->io_size % opts->dev_info.lblock_size) {
+		fprintf(stderr,
+			"Invalid I/O size: must be a multiple of %u B\n",
+			opts->dev_info.lblock_size);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Zero-copy zone data transfer methods. A method failing with an error
+ * indicating that it is not supported for the device or dump file is not
+ * used again, and the next method is tried.
+ */
+#define ZBD_ZC_COPY_RANGE	(1 << 0)
+#define ZBD_ZC_SENDFILE		(1 << 1)
+#define ZBD_ZC_SPLICE		(1 << 2)
+
+struct zbd_zcopy {
+	int			in_fd;
+	int			out_fd;
+	int			pipe_fd[2];
+	size_t			pipe_size;
+	unsigned int		methods;
+};
+
+static int zbd_zcopy_init(struct zbd_zcopy *zc, int in_fd,
+			  const char *out_path, size_t io_size)
+{
+	int ret;
+
+	memset(zc, 0, sizeof(struct zbd_zcopy));
+	zc->in_fd = in_fd;
+	zc->pipe_fd[0] = -1;
+	zc->pipe_fd[1] = -1;
+	zc->methods = ZBD_ZC_COPY_RANGE | ZBD_ZC_SENDFILE | ZBD_ZC_SPLICE;
+
+	/*
+	 * sendfile() writes at the output file position, so use a private
+	 * file descriptor for the output file.
+	 */
+	zc->out_fd = open(out_path, O_WRONLY | O_LARGEFILE);
+	if (zc->out_fd < 0) {
+		fprintf(stderr, "Open %s failed %d (%s)\n",
+			out_path, errno, strerror(errno));
+		return -1;
+	}
+
+	if (pipe(zc->pipe_fd)) {
+		zc->methods &= ~ZBD_ZC_SPLICE;
+		return 0;
+	}
+
+	/* Try to size the pipe to hold a full I/O */
+	ret = fcntl(zc->pipe_fd[1], F_SETPIPE_SZ, io_size);
+	if (ret < 0)
+		ret = fcntl(zc->pipe_fd[1], F_GETPIPE_SZ);
+	if (ret <= 0) {
+		close(zc->pipe_fd[0]);
+		close(zc->pipe_fd[1]);
+		zc->pipe_fd[0] = -1;
+		zc->pipe_fd[1] = -1;
+		zc->methods &= ~ZBD_ZC_SPLICE;
+		return 0;
+	}
+	zc->pipe_size = ret;
+
+	return 0;
+}
+
+static void zbd_zcopy_fini(struct zbd_zcopy *zc)
+{
+	if (zc->pipe_fd[0] >= 0) {
+		close(zc->pipe_fd[0]);
+		close(zc->pipe_fd[1]);
+	}
+	if (zc->out_fd > 0)
+		close(zc->out_fd);
+}
+
+static bool zbd_zcopy_unsupported(int err)
+{
+	return err == EINVAL || err == EXDEV || err == ENOSYS ||
+		err == EOPNOTSUPP || err == EBADF;
+}
+
+/*
+ * Move data from the input file to the output file through the pipe.
+ * Data read into the pipe must always be fully written out, so only an
+ * error for the first splice() call can be recovered from.
+ */
+static ssize_t zbd_zcopy_splice(struct zbd_zcopy *zc, long long ofst,
+				size_t len)
+{
+	loff_t in_ofst = ofst, out_ofst = ofst;
+	ssize_t ret, count;
+
+	if (len > zc->pipe_size)
+		len = zc->pipe_size;
+
+	count = splice(zc->in_fd, &in_ofst, zc->pipe_fd[1], NULL, len,
+		       SPLICE_F_MOVE);
+	if (count <= 0)
+		return count;
+
+	len = count;
+	while (len) {
+		ret = splice(zc->pipe_fd[0], NULL, zc->out_fd, &out_ofst, len,
+			     SPLICE_F_MOVE);
+		if (ret <= 0) {
+			fprintf(stderr, "splice to dump file failed %d (%s)\n",
+				errno, strerror(errno));
+			errno = EIO;
+			return -1;
+		}
+		len -= ret;
+	}
+
+	return count;
+}
+
+/*
+ * Copy the range [*ofst..end) of zone data without copying it through a
+ * user buffer. On return, *ofst indicates the start of the data that
+ * remains to be copied using regular reads and writes.
+ */
+static int zbd_zcopy(struct zbd_zcopy *zc, struct zbd_zone *zone,
+		     long long *ofst, long long end)
+{
+	loff_t in_ofst, out_ofst;
+	unsigned int method;
+	long long pos = *ofst;
+	size_t len;
+	ssize_t ret;
+
+	while (pos < end) {
+		len = end - pos;
+		in_ofst = pos;
+		out_ofst = pos;
+
+		if (zc->methods & ZBD_ZC_COPY_RANGE) {
+			method = ZBD_ZC_COPY_RANGE;
+			ret = copy_file_range(zc->in_fd, &in_ofst,
+					      zc->out_fd, &out_ofst, len, 0);
+		} else if (zbd_zone_cnv(zone) &&
+			   (zc->methods & ZBD_ZC_SENDFILE)) {
+			method = ZBD_ZC_SENDFILE;
+			if (lseek(zc->out_fd, pos, SEEK_SET) != pos)
+				ret = -1;
+			else
+				ret = sendfile(zc->out_fd, zc->in_fd,
+					       &in_ofst, len);
+		} else if (zc->methods & ZBD_ZC_SPLICE) {
+			method = ZBD_ZC_SPLICE;
+			ret = zbd_zcopy_splice(zc, pos, len);
+		} else {
+			break;
+		}
+
+		if (ret < 0 && zbd_zcopy_unsupported(errno)) {
+			zc->methods &= ~method;
+			continue;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "Copy zone data at %lld failed %d (%s)\n",
+				pos, errno, strerror(errno));
+			return -1;
+		}
+		if (!ret) {
+			fprintf(stderr, "Copy zone data at %lld: no data\n",
+				pos);
+			return -1;
+		}
+
+		pos += ret;
+	}
+
+	*ofst = pos;
+
+	return 0;
+}
+
+/*
+ * Dump the zone data from start to the end of the zone data.
+ */
+static ssize_t zbd_dump_one_zone(struct zbd_xfer *x, struct zbd_zcopy *zc,
+				 struct zbd_zone *zone, long long start)
+{
+	long long ofst = start, end;
+
+	/* Ignore offline zones */
+	if (zbd_zone_offline(zone))
+		return 0;
+
+	/* Copy zone data */
+	end = zbd_dump_zone_end(zone);
+	if (ofst >= end)
+		return 0;
+
+	if (zc && zbd_zcopy(zc, zone, &ofst, end))
+		return -1;
+
+	if (zbd_xfer_copy(x, ofst, end))
+		return -1;
+
+	return end - start;
+}
+
+/*
+ * Zone data dump context shared by all dump workers.
+ */
+struct zbd_dump_job {
+	int			fd;
+	int			data_fd;
+	char			*data_path;
+	struct zbd_opts		*opts;
+	struct zbd_zone		*zones;
+	struct zbd_buf_pool	*pool;
+	struct zbd_cdump	*cd;
+	unsigned long long	*delta;
+	uint32_t		*crc;
+
+	pthread_mutex_t		lock;
+	unsigned int		next_zone;
+	unsigned int		zend;
+	long long		dumped_bytes;
+	unsigned int		dumped_zones;
+	int			ret;
+};
+
+/*
+ * Dump worker: dump zones one at a time until all zones of the dump range
+ * are processed or an error is detected by any worker.
+ */
+static void *zbd_dump_worker(void *arg)
+{
+	struct zbd_dump_job *job = arg;
+	struct zbd_zcopy zcopy, *zc = NULL;
+	struct zbd_xfer x;
+	unsigned int zno;
+	ssize_t ret;
+
+	if (job->opts->zero_copy) {
+		zc = &zcopy;
+		if (zbd_zcopy_init(zc, job->fd, job->data_path,
+				   job->opts->io_size)) {
+			zbd_zcopy_fini(zc);
+			goto err;
+		}
+	}
+
+	if (zbd_xfer_start(&x, job->fd, job->data_fd, job->pool,
+			   job->opts->io_size, job->opts->io_depth, job->cd)) {
+		if (zc)
+			zbd_zcopy_fini(zc);
+		goto err;
+	}
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		if (job->ret || job->next_zone >= job->zend) {
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+		zno = job->next_zone++;
+		pthread_mutex_unlock(&job->lock);
+
+		x.crc = job->crc ? &job->crc[zno] : NULL;
+		ret = zbd_dump_one_zone(&x, zc, &job->zones[zno],
+					job->delta ? job->delta[zno] :
+					zbd_zone_start(&job->zones[zno]));
+
+		pthread_mutex_lock(&job->lock);
+		if (ret < 0) {
+			job->ret = -1;
+		} else if (ret) {
+			job->dumped_bytes += ret;
+			job->dumped_zones++;
+		}
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	if (zc)
+		zbd_zcopy_fini(zc);
+
+	if (!zbd_xfer_stop(&x))
+		return NULL;
+
+err:
+	pthread_mutex_lock(&job->lock);
+	job->ret = -1;
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
+}
+
+static int zbd_dump_zone_data(int fd, struct zbd_opts *opts,
+			      struct zbd_dump_info *di)
+{
+	struct zbd_dump *dump = &di->hdr;
+	struct zbd_dump_job job;
+	unsigned int i, nr_jobs = opts->nr_jobs;
+	pthread_t *threads = NULL;
+	char *data_path = NULL;
+	ssize_t ret;
+
+	memset(&job, 0, sizeof(struct zbd_dump_job));
+	job.fd = fd;
+	job.opts = opts;
+	job.zones = di->zones;
+	job.delta = di->delta;
+	job.crc = di->crc;
+	job.next_zone = dump->zstart;
+	job.zend = dump->zend;
+	pthread_mutex_init(&job.lock, NULL);
+
+	/* Do not use more workers than there are zones to dump */
+	if (!nr_jobs)
+		nr_jobs = 1;
+	if (nr_jobs > dump->zend - dump->zstart)
+		nr_jobs = dump->zend - dump->zstart;
+
+	/* Get the IO buffers of all workers */
+	job.pool = zbd_buf_pool_alloc(fd, opts->io_size,
+				      nr_jobs * opts->io_depth, 0);
+	threads = calloc(nr_jobs, sizeof(pthread_t));
+	if (!job.pool || !threads) {
+		fprintf(stderr, "No memory\n");
+		ret = -1;
+		goto out;
+	}
+
+	/* Dump zone data */
+	ret = asprintf(&data_path, "%s/%s_zone_data.%s",
+		       opts->dump_path, opts->dump_prefix,
+		       opts->comp ? "zdump" : "dump");
+
+	if (ret < 0) {
+		fprintf(stderr, "No memory\n");
+		goto out;
+	}
+	job.data_path = data_path;
+
+	printf("    Dumping zones [%u..%u] data to %s (this may take a while)...\n",
+	       dump->zstart, dump->zend - 1, data_path);
+
+	job.data_fd = open(data_path,
+			   O_WRONLY | O_LARGEFILE | O_TRUNC | O_CREAT, 0644);
+	if (job.data_fd < 0) {
+		fprintf(stderr, "Create data file %s failed %d (%s)\n",
+			data_path, errno, strerror(errno));
+		ret = -1;
+		goto out;
+	}
+
+	if (opts->comp) {
+		/* Compressed zone data file */
+		printf("    Compressing zone data using %s, %zu B chunks\n",
+		       zbd_comp_name(opts->comp), opts->io_size);
+		job.cd = zbd_cdump_create(job.data_fd, opts, di->zones, dump,
+					  di->delta);
+		if (!job.cd) {
+			fprintf(stderr, "No memory\n");
+			ret = -1;
+			goto out;
+		}
+	} else {
+		/*
+		 * Make sure that the zone data dump file size is always equal
+		 * to the device capacity, even for partial dumps.
+		 */
+		ret = ftruncate(job.data_fd, opts->dev_info.nr_sectors << 9);
+		if (ret) {
+			fprintf(stderr, "Truncate data file %s failed %d (%s)\n",
+				data_path, errno, strerror(errno));
+			goto out;
+		}
+	}
+
+	if (nr_jobs > 1)
+		printf("    Using %u dump workers\n", nr_jobs);
+
+	for (i = 0; i < nr_jobs; i++) {
+		ret = pthread_create(&threads[i], NULL, zbd_dump_worker, &job);
+		if (ret) {
+			fprintf(stderr, "Create dump worker failed %d (%s)\n",
+				(int)ret, strerror(ret));
+			pthread_mutex_lock(&job.lock);
+			job.ret = -1;
+			pthread_mutex_unlock(&job.lock);
+			break;
+		}
+	}
+
+	/* Wait for all workers that were started */
+	nr_jobs = i;
+	for (i = 0; i < nr_jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	ret = job.ret;
+	if (ret)
+		goto out;
+
+	printf("    Dumped %lld B from %u zones\n",
+	       job.dumped_bytes, job.dumped_zones);
+
+	if (job.cd) {
+		ret = zbd_cdump_finish(job.cd);
+		if (ret)
+			goto out;
+		printf("    Compressed zone data: %llu B\n",
+		       job.cd->data_end - sizeof(struct zbd_cdump_hdr));
+	}
+
+	ret = fsync(job.data_fd);
+	if (ret)
+		fprintf(stderr, "fsync data file %s failed %d (%s)\n",
+			data_path, errno, strerror(errno));
+
+out:
+	if (job.data_fd > 0)
+		close(job.data_fd);
+	free(data_path);
+	free(threads);
+	zbd_cdump_free(job.cd);
+	zbd_buf_pool_free(job.pool);
+	pthread_mutex_destroy(&job.lock);
+
+	return ret;
+}
+
+static int zbd_dump_zone_info(int fd, struct zbd_opts *opts,
+			      struct zbd_dump_info *di)
+{
+	char *info_path = NULL;
+	int info_fd = 0;
+	ssize_t ret;
+
+	/* Dump zone information */
+	ret = asprintf(&info_path, "%s/%s_zone_info.dump",
+		       opts->dump_path, opts->dump_prefix);
+	if (ret < 0) {
+		fprintf(stderr, "No memory\n");
+		return -1;
+	}
+
+	printf("    Dumping zone information to %s\n", info_path);
+
+	info_fd = open(info_path, O_WRONLY | O_LARGEFILE | O_TRUNC | O_CREAT,
+		       0644);
+	if (info_fd < 0) {
+		fprintf(stderr, "Create file %s failed %d (%s)\n",
+			info_path, errno, strerror(errno));
+		ret = -1;
+		goto out;
+	}
+
+	ret = zbd_dump_write_info(info_fd, 0, di);
+	if (ret)
+		goto out;
+
+	ret = fsync(info_fd);
+	if (ret)
+		fprintf(stderr, "fsync zone information file %s failed %d (%s)\n",
+			info_path, errno, strerror(errno));
+
+out:
+	if (info_fd > 0)
+		close(info_fd);
+	free(info_path);
+
+	return ret;
+}
+
+/*
+ * Dump the zone information and zone data to a stream.
+ */
+static int zbd_dump_stream(int fd, struct zbd_opts *opts,
+			   struct zbd_dump_info *di)
+{
+	struct zbd_dump *dump = &di->hdr;
+	struct zbd_dump_stream_zone rec;
+	struct zbd_buf_pool *pool;
+	long long dumped_bytes = 0;
+	unsigned int dumped_zones = 0;
+	struct zbd_zone *zone;
+	struct zbd_xfer x;
+	unsigned int i;
+	uint32_t crc;
+	int p, ret;
+
+	printf("    Dumping zones [%u..%u] to standard output (this may take a while)...\n",
+	       dump->zstart, dump->zend - 1);
+
+	ret = zbd_dump_write_info(opts->stream_fd, -1, di);
+	if (ret)
+		return ret;
+
+	pool = zbd_buf_pool_alloc(fd, opts->io_size, opts->io_depth, 0);
+	if (!pool) {
+		fprintf(stderr, "No memory\n");
+		return -1;
+	}
+
+	ret = zbd_xfer_start(&x, fd, opts->stream_fd, pool, opts->io_size,
+			     opts->io_depth, NULL);
+	if (ret)
+		goto out;
+	x.out_stream = true;
+	x.crc = &crc;
+
+	/*
+	 * Save zones in restore order, one pass at a time. The record header
+	 * and the checksum of the zone data are written once all the zone
+	 * data is written.
+	 */
+	for (p = 0; p < ZBD_DUMP_NR_PASSES; p++) {
+		for (i = dump->zstart; i < dump->zend; i++) {
+			zone = &di->zones[i];
+			if (zbd_dump_zone_pass(zone) != p)
+				continue;
+
+			memset(&rec, 0, sizeof(struct zbd_dump_stream_zone));
+			rec.zno = i;
+			rec.flags = ZBD_DUMP_STREAM_CRC32C;
+			rec.len = zbd_dump_zone_end(zone) -
+				zbd_zone_start(zone);
+			if (zbd_write(opts->stream_fd, &rec, sizeof(rec), -1) !=
+			    sizeof(rec)) {
+				fprintf(stderr, "Write zone %u record failed\n",
+					i);
+				ret = -1;
+				goto out;
+			}
+
+			crc = 0;
+			ret = zbd_xfer_copy(&x, zbd_zone_start(zone),
+					    zbd_dump_zone_end(zone));
+			if (!ret)
+				ret = zbd_xfer_wait(&x);
+			if (ret)
+				goto out;
+
+			if (zbd_write(opts->stream_fd, &crc, sizeof(crc), -1) !=
+			    sizeof(crc)) {
+				fprintf(stderr, "Write zone %u checksum failed\n",
+					i);
+				ret = -1;
+				goto out;
+			}
+
+			if (rec.len) {
+				dumped_bytes += rec.len;
+				dumped_zones++;
+			}
+		}
+	}
+
+	ret = zbd_xfer_wait(&x);
+	if (ret)
+		goto out;
+
+	memset(&rec, 0, sizeof(struct zbd_dump_stream_zone));
+	rec.flags = ZBD_DUMP_STREAM_END;
+	if (zbd_write(opts->stream_fd, &rec, sizeof(rec), -1) != sizeof(rec)) {
+		fprintf(stderr, "Write end record failed\n");
+		ret = -1;
+		goto out;
+	}
+
+	printf("    Dumped %lld B from %u zones\n",
+	       dumped_bytes, dumped_zones);
+
+out:
+	if (x.chunks && zbd_xfer_stop(&x) && !ret)
+		ret = -1;
+	zbd_buf_pool_free(pool);
+
+	return ret;
+}
+
+static void zbd_dump_prep_path(struct zbd_opts *opts)
+{
 	if (!opts->dump_path) {
 		opts->dump_path = get_current_dir_name();
 		if (!opts->dump_path)
@@ -332,24 +1883,188 @@ static void zbd_dump_prep_path(struct zbd_opts *opts)
 		opts->dump_prefix = basename(opts->dev_path);
 }
 
+/*
+ * Check that the zone data in [start..end) is unchanged since the base dump,
+ * using the base dump zone data checksum. Return 1 if the data is unchanged,
+ * 0 if it changed and -1 on error.
+ */
+static int zbd_dump_check_base_data(int fd, struct zbd_opts *opts,
+				    void *buf, unsigned long long start,
+				    unsigned long long end, uint32_t base_crc)
+{
+	uint32_t crc = 0;
+	size_t len;
+	ssize_t ret;
+
+	while (start < end) {
+		len = opts->io_size;
+		if (len > end - start)
+			len = end - start;
+		ret = zbd_read(fd, buf, len, start);
+		if (ret < 0)
+			return -1;
+		if ((size_t)ret != len) {
+			fprintf(stderr, "Short read at %llu\n", start);
+			return -1;
+		}
+		crc = zbd_crc32c(crc, buf, len);
+		start += len;
+	}
+
+	return crc == base_crc;
+}
+
+/*
+ * For an incremental dump, get the start offset of the data to save for each
+ * zone: the end of the zone data saved in the base dump for sequential zones
+ * that were not reset since the base dump, and the zone start for other
+ * zones. A zone with a write pointer that went backward was reset. A zone
+ * reset and rewritten up to or beyond its write pointer in the base dump is
+ * detected by checking its data against the base dump zone data checksum.
+ * Without base dump checksums, zones that were full in the base dump, which
+ * are the zones most likely to be reset and rewritten, are saved entirely.
+ */
+static int zbd_dump_get_delta(int fd, struct zbd_opts *opts,
+			      struct zbd_dump_info *di)
+{
+	unsigned int i, nr_zones = opts->dev_info.nr_zones;
+	unsigned int nr_changed = 0;
+	struct zbd_zone *basez, *z;
+	struct zbd_dump_info base;
+	void *buf = NULL;
+	int ret = -1;
+
+	di->base = realpath(opts->base_path, NULL);
+	if (!di->base) {
+		fprintf(stderr, "Invalid base dump %s\n", opts->base_path);
+		return -1;
+	}
+
+	printf("    Incremental dump based on %s\n", di->base);
+
+	if (zbd_dump_read_info(di->base, &base))
+		return -1;
+
+	if (base.hdr.dev_info.nr_sectors != opts->dev_info.nr_sectors ||
+	    base.hdr.dev_info.nr_zones != nr_zones ||
+	    base.hdr.dev_info.zone_size != opts->dev_info.zone_size) {
+		fprintf(stderr, "Base dump of an incompatible device\n");
+		goto out;
+	}
+	if (base.hdr.zstart != di->hdr.zstart ||
+	    base.hdr.zend != di->hdr.zend) {
+		fprintf(stderr, "Base dump zone range [%u..%u] differs\n",
+			base.hdr.zstart, base.hdr.zend - 1);
+		goto out;
+	}
+
+	di->delta = calloc(nr_zones, sizeof(unsigned long long));
+	if (!di->delta) {
+		fprintf(stderr, "No memory\n");
+		goto out;
+	}
+
+	/*
+	 * The zone data checksums include the data of the base dumps, so they
+	 * can be saved only if the base dump has them.
+	 */
+	if (di->crc && !base.crc) {
+		printf("    Base dump without checksums: not saving zone data checksums\n");
+		free(di->crc);
+		di->crc = NULL;
+	}
+
+	if (base.crc) {
+		buf = malloc(opts->io_size);
+		if (!buf) {
+			fprintf(stderr, "No memory\n");
+			goto out;
+		}
+	} else {
+		printf("    Base dump without checksums: saving entirely zones full in the base dump\n");
+	}
+
+	for (i = 0; i < nr_zones; i++) {
+		z = &di->zones[i];
+		basez = &base.zones[i];
+
+		di->delta[i] = zbd_zone_start(z);
+		if (i < di->hdr.zstart || i >= di->hdr.zend ||
+		    !zbd_zone_seq(z) || zbd_zone_offline(basez) ||
+		    zbd_zone_start(basez) != zbd_zone_start(z) ||
+		    zbd_dump_zone_end(z) < zbd_dump_zone_end(basez))
+			continue;
+
+		if (base.crc) {
+			ret = zbd_dump_check_base_data(fd, opts, buf,
+						zbd_zone_start(z),
+						zbd_dump_zone_end(basez),
+						base.crc[i]);
+			if (ret < 0)
+				goto out;
+			if (!ret) {
+				nr_changed++;
+				continue;
+			}
+		} else if (zbd_zone_full(basez)) {
+			continue;
+		}
+
+		di->delta[i] = zbd_dump_zone_end(basez);
+		if (di->crc)
+			di->crc[i] = base.crc[i];
+	}
+
+	if (nr_changed)
+		printf("    %u zones rewritten since the base dump\n",
+		       nr_changed);
+
+	ret = 0;
+
+out:
+	free(buf);
+	zbd_dump_free_info(&base);
+
+	return ret;
+}
+
 int zbd_dump(int fd, struct zbd_opts *opts)
 {
-	struct zbd_zone *zones = NULL;
-	struct zbd_dump dump;
+	struct zbd_dump_info di;
+	struct zbd_dump *dump = &di.hdr;
 	unsigned int nz;
 	int ret;
 
 	zbd_dump_prep_path(opts);
 
+	if (zbd_dump_check_io_opts(opts))
+		return 1;
+
+	if (opts->stream &&
+	    (opts->comp || opts->zero_copy || opts->nr_jobs > 1 ||
+	     opts->base_path)) {
+		fprintf(stderr,
+			"Options -z, -zc, -j and -inc cannot be used with -stream\n");
+		return 1;
+	}
+
 	/* Setup dump header */
-	memset(&dump, 0, sizeof(struct zbd_dump));
-	memcpy(&dump.dev_info, &opts->dev_info, sizeof(struct zbd_info));
-	dump.zstart = opts->ofst / opts->dev_info.zone_size;
-	dump.zend = (opts->ofst + opts->len + opts->dev_info.zone_size - 1)
+	memset(&di, 0, sizeof(struct zbd_dump_info));
+	memcpy(&dump->dev_info, &opts->dev_info, sizeof(struct zbd_info));
+	dump->zstart = opts->ofst / opts->dev_info.zone_size;
+	dump->zend = (opts->ofst + opts->len + opts->dev_info.zone_size - 1)
 		/ opts->dev_info.zone_size;
+	if (opts->comp) {
+		dump->comp = opts->comp;
+		dump->chunk_size = opts->io_size;
+		if (opts->zero_copy) {
+			printf("Compressed dump: ignoring zero-copy option\n");
+			opts->zero_copy = false;
+		}
+	}
 
 	/* Get zone information */
-	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &zones, &nz);
+	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &di.zones, &nz);
 	if (ret != 0) {
 		fprintf(stderr, "zbd_list_zones() failed %d\n", ret);
 		return 1;
@@ -364,110 +2079,212 @@ int zbd_dump(int fd, struct zbd_opts *opts)
 
 	printf("%s: %u zones\n", opts->dev_path, opts->dev_info.nr_zones);
 
+	if (opts->stream) {
+		dump->flags |= ZBD_DUMP_STREAM;
+		ret = zbd_dump_stream(fd, opts, &di);
+		goto out;
+	}
+
+	/*
+	 * Zone data checksums are computed from the zone data buffers, which
+	 * are not used with zero-copy.
+	 */
+	if (opts->zero_copy) {
+		printf("    Zero-copy dump: not saving zone data checksums\n");
+	} else {
+		di.crc = calloc(nz, sizeof(uint32_t));
+		if (!di.crc) {
+			fprintf(stderr, "No memory\n");
+			ret = 1;
+			goto out;
+		}
+	}
+
+	if (opts->base_path) {
+		ret = zbd_dump_get_delta(fd, opts, &di);
+		if (ret)
+			goto out;
+		dump->flags |= ZBD_DUMP_EXT | ZBD_DUMP_INCREMENTAL;
+	}
+
+	if (di.crc)
+		dump->flags |= ZBD_DUMP_EXT;
+
 	/* Dump zone information and zone data */
-	ret = zbd_dump_zone_data(fd, opts, zones, &dump);
+	ret = zbd_dump_zone_data(fd, opts, &di);
 	if (ret)
 		goto out;
 
-	ret = zbd_dump_zone_info(fd, opts, zones, &dump);
+	ret = zbd_dump_zone_info(fd, opts, &di);
 
 out:
-	free(zones);
+	zbd_dump_free_info(&di);
 	return ret;
 }
 
+/*
+ * Maximum number of dumps in an incremental dump chain.
+ */
+#define ZBD_RESTORE_MAX_CHAIN	4096
+
+/*
+ * Dump used to restore zone data: the dump specified, or for an incremental
+ * dump, one of the dumps it is based on.
+ */
+struct zbd_restore_src {
+	char			*info_path;
+	struct zbd_dump_info	info;
+	int			data_fd;
+	struct zbd_cdump	*cd;
+	size_t			io_size;
+};
+
 struct zbd_restore {
-	int		data_fd;
 	struct zbd_info	dev_info;
 	struct zbd_zone *dump_zones;
 	struct zbd_zone *dev_zones;
 	unsigned int zstart;
 	unsigned int zend;
-	void *buf;
+	struct zbd_restore_src *srcs;
+	unsigned int nr_srcs;
+	struct zbd_buf_pool *pool;
+	size_t buf_size;
+	struct zbd_xfer xfer;
 	long long restored_bytes;
 	unsigned int restored_zones;
 };
 
-static int zbd_load_zone_info(struct zbd_restore *ropts,
-			      struct zbd_opts *opts)
+/*
+ * Add a dump to the restore chain. The zone information is read from the file
+ * info_path, or from stream_fd if it is not negative.
+ */
+static struct zbd_restore_src *zbd_restore_add_src(struct zbd_restore *ropts,
+						   char *info_path,
+						   int stream_fd)
 {
-	struct zbd_dump dump;
-	struct zbd_zone *devz, *dumpz;
-	unsigned int nr_open_zones = 0;
-	unsigned int nr_active_zones = 0;
-	char *info_path = NULL;
-	ssize_t ret, sz;
-	unsigned int i;
-	int info_fd;
+	int ret;
 
-	/* Dump zone information */
-	ret = asprintf(&info_path, "%s/%s_zone_info.dump",
-		       opts->dump_path, opts->dump_prefix);
-	if (ret < 0) {
+	struct zbd_restore_src *srcs, *src;
+
+	srcs = realloc(ropts->srcs,
+		       sizeof(struct zbd_restore_src) * (ropts->nr_srcs + 1));
+	if (!srcs) {
 		fprintf(stderr, "No memory\n");
-		return -1;
+		free(info_path);
+		return NULL;
 	}
+	ropts->srcs = srcs;
 
-	printf("    Getting zone information from %s\n", info_path);
+	src = &srcs[ropts->nr_srcs];
+	memset(src, 0, sizeof(struct zbd_restore_src));
+	src->info_path = info_path;
+	src->data_fd = -1;
 
-	info_fd = open(info_path, O_RDONLY | O_LARGEFILE);
-	if (info_fd < 0) {
-		fprintf(stderr,
-			"Open zone information dump file %s failed %d (%s)\n",
-			info_path, errno, strerror(errno));
-		ret = -1;
-		goto out;
+	if (stream_fd >= 0)
+		ret = zbd_dump_load_info(stream_fd, info_path, -1, &src->info);
+	else
+		ret = zbd_dump_read_info(info_path, &src->info);
+	if (ret) {
+		free(info_path);
+		return NULL;
 	}
+	ropts->nr_srcs++;
 
-	/* Read dump header */
-	ret = zbd_read(info_fd, &dump, sizeof(struct zbd_dump), 0);
-	if (ret != (ssize_t)sizeof(struct zbd_dump)) {
-		fprintf(stderr, "Read dump header failed\n");
-		ret = -1;
-		goto out;
+	return src;
+}
+
+static void zbd_restore_free_srcs(struct zbd_restore *ropts)
+{
+	struct zbd_restore_src *src;
+	unsigned int i;
+
+	for (i = 0; i < ropts->nr_srcs; i++) {
+		src = &ropts->srcs[i];
+		if (src->data_fd >= 0)
+			close(src->data_fd);
+		zbd_cdump_free(src->cd);
+		zbd_dump_free_info(&src->info);
+		free(src->info_path);
+	}
+	free(ropts->srcs);
+}
+
+/*
+ * Load the dumps an incremental dump is based on, up to the first full dump.
+ */
+static int zbd_load_base_info(struct zbd_restore *ropts)
+{
+	struct zbd_restore_src *src = &ropts->srcs[0];
+	struct zbd_dump *hdr;
+	char *base_path;
+
+	while (src->info.base) {
+		if (ropts->nr_srcs >= ZBD_RESTORE_MAX_CHAIN) {
+			fprintf(stderr, "Too many incremental dumps\n");
+			return -1;
+		}
+
+		base_path = strdup(src->info.base);
+		if (!base_path) {
+			fprintf(stderr, "No memory\n");
+			return -1;
+		}
+
+		printf("    Based on dump %s\n", base_path);
+
+		src = zbd_restore_add_src(ropts, base_path, -1);
+		if (!src)
+			return -1;
+
+		hdr = &src->info.hdr;
+		if (hdr->dev_info.nr_sectors != ropts->dev_info.nr_sectors ||
+		    hdr->dev_info.nr_zones != ropts->dev_info.nr_zones ||
+		    hdr->dev_info.zone_size != ropts->dev_info.zone_size) {
+			fprintf(stderr, "Base dump of an incompatible device\n");
+			return -1;
+		}
+		if (hdr->zstart != ropts->zstart || hdr->zend != ropts->zend) {
+			fprintf(stderr, "Base dump zone range [%u..%u] differs\n",
+				hdr->zstart, hdr->zend - 1);
+			return -1;
+		}
 	}
-	memcpy(&ropts->dev_info, &dump.dev_info, sizeof(struct zbd_info));
-	ropts->zstart = dump.zstart;
-	ropts->zend = dump.zend;
+
+	return 0;
+}
+
+/*
+ * Check that the target device and its zones are compatible with the device
+ * and zones to restore or copy.
+ */
+static int zbd_restore_check_dev(struct zbd_restore *ropts,
+				 struct zbd_opts *opts)
+{
+	struct zbd_zone *devz, *dumpz;
+	unsigned int nr_open_zones = 0;
+	unsigned int nr_active_zones = 0;
+	unsigned int i;
 
 	/* Check device information against target device */
-	ret = -1;
 	if (ropts->dev_info.nr_sectors != opts->dev_info.nr_sectors) {
 		fprintf(stderr, "Incompatible capacity\n");
-		goto out;
+		return -1;
 	}
 	if (ropts->dev_info.lblock_size != opts->dev_info.lblock_size) {
 		fprintf(stderr, "Incompatible logical block size\n");
-		goto out;
+		return -1;
 	}
 	if (ropts->dev_info.pblock_size != opts->dev_info.pblock_size) {
 		fprintf(stderr, "Incompatible physical block size\n");
-		goto out;
+		return -1;
 	}
 	if (ropts->dev_info.nr_zones != opts->dev_info.nr_zones) {
 		fprintf(stderr, "Incompatible number of zones\n");
-		goto out;
+		return -1;
 	}
 	if (ropts->dev_info.zone_size != opts->dev_info.zone_size) {
 		fprintf(stderr, "Incompatible zone size\n");
-		goto out;
-	}
-
-	/* Read dumped zone information */
-	ropts->dump_zones = calloc(ropts->dev_info.nr_zones,
-				  sizeof(struct zbd_zone));
-	if (!ropts->dump_zones) {
-		fprintf(stderr, "No memory\n");
-		goto out;
-	}
-
-	sz = sizeof(struct zbd_zone) * ropts->dev_info.nr_zones;
-	ret = zbd_read(info_fd, ropts->dump_zones, sz, sizeof(struct zbd_dump));
-	if (ret != sz) {
-		fprintf(stderr, "Read zone information failed %zd %zd\n",
-			ret, sz);
-		ret = -1;
-		goto out;
+		return -1;
 	}
 
 	/* Check zones against target device zones */
@@ -475,30 +2292,29 @@ static int zbd_load_zone_info(struct zbd_restore *ropts,
 		dumpz = &ropts->dump_zones[i];
 		devz = &ropts->dev_zones[i];
 
-		ret = -1;
 		if (zbd_zone_type(dumpz) != zbd_zone_type(devz)) {
 			fprintf(stderr, "Incompatible zone %u type\n", i);
-			goto out;
+			return -1;
 		}
 		if (zbd_zone_start(dumpz) != zbd_zone_start(devz)) {
 			fprintf(stderr, "Incompatible zone %u start\n", i);
-			goto out;
+			return -1;
 		}
 		if (zbd_zone_len(dumpz) != zbd_zone_len(devz)) {
 			fprintf(stderr, "Incompatible zone %u start\n", i);
-			goto out;
+			return -1;
 		}
 		if (zbd_zone_capacity(dumpz) != zbd_zone_capacity(devz)) {
 			fprintf(stderr, "Incompatible zone %u start\n", i);
-			goto out;
+			return -1;
 		}
 		if (zbd_zone_offline(devz) && !zbd_zone_offline(dumpz)) {
 			fprintf(stderr, "Incompatible offline zone %u\n", i);
-			goto out;
+			return -1;
 		}
 		if (zbd_zone_rdonly(devz)) {
 			fprintf(stderr, "Incompatible read-only zone %u\n", i);
-			goto out;
+			return -1;
 		}
 
 		/* Count open and active zones */
@@ -516,162 +2332,653 @@ static int zbd_load_zone_info(struct zbd_restore *ropts,
 	    nr_open_zones > opts->dev_info.max_nr_open_zones) {
 		fprintf(stderr,
 			"Incompatible maximum number of open zones\n");
-		goto out;
+		return -1;
 	}
 	if (opts->dev_info.max_nr_active_zones &&
 	    nr_active_zones > opts->dev_info.max_nr_active_zones) {
 		fprintf(stderr,
 			"Incompatible maximum number of active zones\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int zbd_load_zone_info(struct zbd_restore *ropts,
+			      struct zbd_opts *opts)
+{
+	struct zbd_restore_src *src;
+	char *info_path = NULL;
+	int ret;
+
+	/* Dump zone information */
+	if (opts->stream)
+		ret = asprintf(&info_path, "standard input");
+	else
+		ret = asprintf(&info_path, "%s/%s_zone_info.dump",
+			       opts->dump_path, opts->dump_prefix);
+	if (ret < 0) {
+		fprintf(stderr, "No memory\n");
+		return -1;
+	}
+
+	printf("    Getting zone information from %s\n", info_path);
+
+	src = zbd_restore_add_src(ropts, info_path,
+				  opts->stream ? opts->stream_fd : -1);
+	if (!src)
+		return -1;
+
+	if (opts->stream &&
+	    (!(src->info.hdr.flags & ZBD_DUMP_STREAM) ||
+	     src->info.hdr.comp || src->info.base)) {
+		fprintf(stderr, "Invalid dump stream\n");
+		return -1;
+	}
+	if (!opts->stream && (src->info.hdr.flags & ZBD_DUMP_STREAM)) {
+		fprintf(stderr, "Dump streams must be restored with -stream\n");
+		return -1;
+	}
+
+	memcpy(&ropts->dev_info, &src->info.hdr.dev_info,
+	       sizeof(struct zbd_info));
+	ropts->zstart = src->info.hdr.zstart;
+	ropts->zend = src->info.hdr.zend;
+	ropts->dump_zones = src->info.zones;
+
+	if (zbd_restore_check_dev(ropts, opts))
+		return -1;
+
+	return zbd_load_base_info(ropts);
+}
+
+static int zbd_open_src_data(struct zbd_restore_src *src,
+			     struct zbd_opts *opts)
+{
+	char *data_path;
+	struct stat st;
+	int ret = -1;
+
+	data_path = zbd_dump_data_path(src->info_path, src->info.hdr.comp);
+	if (!data_path)
+		return -1;
+
+	src->data_fd = open(data_path, O_RDONLY | O_LARGEFILE);
+	if (src->data_fd < 0) {
+		fprintf(stderr,
+			"Open zone data dump file %s failed %d (%s)\n",
+			data_path, errno, strerror(errno));
+		goto out;
+	}
+
+	if (src->info.hdr.comp) {
+		/*
+		 * Load the compressed data file index. Chunks are
+		 * decompressed as a whole, so use the chunk size for I/Os.
+		 */
+		src->cd = zbd_cdump_open(src->data_fd, opts, src->info.zones,
+					 src->info.delta);
+		if (!src->cd)
+			goto out;
+		if (src->cd->chunk_size % opts->dev_info.lblock_size) {
+			fprintf(stderr, "Invalid zone data chunk size\n");
+			goto out;
+		}
+		src->io_size = src->cd->chunk_size;
+		ret = 0;
+		goto out;
+	}
+
+	/* Check zone data file size */
+	ret = fstat(src->data_fd, &st);
+	if (ret) {
+		fprintf(stderr,
+			"stat zone data dump file %s failed %d (%s)\n",
+			data_path, errno, strerror(errno));
+		goto out;
+	}
+
+	if ((unsigned long long)st.st_size != opts->dev_info.nr_sectors << 9) {
+		fprintf(stderr, "Invalid zone data dump file %s size\n",
+			data_path);
+		ret = -1;
 		goto out;
 	}
+	src->io_size = opts->io_size;
+
+out:
+	free(data_path);
+
+	return ret;
+}
+
+static int zbd_open_zone_data(struct zbd_restore *ropts,
+			      struct zbd_opts *opts)
+{
+	unsigned int i;
+
+	if (opts->stream) {
+		ropts->srcs[0].data_fd = opts->stream_fd;
+		ropts->srcs[0].io_size = opts->io_size;
+		ropts->buf_size = opts->io_size;
+		return 0;
+	}
+
+	for (i = 0; i < ropts->nr_srcs; i++) {
+		if (zbd_open_src_data(&ropts->srcs[i], opts))
+			return -1;
+		if (ropts->srcs[i].io_size > ropts->buf_size)
+			ropts->buf_size = ropts->srcs[i].io_size;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the start offset of the data of a zone saved in a dump.
+ */
+static long long zbd_restore_src_start(struct zbd_restore_src *src,
+				       unsigned int zno)
+{
+	if (src->info.delta)
+		return src->info.delta[zno];
+
+	return zbd_zone_start(&src->info.zones[zno]);
+}
+
+static int zbd_restore_copy_zone_data(struct zbd_restore *ropts,
+				      struct zbd_xfer *x, unsigned int zno)
+{
+	struct zbd_zone *dumpz = &ropts->dump_zones[zno];
+	struct zbd_restore_src *src;
+	long long ofst, end;
+	int k;
+
+	/*
+	 * Find the most recent dump holding the zone data from the zone
+	 * start and replay the data saved in each dump from there.
+	 */
+	for (k = 0; k < (int)ropts->nr_srcs - 1; k++) {
+		if (zbd_restore_src_start(&ropts->srcs[k], zno) ==
+		    (long long)zbd_zone_start(dumpz))
+			break;
+	}
+
+	for (; k >= 0; k--) {
+		src = &ropts->srcs[k];
+		ofst = zbd_restore_src_start(src, zno);
+		end = zbd_dump_zone_end(&src->info.zones[zno]);
+		if (k && end != zbd_restore_src_start(&ropts->srcs[k - 1],
+						      zno)) {
+			fprintf(stderr,
+				"Inconsistent incremental dump of zone %u\n",
+				zno);
+			return -1;
+		}
+		if (ofst >= end)
+			continue;
+
+		/* Copy zone dump data */
+		if (zbd_xfer_set_input(x, src->data_fd, src->cd,
+				       src->io_size) ||
+		    zbd_xfer_copy(x, ofst, end))
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Copy the data of a zone from the dump chain. If the dump has zone data
+ * checksums, the checksum of the zone data is verified once all the zone
+ * data is written.
+ */
+static long long zbd_restore_zone_data(struct zbd_restore *ropts,
+				       struct zbd_xfer *x, unsigned int zno)
+{
+	struct zbd_zone *dumpz = &ropts->dump_zones[zno];
+	uint32_t *dump_crc = ropts->srcs[0].info.crc;
+	uint32_t crc = 0;
+	int ret;
+
+	if (!dump_crc) {
+		if (zbd_restore_copy_zone_data(ropts, x, zno))
+			return -1;
+		return zbd_dump_zone_end(dumpz) - zbd_zone_start(dumpz);
+	}
+
+	x->crc = &crc;
+	ret = zbd_restore_copy_zone_data(ropts, x, zno);
+	if (zbd_xfer_wait(x))
+		ret = -1;
+	x->crc = NULL;
+	if (ret)
+		return -1;
+
+	if (crc != dump_crc[zno]) {
+		fprintf(stderr, "Zone %u data checksum mismatch\n", zno);
+		return -1;
+	}
+
+	return zbd_dump_zone_end(dumpz) - zbd_zone_start(dumpz);
+}
+
+/*
+ * Restore the data and condition of a zone. Return the amount of data
+ * restored, or -1 on error. The zone data is written when this returns.
+ */
+static long long zbd_restore_one_zone(int fd, struct zbd_restore *ropts,
+				      struct zbd_xfer *x, unsigned int zno)
+{
+	struct zbd_zone *dumpz = &ropts->dump_zones[zno];
+	struct zbd_zone *devz = &ropts->dev_zones[zno];
+	long long restored_bytes;
+	int ret;
+
+	/* Copy zone data */
+	restored_bytes = zbd_restore_zone_data(ropts, x, zno);
+	if (restored_bytes < 0)
+		return restored_bytes;
+
+	/*
+	 * Restore zone condition. This must be done only once the zone
+	 * data is written.
+	 */
+	if (zbd_xfer_wait(x))
+		return -1;
+
+	if (zbd_zone_closed(dumpz)) {
+		ret = zbd_close_zones(fd, zbd_zone_start(devz),
+				      zbd_zone_len(devz));
+		if (ret) {
+			fprintf(stderr,
+				"Close target zone at %llu failed %d (%s)\n",
+				zbd_zone_start(devz),
+				errno, strerror(errno));
+			return ret;
+		}
+	} else if (zbd_zone_exp_open(dumpz)) {
+		ret = zbd_open_zones(fd, zbd_zone_start(devz),
+				     zbd_zone_len(devz));
+		if (ret) {
+			fprintf(stderr,
+				"Open target zone at %llu failed %d (%s)\n",
+				zbd_zone_start(devz),
+				errno, strerror(errno));
+			return ret;
+		}
+	}
+
+	return restored_bytes;
+}
+
+static void zbd_restore_account(struct zbd_restore *ropts,
+				long long restored_bytes)
+{
+	if (restored_bytes > 0) {
+		ropts->restored_bytes += restored_bytes;
+		ropts->restored_zones++;
+	}
+}
+
+/*
+ * Reset the target zones in the dump range, using a single reset operation
+ * for each range of consecutive sequential zones. Empty zones within a range
+ * are also reset.
+ */
+static int zbd_restore_reset_zones(int fd, struct zbd_restore *ropts)
+{
+	unsigned int i, first, last;
+	struct zbd_zone *devz;
+	bool in_range = false;
+	long long ofst, len;
+	int ret;
+
+	for (i = ropts->zstart; i <= ropts->zend; i++) {
+		devz = &ropts->dev_zones[i];
+
+		if (i < ropts->zend && zbd_zone_seq(devz) &&
+		    !zbd_zone_offline(devz) &&
+		    !zbd_zone_offline(&ropts->dump_zones[i])) {
+			if (zbd_zone_empty(devz))
+				continue;
+			if (!in_range)
+				first = i;
+			last = i;
+			in_range = true;
+			continue;
+		}
+
+		if (!in_range)
+			continue;
+		in_range = false;
+
+		ofst = zbd_zone_start(&ropts->dev_zones[first]);
+		len = zbd_zone_start(&ropts->dev_zones[last]) +
+			zbd_zone_len(&ropts->dev_zones[last]) - ofst;
+		ret = zbd_reset_zones(fd, ofst, len);
+		if (ret) {
+			fprintf(stderr,
+				"Reset target zones %u..%u failed %d (%s)\n",
+				first, last, errno, strerror(errno));
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Zone restore scheduler shared by all restore workers. Zones are processed
+ * in restore pass order, with the number of zones being written and left
+ * open or active by restored zones kept within the target device limits.
+ */
+struct zbd_restore_job {
+	int			fd;
+	struct zbd_opts		*opts;
+	struct zbd_restore	*ropts;
+
+	unsigned int		*queue;
+	unsigned int		nr_queued;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	unsigned int		next;
+	unsigned int		max_open;
+	unsigned int		max_active;
+	unsigned int		nr_open;
+	unsigned int		nr_active;
+	int			ret;
+};
+
+/*
+ * Test if the restore of a zone can start without exceeding the target
+ * device open and active zone limits. Writing a sequential zone implicitly
+ * opens it.
+ */
+static bool zbd_restore_can_start(struct zbd_restore_job *job,
+				  struct zbd_zone *dumpz)
+{
+	if (!zbd_zone_seq(dumpz))
+		return true;
+
+	return (!job->max_open || job->nr_open < job->max_open) &&
+		(!job->max_active || job->nr_active < job->max_active);
+}
+
+static void zbd_restore_start_zone(struct zbd_restore_job *job,
+				   struct zbd_zone *dumpz)
+{
+	if (!zbd_zone_seq(dumpz))
+		return;
+
+	job->nr_open++;
+	job->nr_active++;
+}
+
+/*
+ * Release the resources of a zone that do not remain used by the restored
+ * zone condition.
+ */
+static void zbd_restore_end_zone(struct zbd_restore_job *job,
+				 struct zbd_zone *dumpz)
+{
+	if (!zbd_zone_seq(dumpz))
+		return;
+
+	if (zbd_zone_full(dumpz)) {
+		job->nr_open--;
+		job->nr_active--;
+	} else if (zbd_zone_closed(dumpz)) {
+		job->nr_open--;
+	}
+}
+
+static void *zbd_restore_worker(void *arg)
+{
+	struct zbd_restore_job *job = arg;
+	struct zbd_restore *ropts = job->ropts;
+	struct zbd_zone *dumpz;
+	long long ret;
+	struct zbd_xfer x;
+	unsigned int zno;
+
+	if (zbd_xfer_start(&x, ropts->srcs[0].data_fd, job->fd, ropts->pool,
+			   ropts->srcs[0].io_size, job->opts->io_depth, NULL))
+		goto err;
+
+	pthread_mutex_lock(&job->lock);
+
+	for (;;) {
+		/* Wait until the next zone can be restored */
+		while (!job->ret && job->next < job->nr_queued &&
+		       !zbd_restore_can_start(job,
+				&ropts->dump_zones[job->queue[job->next]]))
+			pthread_cond_wait(&job->cond, &job->lock);
+		if (job->ret || job->next >= job->nr_queued)
+			break;
+
+		zno = job->queue[job->next++];
+		dumpz = &ropts->dump_zones[zno];
+		zbd_restore_start_zone(job, dumpz);
+		pthread_mutex_unlock(&job->lock);
+
+		ret = zbd_restore_one_zone(job->fd, ropts, &x, zno);
+
+		pthread_mutex_lock(&job->lock);
+		if (ret < 0)
+			job->ret = -1;
+		else
+			zbd_restore_account(ropts, ret);
+		zbd_restore_end_zone(job, dumpz);
+		pthread_cond_broadcast(&job->cond);
+	}
 
-	ret = 0;
-out:
+	pthread_mutex_unlock(&job->lock);
 
-	free(info_path);
-	close(info_fd);
+	if (!zbd_xfer_stop(&x))
+		return NULL;
 
-	return ret;
+err:
+	pthread_mutex_lock(&job->lock);
+	job->ret = -1;
+	pthread_cond_broadcast(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+
+	return NULL;
 }
 
-static int zbd_open_zone_data(struct zbd_restore *ropts,
-			      struct zbd_opts *opts)
+/*
+ * Restore the zones of the dump range using several workers.
+ */
+static int zbd_restore_zones(int fd, struct zbd_restore *ropts,
+			     struct zbd_opts *opts)
 {
-	char *data_path = NULL;
-	struct stat st;
-	int ret;
-
-	/* Dump zone information */
-	ret = asprintf(&data_path, "%s/%s_zone_data.dump",
-		       opts->dump_path, opts->dump_prefix);
-	if (ret < 0) {
+	unsigned int i, nr_jobs = opts->nr_jobs;
+	struct zbd_restore_job job;
+	pthread_t *threads = NULL;
+	int p, ret;
+
+	memset(&job, 0, sizeof(struct zbd_restore_job));
+	job.fd = fd;
+	job.opts = opts;
+	job.ropts = ropts;
+	job.max_open = opts->dev_info.max_nr_open_zones;
+	job.max_active = opts->dev_info.max_nr_active_zones;
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_cond_init(&job.cond, NULL);
+
+	/* Queue zones in restore pass order */
+	job.queue = calloc(ropts->zend - ropts->zstart,
+			   sizeof(unsigned int));
+	if (!job.queue) {
 		fprintf(stderr, "No memory\n");
-		return -1;
-	}
-
-	printf("    Restoring zones [%u..%u] data from %s (this may take a while)...\n",
-	       ropts->zstart, ropts->zend - 1, data_path);
-
-	ropts->data_fd = open(data_path, O_RDONLY | O_LARGEFILE);
-	if (ropts->data_fd < 0) {
-		fprintf(stderr,
-			"Open zone data dump file %s failed %d (%s)\n",
-			data_path, errno, strerror(errno));
 		ret = -1;
 		goto out;
 	}
+	for (p = 0; p < ZBD_DUMP_NR_PASSES; p++) {
+		for (i = ropts->zstart; i < ropts->zend; i++) {
+			if (zbd_dump_zone_pass(&ropts->dump_zones[i]) == p)
+				job.queue[job.nr_queued++] = i;
+		}
+	}
 
-	/* Check zone data file size */
-	ret = fstat(ropts->data_fd, &st);
-	if (ret) {
-		fprintf(stderr,
-			"stat zone data dump file %s failed %d (%s)\n",
-			data_path, errno, strerror(errno));
+	/* Do not use more workers than there are zones to restore */
+	if (!nr_jobs)
+		nr_jobs = 1;
+	if (nr_jobs > job.nr_queued)
+		nr_jobs = job.nr_queued;
+	if (!nr_jobs) {
+		ret = 0;
 		goto out;
 	}
 
-	if ((unsigned long long)st.st_size != opts->dev_info.nr_sectors << 9) {
-		fprintf(stderr, "Invalid zone data dump file size\n");
+	/* Get the IO buffers of all workers */
+	ropts->pool = zbd_buf_pool_alloc(fd, ropts->buf_size,
+					 nr_jobs * opts->io_depth, 0);
+	threads = calloc(nr_jobs, sizeof(pthread_t));
+	if (!ropts->pool || !threads) {
+		fprintf(stderr, "No memory\n");
 		ret = -1;
+		goto out;
+	}
+
+	if (nr_jobs > 1)
+		printf("    Using %u restore workers\n", nr_jobs);
+
+	for (i = 0; i < nr_jobs; i++) {
+		ret = pthread_create(&threads[i], NULL, zbd_restore_worker,
+				     &job);
+		if (ret) {
+			fprintf(stderr,
+				"Create restore worker failed %d (%s)\n",
+				ret, strerror(ret));
+			pthread_mutex_lock(&job.lock);
+			job.ret = -1;
+			pthread_cond_broadcast(&job.cond);
+			pthread_mutex_unlock(&job.lock);
+			break;
+		}
 	}
 
+	/* Wait for all workers that were started */
+	nr_jobs = i;
+	for (i = 0; i < nr_jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	ret = job.ret;
+
 out:
-	free(data_path);
+	free(threads);
+	free(job.queue);
+	pthread_cond_destroy(&job.cond);
+	pthread_mutex_destroy(&job.lock);
 
 	return ret;
 }
 
-static long long zbd_restore_zone_data(int fd, struct zbd_restore *ropts,
-				       struct zbd_zone *dumpz)
+/*
+ * Restore zones in the order of the zone data records of a dump stream.
+ */
+static int zbd_restore_stream(int fd, struct zbd_restore *ropts,
+			      struct zbd_opts *opts)
 {
-	long long ofst, end;
-	ssize_t ret, iosize;
+	struct zbd_dump_stream_zone rec;
+	long long restored_bytes;
+	struct zbd_zone *dumpz;
+	uint32_t crc, dump_crc;
+	bool *restored;
+	unsigned int i;
+	int p = 0, ret = -1;
 
-	/* Copy zone dump data */
-	ofst = zbd_zone_start(dumpz);
-	if (zbd_zone_seq(dumpz) && !zbd_zone_full(dumpz))
-		end = zbd_zone_wp(dumpz);
-	else
-		end = ofst + zbd_zone_capacity(dumpz);
+	restored = calloc(ropts->dev_info.nr_zones, sizeof(bool));
+	if (!restored) {
+		fprintf(stderr, "No memory\n");
+		return -1;
+	}
 
-	while (ofst < end) {
+	for (;;) {
+		if (zbd_read(opts->stream_fd, &rec, sizeof(rec), -1) !=
+		    sizeof(rec)) {
+			fprintf(stderr, "Truncated dump stream\n");
+			goto out;
+		}
+		if (rec.flags & ZBD_DUMP_STREAM_END)
+			break;
 
-		if (ofst + ZBD_DUMP_IO_SIZE > end)
-			iosize = end - ofst;
-		else
-			iosize = ZBD_DUMP_IO_SIZE;
+		if (rec.zno < ropts->zstart || rec.zno >= ropts->zend ||
+		    restored[rec.zno])
+			goto err;
+		dumpz = &ropts->dump_zones[rec.zno];
+		if (zbd_dump_zone_pass(dumpz) < p ||
+		    rec.len != (unsigned long long)
+		    (zbd_dump_zone_end(dumpz) - zbd_zone_start(dumpz)))
+			goto err;
+		p = zbd_dump_zone_pass(dumpz);
+		restored[rec.zno] = true;
+
+		crc = 0;
+		if (rec.flags & ZBD_DUMP_STREAM_CRC32C)
+			ropts->xfer.crc = &crc;
+		restored_bytes = zbd_restore_one_zone(fd, ropts, &ropts->xfer,
+						      rec.zno);
+		if (restored_bytes < 0)
+			goto out;
+		ropts->xfer.crc = NULL;
+		zbd_restore_account(ropts, restored_bytes);
 
-		ret = zbd_read(ropts->data_fd, ropts->buf, iosize, ofst);
-		if (ret != iosize) {
-			fprintf(stderr, "Read zone dump data failed\n");
-			return -1;
+		/* The zone data checksum follows the zone data */
+		if (!(rec.flags & ZBD_DUMP_STREAM_CRC32C))
+			continue;
+		if (zbd_read(opts->stream_fd, &dump_crc, sizeof(dump_crc),
+			     -1) != sizeof(dump_crc)) {
+			fprintf(stderr, "Truncated dump stream\n");
+			goto out;
 		}
-
-		ret = zbd_write(fd, ropts->buf, iosize, ofst);
-		if (ret != iosize) {
-			fprintf(stderr, "Write zone data failed\n");
-			return -1;
+		if (crc != dump_crc) {
+			fprintf(stderr, "Zone %u data checksum mismatch\n",
+				rec.zno);
+			goto out;
 		}
-
-		ofst += iosize;
-	}
-
-	return end - zbd_zone_start(dumpz);
-}
-
-static int zbd_restore_one_zone(int fd, struct zbd_restore *ropts,
-				struct zbd_zone *dumpz, struct zbd_zone *devz)
-{
-	long long restored_bytes;
-	int ret;
-
-	/* Copy zone data */
-	restored_bytes = zbd_restore_zone_data(fd, ropts, dumpz);
-	if (restored_bytes < 0)
-		return restored_bytes;
-
-	if (restored_bytes) {
-		ropts->restored_bytes += restored_bytes;
-		ropts->restored_zones++;
 	}
 
-	/* Restore zone condition */
-	if (zbd_zone_closed(dumpz)) {
-		ret = zbd_close_zones(fd, zbd_zone_start(devz),
-				      zbd_zone_len(devz));
-		if (ret) {
-			fprintf(stderr,
-				"Close target zone at %llu failed %d (%s)\n",
-				zbd_zone_start(devz),
-				errno, strerror(errno));
-			return ret;
-		}
-	} else if (zbd_zone_exp_open(dumpz)) {
-		ret = zbd_open_zones(fd, zbd_zone_start(devz),
-				     zbd_zone_len(devz));
-		if (ret) {
-			fprintf(stderr,
-				"Open target zone at %llu failed %d (%s)\n",
-				zbd_zone_start(devz),
-				errno, strerror(errno));
-			return ret;
+	for (i = ropts->zstart; i < ropts->zend; i++) {
+		dumpz = &ropts->dump_zones[i];
+		if (zbd_dump_zone_pass(dumpz) >= 0 && !restored[i]) {
+			fprintf(stderr, "Missing zone %u data in dump stream\n",
+				i);
+			goto out;
 		}
 	}
 
-	return 0;
+	ret = zbd_xfer_wait(&ropts->xfer);
+	goto out;
+
+err:
+	fprintf(stderr, "Invalid dump stream zone %u record\n", rec.zno);
+	ret = -1;
+out:
+	/* Do not leave queued data referencing the zone checksum */
+	zbd_xfer_wait(&ropts->xfer);
+	ropts->xfer.crc = NULL;
+	free(restored);
+
+	return ret;
 }
 
 int zbd_restore(int fd, struct zbd_opts *opts)
 {
 	struct zbd_restore ropts;
-	struct zbd_zone *dumpz, *devz;
-	unsigned int i, nz = 0;
+	unsigned int nz = 0;
 	int ret;
 
 	memset(&ropts, 0, sizeof(struct zbd_restore));
 
 	zbd_dump_prep_path(opts);
 
+	if (zbd_dump_check_io_opts(opts))
+		return 1;
+
 	/* Get zone information from the target device */
 	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &ropts.dev_zones, &nz);
 	if (ret != 0) {
@@ -692,96 +2999,268 @@ int zbd_restore(int fd, struct zbd_opts *opts)
 		goto out;
 
 	/* Open and check the zone data dump file */
+	printf("    Restoring zones [%u..%u] data (this may take a while)...\n",
+	       ropts.zstart, ropts.zend - 1);
 	ret = zbd_open_zone_data(&ropts, opts);
 	if (ret)
 		goto out;
 
-	/* Get an IO buffer */
-	ret = posix_memalign(&ropts.buf, sysconf(_SC_PAGESIZE),
-			     ZBD_DUMP_IO_SIZE);
-	if (ret) {
-		fprintf(stderr, "No memory\n");
+	/*
+	 * Restore the target device: reset all zones in the dump range and
+	 * restore the data and condition of the zones in restore pass order.
+	 */
+	ret = zbd_restore_reset_zones(fd, &ropts);
+	if (ret)
+		goto out;
+
+	if (opts->stream) {
+		/* Restore zones sequentially, in the stream order */
+		ropts.pool = zbd_buf_pool_alloc(fd, ropts.buf_size,
+						opts->io_depth, 0);
+		if (!ropts.pool) {
+			fprintf(stderr, "No memory\n");
+			ret = -1;
+			goto out;
+		}
+
+		ret = zbd_xfer_start(&ropts.xfer, ropts.srcs[0].data_fd, fd,
+				     ropts.pool, ropts.srcs[0].io_size,
+				     opts->io_depth, NULL);
+		if (ret)
+			goto out;
+		ropts.xfer.in_stream = true;
+
+		ret = zbd_restore_stream(fd, &ropts, opts);
+	} else {
+		ret = zbd_restore_zones(fd, &ropts, opts);
+	}
+	if (ret)
 		goto out;
+
+	printf("    Restored %lld B in %u zones\n",
+	       ropts.restored_bytes, ropts.restored_zones);
+
+	ret = fsync(fd);
+	if (ret)
+		fprintf(stderr, "fsync target device failed %d (%s)\n",
+			errno, strerror(errno));
+
+	fsync(fd);
+
+out:
+	free(ropts.dev_zones);
+	if (ropts.xfer.chunks && zbd_xfer_stop(&ropts.xfer) && !ret)
+		ret = -1;
+	zbd_restore_free_srcs(&ropts);
+	zbd_buf_pool_free(ropts.pool);
+
+	return ret;
+}
+
+/*
+ * Verify the zone data checksums of a dump, reading the zone data of the
+ * dump chain in the same manner as for a restore, without writing it.
+ */
+int zbd_verify(int fd, struct zbd_opts *opts)
+{
+	struct zbd_restore ropts;
+	struct zbd_restore_src *src;
+	unsigned int zno, zstart, zend;
+	unsigned int nr_zones = 0, nr_errors = 0;
+	long long verified_bytes = 0, len;
+	char *info_path;
+	int ret = -1;
+
+	memset(&ropts, 0, sizeof(struct zbd_restore));
+
+	if (opts->stream) {
+		fprintf(stderr, "Dump streams are verified when restored\n");
+		return 1;
 	}
 
-	/*
-	 * Restore the target device. To avoid hitting the max active or max
-	 * open zone limits of the target drive, process all zones in several
-	 * passes with each pass handling one condition.
-	 */
+	if (zbd_dump_check_io_opts(opts))
+		return 1;
+
+	info_path = strdup(opts->dev_path);
+	if (!info_path) {
+		fprintf(stderr, "No memory\n");
+		return 1;
+	}
 
-	/* Pass 1: Reset all zones in the dump range */
-	for (i = ropts.zstart; i < ropts.zend; i++) {
-		dumpz = &ropts.dump_zones[i];
-		devz = &ropts.dev_zones[i];
+	printf("    Getting zone information from %s\n", info_path);
 
-		if (zbd_zone_offline(dumpz))
-			continue;
-		if (!zbd_zone_seq(dumpz) || zbd_zone_empty(dumpz))
-			continue;
+	src = zbd_restore_add_src(&ropts, info_path, -1);
+	if (!src)
+		goto out;
 
-		ret = zbd_reset_zones(fd, zbd_zone_start(devz),
-				      zbd_zone_len(devz));
-		if (ret) {
-			fprintf(stderr, "Reset target zone %u failed %d (%s)\n",
-				i, errno, strerror(errno));
-			goto out;
-		}
+	if (src->info.hdr.flags & ZBD_DUMP_STREAM) {
+		fprintf(stderr,
+			"Dump streams are verified when restored\n");
+		goto out;
+	}
+	if (!src->info.crc) {
+		fprintf(stderr, "No zone data checksums in dump %s\n",
+			src->info_path);
+		goto out;
 	}
 
-	/* Pass 2: copy data of conventional and full sequential zones */
-	for (i = ropts.zstart; i < ropts.zend; i++) {
-		dumpz = &ropts.dump_zones[i];
-		devz = &ropts.dev_zones[i];
+	memcpy(&ropts.dev_info, &src->info.hdr.dev_info,
+	       sizeof(struct zbd_info));
+	ropts.zstart = src->info.hdr.zstart;
+	ropts.zend = src->info.hdr.zend;
+	ropts.dump_zones = src->info.zones;
 
-		if (!zbd_zone_cnv(dumpz) && !zbd_zone_full(dumpz))
-			continue;
+	ret = zbd_load_base_info(&ropts);
+	if (ret)
+		goto out;
 
-		ret = zbd_restore_one_zone(fd, &ropts, dumpz, devz);
-		if (ret < 0)
-			goto out;
+	ret = zbd_open_zone_data(&ropts, opts);
+	if (ret)
+		goto out;
+
+	/* Limit verification to the zones of the operation range */
+	zstart = opts->ofst / ropts.dev_info.zone_size;
+	zend = (opts->ofst + opts->len + ropts.dev_info.zone_size - 1) /
+		ropts.dev_info.zone_size;
+	if (zstart < ropts.zstart)
+		zstart = ropts.zstart;
+	if (zend > ropts.zend)
+		zend = ropts.zend;
+
+	printf("    Verifying zones [%u..%u] data (this may take a while)...\n",
+	       zstart, zend - 1);
+
+	ropts.pool = zbd_buf_pool_alloc(-1, ropts.buf_size, opts->io_depth, 0);
+	if (!ropts.pool) {
+		fprintf(stderr, "No memory\n");
+		ret = -1;
+		goto out;
 	}
 
-	/* Pass 3: handle closed zones */
-	for (i = ropts.zstart; i < ropts.zend; i++) {
-		dumpz = &ropts.dump_zones[i];
-		devz = &ropts.dev_zones[i];
+	ret = zbd_xfer_start(&ropts.xfer, -1, -1, ropts.pool, ropts.buf_size,
+			     opts->io_depth, NULL);
+	if (ret)
+		goto out;
 
-		if (!zbd_zone_closed(dumpz))
+	for (zno = zstart; zno < zend; zno++) {
+		if (zbd_dump_zone_pass(&ropts.dump_zones[zno]) < 0)
 			continue;
 
-		ret = zbd_restore_one_zone(fd, &ropts, dumpz, devz);
-		if (ret < 0)
-			goto out;
+		len = zbd_restore_zone_data(&ropts, &ropts.xfer, zno);
+		if (len < 0) {
+			nr_errors++;
+			continue;
+		}
+		verified_bytes += len;
+		nr_zones++;
 	}
 
-	/* Pass 4: handle explicitly open zones */
-	for (i = ropts.zstart; i < ropts.zend; i++) {
-		dumpz = &ropts.dump_zones[i];
-		devz = &ropts.dev_zones[i];
+	printf("    Verified %lld B in %u zones, %u error%s\n",
+	       verified_bytes, nr_zones, nr_errors,
+	       nr_errors == 1 ? "" : "s");
+	if (nr_errors)
+		ret = -1;
 
-		if (!zbd_zone_exp_open(dumpz))
-			continue;
+out:
+	if (ropts.xfer.chunks && zbd_xfer_stop(&ropts.xfer) && !ret)
+		ret = -1;
+	zbd_restore_free_srcs(&ropts);
+	zbd_buf_pool_free(ropts.pool);
 
-		ret = zbd_restore_one_zone(fd, &ropts, dumpz, devz);
-		if (ret < 0)
-			goto out;
+	return ret;
+}
+
+/*
+ * Copy the zone data and zone condition of the zones of the operation range
+ * of the source device to the target device. This is a restore using the
+ * source device in place of the dump files.
+ */
+int zbd_copy(int fd, struct zbd_opts *opts)
+{
+	struct zbd_restore ropts;
+	struct zbd_restore_src *src;
+	unsigned int nz = 0;
+	int src_fd, ret;
+
+	memset(&ropts, 0, sizeof(struct zbd_restore));
+
+	if (opts->stream || opts->comp || opts->zero_copy || opts->base_path) {
+		fprintf(stderr,
+			"Options -stream, -z, -zc and -inc cannot be used with copy\n");
+		return 1;
 	}
 
-	/* Pass 5: handle implicitly open zones */
-	for (i = ropts.zstart; i < ropts.zend; i++) {
-		dumpz = &ropts.dump_zones[i];
-		devz = &ropts.dev_zones[i];
+	if (zbd_dump_check_io_opts(opts))
+		return 1;
 
-		if (!zbd_zone_imp_open(dumpz))
-			continue;
+	src_fd = zbd_open(opts->src_path, O_RDONLY | O_LARGEFILE,
+			  &ropts.dev_info);
+	if (src_fd < 0) {
+		fprintf(stderr, "Open %s failed (%s)\n",
+			opts->src_path, strerror(errno));
+		return 1;
+	}
 
-		ret = zbd_restore_one_zone(fd, &ropts, dumpz, devz);
-		if (ret < 0)
-			goto out;
+	ret = -1;
+	ropts.srcs = calloc(1, sizeof(struct zbd_restore_src));
+	if (!ropts.srcs) {
+		fprintf(stderr, "No memory\n");
+		goto out;
+	}
+	ropts.nr_srcs = 1;
+	src = &ropts.srcs[0];
+	src->data_fd = -1;
+	src->io_size = opts->io_size;
+	ropts.buf_size = opts->io_size;
+
+	/* Get zone information from the source and target devices */
+	ret = zbd_list_zones(src_fd, 0, 0, ZBD_RO_ALL, &src->info.zones, &nz);
+	if (ret != 0) {
+		fprintf(stderr, "zbd_list_zones() failed %d\n", ret);
+		goto out;
+	}
+	if (nz != ropts.dev_info.nr_zones) {
+		fprintf(stderr,
+			"Invalid number of zones: expected %u, got %u\n",
+			ropts.dev_info.nr_zones, nz);
+		ret = -1;
+		goto out;
 	}
 
-	printf("    Restored %lld B in %u zones\n",
+	ret = zbd_list_zones(fd, 0, 0, ZBD_RO_ALL, &ropts.dev_zones, &nz);
+	if (ret != 0) {
+		fprintf(stderr, "zbd_list_zones() failed %d\n", ret);
+		goto out;
+	}
+	if (nz != opts->dev_info.nr_zones) {
+		fprintf(stderr,
+			"Invalid number of zones: expected %u, got %u\n",
+			opts->dev_info.nr_zones, nz);
+		ret = -1;
+		goto out;
+	}
+
+	ropts.dump_zones = src->info.zones;
+	ropts.zstart = opts->ofst / opts->dev_info.zone_size;
+	ropts.zend = (opts->ofst + opts->len + opts->dev_info.zone_size - 1)
+		/ opts->dev_info.zone_size;
+
+	ret = zbd_restore_check_dev(&ropts, opts);
+	if (ret)
+		goto out;
+
+	printf("%s: copying zones [%u..%u] to %s (this may take a while)...\n",
+	       opts->src_path, ropts.zstart, ropts.zend - 1, opts->dev_path);
+
+	src->data_fd = src_fd;
+	ret = zbd_restore_reset_zones(fd, &ropts);
+	if (!ret)
+		ret = zbd_restore_zones(fd, &ropts, opts);
+	src->data_fd = -1;
+	if (ret)
+		goto out;
+
+	printf("    Copied %lld B in %u zones\n",
 	       ropts.restored_bytes, ropts.restored_zones);
 
 	ret = fsync(fd);
@@ -789,14 +3268,11 @@ int zbd_restore(int fd, struct zbd_opts *opts)
 		fprintf(stderr, "fsync target device failed %d (%s)\n",
 			errno, strerror(errno));
 
-	fsync(fd);
-
 out:
-	if (ropts.data_fd > 0)
-		close(ropts.data_fd);
 	free(ropts.dev_zones);
-	free(ropts.dump_zones);
-	free(ropts.buf);
+	zbd_restore_free_srcs(&ropts);
+	zbd_buf_pool_free(ropts.pool);
+	zbd_close(src_fd);
 
 	return ret;
 }
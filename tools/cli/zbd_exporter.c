@@ -0,0 +1,578 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "./zbd.h"
+
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+/*
+ * Maximum number of zones refreshed at once: larger operation ranges are
+ * refreshed in several batches spread over the refresh interval, so that
+ * the exporter never issues long zone reports.
+ */
+#define ZBD_EXP_BATCH		4096
+
+/*
+ * Maximum size of an HTTP request and I/O timeout of HTTP clients.
+ */
+#define ZBD_EXP_REQ_SIZE	2048
+#define ZBD_EXP_TIMEOUT		1
+
+/*
+ * Zone conditions exported, in the order of enum zbd_zone_cond values.
+ */
+#define ZBD_EXP_NR_COND		16
+
+static const char *zbd_exp_cond_names[ZBD_EXP_NR_COND] = {
+	[ZBD_ZONE_COND_NOT_WP]		= "not_wp",
+	[ZBD_ZONE_COND_EMPTY]		= "empty",
+	[ZBD_ZONE_COND_IMP_OPEN]	= "imp_open",
+	[ZBD_ZONE_COND_EXP_OPEN]	= "exp_open",
+	[ZBD_ZONE_COND_CLOSED]		= "closed",
+	[ZBD_ZONE_COND_READONLY]	= "read_only",
+	[ZBD_ZONE_COND_FULL]		= "full",
+	[ZBD_ZONE_COND_OFFLINE]		= "offline",
+};
+
+struct zbd_exp {
+	struct zbd_opts		*opts;
+	int			fd;
+	char			*name;
+
+	/* Zone snapshot of the operation range */
+	unsigned int		zstart;
+	unsigned int		nr_zones;
+	struct zbd_zone		*zones;
+	struct zbd_zone		*batch;
+	unsigned int		batch_size;
+	unsigned int		cursor;
+
+	/* Metrics of the zone snapshot */
+	unsigned int		nr_cond[ZBD_EXP_NR_COND];
+	unsigned int		nr_rwp;
+	unsigned int		nr_non_seq;
+	unsigned long long	capacity;
+	unsigned long long	written;
+
+	/* Exporter metrics */
+	unsigned long long	nr_passes;
+	unsigned long long	nr_errors;
+	unsigned long long	nr_scrapes;
+	time_t			last_pass;
+
+	int			listen_fd;
+	char			*textfile;
+	char			*tmpfile;
+};
+
+static volatile sig_atomic_t zbd_exp_stop;
+
+static void zbd_exp_sig(int sig)
+{
+	zbd_exp_stop = 1;
+}
+
+static unsigned long long zbd_exp_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Number of bytes written in a zone. The write pointer of full, read-only
+ * and offline zones is not valid, and conventional zones have none.
+ */
+static unsigned long long zbd_exp_zone_written(struct zbd_zone *z)
+{
+	switch (zbd_zone_cond(z)) {
+	case ZBD_ZONE_COND_IMP_OPEN:
+	case ZBD_ZONE_COND_EXP_OPEN:
+	case ZBD_ZONE_COND_CLOSED:
+		return zbd_zone_wp(z) - zbd_zone_start(z);
+	case ZBD_ZONE_COND_FULL:
+		return zbd_zone_capacity(z);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Add (sign > 0) or remove (sign < 0) a zone from the snapshot metrics.
+ */
+static void zbd_exp_account(struct zbd_exp *e, struct zbd_zone *z, int sign)
+{
+	e->nr_cond[zbd_zone_cond(z) & (ZBD_EXP_NR_COND - 1)] += sign;
+	if (zbd_zone_rwp_recommended(z))
+		e->nr_rwp += sign;
+	if (zbd_zone_non_seq_resources(z))
+		e->nr_non_seq += sign;
+	if (!zbd_zone_cnv(z)) {
+		e->capacity += sign * (long long)zbd_zone_capacity(z);
+		e->written += sign * (long long)zbd_exp_zone_written(z);
+	}
+}
+
+/*
+ * Refresh the next batch of zones of the snapshot, updating the snapshot
+ * metrics with the changes of the zones refreshed only.
+ */
+static int zbd_exp_refresh(struct zbd_exp *e, bool init)
+{
+	unsigned long long zone_size = e->opts->dev_info.zone_size;
+	unsigned int i, nz = e->nr_zones - e->cursor;
+	struct zbd_zone *z;
+	int ret;
+
+	if (nz > e->batch_size)
+		nz = e->batch_size;
+
+	ret = zbd_report_zones(e->fd,
+			       (off_t)(e->zstart + e->cursor) * zone_size,
+			       (off_t)nz * zone_size, ZBD_RO_ALL,
+			       e->batch, &nz);
+	if (ret || !nz) {
+		e->nr_errors++;
+		fprintf(stderr, "%s: Refresh zones %u..%u failed (%s)\n",
+			e->name, e->zstart + e->cursor,
+			e->zstart + e->cursor + e->batch_size - 1,
+			ret ? strerror(errno) : "no zones reported");
+		return -1;
+	}
+
+	for (i = 0; i < nz; i++) {
+		z = &e->zones[e->cursor + i];
+		if (!init)
+			zbd_exp_account(e, z, -1);
+		*z = e->batch[i];
+		zbd_exp_account(e, z, 1);
+	}
+
+	e->cursor += nz;
+	if (e->cursor < e->nr_zones)
+		return 0;
+
+	e->cursor = 0;
+	e->nr_passes++;
+	e->last_pass = time(NULL);
+
+	return 1;
+}
+
+static void zbd_exp_metric(FILE *f, const char *name, const char *type,
+			   const char *help)
+{
+	fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/*
+ * Write the metrics in the Prometheus text exposition format.
+ */
+static void zbd_exp_write_metrics(struct zbd_exp *e, FILE *f)
+{
+	struct zbd_info *zinfo = &e->opts->dev_info;
+	const char *dev = e->name;
+	unsigned int i;
+
+	zbd_exp_metric(f, "zbd_zones", "gauge",
+		       "Number of zones per zone condition.");
+	for (i = 0; i < ZBD_EXP_NR_COND; i++) {
+		if (!zbd_exp_cond_names[i])
+			continue;
+		fprintf(f, "zbd_zones{device=\"%s\",cond=\"%s\"} %u\n",
+			dev, zbd_exp_cond_names[i], e->nr_cond[i]);
+	}
+
+	zbd_exp_metric(f, "zbd_zone_size_bytes", "gauge",
+		       "Size of the device zones.");
+	fprintf(f, "zbd_zone_size_bytes{device=\"%s\"} %llu\n",
+		dev, zinfo->zone_size);
+
+	zbd_exp_metric(f, "zbd_capacity_bytes", "gauge",
+		       "Total capacity of the sequential zones.");
+	fprintf(f, "zbd_capacity_bytes{device=\"%s\"} %llu\n",
+		dev, e->capacity);
+
+	zbd_exp_metric(f, "zbd_written_bytes", "gauge",
+		       "Number of bytes written in the sequential zones.");
+	fprintf(f, "zbd_written_bytes{device=\"%s\"} %llu\n",
+		dev, e->written);
+
+	zbd_exp_metric(f, "zbd_open_zones", "gauge",
+		       "Number of implicitly and explicitly open zones.");
+	fprintf(f, "zbd_open_zones{device=\"%s\"} %u\n",
+		dev, e->nr_cond[ZBD_ZONE_COND_IMP_OPEN] +
+		e->nr_cond[ZBD_ZONE_COND_EXP_OPEN]);
+
+	zbd_exp_metric(f, "zbd_max_open_zones", "gauge",
+		       "Maximum number of open zones (0 for no limit).");
+	fprintf(f, "zbd_max_open_zones{device=\"%s\"} %u\n",
+		dev, zinfo->max_nr_open_zones);
+
+	zbd_exp_metric(f, "zbd_active_zones", "gauge",
+		       "Number of open and closed zones.");
+	fprintf(f, "zbd_active_zones{device=\"%s\"} %u\n",
+		dev, e->nr_cond[ZBD_ZONE_COND_IMP_OPEN] +
+		e->nr_cond[ZBD_ZONE_COND_EXP_OPEN] +
+		e->nr_cond[ZBD_ZONE_COND_CLOSED]);
+
+	zbd_exp_metric(f, "zbd_max_active_zones", "gauge",
+		       "Maximum number of active zones (0 for no limit).");
+	fprintf(f, "zbd_max_active_zones{device=\"%s\"} %u\n",
+		dev, zinfo->max_nr_active_zones);
+
+	zbd_exp_metric(f, "zbd_rwp_recommended_zones", "gauge",
+		       "Number of zones with a reset write pointer recommended.");
+	fprintf(f, "zbd_rwp_recommended_zones{device=\"%s\"} %u\n",
+		dev, e->nr_rwp);
+
+	zbd_exp_metric(f, "zbd_non_seq_resources_zones", "gauge",
+		       "Number of zones using non-sequential write resources.");
+	fprintf(f, "zbd_non_seq_resources_zones{device=\"%s\"} %u\n",
+		dev, e->nr_non_seq);
+
+	zbd_exp_metric(f, "zbd_exporter_refresh_passes_total", "counter",
+		       "Number of complete refreshes of the zone snapshot.");
+	fprintf(f, "zbd_exporter_refresh_passes_total{device=\"%s\"} %llu\n",
+		dev, e->nr_passes);
+
+	zbd_exp_metric(f, "zbd_exporter_refresh_errors_total", "counter",
+		       "Number of failed zone snapshot refreshes.");
+	fprintf(f, "zbd_exporter_refresh_errors_total{device=\"%s\"} %llu\n",
+		dev, e->nr_errors);
+
+	zbd_exp_metric(f, "zbd_exporter_last_refresh_timestamp_seconds",
+		       "gauge",
+		       "Time of the last complete refresh of the zone snapshot.");
+	fprintf(f, "zbd_exporter_last_refresh_timestamp_seconds{device=\"%s\"} %lld\n",
+		dev, (long long)e->last_pass);
+}
+
+/*
+ * Atomically replace the textfile collector file.
+ */
+static int zbd_exp_write_textfile(struct zbd_exp *e)
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(e->tmpfile, "w");
+	if (!f) {
+		fprintf(stderr, "Create %s failed (%s)\n",
+			e->tmpfile, strerror(errno));
+		return -1;
+	}
+
+	zbd_exp_write_metrics(e, f);
+	ret = fflush(f);
+	if (!ret)
+		ret = fsync(fileno(f));
+	if (fclose(f) || ret) {
+		fprintf(stderr, "Write %s failed (%s)\n",
+			e->tmpfile, strerror(errno));
+		unlink(e->tmpfile);
+		return -1;
+	}
+
+	if (rename(e->tmpfile, e->textfile)) {
+		fprintf(stderr, "Rename %s failed (%s)\n",
+			e->tmpfile, strerror(errno));
+		unlink(e->tmpfile);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int zbd_exp_send(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void zbd_exp_reply(int fd, const char *status, const char *type,
+			  const char *body, size_t len)
+{
+	char hdr[256];
+	int n;
+
+	n = snprintf(hdr, sizeof(hdr),
+		     "HTTP/1.1 %s\r\n"
+		     "Content-Type: %s\r\n"
+		     "Content-Length: %zu\r\n"
+		     "Connection: close\r\n\r\n",
+		     status, type, len);
+	if (zbd_exp_send(fd, hdr, n) == 0 && len)
+		zbd_exp_send(fd, body, len);
+}
+
+/*
+ * Serve one HTTP request. Clients are served one at a time with a short
+ * I/O timeout, which is enough for a metrics scraper.
+ */
+static void zbd_exp_serve(struct zbd_exp *e)
+{
+	struct timeval tv = { .tv_sec = ZBD_EXP_TIMEOUT };
+	char req[ZBD_EXP_REQ_SIZE];
+	char *body = NULL, *path, *end;
+	size_t len = 0, body_len = 0;
+	ssize_t ret;
+	FILE *f;
+	int fd;
+
+	fd = accept4(e->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	/* Read the request line and headers */
+	while (len < sizeof(req) - 1) {
+		ret = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			goto out;
+		len += ret;
+		req[len] = '\0';
+		if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+			break;
+	}
+	req[len] = '\0';
+
+	if (strncmp(req, "GET ", 4) != 0) {
+		zbd_exp_reply(fd, "405 Method Not Allowed", "text/plain",
+			      "Method not allowed\n", 19);
+		goto out;
+	}
+
+	path = req + 4;
+	end = strpbrk(path, " ?\r\n");
+	if (end)
+		*end = '\0';
+	if (strcmp(path, "/metrics") != 0 && strcmp(path, "/") != 0) {
+		zbd_exp_reply(fd, "404 Not Found", "text/plain",
+			      "Not found\n", 10);
+		goto out;
+	}
+
+	f = open_memstream(&body, &body_len);
+	if (!f) {
+		zbd_exp_reply(fd, "500 Internal Server Error", "text/plain",
+			      "No memory\n", 10);
+		goto out;
+	}
+	e->nr_scrapes++;
+	zbd_exp_write_metrics(e, f);
+	fclose(f);
+
+	zbd_exp_reply(fd, "200 OK", "text/plain; version=0.0.4; charset=utf-8",
+		      body, body_len);
+	free(body);
+
+out:
+	close(fd);
+}
+
+/*
+ * Listen on [addr:]port. The address defaults to the loopback address.
+ */
+static int zbd_exp_listen(struct zbd_exp *e, char *listen_addr)
+{
+	struct addrinfo hints, *res, *ai;
+	char *host = NULL, *port, *p;
+	char addr[256];
+	int fd = -1, on = 1, ret;
+
+	snprintf(addr, sizeof(addr), "%s", listen_addr);
+	p = strrchr(addr, ':');
+	if (p) {
+		*p = '\0';
+		port = p + 1;
+		host = addr;
+		if (host[0] == '[') {
+			host++;
+			p = strchr(host, ']');
+			if (p)
+				*p = '\0';
+		}
+		if (!host[0])
+			host = NULL;
+	} else {
+		port = addr;
+	}
+	if (!host)
+		host = "127.0.0.1";
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret) {
+		fprintf(stderr, "Invalid listen address %s (%s)\n",
+			listen_addr, gai_strerror(ret));
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen(fd, 16) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (fd < 0) {
+		fprintf(stderr, "Listen on %s failed (%s)\n",
+			listen_addr, strerror(errno));
+		return -1;
+	}
+
+	e->listen_fd = fd;
+	printf("%s: Serving metrics on http://%s%s%s:%s/metrics\n",
+	       e->name, strchr(host, ':') ? "[" : "", host,
+	       strchr(host, ':') ? "]" : "", port);
+
+	return 0;
+}
+
+/*
+ * Run the exporter: the zone snapshot of the operation range is refreshed
+ * batch by batch, so that all zones are refreshed once per refresh interval,
+ * and the snapshot metrics are served on an HTTP endpoint and/or written to
+ * a textfile collector file after each complete refresh.
+ */
+int zbd_exporter(int fd, struct zbd_opts *opts)
+{
+	unsigned long long zone_size = opts->dev_info.zone_size;
+	unsigned long long now, next, tick;
+	unsigned int nr_batches;
+	struct sigaction sa;
+	struct zbd_exp e;
+	struct pollfd pfd;
+	int ret = 1;
+
+	if (!opts->exp_interval)
+		opts->exp_interval = ZBD_EXP_INTERVAL;
+	if (!opts->exp_listen && !opts->exp_textfile)
+		opts->exp_listen = ZBD_EXP_LISTEN;
+
+	memset(&e, 0, sizeof(struct zbd_exp));
+	e.opts = opts;
+	e.fd = fd;
+	e.name = basename(opts->dev_path);
+	e.listen_fd = -1;
+	e.zstart = opts->ofst / zone_size;
+	e.nr_zones = (opts->ofst + opts->len + zone_size - 1) / zone_size -
+		e.zstart;
+	e.batch_size = e.nr_zones;
+	if (e.batch_size > ZBD_EXP_BATCH)
+		e.batch_size = ZBD_EXP_BATCH;
+
+	e.zones = calloc(e.nr_zones, sizeof(struct zbd_zone));
+	e.batch = calloc(e.batch_size, sizeof(struct zbd_zone));
+	if (!e.zones || !e.batch) {
+		fprintf(stderr, "No memory\n");
+		goto out;
+	}
+
+	if (opts->exp_textfile) {
+		if (asprintf(&e.textfile, "%s/zbd_%s.prom",
+			     opts->exp_textfile, e.name) < 0 ||
+		    asprintf(&e.tmpfile, "%s/.zbd_%s.prom.tmp",
+			     opts->exp_textfile, e.name) < 0) {
+			e.textfile = NULL;
+			e.tmpfile = NULL;
+			fprintf(stderr, "No memory\n");
+			goto out;
+		}
+	}
+
+	/* Initial snapshot */
+	do {
+		if (zbd_exp_refresh(&e, true) < 0)
+			goto out;
+	} while (e.cursor);
+
+	if (e.textfile) {
+		if (zbd_exp_write_textfile(&e))
+			goto out;
+		printf("%s: Writing metrics to %s\n", e.name, e.textfile);
+	}
+
+	if (opts->exp_listen && zbd_exp_listen(&e, opts->exp_listen))
+		goto out;
+
+	fflush(stdout);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = zbd_exp_sig;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	nr_batches = (e.nr_zones + e.batch_size - 1) / e.batch_size;
+	tick = opts->exp_interval / nr_batches;
+	if (!tick)
+		tick = 1;
+	next = zbd_exp_now() + tick;
+
+	while (!zbd_exp_stop) {
+		now = zbd_exp_now();
+		if (now >= next) {
+			if (zbd_exp_refresh(&e, false) > 0 && e.textfile)
+				zbd_exp_write_textfile(&e);
+			next += tick;
+			if (next <= now)
+				next = now + tick;
+			continue;
+		}
+
+		pfd.fd = e.listen_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, next - now) > 0 && (pfd.revents & POLLIN))
+			zbd_exp_serve(&e);
+	}
+
+	ret = 0;
+
+out:
+	if (e.listen_fd >= 0)
+		close(e.listen_fd);
+	free(e.textfile);
+	free(e.tmpfile);
+	free(e.batch);
+	free(e.zones);
+
+	return ret;
+}
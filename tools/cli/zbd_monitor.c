@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "./zbd.h"
+
+#include <signal.h>
+#include <time.h>
+
+static volatile sig_atomic_t zbd_mon_stop;
+
+static void zbd_mon_sig(int sig)
+{
+	zbd_mon_stop = 1;
+}
+
+static unsigned long long zbd_mon_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Sum of the activity of all zones.
+ */
+static void zbd_mon_sum(const struct zbd_zone_activity *za,
+			unsigned int nr_zones, struct zbd_zone_activity *sum)
+{
+	unsigned int i;
+
+	memset(sum, 0, sizeof(struct zbd_zone_activity));
+	for (i = 0; i < nr_zones; i++) {
+		sum->bytes_written += za[i].bytes_written;
+		sum->write_rate += za[i].write_rate;
+		sum->nr_resets += za[i].nr_resets;
+		sum->nr_opens += za[i].nr_opens;
+		sum->nr_closes += za[i].nr_closes;
+		sum->nr_fulls += za[i].nr_fulls;
+	}
+}
+
+static void zbd_mon_print_interval(unsigned long long t,
+				   struct zbd_zone_activity *sum,
+				   struct zbd_zone_activity *prev)
+{
+	printf("%8.3f s: %10.3f MB/s, %llu resets, %llu opens, "
+	       "%llu closes, %llu fulls\n",
+	       (double)t / 1000.0,
+	       (double)sum->write_rate / 1000000.0,
+	       sum->nr_resets - prev->nr_resets,
+	       sum->nr_opens - prev->nr_opens,
+	       sum->nr_closes - prev->nr_closes,
+	       sum->nr_fulls - prev->nr_fulls);
+	fflush(stdout);
+}
+
+static void zbd_mon_print_zones(struct zbd_opts *opts,
+				const struct zbd_zone_activity *za,
+				unsigned int nr_zones, unsigned long long t)
+{
+	unsigned int i, zno = opts->ofst / opts->dev_info.zone_size;
+
+	printf("Zone activity over %.3f s:\n", (double)t / 1000.0);
+	for (i = 0; i < nr_zones; i++) {
+		if (!za[i].bytes_written && !za[i].nr_resets &&
+		    !za[i].nr_opens && !za[i].nr_closes && !za[i].nr_fulls)
+			continue;
+		printf("Zone %05u: written %llu B (%.3f MB/s), %llu resets, "
+		       "%llu opens, %llu closes, %llu fulls\n",
+		       zno + i, za[i].bytes_written,
+		       t ? (double)za[i].bytes_written / 1000.0 / t : 0.0,
+		       za[i].nr_resets, za[i].nr_opens, za[i].nr_closes,
+		       za[i].nr_fulls);
+	}
+}
+
+int zbd_monitor(int fd, struct zbd_opts *opts)
+{
+	struct zbd_zone_activity sum, prev;
+	const struct zbd_zone_activity *za;
+	unsigned long long start, next, now;
+	unsigned int nr_zones, n = 0;
+	struct zbd_sampler *s;
+	struct sigaction sa;
+	struct timespec ts;
+	int ret = 0;
+
+	if (!opts->mon_interval)
+		opts->mon_interval = ZBD_MON_INTERVAL;
+
+	s = zbd_sampler_alloc(fd, opts->ofst, opts->len, opts->mon_path);
+	if (!s) {
+		fprintf(stderr, "Allocate zone sampler failed (%s)\n",
+			strerror(errno));
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = zbd_mon_sig;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	memset(&prev, 0, sizeof(struct zbd_zone_activity));
+	za = zbd_sampler_activity(s, &nr_zones);
+	start = zbd_mon_now();
+	next = start;
+	now = start;
+
+	while (!zbd_mon_stop && (!opts->mon_count || n < opts->mon_count)) {
+		next += opts->mon_interval;
+		now = zbd_mon_now();
+		if (next > now) {
+			ts.tv_sec = (next - now) / 1000;
+			ts.tv_nsec = ((next - now) % 1000) * 1000000;
+			if (nanosleep(&ts, NULL) && zbd_mon_stop)
+				break;
+		}
+
+		if (zbd_sampler_sample(s)) {
+			fprintf(stderr, "Sample zones failed (%s)\n",
+				strerror(errno));
+			ret = 1;
+			break;
+		}
+		n++;
+
+		now = zbd_mon_now();
+		zbd_mon_sum(za, nr_zones, &sum);
+		zbd_mon_print_interval(now - start, &sum, &prev);
+		prev = sum;
+	}
+
+	zbd_mon_print_zones(opts, za, nr_zones, now - start);
+
+	zbd_sampler_free(s);
+
+	return ret;
+}
+
+/*
+ * If the device path is a regular file, print the zones changing in
+ * the samples of the zone timeline file in the CSV format. Returns -1 if
+ * the path is not a regular file.
+ */
+int zbd_monitor_timeline(struct zbd_opts *opts)
+{
+	struct zbd_zone *zones, *prev;
+	unsigned long long time_ns;
+	struct zbd_timeline *tl;
+	struct zbd_tl_hdr hdr;
+	unsigned int i, zno;
+	struct stat st;
+	bool first = true;
+	int ret;
+
+	if (stat(opts->dev_path, &st) || !S_ISREG(st.st_mode))
+		return -1;
+
+	tl = zbd_timeline_open(opts->dev_path, &hdr);
+	if (!tl) {
+		fprintf(stderr, "%s is not a zone timeline file\n",
+			opts->dev_path);
+		return 1;
+	}
+
+	zones = calloc(hdr.nr_zones, sizeof(struct zbd_zone));
+	prev = calloc(hdr.nr_zones, sizeof(struct zbd_zone));
+	if (!zones || !prev) {
+		fprintf(stderr, "No memory\n");
+		ret = 1;
+		goto out;
+	}
+
+	zno = hdr.start / hdr.zone_size;
+	printf("time (ms), zone num, cond, wp\n");
+	while ((ret = zbd_timeline_next(tl, &time_ns, zones)) == 1) {
+		for (i = 0; i < hdr.nr_zones; i++) {
+			if (!first &&
+			    zones[i].cond == prev[i].cond &&
+			    zones[i].wp == prev[i].wp &&
+			    zones[i].flags == prev[i].flags)
+				continue;
+			printf("%.3f, %u, %s, %llu\n",
+			       (double)time_ns / 1000000.0, zno + i,
+			       zbd_zone_cond_str(&zones[i], true),
+			       zbd_zone_wp(&zones[i]) / opts->unit);
+		}
+		memcpy(prev, zones, hdr.nr_zones * sizeof(struct zbd_zone));
+		first = false;
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "Invalid zone timeline file %s\n",
+			opts->dev_path);
+		ret = 1;
+	}
+
+out:
+	free(prev);
+	free(zones);
+	zbd_timeline_close(tl);
+
+	return ret;
+}
@@ -0,0 +1,444 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+/*
+ * SPDX-FileCopyrightText: 2020 Western Digital Corporation or its affiliates.
+ *
+ * Authors: Damien Le Moal (damien.lemoal@wdc.com)
+ */
+#include "./zbd.h"
+
+#include <time.h>
+
+/*
+ * Types of replayed calls.
+ */
+enum zbd_replay_op {
+	ZBD_REPLAY_REPORT = 0,
+	ZBD_REPLAY_LIST,
+	ZBD_REPLAY_RESET,
+	ZBD_REPLAY_OPEN,
+	ZBD_REPLAY_CLOSE,
+	ZBD_REPLAY_FINISH,
+	ZBD_REPLAY_OP_MAX,
+};
+
+static const char *zbd_replay_op_names[ZBD_REPLAY_OP_MAX] = {
+	[ZBD_REPLAY_REPORT]	= "report",
+	[ZBD_REPLAY_LIST]	= "list",
+	[ZBD_REPLAY_RESET]	= "reset",
+	[ZBD_REPLAY_OPEN]	= "open",
+	[ZBD_REPLAY_CLOSE]	= "close",
+	[ZBD_REPLAY_FINISH]	= "finish",
+};
+
+/*
+ * Latencies of the calls of a type, in the trace and when replayed.
+ */
+struct zbd_replay_lat {
+	unsigned long long	count;
+	unsigned long long	*trace_ns;
+	unsigned long long	*replay_ns;
+};
+
+struct zbd_replay {
+	struct zbd_opts		*opts;
+	int			fd;
+	int			trace_fd;
+	struct zbd_rec		*recs;
+	unsigned long long	nr_recs;
+	struct zbd_zone		*zones;
+	unsigned int		nr_zones;
+	unsigned long long	runtime;
+	unsigned long long	nr_calls;
+	unsigned long long	nr_diffs;
+	struct zbd_replay_lat	lat[ZBD_REPLAY_OP_MAX];
+};
+
+static unsigned long long zbd_replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void zbd_replay_wait(unsigned long long t)
+{
+	unsigned long long now = zbd_replay_now();
+	struct timespec ts;
+
+	if (t <= now)
+		return;
+
+	t -= now;
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+}
+
+static int zbd_replay_rec_cmp(const void *a, const void *b)
+{
+	const struct zbd_rec *ra = a, *rb = b;
+
+	if (ra->time_ns < rb->time_ns)
+		return -1;
+	if (ra->time_ns > rb->time_ns)
+		return 1;
+	return 0;
+}
+
+static int zbd_replay_lat_cmp(const void *a, const void *b)
+{
+	unsigned long long la = *(const unsigned long long *)a;
+	unsigned long long lb = *(const unsigned long long *)b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+/*
+ * Load the records of a call trace file, sorted in call start time order.
+ */
+static int zbd_replay_load(struct zbd_replay *r, const char *path)
+{
+	struct zbd_rec_hdr hdr;
+	unsigned long long n = 0, max = 0;
+	struct zbd_rec *recs;
+	char *rec = NULL;
+	int ret = -1;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Open %s failed (%s)\n",
+			path, strerror(errno));
+		return -1;
+	}
+
+	if (fread(&hdr, sizeof(struct zbd_rec_hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, ZBD_REC_MAGIC, sizeof(hdr.magic)) != 0) {
+		fprintf(stderr, "%s is not a call trace file\n", path);
+		goto out;
+	}
+
+	if (hdr.version != ZBD_REC_VERSION ||
+	    hdr.rec_size < sizeof(struct zbd_rec)) {
+		fprintf(stderr, "Unsupported call trace file version %u\n",
+			hdr.version);
+		goto out;
+	}
+
+	rec = malloc(hdr.rec_size);
+	if (!rec) {
+		fprintf(stderr, "No memory\n");
+		goto out;
+	}
+
+	while (fread(rec, hdr.rec_size, 1, f) == 1) {
+		if (n == max) {
+			max = max ? max * 2 : 4096;
+			recs = realloc(r->recs, max * sizeof(struct zbd_rec));
+			if (!recs) {
+				fprintf(stderr, "No memory\n");
+				goto out;
+			}
+			r->recs = recs;
+		}
+		memcpy(&r->recs[n], rec, sizeof(struct zbd_rec));
+		n++;
+	}
+
+	if (ferror(f)) {
+		fprintf(stderr, "Read %s failed\n", path);
+		goto out;
+	}
+
+	if (n)
+		qsort(r->recs, n, sizeof(struct zbd_rec), zbd_replay_rec_cmp);
+	r->nr_recs = n;
+	ret = 0;
+
+out:
+	free(rec);
+	fclose(f);
+
+	return ret;
+}
+
+/*
+ * Select the trace file descriptor of the calls to replay: the one
+ * specified by the user, or the one of the first device successfully open,
+ * or the one of the first call if the trace has no device open.
+ */
+static void zbd_replay_select_fd(struct zbd_replay *r)
+{
+	unsigned long long i;
+	struct zbd_rec *rec;
+
+	r->trace_fd = r->opts->replay_fd;
+	if (r->trace_fd >= 0)
+		return;
+
+	for (i = 0; i < r->nr_recs; i++) {
+		rec = &r->recs[i];
+		if (rec->type == ZBD_REC_OPEN && rec->ret >= 0) {
+			r->trace_fd = rec->fd;
+			return;
+		}
+	}
+
+	if (r->nr_recs)
+		r->trace_fd = r->recs[0].fd;
+}
+
+/*
+ * Check that the device zone geometry matches the one of the device
+ * open in the trace with the replayed file descriptor.
+ */
+static int zbd_replay_check(struct zbd_replay *r)
+{
+	struct zbd_info *zinfo = &r->opts->dev_info;
+	unsigned long long i;
+	struct zbd_rec *rec;
+
+	for (i = 0; i < r->nr_recs; i++) {
+		rec = &r->recs[i];
+		if (rec->type != ZBD_REC_OPEN || rec->ret < 0 || !rec->ofst ||
+		    rec->fd != r->trace_fd)
+			continue;
+		if (rec->ofst != zinfo->zone_size) {
+			fprintf(stderr,
+				"Trace zone size %llu B differs from device zone size %llu B\n",
+				(unsigned long long)rec->ofst,
+				zinfo->zone_size);
+			return -1;
+		}
+		if (rec->len > zinfo->nr_sectors << 9)
+			printf("Warning: trace device capacity %llu B larger than device capacity %llu B\n",
+			       (unsigned long long)rec->len,
+			       zinfo->nr_sectors << 9);
+	}
+
+	return 0;
+}
+
+/*
+ * Type of a replayed call, or -1 for calls that are not replayed.
+ */
+static int zbd_replay_rec_op(struct zbd_replay *r, struct zbd_rec *rec)
+{
+	if (rec->fd != r->trace_fd)
+		return -1;
+
+	switch (rec->type) {
+	case ZBD_REC_REPORT:
+		return ZBD_REPLAY_REPORT;
+	case ZBD_REC_LIST:
+		return ZBD_REPLAY_LIST;
+	case ZBD_REC_ZONE_OP:
+		if (rec->op < ZBD_OP_RESET || rec->op > ZBD_OP_FINISH)
+			return -1;
+		return ZBD_REPLAY_RESET + rec->op - ZBD_OP_RESET;
+	default:
+		return -1;
+	}
+}
+
+static int zbd_replay_call(struct zbd_replay *r, struct zbd_rec *rec)
+{
+	struct zbd_zone *zones;
+	unsigned int nrz;
+	int ret;
+
+	switch (rec->type) {
+	case ZBD_REC_REPORT:
+		nrz = rec->nr_zones;
+		if (!nrz)
+			return zbd_report_nr_zones(r->fd, rec->ofst, rec->len,
+						   rec->op, &nrz);
+		if (nrz > r->nr_zones) {
+			zones = realloc(r->zones,
+					nrz * sizeof(struct zbd_zone));
+			if (!zones) {
+				errno = ENOMEM;
+				return -1;
+			}
+			r->zones = zones;
+			r->nr_zones = nrz;
+		}
+		return zbd_report_zones(r->fd, rec->ofst, rec->len, rec->op,
+					r->zones, &nrz);
+	case ZBD_REC_LIST:
+		zones = NULL;
+		ret = zbd_list_zones(r->fd, rec->ofst, rec->len, rec->op,
+				     &zones, &nrz);
+		free(zones);
+		return ret;
+	default:
+		return zbd_zones_operation(r->fd, rec->op, rec->ofst, rec->len);
+	}
+}
+
+static int zbd_replay_run(struct zbd_replay *r)
+{
+	unsigned long long nr[ZBD_REPLAY_OP_MAX] = { 0 };
+	unsigned long long i, start, t0 = 0;
+	struct zbd_replay_lat *lat;
+	struct zbd_rec *rec;
+	int op, ret;
+
+	for (i = 0; i < r->nr_recs; i++) {
+		op = zbd_replay_rec_op(r, &r->recs[i]);
+		if (op >= 0)
+			nr[op]++;
+	}
+
+	for (op = 0; op < ZBD_REPLAY_OP_MAX; op++) {
+		if (!nr[op])
+			continue;
+		lat = &r->lat[op];
+		lat->trace_ns = calloc(nr[op], sizeof(unsigned long long));
+		lat->replay_ns = calloc(nr[op], sizeof(unsigned long long));
+		if (!lat->trace_ns || !lat->replay_ns) {
+			fprintf(stderr, "No memory\n");
+			return -1;
+		}
+	}
+
+	if (r->nr_recs)
+		t0 = r->recs[0].time_ns;
+
+	r->runtime = zbd_replay_now();
+	for (i = 0; i < r->nr_recs; i++) {
+		rec = &r->recs[i];
+		op = zbd_replay_rec_op(r, rec);
+		if (op < 0)
+			continue;
+
+		if (!r->opts->replay_afap)
+			zbd_replay_wait(r->runtime + rec->time_ns - t0);
+
+		start = zbd_replay_now();
+		ret = zbd_replay_call(r, rec);
+
+		lat = &r->lat[op];
+		lat->replay_ns[lat->count] = zbd_replay_now() - start;
+		lat->trace_ns[lat->count] = rec->lat_ns;
+		lat->count++;
+		r->nr_calls++;
+
+		/* Compare the success or failure of the call with the trace */
+		if ((ret < 0) != (rec->ret < 0))
+			r->nr_diffs++;
+	}
+	r->runtime = zbd_replay_now() - r->runtime;
+
+	return 0;
+}
+
+static unsigned long long zbd_replay_pct(unsigned long long *v,
+					 unsigned long long n, double pct)
+{
+	unsigned long long i = pct * n / 100;
+
+	if (i >= n)
+		i = n - 1;
+
+	return v[i];
+}
+
+static void zbd_replay_print_lat(const char *name, unsigned long long *v,
+				 unsigned long long n)
+{
+	unsigned long long i, sum = 0;
+
+	qsort(v, n, sizeof(unsigned long long), zbd_replay_lat_cmp);
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	printf("      %s lat (usec): min %.1f, avg %.1f, p50 %.1f, p90 %.1f, "
+	       "p99 %.1f, p99.9 %.1f, max %.1f\n",
+	       name,
+	       (double)v[0] / 1000,
+	       (double)sum / n / 1000,
+	       (double)zbd_replay_pct(v, n, 50) / 1000,
+	       (double)zbd_replay_pct(v, n, 90) / 1000,
+	       (double)zbd_replay_pct(v, n, 99) / 1000,
+	       (double)zbd_replay_pct(v, n, 99.9) / 1000,
+	       (double)v[n - 1] / 1000);
+}
+
+static void zbd_replay_print_stats(struct zbd_replay *r)
+{
+	double secs = (double)r->runtime / 1000000000.0;
+	unsigned long long trace_ns = 0;
+	struct zbd_replay_lat *lat;
+	struct zbd_rec *last;
+	int op;
+
+	if (r->nr_recs) {
+		last = &r->recs[r->nr_recs - 1];
+		trace_ns = last->time_ns + last->lat_ns - r->recs[0].time_ns;
+	}
+
+	printf("    %llu calls in %.3f s (trace: %.3f s), %llu result%s differ%s from the trace\n",
+	       r->nr_calls, secs, (double)trace_ns / 1000000000.0,
+	       r->nr_diffs, r->nr_diffs == 1 ? "" : "s",
+	       r->nr_diffs == 1 ? "s" : "");
+
+	for (op = 0; op < ZBD_REPLAY_OP_MAX; op++) {
+		lat = &r->lat[op];
+		if (!lat->count)
+			continue;
+
+		printf("    %s: %llu calls, %.0f calls/s\n",
+		       zbd_replay_op_names[op], lat->count,
+		       lat->count / secs);
+		zbd_replay_print_lat("trace", lat->trace_ns, lat->count);
+		zbd_replay_print_lat("replay", lat->replay_ns, lat->count);
+	}
+}
+
+/*
+ * Replay the zone reports, zone lists and zone operations of a call trace
+ * recorded with zbd_record_start() in the order of their start time, at the
+ * original timing or as fast as possible. Only the calls of a single trace
+ * file descriptor are replayed. Calls are replayed one at a time, so calls
+ * that overlapped in the trace are serialized.
+ */
+int zbd_replay(int fd, struct zbd_opts *opts)
+{
+	struct zbd_replay r;
+	int ret = -1, i;
+
+	memset(&r, 0, sizeof(struct zbd_replay));
+	r.opts = opts;
+	r.fd = fd;
+
+	if (zbd_replay_load(&r, opts->src_path))
+		goto out;
+
+	zbd_replay_select_fd(&r);
+	if (zbd_replay_check(&r))
+		goto out;
+
+	printf("%s: replaying %llu records of %s, file descriptor %d%s\n",
+	       opts->dev_path, r.nr_recs, opts->src_path, r.trace_fd,
+	       opts->replay_afap ? " as fast as possible" : "");
+
+	if (zbd_replay_run(&r))
+		goto out;
+
+	zbd_replay_print_stats(&r);
+	ret = 0;
+
+out:
+	for (i = 0; i < ZBD_REPLAY_OP_MAX; i++) {
+		free(r.lat[i].trace_ns);
+		free(r.lat[i].replay_ns);
+	}
+	free(r.zones);
+	free(r.recs);
+
+	return ret;
+}